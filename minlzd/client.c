@@ -0,0 +1,376 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    client.c
+
+Abstract:
+
+    This module implements the client library of the minlzd decoding service,
+    along with the message transport that the service itself also uses. Each
+    message is a fixed-size structure, optionally carrying one file descriptor
+    as SCM_RIGHTS ancillary data. A connection can be reused for any number of
+    requests, which are answered in order.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "minlzd.h"
+
+bool
+ZdSendMessage (
+    int Socket,
+    const void* Buffer,
+    size_t Size,
+    int Fd
+    )
+{
+    union
+    {
+        struct cmsghdr Header;
+        char Buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr* header;
+    struct msghdr message;
+    struct iovec iov;
+    ssize_t sent;
+
+    //
+    // Attach the descriptor to the message, if there is one
+    //
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = (void*)Buffer;
+    iov.iov_len = Size;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (Fd != -1)
+    {
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.Buffer;
+        message.msg_controllen = sizeof(control.Buffer);
+        header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &Fd, sizeof(int));
+    }
+
+    //
+    // The descriptor goes out with the first bytes, then send the rest
+    //
+    while (iov.iov_len != 0)
+    {
+        sent = sendmsg(Socket, &message, MSG_NOSIGNAL);
+        if ((sent < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        iov.iov_base = (uint8_t*)iov.iov_base + sent;
+        iov.iov_len -= (size_t)sent;
+        message.msg_control = NULL;
+        message.msg_controllen = 0;
+    }
+    return true;
+}
+
+ssize_t
+ZdReceivePart (
+    int Socket,
+    void* Buffer,
+    size_t Size,
+    int* Fd
+    )
+{
+    union
+    {
+        struct cmsghdr Header;
+        char Buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr* header;
+    struct msghdr message;
+    struct iovec iov;
+    ssize_t received;
+    int unwanted;
+
+    //
+    // Receive whatever part of the message is there, picking up a descriptor
+    // if one was attached and none was received yet
+    //
+    iov.iov_base = Buffer;
+    iov.iov_len = Size;
+    do
+    {
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.Buffer;
+        message.msg_controllen = sizeof(control.Buffer);
+        received = recvmsg(Socket, &message, MSG_CMSG_CLOEXEC);
+    } while ((received < 0) && (errno == EINTR));
+    if (received <= 0)
+    {
+        return received;
+    }
+    for (header = CMSG_FIRSTHDR(&message);
+         header != NULL;
+         header = CMSG_NXTHDR(&message, header))
+    {
+        if ((header->cmsg_level == SOL_SOCKET) &&
+            (header->cmsg_type == SCM_RIGHTS) &&
+            (header->cmsg_len == CMSG_LEN(sizeof(int))))
+        {
+            //
+            // Never leak descriptors that were not asked for
+            //
+            if ((Fd != NULL) && (*Fd == -1))
+            {
+                memcpy(Fd, CMSG_DATA(header), sizeof(int));
+            }
+            else
+            {
+                memcpy(&unwanted, CMSG_DATA(header), sizeof(int));
+                close(unwanted);
+            }
+        }
+    }
+    return received;
+}
+
+bool
+ZdReceiveMessage (
+    int Socket,
+    void* Buffer,
+    size_t Size,
+    int* Fd
+    )
+{
+    ssize_t received;
+    size_t offset;
+
+    //
+    // Receive the whole message, picking up a descriptor if one was attached
+    //
+    if (Fd != NULL)
+    {
+        *Fd = -1;
+    }
+    for (offset = 0; offset < Size; offset += (size_t)received)
+    {
+        received = ZdReceivePart(Socket, (uint8_t*)Buffer + offset, Size - offset, Fd);
+        if (received <= 0)
+        {
+            goto Failure;
+        }
+    }
+    return true;
+
+Failure:
+    if ((Fd != NULL) && (*Fd != -1))
+    {
+        close(*Fd);
+        *Fd = -1;
+    }
+    return false;
+}
+
+int
+ZdConnect (
+    const char* SocketPath
+    )
+{
+    struct sockaddr_un address;
+    int client;
+
+    //
+    // Use the default path unless one was given or set in the environment
+    //
+    if (SocketPath == NULL)
+    {
+        SocketPath = getenv("MINLZD_SOCKET");
+    }
+    if (SocketPath == NULL)
+    {
+        SocketPath = ZD_SOCKET_PATH;
+    }
+    if (strlen(SocketPath) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SocketPath);
+    client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client == -1)
+    {
+        return -1;
+    }
+    if (connect(client, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(client);
+        return -1;
+    }
+    return client;
+}
+
+int
+ZdReceiveResult (
+    int Socket,
+    PZD_RESULT Result
+    )
+{
+    ZD_RESPONSE response;
+    void* output;
+    int fd;
+
+    //
+    // Wait for the answer, and map the output that came with it
+    //
+    memset(Result, 0, sizeof(*Result));
+    Result->Fd = -1;
+    if (!ZdReceiveMessage(Socket, &response, sizeof(response), &fd) ||
+        (response.Magic != ZD_MAGIC))
+    {
+        return EPROTO;
+    }
+    if (response.Status != 0)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return response.Status;
+    }
+    if (fd == -1)
+    {
+        return EPROTO;
+    }
+    if (response.OutputSize != 0)
+    {
+        output = mmap(NULL, response.OutputSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (output == MAP_FAILED)
+        {
+            close(fd);
+            return errno;
+        }
+        Result->Output = output;
+    }
+    Result->OutputSize = response.OutputSize;
+    Result->ChecksumError = (response.ChecksumError != 0);
+    Result->DecodeTime = response.DecodeTime;
+    Result->Fd = fd;
+    return 0;
+}
+
+int
+ZdDecodeFile (
+    int Socket,
+    const char* Path,
+    PZD_RESULT Result
+    )
+{
+    ZD_REQUEST request;
+
+    //
+    // The service opens the file itself, so the path must make sense to it
+    //
+    memset(&request, 0, sizeof(request));
+    request.Magic = ZD_MAGIC;
+    request.Type = ZdRequestPath;
+    request.PathLength = (uint32_t)strlen(Path);
+    if (request.PathLength > ZD_MAX_PATH)
+    {
+        return ENAMETOOLONG;
+    }
+    if (!ZdSendMessage(Socket, &request, sizeof(request), -1) ||
+        !ZdSendMessage(Socket, Path, request.PathLength, -1))
+    {
+        return EPIPE;
+    }
+    return ZdReceiveResult(Socket, Result);
+}
+
+int
+ZdDecodeFd (
+    int Socket,
+    int Fd,
+    PZD_RESULT Result
+    )
+{
+    ZD_REQUEST request;
+
+    //
+    // Hand the descriptor over; the service maps it from its start
+    //
+    memset(&request, 0, sizeof(request));
+    request.Magic = ZD_MAGIC;
+    request.Type = ZdRequestFd;
+    if (!ZdSendMessage(Socket, &request, sizeof(request), Fd))
+    {
+        return EPIPE;
+    }
+    return ZdReceiveResult(Socket, Result);
+}
+
+int
+ZdGetMetrics (
+    int Socket,
+    PZD_RESULT Result
+    )
+{
+    ZD_REQUEST request;
+
+    //
+    // The metrics come back as text in the output of the result
+    //
+    memset(&request, 0, sizeof(request));
+    request.Magic = ZD_MAGIC;
+    request.Type = ZdRequestMetrics;
+    if (!ZdSendMessage(Socket, &request, sizeof(request), -1))
+    {
+        return EPIPE;
+    }
+    return ZdReceiveResult(Socket, Result);
+}
+
+void
+ZdReleaseResult (
+    PZD_RESULT Result
+    )
+{
+    if (Result->Output != NULL)
+    {
+        munmap((void*)Result->Output, Result->OutputSize);
+    }
+    if (Result->Fd != -1)
+    {
+        close(Result->Fd);
+    }
+    memset(Result, 0, sizeof(*Result));
+    Result->Fd = -1;
+}
+
+void
+ZdDisconnect (
+    int Socket
+    )
+{
+    close(Socket);
+}
@@ -0,0 +1,348 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    loadtest.c
+
+Abstract:
+
+    This module implements minlzd-load, a load generator for the minlzd service.
+    A number of client threads, each with its own connection, send decoding
+    requests for the given archives in a loop (by path, or through a memfd copy
+    of each archive), and the tool then reports the throughput of the service
+    along with the distribution of the request latencies seen by the clients,
+    and optionally the metrics that the service itself collected.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "minlzd.h"
+
+//
+// Per-client state and results
+//
+typedef struct _ZD_CLIENT
+{
+    pthread_t Thread;
+    uint32_t Index;
+    int* InputFds;
+    uint64_t* Latencies;
+    uint32_t Completed;
+    uint32_t Failed;
+    uint64_t Bytes;
+    uint8_t LastByte;
+} ZD_CLIENT, *PZD_CLIENT;
+
+//
+// Test parameters
+//
+typedef struct _ZD_LOAD_TEST
+{
+    char** Files;
+    uint32_t FileCount;
+    uint32_t Requests;
+    bool UseMemfd;
+    bool PrintMetrics;
+} ZD_LOAD_TEST, *PZD_LOAD_TEST;
+ZD_LOAD_TEST LoadTest;
+
+uint64_t
+ZdGetTime (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+}
+
+int
+ZdCopyToMemfd (
+    const char* Path
+    )
+{
+    struct stat fileStat;
+    uint8_t buffer[65536];
+    ssize_t bytesRead;
+    FILE* file;
+    int fd;
+
+    //
+    // Stage the archive in anonymous memory, as a client that produced (or
+    // downloaded) the stream itself would
+    //
+    file = fopen(Path, "rb");
+    if ((file == NULL) || (fstat(fileno(file), &fileStat) != 0))
+    {
+        return -1;
+    }
+    fd = memfd_create("minlzd-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    while ((fd != -1) && ((bytesRead = (ssize_t)fread(buffer, 1, sizeof(buffer), file)) > 0))
+    {
+        if (write(fd, buffer, (size_t)bytesRead) != bytesRead)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    fclose(file);
+
+    //
+    // Seal it against shrinking, so that the service can map it rather than
+    // read it
+    //
+    if ((fd != -1) &&
+        (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) != 0))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+void*
+ZdClientThread (
+    void* Context
+    )
+{
+    PZD_CLIENT client;
+    ZD_RESULT result;
+    uint64_t start;
+    uint32_t i, file;
+    int connection, status;
+
+    client = (PZD_CLIENT)Context;
+    connection = ZdConnect(NULL);
+    if (connection == -1)
+    {
+        printf("Client %d: failed to connect: %s\n", client->Index, strerror(errno));
+        client->Failed = LoadTest.Requests;
+        return NULL;
+    }
+
+    //
+    // Cycle through the archives, starting at a different one in each client
+    //
+    for (i = 0; i < LoadTest.Requests; i++)
+    {
+        file = (client->Index + i) % LoadTest.FileCount;
+        start = ZdGetTime();
+        status = LoadTest.UseMemfd ?
+                 ZdDecodeFd(connection, client->InputFds[file], &result) :
+                 ZdDecodeFile(connection, LoadTest.Files[file], &result);
+        if (status != 0)
+        {
+            client->Failed++;
+            if (status == EPROTO || status == EPIPE)
+            {
+                break;
+            }
+            continue;
+        }
+
+        //
+        // Touch the output, as a real client would
+        //
+        if (result.OutputSize != 0)
+        {
+            client->LastByte = *(volatile const uint8_t*)&result.Output[result.OutputSize - 1];
+        }
+        client->Latencies[client->Completed++] = ZdGetTime() - start;
+        client->Bytes += result.OutputSize;
+        ZdReleaseResult(&result);
+    }
+    ZdDisconnect(connection);
+    return NULL;
+}
+
+int
+ZdCompareLatencies (
+    const void* Left,
+    const void* Right
+    )
+{
+    uint64_t left, right;
+
+    left = *(const uint64_t*)Left;
+    right = *(const uint64_t*)Right;
+    return (left > right) - (left < right);
+}
+
+void
+ZdPrintMetrics (
+    void
+    )
+{
+    ZD_RESULT result;
+    int connection, status;
+
+    connection = ZdConnect(NULL);
+    status = (connection != -1) ? ZdGetMetrics(connection, &result) : errno;
+    if (status != 0)
+    {
+        printf("Failed to get the service metrics: %s\n", strerror(status));
+    }
+    else
+    {
+        printf("\n%.*s", (int)result.OutputSize, (const char*)result.Output);
+        ZdReleaseResult(&result);
+    }
+    if (connection != -1)
+    {
+        ZdDisconnect(connection);
+    }
+}
+
+int32_t
+main (
+    int32_t ArgumentCount,
+    char* Arguments[]
+    )
+{
+    PZD_CLIENT clients;
+    uint64_t* latencies;
+    uint64_t start, elapsed, totalBytes;
+    uint32_t i, j, clientCount, started, completed, failed;
+    int32_t argument;
+    double seconds;
+
+    //
+    // Parse the options, followed by the archives to decode
+    //
+    clientCount = 1;
+    LoadTest.Requests = 100;
+    for (argument = 1; argument < ArgumentCount; argument++)
+    {
+        if ((strcmp(Arguments[argument], "-c") == 0) && ((argument + 1) < ArgumentCount))
+        {
+            clientCount = (uint32_t)strtoul(Arguments[++argument], NULL, 0);
+        }
+        else if ((strcmp(Arguments[argument], "-n") == 0) && ((argument + 1) < ArgumentCount))
+        {
+            LoadTest.Requests = (uint32_t)strtoul(Arguments[++argument], NULL, 0);
+        }
+        else if (strcmp(Arguments[argument], "-m") == 0)
+        {
+            LoadTest.UseMemfd = true;
+        }
+        else if (strcmp(Arguments[argument], "-p") == 0)
+        {
+            LoadTest.PrintMetrics = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+    LoadTest.Files = &Arguments[argument];
+    LoadTest.FileCount = (uint32_t)(ArgumentCount - argument);
+    if ((LoadTest.FileCount == 0) || (clientCount == 0) || (LoadTest.Requests == 0))
+    {
+        printf("Usage: minlzd-load [-c CLIENTS] [-n REQUESTS] [-m] [-p] [INPUT FILE]...\n");
+        printf("Have CLIENTS connections (default: 1) each send REQUESTS requests\n");
+        printf("(default: 100) to decode the INPUT FILEs to minlzd. With -m, send\n");
+        printf("the archives in memfds instead of by path. With -p, print the\n");
+        printf("metrics of the service at the end.\n");
+        return EINVAL;
+    }
+
+    clients = calloc(clientCount, sizeof(*clients));
+    latencies = calloc((size_t)clientCount * LoadTest.Requests, sizeof(*latencies));
+    if ((clients == NULL) || (latencies == NULL))
+    {
+        printf("Out of memory for allocating the clients\n");
+        return ENOMEM;
+    }
+    for (i = 0; i < clientCount; i++)
+    {
+        clients[i].Index = i;
+        clients[i].Latencies = &latencies[(size_t)i * LoadTest.Requests];
+        if (!LoadTest.UseMemfd)
+        {
+            continue;
+        }
+        clients[i].InputFds = calloc(LoadTest.FileCount, sizeof(int));
+        for (j = 0; (clients[i].InputFds != NULL) && (j < LoadTest.FileCount); j++)
+        {
+            clients[i].InputFds[j] = ZdCopyToMemfd(LoadTest.Files[j]);
+            if (clients[i].InputFds[j] == -1)
+            {
+                printf("Failed to stage %s in memory\n", LoadTest.Files[j]);
+                return EIO;
+            }
+        }
+        if (clients[i].InputFds == NULL)
+        {
+            printf("Out of memory for allocating the clients\n");
+            return ENOMEM;
+        }
+    }
+
+    //
+    // Run all of the clients at once
+    //
+    start = ZdGetTime();
+    for (started = 0; started < clientCount; started++)
+    {
+        if (pthread_create(&clients[started].Thread, NULL, ZdClientThread, &clients[started]) != 0)
+        {
+            printf("Failed to create client thread %d\n", started);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(clients[i].Thread, NULL);
+    }
+    elapsed = ZdGetTime() - start;
+
+    //
+    // Gather every completed request's latency to report percentiles
+    //
+    for (i = 0, completed = 0, failed = 0, totalBytes = 0; i < started; i++)
+    {
+        memmove(&latencies[completed],
+                clients[i].Latencies,
+                clients[i].Completed * sizeof(*latencies));
+        completed += clients[i].Completed;
+        failed += clients[i].Failed;
+        totalBytes += clients[i].Bytes;
+    }
+    seconds = (double)elapsed / 1e9;
+    printf("%d requests (%d failed) from %d clients in %f seconds\n",
+           completed + failed, failed, started, seconds);
+    printf("Throughput: %f requests/s, %f MB/s\n",
+           (double)completed / seconds,
+           (double)totalBytes / seconds / 1e6);
+    if (completed != 0)
+    {
+        qsort(latencies, completed, sizeof(*latencies), ZdCompareLatencies);
+        printf("Latency: p50 %.1fus, p90 %.1fus, p99 %.1fus, max %.1fus\n",
+               (double)latencies[(completed * 50) / 100] / 1e3,
+               (double)latencies[(completed * 90) / 100] / 1e3,
+               (double)latencies[(completed * 99) / 100] / 1e3,
+               (double)latencies[completed - 1] / 1e3);
+    }
+    if (LoadTest.PrintMetrics)
+    {
+        ZdPrintMetrics();
+    }
+    return (failed == 0) ? 0 : EIO;
+}
@@ -0,0 +1,959 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    minlzd.c
+
+Abstract:
+
+    This module implements minlzd, a local decoding service that accepts .xz
+    decode requests over a Unix socket. The main thread accepts connections and
+    polls all of them with epoll, reads each request as it arrives, and queues
+    it for a fixed pool of worker threads, so that tools which decode often use
+    a warm worker (whose minlzlib state, checksum tables and CPU dispatch are
+    already initialized) instead of cold-starting their own decoder. Workers
+    take requests rather than connections, so idle or long-lived clients never
+    tie one up. Client sockets are non-blocking, and each connection keeps the
+    part of its request that arrived so far, so a client that stalls in the
+    middle of a request never holds up the others. A connection is only queued
+    once its whole request has arrived, and is not polled again until that
+    request has been answered, which keeps the answers in order. Only regular
+    files (including memfds) are decoded. The input is mapped when it is a memfd
+    sealed against shrinking, and read into a private buffer otherwise, since a
+    client truncating a mapped file would kill the service with SIGBUS. The
+    output is decoded in a single pass straight into a memfd, which is grown as
+    needed, then sealed and passed back to the client, so that no output is
+    copied on either side. The decoder metrics of the process, along with the
+    request counts of the service, are handed out the same way, in the
+    Prometheus text format.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "minlzd.h"
+#include "minlzdec.h"
+#include <minlzma.h>
+
+//
+// Per-worker statistics, updated with relaxed atomics since other workers read
+// them when answering a metrics request
+//
+typedef struct _ZD_WORKER
+{
+    pthread_t Thread;
+    uint32_t Index;
+    uint64_t Requests;
+    uint64_t Failures;
+    uint64_t Bytes;
+} ZD_WORKER, *PZD_WORKER;
+
+//
+// A client connection, along with the request read from it (of which Received
+// bytes, counting the header and then the path, have arrived so far), while it
+// is being read, waits in the queue or is being served
+//
+typedef struct _ZD_CONNECTION
+{
+    struct _ZD_CONNECTION* Next;
+    int Socket;
+    int InputFd;
+    uint32_t Received;
+    ZD_REQUEST Request;
+    char Path[ZD_MAX_PATH + 1];
+} ZD_CONNECTION, *PZD_CONNECTION;
+
+//
+// Outcome of reading the part of a request that has arrived
+//
+typedef enum _ZD_READ_STATUS
+{
+    ZdReadPending,
+    ZdReadComplete,
+    ZdReadFailed
+} ZD_READ_STATUS;
+
+//
+// Service state
+//
+typedef struct _ZD_SERVICE
+{
+    int Listener;
+    int Signals;
+    int Poll;
+    const char* SocketPath;
+    PZD_WORKER Workers;
+    uint32_t WorkerCount;
+    pthread_mutex_t QueueLock;
+    pthread_cond_t QueueEvent;
+    PZD_CONNECTION QueueHead;
+    PZD_CONNECTION QueueTail;
+} ZD_SERVICE, *PZD_SERVICE;
+ZD_SERVICE Service;
+
+//
+// Events handled by the main thread at once
+//
+#define ZD_MAX_EVENTS           64
+
+int
+ZdOpenInput (
+    PZD_CONNECTION Connection
+    )
+{
+    //
+    // Either take the descriptor that came with the request, or open the path
+    // that came after it ourselves
+    //
+    if (Connection->Request.Type == ZdRequestFd)
+    {
+        return (Connection->InputFd != -1) ? 0 : EBADF;
+    }
+    if (Connection->InputFd != -1)
+    {
+        close(Connection->InputFd);
+        Connection->InputFd = -1;
+    }
+    if (Connection->Request.Type != ZdRequestPath)
+    {
+        return EINVAL;
+    }
+    if (Connection->Request.PathLength > ZD_MAX_PATH)
+    {
+        return ENAMETOOLONG;
+    }
+    if (Connection->Path[0] == '\0')
+    {
+        return EINVAL;
+    }
+
+    //
+    // Opening a FIFO (or a terminal) would block, or take it over, before we
+    // get a chance to reject it for not being a regular file
+    //
+    Connection->InputFd = open(Connection->Path,
+                               O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    return (Connection->InputFd != -1) ? 0 : errno;
+}
+
+int
+ZdLoadInput (
+    int InputFd,
+    uint32_t InputSize,
+    uint8_t** Input,
+    bool* Mapped
+    )
+{
+    uint32_t offset;
+    ssize_t bytesRead;
+    int seals, status;
+
+    //
+    // A memfd that is sealed against shrinking can't be truncated under us, so
+    // it is mapped. Anything else is read, so that its owner can't make us
+    // fault on pages that no longer exist.
+    //
+    seals = fcntl(InputFd, F_GET_SEALS);
+    *Mapped = (seals != -1) && ((seals & F_SEAL_SHRINK) != 0);
+    if (*Mapped)
+    {
+        *Input = mmap(NULL, InputSize, PROT_READ, MAP_PRIVATE, InputFd, 0);
+        return (*Input != MAP_FAILED) ? 0 : errno;
+    }
+    *Input = malloc(InputSize);
+    if (*Input == NULL)
+    {
+        return ENOMEM;
+    }
+    for (offset = 0; offset < InputSize; offset += (uint32_t)bytesRead)
+    {
+        bytesRead = pread(InputFd, *Input + offset, InputSize - offset, offset);
+        if ((bytesRead < 0) && (errno == EINTR))
+        {
+            bytesRead = 0;
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            //
+            // The file shrank since we looked at its size
+            //
+            status = (bytesRead == 0) ? EIO : errno;
+            free(*Input);
+            return status;
+        }
+    }
+    return 0;
+}
+
+void*
+ZdAllocateOutput (
+    void* Context,
+    uint32_t Size
+    )
+{
+    uint8_t* output;
+    int* outputFd;
+
+    //
+    // Back the output buffer with the memfd that will be handed to the client
+    //
+    outputFd = (int*)Context;
+    *outputFd = memfd_create("minlzd-output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*outputFd == -1)
+    {
+        return NULL;
+    }
+    output = MAP_FAILED;
+    if (ftruncate(*outputFd, Size) == 0)
+    {
+        output = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, *outputFd, 0);
+    }
+    if (output == MAP_FAILED)
+    {
+        close(*outputFd);
+        *outputFd = -1;
+        return NULL;
+    }
+    return output;
+}
+
+void*
+ZdReallocateOutput (
+    void* Context,
+    void* Buffer,
+    uint32_t OldSize,
+    uint32_t NewSize
+    )
+{
+    void* output;
+    int outputFd;
+
+    //
+    // Resize the memfd along with our view of it, growing the file before the
+    // view can reach past its end, and shrinking it only once it can't. The
+    // kernel moves the pages of the view if it can't be resized in place.
+    //
+    outputFd = *(int*)Context;
+    if ((NewSize > OldSize) && (ftruncate(outputFd, NewSize) != 0))
+    {
+        return NULL;
+    }
+    output = mremap(Buffer, OldSize, NewSize, MREMAP_MAYMOVE);
+    if (output == MAP_FAILED)
+    {
+        if (NewSize > OldSize)
+        {
+            (void)ftruncate(outputFd, OldSize);
+        }
+        return NULL;
+    }
+    if (NewSize < OldSize)
+    {
+        (void)ftruncate(outputFd, NewSize);
+    }
+    return output;
+}
+
+void
+ZdFreeOutput (
+    void* Context,
+    void* Buffer,
+    uint32_t Size
+    )
+{
+    int* outputFd;
+
+    outputFd = (int*)Context;
+    munmap(Buffer, Size);
+    close(*outputFd);
+    *outputFd = -1;
+}
+
+int
+ZdDecode (
+    int InputFd,
+    PZD_RESPONSE Response,
+    int* OutputFd
+    )
+{
+    XZ_ALLOCATOR allocator;
+    struct stat inputStat;
+    uint8_t* input;
+    uint8_t* output;
+    uint32_t inputSize, outputSize;
+    uint64_t start;
+    bool mapped;
+    int status;
+
+    output = NULL;
+    outputSize = 0;
+    *OutputFd = -1;
+
+    //
+    // Load the whole input stream, which must be a regular file (or a memfd),
+    // as reading anything else could block the worker forever
+    //
+    if (fstat(InputFd, &inputStat) != 0)
+    {
+        return errno;
+    }
+    if (!S_ISREG(inputStat.st_mode))
+    {
+        return EINVAL;
+    }
+    if ((inputStat.st_size == 0) || ((uint64_t)inputStat.st_size > UINT32_MAX))
+    {
+        return EFBIG;
+    }
+    inputSize = (uint32_t)inputStat.st_size;
+    status = ZdLoadInput(InputFd, inputSize, &input, &mapped);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    //
+    // Decode straight into a memfd, in a single pass: XzDecodeAlloc sizes it
+    // from the index of the stream when it has a usable one, and grows it as
+    // needed otherwise. An empty output still gets an (empty) memfd.
+    //
+    start = MdGetTime();
+    allocator.Allocate = ZdAllocateOutput;
+    allocator.Reallocate = ZdReallocateOutput;
+    allocator.Free = ZdFreeOutput;
+    allocator.Context = OutputFd;
+    if (!XzDecodeAlloc(input, inputSize, &allocator, &output, &outputSize))
+    {
+        status = ENOTSUP;
+        goto Cleanup;
+    }
+    if (output == NULL)
+    {
+        *OutputFd = memfd_create("minlzd-output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (*OutputFd == -1)
+        {
+            status = errno;
+            goto Cleanup;
+        }
+    }
+    Response->OutputSize = outputSize;
+    Response->ChecksumError = XzChecksumError();
+    Response->DecodeTime = MdGetTime() - start;
+
+    //
+    // Unmap our view first, as a memfd can't be sealed against writes while it
+    // still has writable mappings. Sealing guarantees the client that what it
+    // maps can't change under it, so fail the request if it can't be done.
+    //
+    if (output != NULL)
+    {
+        munmap(output, outputSize);
+        output = NULL;
+    }
+    if (fcntl(*OutputFd,
+              F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+        status = errno;
+        goto Cleanup;
+    }
+    status = 0;
+
+Cleanup:
+    if (output != NULL)
+    {
+        munmap(output, outputSize);
+    }
+    if (mapped)
+    {
+        munmap(input, inputSize);
+    }
+    else
+    {
+        free(input);
+    }
+    if ((status != 0) && (*OutputFd != -1))
+    {
+        close(*OutputFd);
+        *OutputFd = -1;
+    }
+    return status;
+}
+
+int
+ZdWriteMetrics (
+    PZD_RESPONSE Response,
+    int* OutputFd
+    )
+{
+    XZ_METRICS metrics;
+    uint64_t requests, failures;
+    uint32_t i;
+    FILE* file;
+    off_t size;
+    bool written;
+    int status;
+
+    //
+    // Write the metrics into a memfd, through a stream of its own
+    //
+    *OutputFd = memfd_create("minlzd-metrics", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*OutputFd == -1)
+    {
+        return errno;
+    }
+    file = fdopen(dup(*OutputFd), "w");
+    if (file == NULL)
+    {
+        close(*OutputFd);
+        *OutputFd = -1;
+        return ENOMEM;
+    }
+    XzGetMetrics(&metrics);
+    written = MdWriteMetrics(file, &metrics);
+    for (i = 0, requests = 0, failures = 0; i < Service.WorkerCount; i++)
+    {
+        requests += __atomic_load_n(&Service.Workers[i].Requests, __ATOMIC_RELAXED);
+        failures += __atomic_load_n(&Service.Workers[i].Failures, __ATOMIC_RELAXED);
+    }
+    MdWriteCounter(file, "minlzd_requests_total", "Decode requests served.", requests);
+    MdWriteCounter(file, "minlzd_request_failures_total", "Decode requests that failed.", failures);
+    written = (fclose(file) == 0) && written;
+    size = lseek(*OutputFd, 0, SEEK_END);
+    if (!written || (size <= 0))
+    {
+        close(*OutputFd);
+        *OutputFd = -1;
+        return EIO;
+    }
+    if (fcntl(*OutputFd,
+              F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+        status = errno;
+        close(*OutputFd);
+        *OutputFd = -1;
+        return status;
+    }
+    Response->OutputSize = (uint32_t)size;
+    return 0;
+}
+
+bool
+ZdServeRequest (
+    PZD_WORKER Worker,
+    PZD_CONNECTION Connection
+    )
+{
+    ZD_RESPONSE response;
+    int outputFd;
+    bool keep, sent;
+
+    //
+    // Answer the request, and tell the caller whether the connection can be
+    // used for more of them
+    //
+    memset(&response, 0, sizeof(response));
+    response.Magic = ZD_MAGIC;
+    outputFd = -1;
+    if (Connection->Request.Magic != ZD_MAGIC)
+    {
+        response.Status = EPROTO;
+    }
+    else if (Connection->Request.Type == ZdRequestMetrics)
+    {
+        response.Status = ZdWriteMetrics(&response, &outputFd);
+        sent = ZdSendMessage(Connection->Socket, &response, sizeof(response), outputFd);
+        if (outputFd != -1)
+        {
+            close(outputFd);
+        }
+        return sent;
+    }
+    else
+    {
+        response.Status = ZdOpenInput(Connection);
+    }
+    if (response.Status == 0)
+    {
+        response.Status = ZdDecode(Connection->InputFd, &response, &outputFd);
+    }
+
+    __atomic_fetch_add(&Worker->Requests, 1, __ATOMIC_RELAXED);
+    if (response.Status == 0)
+    {
+        __atomic_fetch_add(&Worker->Bytes, response.OutputSize, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_add(&Worker->Failures, 1, __ATOMIC_RELAXED);
+    }
+    sent = ZdSendMessage(Connection->Socket, &response, sizeof(response), outputFd);
+    if (outputFd != -1)
+    {
+        close(outputFd);
+    }
+
+    //
+    // Neither garbage nor the path of a request whose path was too long was
+    // read off the socket, so the next request can't be found after them
+    //
+    keep = (response.Status != EPROTO) &&
+           ((Connection->Request.Type != ZdRequestPath) ||
+            (Connection->Request.PathLength <= ZD_MAX_PATH));
+    return sent && keep;
+}
+
+void
+ZdCloseConnection (
+    PZD_CONNECTION Connection
+    )
+{
+    //
+    // Closing the socket also takes it out of the epoll set
+    //
+    if (Connection->InputFd != -1)
+    {
+        close(Connection->InputFd);
+    }
+    close(Connection->Socket);
+    free(Connection);
+}
+
+bool
+ZdPollConnection (
+    PZD_CONNECTION Connection,
+    int Operation
+    )
+{
+    struct epoll_event event;
+
+    //
+    // Only report the next request once, as it is then owned by the queue (and
+    // the worker that serves it) until it has been answered
+    //
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = Connection;
+    return epoll_ctl(Service.Poll, Operation, Connection->Socket, &event) == 0;
+}
+
+void*
+ZdWorkerThread (
+    void* Context
+    )
+{
+    PZD_CONNECTION connection;
+    PZD_WORKER worker;
+
+    //
+    // Serve queued requests, one at a time, and hand each connection back to
+    // the main thread once its request has been answered
+    //
+    worker = (PZD_WORKER)Context;
+    for (;;)
+    {
+        pthread_mutex_lock(&Service.QueueLock);
+        while (Service.QueueHead == NULL)
+        {
+            pthread_cond_wait(&Service.QueueEvent, &Service.QueueLock);
+        }
+        connection = Service.QueueHead;
+        Service.QueueHead = connection->Next;
+        if (Service.QueueHead == NULL)
+        {
+            Service.QueueTail = NULL;
+        }
+        pthread_mutex_unlock(&Service.QueueLock);
+
+        connection->Next = NULL;
+        if (!ZdServeRequest(worker, connection))
+        {
+            ZdCloseConnection(connection);
+            continue;
+        }
+        if (connection->InputFd != -1)
+        {
+            close(connection->InputFd);
+            connection->InputFd = -1;
+        }
+        connection->Received = 0;
+        if (!ZdPollConnection(connection, EPOLL_CTL_MOD))
+        {
+            ZdCloseConnection(connection);
+        }
+    }
+    return NULL;
+}
+
+ZD_READ_STATUS
+ZdReadRequest (
+    PZD_CONNECTION Connection
+    )
+{
+    uint32_t pathReceived, size;
+    ssize_t received;
+    uint8_t* buffer;
+
+    //
+    // Read as much of the request as has arrived, without waiting for the
+    // rest: first the header (and descriptor), then the path of path requests.
+    // Nothing past the request is read, as the client may have already sent
+    // its next one. Nothing more is read for a request with no magic, or with
+    // a path that is too long: the worker answers it with an error, and closes
+    // the connection.
+    //
+    for (;;)
+    {
+        if (Connection->Received < sizeof(Connection->Request))
+        {
+            buffer = (uint8_t*)&Connection->Request + Connection->Received;
+            size = (uint32_t)sizeof(Connection->Request) - Connection->Received;
+        }
+        else
+        {
+            pathReceived = Connection->Received - (uint32_t)sizeof(Connection->Request);
+            if ((Connection->Request.Magic != ZD_MAGIC) ||
+                (Connection->Request.Type != ZdRequestPath) ||
+                (Connection->Request.PathLength > ZD_MAX_PATH))
+            {
+                Connection->Path[0] = '\0';
+                return ZdReadComplete;
+            }
+            if (pathReceived == Connection->Request.PathLength)
+            {
+                Connection->Path[pathReceived] = '\0';
+                return ZdReadComplete;
+            }
+            buffer = (uint8_t*)Connection->Path + pathReceived;
+            size = Connection->Request.PathLength - pathReceived;
+        }
+        received = ZdReceivePart(Connection->Socket,
+                                 buffer,
+                                 size,
+                                 &Connection->InputFd);
+        if (received <= 0)
+        {
+            return ((received < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) ?
+                   ZdReadPending : ZdReadFailed;
+        }
+        Connection->Received += (uint32_t)received;
+    }
+}
+
+void
+ZdQueueRequest (
+    PZD_CONNECTION Connection
+    )
+{
+    //
+    // Requests are served in the order they came in, by the first free worker
+    //
+    pthread_mutex_lock(&Service.QueueLock);
+    if (Service.QueueTail == NULL)
+    {
+        Service.QueueHead = Connection;
+    }
+    else
+    {
+        Service.QueueTail->Next = Connection;
+    }
+    Service.QueueTail = Connection;
+    pthread_cond_signal(&Service.QueueEvent);
+    pthread_mutex_unlock(&Service.QueueLock);
+}
+
+void
+ZdAcceptClients (
+    void
+    )
+{
+    PZD_CONNECTION connection;
+    struct ucred credentials;
+    socklen_t length;
+    int client;
+
+    //
+    // Take all pending connections off the listening socket, and only serve
+    // clients that run as our own user (or root), since we open files on
+    // their behalf. Client sockets are non-blocking, so that this thread only
+    // reads what has arrived, and a worker drops a client that stopped reading
+    // its answers instead of waiting on it.
+    //
+    for (;;)
+    {
+        client = accept4(Service.Listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (client == -1)
+        {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+            {
+                continue;
+            }
+            break;
+        }
+        length = sizeof(credentials);
+        if ((getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) ||
+            ((credentials.uid != getuid()) && (credentials.uid != 0)))
+        {
+            close(client);
+            continue;
+        }
+        connection = calloc(1, sizeof(*connection));
+        if (connection == NULL)
+        {
+            close(client);
+            continue;
+        }
+        connection->Socket = client;
+        connection->InputFd = -1;
+        if (!ZdPollConnection(connection, EPOLL_CTL_ADD))
+        {
+            ZdCloseConnection(connection);
+        }
+    }
+}
+
+void
+ZdDispatch (
+    void
+    )
+{
+    struct epoll_event events[ZD_MAX_EVENTS];
+    PZD_CONNECTION connection;
+    ZD_READ_STATUS status;
+    int32_t count, i;
+
+    //
+    // Accept new clients and queue the requests of existing ones until we are
+    // told to exit. A connection whose request only partly arrived is polled
+    // again for the rest of it.
+    //
+    for (;;)
+    {
+        count = epoll_wait(Service.Poll, events, ZD_MAX_EVENTS, -1);
+        if ((count == -1) && (errno != EINTR))
+        {
+            return;
+        }
+        for (i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == &Service.Signals)
+            {
+                return;
+            }
+            if (events[i].data.ptr == &Service.Listener)
+            {
+                ZdAcceptClients();
+                continue;
+            }
+            connection = (PZD_CONNECTION)events[i].data.ptr;
+            status = ZdReadRequest(connection);
+            if (status == ZdReadComplete)
+            {
+                ZdQueueRequest(connection);
+            }
+            else if ((status == ZdReadFailed) ||
+                     !ZdPollConnection(connection, EPOLL_CTL_MOD))
+            {
+                ZdCloseConnection(connection);
+            }
+        }
+    }
+}
+
+bool
+ZdCreatePoll (
+    void
+    )
+{
+    struct epoll_event event;
+
+    //
+    // The listening socket is non-blocking, so that all pending connections
+    // can be taken off it at once
+    //
+    Service.Poll = epoll_create1(EPOLL_CLOEXEC);
+    if ((Service.Poll == -1) ||
+        (fcntl(Service.Listener, F_SETFL, O_NONBLOCK) != 0))
+    {
+        return false;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = &Service.Listener;
+    if (epoll_ctl(Service.Poll, EPOLL_CTL_ADD, Service.Listener, &event) != 0)
+    {
+        return false;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = &Service.Signals;
+    return epoll_ctl(Service.Poll, EPOLL_CTL_ADD, Service.Signals, &event) == 0;
+}
+
+int
+ZdListen (
+    const char* SocketPath
+    )
+{
+    struct sockaddr_un address;
+    int listener;
+
+    if (strlen(SocketPath) >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SocketPath);
+
+    //
+    // Replace a socket left behind by a previous instance, and make it only
+    // reachable by our own user
+    //
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1)
+    {
+        return -1;
+    }
+    unlink(SocketPath);
+    if ((bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0) ||
+        (chmod(SocketPath, 0600) != 0) ||
+        (listen(listener, SOMAXCONN) != 0))
+    {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int32_t
+main (
+    int32_t ArgumentCount,
+    char* Arguments[]
+    )
+{
+    sigset_t signals;
+    uint32_t i, started;
+
+    printf("minlzd v.1.1.5 -- http://ionescu007.github.io/minlzma\n");
+    printf("Copyright(c) 2020-2021 Alex Ionescu (@aionescu)\n\n");
+
+    //
+    // Parse the optional worker count and socket path
+    //
+    Service.WorkerCount = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    Service.SocketPath = getenv("MINLZD_SOCKET");
+    if (Service.SocketPath == NULL)
+    {
+        Service.SocketPath = ZD_SOCKET_PATH;
+    }
+    for (i = 1; i < (uint32_t)ArgumentCount; i++)
+    {
+        if ((strcmp(Arguments[i], "-j") == 0) && ((i + 1) < (uint32_t)ArgumentCount))
+        {
+            Service.WorkerCount = (uint32_t)strtoul(Arguments[++i], NULL, 0);
+        }
+        else if ((strcmp(Arguments[i], "-s") == 0) && ((i + 1) < (uint32_t)ArgumentCount))
+        {
+            Service.SocketPath = Arguments[++i];
+        }
+        else
+        {
+            Service.WorkerCount = 0;
+            break;
+        }
+    }
+    if (Service.WorkerCount == 0)
+    {
+        printf("Usage: minlzd [-j THREADS] [-s SOCKET]\n");
+        printf("Serve .xz decoding requests on SOCKET (default: %s), using\n", ZD_SOCKET_PATH);
+        printf("THREADS worker threads (default: one per processor).\n");
+        return EINVAL;
+    }
+
+    //
+    // Block the termination signals in every thread, so that the main thread
+    // can poll for them and remove the socket on the way out
+    //
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    Service.Signals = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    XzSetMetricsClock(MdGetTime);
+    Service.Listener = ZdListen(Service.SocketPath);
+    if (Service.Listener == -1)
+    {
+        printf("Failed to listen on %s: %s\n", Service.SocketPath, strerror(errno));
+        return errno;
+    }
+    if ((Service.Signals == -1) || !ZdCreatePoll())
+    {
+        printf("Failed to poll the listening socket: %s\n", strerror(errno));
+        unlink(Service.SocketPath);
+        return errno;
+    }
+    pthread_mutex_init(&Service.QueueLock, NULL);
+    pthread_cond_init(&Service.QueueEvent, NULL);
+    Service.Workers = calloc(Service.WorkerCount, sizeof(*Service.Workers));
+    if (Service.Workers == NULL)
+    {
+        printf("Out of memory for allocating the workers\n");
+        return ENOMEM;
+    }
+    for (started = 0; started < Service.WorkerCount; started++)
+    {
+        Service.Workers[started].Index = started;
+        if (pthread_create(&Service.Workers[started].Thread,
+                           NULL,
+                           ZdWorkerThread,
+                           &Service.Workers[started]) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        printf("Failed to create the worker threads\n");
+        unlink(Service.SocketPath);
+        return EAGAIN;
+    }
+    printf("Listening on %s with %d workers\n", Service.SocketPath, started);
+    fflush(stdout);
+
+    //
+    // Dispatch requests until we are told to exit, then report what each
+    // worker did. The workers are not joined, as they may be busy decoding.
+    //
+    ZdDispatch();
+    unlink(Service.SocketPath);
+    for (i = 0; i < started; i++)
+    {
+        printf("Worker %d: %llu requests (%llu failed), %llu bytes\n",
+               i,
+               (unsigned long long)__atomic_load_n(&Service.Workers[i].Requests, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&Service.Workers[i].Failures, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&Service.Workers[i].Bytes, __ATOMIC_RELAXED));
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    minlzd.h
+
+Abstract:
+
+    This header file contains the protocol spoken between the minlzd decoding
+    service and its clients over a Unix socket, as well as the interface of the
+    client library. A client sends a request naming either a file path or an
+    attached file descriptor (e.g.: a memfd) holding the .xz stream, and the
+    service answers with the status of the decode and, on success, a sealed
+    memfd holding the decompressed output, which the client maps directly. The
+    service only maps an input memfd that is sealed against shrinking (with
+    F_SEAL_SHRINK), and reads any other input into a buffer of its own.
+    Clients can also ask for the service's metrics, which come back the same
+    way, as text in the Prometheus exposition format.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+//
+// Default socket path, which can be overridden with the MINLZD_SOCKET variable
+//
+#define ZD_SOCKET_PATH      "/tmp/minlzd.sock"
+#define ZD_MAGIC            'dZLM'
+#define ZD_MAX_PATH         4096
+
+typedef enum _ZD_REQUEST_TYPE
+{
+    ZdRequestPath,
+    ZdRequestFd,
+    ZdRequestMetrics
+} ZD_REQUEST_TYPE;
+
+//
+// Request header, followed by PathLength bytes of path (without terminator)
+// for ZdRequestPath, or carrying the input descriptor for ZdRequestFd
+//
+typedef struct _ZD_REQUEST
+{
+    uint32_t Magic;
+    uint32_t Type;
+    uint32_t PathLength;
+    uint32_t Reserved;
+} ZD_REQUEST, *PZD_REQUEST;
+
+//
+// Response, carrying the output descriptor when Status is 0
+//
+typedef struct _ZD_RESPONSE
+{
+    uint32_t Magic;
+    int32_t Status;
+    uint32_t OutputSize;
+    uint32_t ChecksumError;
+    uint64_t DecodeTime;
+} ZD_RESPONSE, *PZD_RESPONSE;
+
+//
+// Decoded output returned to clients of the library
+//
+typedef struct _ZD_RESULT
+{
+    const uint8_t* Output;
+    uint32_t OutputSize;
+    bool ChecksumError;
+    uint64_t DecodeTime;
+    int Fd;
+} ZD_RESULT, *PZD_RESULT;
+
+//
+// Message transport, shared by the service and the client library
+//
+bool
+ZdSendMessage (
+    int Socket,
+    const void* Buffer,
+    size_t Size,
+    int Fd
+    );
+
+ssize_t
+ZdReceivePart (
+    int Socket,
+    void* Buffer,
+    size_t Size,
+    int* Fd
+    );
+
+bool
+ZdReceiveMessage (
+    int Socket,
+    void* Buffer,
+    size_t Size,
+    int* Fd
+    );
+
+//
+// Client library
+//
+int
+ZdConnect (
+    const char* SocketPath
+    );
+
+int
+ZdDecodeFile (
+    int Socket,
+    const char* Path,
+    PZD_RESULT Result
+    );
+
+int
+ZdDecodeFd (
+    int Socket,
+    int Fd,
+    PZD_RESULT Result
+    );
+
+int
+ZdGetMetrics (
+    int Socket,
+    PZD_RESULT Result
+    );
+
+void
+ZdReleaseResult (
+    PZD_RESULT Result
+    );
+
+void
+ZdDisconnect (
+    int Socket
+    );
@@ -0,0 +1,357 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    bench.c
+
+Abstract:
+
+    This module implements the benchmark mode of minlzdec, which decodes a file
+    in memory a number of times with each decode engine (see XzSetDecodeEngine),
+    then as many times as trusted input (see XzSetTrustedInput), and reports the
+    throughput of each along with whether they produced the same output as the
+    call tree engine. Everything happens on the calling thread, so that the
+    decode loops are compared on their own. It also implements the time-to-
+    result benchmark, which measures how long it takes to get the output of
+    small messages, where the fixed costs of a decode dominate.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+//
+// The ways of decoding that are compared, the first one being the reference
+//
+typedef struct _MD_BENCH_LOOP
+{
+    const char* Name;
+    XZ_DECODE_ENGINE Engine;
+    bool Trusted;
+} MD_BENCH_LOOP, *PMD_BENCH_LOOP;
+
+const MD_BENCH_LOOP k_BenchLoops[] =
+{
+    { "calltree", XzDecodeEngineCallTree, false },
+    { "statemachine", XzDecodeEngineStateMachine, false },
+    { "assembly", XzDecodeEngineAssembly, false },
+    { "trusted", XzDecodeEngineCallTree, true },
+};
+
+bool
+MdBenchReadFile (
+    const char* InputPath,
+    uint8_t** InputBuffer,
+    uint32_t* InputSize
+    )
+{
+    FILE* inputFile;
+    long fileSize;
+
+    //
+    // Read the whole file, as it is decoded from memory
+    //
+    inputFile = fopen(InputPath, "rb");
+    if (inputFile == NULL)
+    {
+        printf("Failed to open input file: %s\n", InputPath);
+        return false;
+    }
+    fseek(inputFile, 0, SEEK_END);
+    fileSize = ftell(inputFile);
+    fseek(inputFile, 0, SEEK_SET);
+    if ((fileSize <= 0) || ((unsigned long)fileSize > UINT32_MAX))
+    {
+        printf("Unsupported input file size: %ld\n", fileSize);
+        fclose(inputFile);
+        return false;
+    }
+    *InputSize = (uint32_t)fileSize;
+    *InputBuffer = malloc(*InputSize);
+    if ((*InputBuffer == NULL) ||
+        (fread(*InputBuffer, 1, *InputSize, inputFile) != *InputSize))
+    {
+        printf("Failed to read input file: %s\n", InputPath);
+        free(*InputBuffer);
+        fclose(inputFile);
+        return false;
+    }
+    fclose(inputFile);
+    return true;
+}
+
+bool
+MdBenchDecode (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t OutputSize,
+    uint32_t Iterations,
+    const MD_BENCH_LOOP* Loop,
+    uint64_t* Time
+    )
+{
+    uint32_t i, outputSize;
+    uint64_t start;
+    bool isLzip, result;
+
+    //
+    // Decode the whole file each time, as a single thread would
+    //
+    isLzip = MdIsLzip(InputBuffer, InputSize);
+    XzSetDecodeEngine(Loop->Engine);
+    XzSetTrustedInput(Loop->Trusted);
+    start = MdGetTime();
+    for (i = 0, result = true; result && (i < Iterations); i++)
+    {
+        outputSize = OutputSize;
+        result = isLzip ?
+                 XzDecodeLzip(InputBuffer, InputSize, OutputBuffer, &outputSize) :
+                 XzDecode(InputBuffer, InputSize, OutputBuffer, &outputSize);
+        result &= (outputSize == OutputSize);
+    }
+    *Time = MdGetTime() - start;
+    XzSetDecodeEngine(MdDecodeEngine);
+    XzSetTrustedInput(false);
+    return result;
+}
+
+void
+MdBenchPrint (
+    const char* Name,
+    uint32_t OutputSize,
+    uint32_t Iterations,
+    uint64_t Time,
+    uint64_t ReferenceTime,
+    bool Identical
+    )
+{
+    printf("%-12s %10.3f ms/decode %10.1f MB/s %8.3fx  %s\n",
+           Name,
+           (double)Time / Iterations / 1000000,
+           ((double)OutputSize * Iterations / (1024 * 1024)) /
+           ((double)Time / 1000000000),
+           (double)ReferenceTime / (double)Time,
+           Identical ? "identical" : "MISMATCHED");
+}
+
+bool
+MdBenchmark (
+    const char* InputPath,
+    uint32_t Iterations
+    )
+{
+    uint8_t* inputBuffer;
+    uint8_t* referenceBuffer;
+    uint8_t* outputBuffer;
+    uint32_t inputSize, outputSize, i;
+    uint64_t time, referenceTime;
+    bool result, identical;
+
+    //
+    // Read the whole file, and find out how large it is once decoded
+    //
+    if (Iterations == 0)
+    {
+        Iterations = 1;
+    }
+    if (!MdBenchReadFile(InputPath, &inputBuffer, &inputSize))
+    {
+        return false;
+    }
+    outputSize = 0;
+    result = MdIsLzip(inputBuffer, inputSize) ?
+             XzDecodeLzip(inputBuffer, inputSize, NULL, &outputSize) :
+             XzDecode(inputBuffer, inputSize, NULL, &outputSize);
+    referenceBuffer = result ? MdAllocateOutput(outputSize) : NULL;
+    outputBuffer = result ? MdAllocateOutput(outputSize) : NULL;
+    if ((referenceBuffer == NULL) || (outputBuffer == NULL))
+    {
+        printf("Failed to size the output of %s\n", InputPath);
+        result = false;
+        goto Cleanup;
+    }
+
+    //
+    // Decode once with the reference loop, which also faults in its buffer,
+    // then time each loop after a first decode that does the same
+    //
+    printf("Decoding %u bytes into %u bytes, %u times with each loop\n",
+           inputSize, outputSize, Iterations);
+    if (!MdBenchDecode(inputBuffer, inputSize, referenceBuffer, outputSize,
+                       1, &k_BenchLoops[0], &time))
+    {
+        printf("Decoding failed\n");
+        result = false;
+        goto Cleanup;
+    }
+    referenceTime = 0;
+    for (i = 0; i < (sizeof(k_BenchLoops) / sizeof(k_BenchLoops[0])); i++)
+    {
+        //
+        // Engines that were not built into this library are skipped
+        //
+        if (!XzSetDecodeEngine(k_BenchLoops[i].Engine))
+        {
+            printf("%-12s not available\n", k_BenchLoops[i].Name);
+            continue;
+        }
+        if (!MdBenchDecode(inputBuffer, inputSize, outputBuffer, outputSize,
+                           1, &k_BenchLoops[i], &time) ||
+            !MdBenchDecode(inputBuffer, inputSize, outputBuffer, outputSize,
+                           Iterations, &k_BenchLoops[i], &time))
+        {
+            printf("Decoding failed with %s\n", k_BenchLoops[i].Name);
+            result = false;
+            continue;
+        }
+
+        //
+        // Every loop must of course produce the same output
+        //
+        identical = (memcmp(referenceBuffer, outputBuffer, outputSize) == 0);
+        result &= identical;
+        if (i == 0)
+        {
+            referenceTime = time;
+        }
+        MdBenchPrint(k_BenchLoops[i].Name,
+                     outputSize,
+                     Iterations,
+                     time,
+                     referenceTime,
+                     identical);
+    }
+
+Cleanup:
+    if (outputBuffer != NULL)
+    {
+        MdFreeOutput(outputBuffer, outputSize);
+    }
+    if (referenceBuffer != NULL)
+    {
+        MdFreeOutput(referenceBuffer, outputSize);
+    }
+    free(inputBuffer);
+    return result;
+}
+
+bool
+MdBenchGetResult (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t OutputSize,
+    bool FromIndex
+    )
+{
+    uint32_t outputSize;
+    bool isLzip;
+
+    //
+    // Get the size of the output, from the index or from a first decode, then
+    // decode the file, which is all it takes a caller to get a message out
+    //
+    isLzip = MdIsLzip(InputBuffer, InputSize);
+    outputSize = 0;
+    if (FromIndex)
+    {
+        if (!MdGetOutputSize(InputBuffer, InputSize, &outputSize))
+        {
+            return false;
+        }
+    }
+    else if (!(isLzip ?
+               XzDecodeLzip(InputBuffer, InputSize, NULL, &outputSize) :
+               XzDecode(InputBuffer, InputSize, NULL, &outputSize)))
+    {
+        return false;
+    }
+    if (outputSize != OutputSize)
+    {
+        return false;
+    }
+    return isLzip ?
+           XzDecodeLzip(InputBuffer, InputSize, OutputBuffer, &outputSize) :
+           XzDecode(InputBuffer, InputSize, OutputBuffer, &outputSize);
+}
+
+bool
+MdBenchLatency (
+    char* Files[],
+    uint32_t FileCount,
+    uint32_t Iterations
+    )
+{
+    uint8_t* inputBuffer;
+    uint8_t* outputBuffer;
+    uint32_t inputSize, outputSize, i, j;
+    uint64_t start, firstTime, sizedTime, indexedTime;
+    bool result;
+
+    //
+    // Time how long it takes to get the output of each (small) file: the very
+    // first time on this thread, then on average when sizing the output with
+    // a first decode, and when sizing it from the index
+    //
+    if (Iterations == 0)
+    {
+        Iterations = 1;
+    }
+    printf("%-24s %8s %8s %12s %12s %12s\n",
+           "File", "Input", "Output", "First (us)", "Sized (us)", "Indexed (us)");
+    for (i = 0, result = true; i < FileCount; i++)
+    {
+        if (!MdBenchReadFile(Files[i], &inputBuffer, &inputSize))
+        {
+            result = false;
+            continue;
+        }
+        outputBuffer = NULL;
+        start = MdGetTime();
+        if (!MdGetOutputSize(inputBuffer, inputSize, &outputSize) ||
+            ((outputBuffer = malloc(outputSize + 1)) == NULL) ||
+            !MdBenchGetResult(inputBuffer, inputSize, outputBuffer, outputSize, true))
+        {
+            printf("Decoding failed: %s\n", Files[i]);
+            result = false;
+            goto Next;
+        }
+        firstTime = MdGetTime() - start;
+
+        start = MdGetTime();
+        for (j = 0; j < Iterations; j++)
+        {
+            result &= MdBenchGetResult(inputBuffer, inputSize, outputBuffer, outputSize, false);
+        }
+        sizedTime = MdGetTime() - start;
+        start = MdGetTime();
+        for (j = 0; j < Iterations; j++)
+        {
+            result &= MdBenchGetResult(inputBuffer, inputSize, outputBuffer, outputSize, true);
+        }
+        indexedTime = MdGetTime() - start;
+
+        printf("%-24s %8u %8u %12.2f %12.2f %12.2f\n",
+               Files[i],
+               inputSize,
+               outputSize,
+               (double)firstTime / 1000,
+               (double)sizedTime / Iterations / 1000,
+               (double)indexedTime / Iterations / 1000);
+Next:
+        free(outputBuffer);
+        free(inputBuffer);
+    }
+    return result;
+}
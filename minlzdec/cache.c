@@ -0,0 +1,591 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    cache.c
+
+Abstract:
+
+    This module implements an optional cache of decoded archives, shared by all
+    of the minlzdec processes on the machine through a POSIX shared memory
+    segment. Since minlzlib only supports single-block streams, each entry is a
+    whole decoded block, keyed by the identity of the archive file, the block
+    index, and the check value stored after the block. The segment holds a
+    fixed array of slots, followed by the data area. Writers serialize on a
+    robust process-shared mutex and evict the least recently used entries until
+    the new block fits in a gap of the data area. Readers never take the lock:
+    each slot is protected by a sequence counter that writers make odd while
+    they modify the slot (or reuse its data), so a reader copies the data out
+    and then checks that the counter did not change under it.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minlzdec.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MD_CACHE_NAME       "/minlzdec-cache"
+#define MD_CACHE_MAGIC      'CzLM'
+#define MD_CACHE_VERSION    1
+#define MD_CACHE_SLOTS      1024
+
+//
+// How long to wait (in nanoseconds) for the process that created the segment
+// to finish setting it up, before assuming that it died while doing so
+//
+#define MD_CACHE_CREATE_TIMEOUT 1000000000ull
+
+//
+// A cached block. The sequence counter is odd while a writer owns the slot.
+//
+typedef struct _MD_CACHE_SLOT
+{
+    atomic_uint Sequence;
+    uint32_t InUse;
+    MD_CACHE_KEY Key;
+    uint64_t DataOffset;
+    uint32_t DataSize;
+    atomic_ullong LastUsed;
+} MD_CACHE_SLOT, *PMD_CACHE_SLOT;
+
+//
+// Layout of the start of the shared segment, followed by the data area
+//
+typedef struct _MD_CACHE_HEADER
+{
+    atomic_uint Magic;
+    uint32_t Version;
+    uint64_t SegmentSize;
+    uint64_t DataSize;
+    pthread_mutex_t Lock;
+    atomic_ullong Clock;
+    MD_CACHE_SLOT Slots[MD_CACHE_SLOTS];
+} MD_CACHE_HEADER, *PMD_CACHE_HEADER;
+
+PMD_CACHE_HEADER Cache;
+
+uint8_t*
+MdCacheGetData (
+    void
+    )
+{
+    return (uint8_t*)(Cache + 1);
+}
+
+bool
+MdCacheOpen (
+    uint64_t Size,
+    bool* Stale
+    )
+{
+    pthread_mutexattr_t attributes;
+    PMD_CACHE_HEADER header;
+    struct stat segmentStat;
+    uint64_t deadline;
+    bool created;
+    int fd;
+
+    //
+    // Create the segment, or open the one created by another process
+    //
+    *Stale = false;
+    Size += sizeof(*Cache);
+    created = true;
+    fd = shm_open(MD_CACHE_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd == -1) && (errno == EEXIST))
+    {
+        created = false;
+        fd = shm_open(MD_CACHE_NAME, O_RDWR, 0600);
+    }
+    if (fd == -1)
+    {
+        return false;
+    }
+    if (created && (ftruncate(fd, (off_t)Size) != 0))
+    {
+        shm_unlink(MD_CACHE_NAME);
+        close(fd);
+        return false;
+    }
+
+    //
+    // Whoever created the segment picked its size, so wait for the creator to
+    // size it before mapping it. A creator that died before doing so left the
+    // segment stale.
+    //
+    deadline = MdGetTime() + MD_CACHE_CREATE_TIMEOUT;
+    for (;;)
+    {
+        if (fstat(fd, &segmentStat) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        if ((uint64_t)segmentStat.st_size >= sizeof(*Cache))
+        {
+            break;
+        }
+        if (MdGetTime() > deadline)
+        {
+            *Stale = true;
+            close(fd);
+            return false;
+        }
+        sched_yield();
+    }
+    Size = (uint64_t)segmentStat.st_size;
+    header = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        return false;
+    }
+
+    //
+    // The creator initializes the header (the slots are already zeroed) and
+    // then publishes the magic, which the other processes wait for
+    //
+    if (created)
+    {
+        header->Version = MD_CACHE_VERSION;
+        header->SegmentSize = Size;
+        header->DataSize = Size - sizeof(*header);
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&header->Lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+        atomic_store_explicit(&header->Magic, MD_CACHE_MAGIC, memory_order_release);
+    }
+    while (atomic_load_explicit(&header->Magic, memory_order_acquire) != MD_CACHE_MAGIC)
+    {
+        if (MdGetTime() > deadline)
+        {
+            *Stale = true;
+            munmap(header, Size);
+            return false;
+        }
+        sched_yield();
+    }
+    if ((header->Version != MD_CACHE_VERSION) || (header->SegmentSize != Size))
+    {
+        munmap(header, Size);
+        return false;
+    }
+    Cache = header;
+    return true;
+}
+
+bool
+MdCacheInitialize (
+    uint64_t Size
+    )
+{
+    bool stale;
+
+    //
+    // Replace a segment whose creator never finished setting it up, once. Any
+    // process still using the old one keeps it until it exits.
+    //
+    if (MdCacheOpen(Size, &stale))
+    {
+        return true;
+    }
+    if (!stale)
+    {
+        return false;
+    }
+    shm_unlink(MD_CACHE_NAME);
+    return MdCacheOpen(Size, &stale);
+}
+
+bool
+MdCacheGetKey (
+    FILE* File,
+    const uint8_t* Input,
+    uint32_t InputSize,
+    PMD_CACHE_KEY Key
+    )
+{
+    struct stat fileStat;
+    uint32_t checkType, indexOffset;
+
+    //
+    // The archive is identified by its file, which must not have changed
+    //
+    if ((Cache == NULL) || (fstat(fileno(File), &fileStat) != 0))
+    {
+        return false;
+    }
+    memset(Key, 0, sizeof(*Key));
+    Key->Device = (uint64_t)fileStat.st_dev;
+    Key->Inode = (uint64_t)fileStat.st_ino;
+    Key->FileSize = (uint64_t)fileStat.st_size;
+    Key->ModifyTime = ((uint64_t)fileStat.st_mtim.tv_sec * 1000000000) +
+                      (uint64_t)fileStat.st_mtim.tv_nsec;
+
+    //
+    // Locate the check value stored after the (only) block: it immediately
+    // precedes the index, whose size is stored in the stream footer. The size
+    // of the check depends on its type, stored in the stream flags.
+    //
+    if ((InputSize < 32) ||
+        (Input[0] != 0xFD) || (Input[1] != '7') ||
+        (Input[InputSize - 2] != 'Y') || (Input[InputSize - 1] != 'Z'))
+    {
+        return false;
+    }
+    checkType = Input[7] & 0xF;
+    Key->CheckSize = (checkType == 0) ? 0 : (4u << ((checkType - 1) / 3));
+    indexOffset = ((uint32_t)Input[InputSize - 8] |
+                   ((uint32_t)Input[InputSize - 7] << 8) |
+                   ((uint32_t)Input[InputSize - 6] << 16) |
+                   ((uint32_t)Input[InputSize - 5] << 24));
+    if (indexOffset >= ((InputSize - 24) / 4))
+    {
+        return false;
+    }
+    indexOffset = InputSize - 12 - ((indexOffset + 1) * 4);
+    if (indexOffset < (12 + Key->CheckSize))
+    {
+        return false;
+    }
+    memcpy(Key->Check, &Input[indexOffset - Key->CheckSize], Key->CheckSize);
+    Key->BlockIndex = 0;
+    return true;
+}
+
+bool
+MdCacheRead (
+    const MD_CACHE_KEY* Key,
+    uint8_t* Buffer,
+    uint32_t* Size
+    )
+{
+    PMD_CACHE_SLOT slot;
+    uint32_t i, sequence, dataSize;
+    uint64_t dataOffset;
+
+    //
+    // Look for a slot holding this key, without taking the lock. With a NULL
+    // buffer, only return the size of the block, otherwise copy it out.
+    //
+    if (Cache == NULL)
+    {
+        return false;
+    }
+    for (i = 0; i < MD_CACHE_SLOTS; i++)
+    {
+        slot = &Cache->Slots[i];
+        sequence = atomic_load_explicit(&slot->Sequence, memory_order_acquire);
+        if ((sequence & 1) || !slot->InUse ||
+            (memcmp(&slot->Key, Key, sizeof(*Key)) != 0))
+        {
+            continue;
+        }
+        dataOffset = slot->DataOffset;
+        dataSize = slot->DataSize;
+        if (((dataOffset + dataSize) > Cache->DataSize) ||
+            ((Buffer != NULL) && (dataSize != *Size)))
+        {
+            continue;
+        }
+        if (Buffer != NULL)
+        {
+            memcpy(Buffer, &MdCacheGetData()[dataOffset], dataSize);
+        }
+
+        //
+        // If a writer touched the slot while we were reading it, what we read
+        // may be torn, so treat it as a miss
+        //
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->Sequence, memory_order_relaxed) != sequence)
+        {
+            return false;
+        }
+        *Size = dataSize;
+        atomic_store_explicit(&slot->LastUsed,
+                              atomic_fetch_add(&Cache->Clock, 1) + 1,
+                              memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void
+MdCacheEvict (
+    PMD_CACHE_SLOT Slot
+    )
+{
+    //
+    // Invalidate the slot for any reader that may be copying its data
+    //
+    atomic_fetch_add_explicit(&Slot->Sequence, 1, memory_order_acq_rel);
+    Slot->InUse = false;
+    atomic_fetch_add_explicit(&Slot->Sequence, 1, memory_order_release);
+}
+
+int
+MdCacheCompareSlots (
+    const void* Left,
+    const void* Right
+    )
+{
+    uint64_t leftOffset, rightOffset;
+
+    leftOffset = (*(PMD_CACHE_SLOT const*)Left)->DataOffset;
+    rightOffset = (*(PMD_CACHE_SLOT const*)Right)->DataOffset;
+    return (leftOffset > rightOffset) - (leftOffset < rightOffset);
+}
+
+bool
+MdCacheFindGap (
+    uint32_t Size,
+    uint64_t* Offset
+    )
+{
+    PMD_CACHE_SLOT liveSlots[MD_CACHE_SLOTS];
+    uint32_t i, liveCount;
+    uint64_t gapStart;
+
+    //
+    // Walk the live blocks in the order of their data, and return the first
+    // gap between them (or after the last one) that is large enough
+    //
+    for (i = 0, liveCount = 0; i < MD_CACHE_SLOTS; i++)
+    {
+        if (Cache->Slots[i].InUse)
+        {
+            liveSlots[liveCount++] = &Cache->Slots[i];
+        }
+    }
+    qsort(liveSlots, liveCount, sizeof(liveSlots[0]), MdCacheCompareSlots);
+    for (i = 0, gapStart = 0; i < liveCount; i++)
+    {
+        if ((liveSlots[i]->DataOffset - gapStart) >= Size)
+        {
+            break;
+        }
+        gapStart = liveSlots[i]->DataOffset + liveSlots[i]->DataSize;
+    }
+    *Offset = gapStart;
+    return (i < liveCount) || ((Cache->DataSize - gapStart) >= Size);
+}
+
+PMD_CACHE_SLOT
+MdCacheGetLeastRecent (
+    bool LiveOnly
+    )
+{
+    PMD_CACHE_SLOT slot, oldest;
+    uint32_t i;
+
+    //
+    // Return a free slot if one exists (and is wanted), or the live slot that
+    // was used the longest time ago
+    //
+    for (i = 0, oldest = NULL; i < MD_CACHE_SLOTS; i++)
+    {
+        slot = &Cache->Slots[i];
+        if (!slot->InUse)
+        {
+            if (!LiveOnly)
+            {
+                return slot;
+            }
+            continue;
+        }
+        if ((oldest == NULL) ||
+            (atomic_load_explicit(&slot->LastUsed, memory_order_relaxed) <
+             atomic_load_explicit(&oldest->LastUsed, memory_order_relaxed)))
+        {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+void
+MdCacheInsert (
+    const MD_CACHE_KEY* Key,
+    const uint8_t* Buffer,
+    uint32_t Size
+    )
+{
+    PMD_CACHE_SLOT slot;
+    uint64_t offset;
+    uint32_t i, existingSize;
+    int status;
+
+    if ((Cache == NULL) || (Size > Cache->DataSize))
+    {
+        return;
+    }
+
+    //
+    // If a writer died while holding the lock, it may have left a slot half
+    // written, so drop any slot that is still marked as being modified. If
+    // the lock can't be taken (or made consistent again, after which nobody
+    // can take it), skip caching this block.
+    //
+    status = pthread_mutex_lock(&Cache->Lock);
+    if (status == EOWNERDEAD)
+    {
+        for (i = 0; i < MD_CACHE_SLOTS; i++)
+        {
+            if (atomic_load(&Cache->Slots[i].Sequence) & 1)
+            {
+                Cache->Slots[i].InUse = false;
+                atomic_fetch_add(&Cache->Slots[i].Sequence, 1);
+            }
+        }
+        status = pthread_mutex_consistent(&Cache->Lock);
+        if (status != 0)
+        {
+            goto Cleanup;
+        }
+    }
+    else if (status != 0)
+    {
+        return;
+    }
+
+    //
+    // Another process may have cached this block since we looked
+    //
+    if (MdCacheRead(Key, NULL, &existingSize))
+    {
+        goto Cleanup;
+    }
+
+    //
+    // Evict the least recently used blocks until there is room for this one
+    //
+    while (!MdCacheFindGap(Size, &offset))
+    {
+        slot = MdCacheGetLeastRecent(true);
+        if (slot == NULL)
+        {
+            goto Cleanup;
+        }
+        MdCacheEvict(slot);
+    }
+    slot = MdCacheGetLeastRecent(false);
+    if (slot->InUse)
+    {
+        MdCacheEvict(slot);
+    }
+
+    //
+    // Fill in the slot while its sequence is odd, then publish it
+    //
+    atomic_fetch_add_explicit(&slot->Sequence, 1, memory_order_acq_rel);
+    slot->Key = *Key;
+    slot->DataOffset = offset;
+    slot->DataSize = Size;
+    memcpy(&MdCacheGetData()[offset], Buffer, Size);
+    atomic_store_explicit(&slot->LastUsed,
+                          atomic_fetch_add(&Cache->Clock, 1) + 1,
+                          memory_order_relaxed);
+    slot->InUse = true;
+    atomic_fetch_add_explicit(&slot->Sequence, 1, memory_order_release);
+
+Cleanup:
+    pthread_mutex_unlock(&Cache->Lock);
+}
+#else
+bool
+MdCacheInitialize (
+    uint64_t Size
+    )
+{
+    (void)(Size);
+    printf("The shared cache is not supported on this platform\n");
+    return false;
+}
+
+bool
+MdCacheGetKey (
+    FILE* File,
+    const uint8_t* Input,
+    uint32_t InputSize,
+    PMD_CACHE_KEY Key
+    )
+{
+    (void)(File);
+    (void)(Input);
+    (void)(InputSize);
+    (void)(Key);
+    return false;
+}
+
+bool
+MdCacheRead (
+    const MD_CACHE_KEY* Key,
+    uint8_t* Buffer,
+    uint32_t* Size
+    )
+{
+    (void)(Key);
+    (void)(Buffer);
+    (void)(Size);
+    return false;
+}
+
+void
+MdCacheInsert (
+    const MD_CACHE_KEY* Key,
+    const uint8_t* Buffer,
+    uint32_t Size
+    )
+{
+    (void)(Key);
+    (void)(Buffer);
+    (void)(Size);
+}
+#endif
+
+uint8_t*
+MdReadCachedBlock (
+    const MD_CACHE_KEY* Key,
+    uint32_t* Size
+    )
+{
+    uint8_t* buffer;
+
+    //
+    // Get the size of the cached block, then copy it out. If it got evicted
+    // in the meantime, decode it after all.
+    //
+    if (!MdCacheRead(Key, NULL, Size))
+    {
+        return NULL;
+    }
+    buffer = MdAllocateOutput(*Size);
+    if ((buffer != NULL) && !MdCacheRead(Key, buffer, Size))
+    {
+        MdFreeOutput(buffer, *Size);
+        buffer = NULL;
+    }
+    return buffer;
+}
@@ -0,0 +1,393 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    list.c
+
+Abstract:
+
+    This module implements listing of XZ archives, similar to xz --list. Each
+    archive is mapped rather than read, and only its stream headers, footers
+    and indexes are parsed (see XzGetStreamInfo), so that just a few pages of
+    each file are ever touched, no matter how large it is. Archives are handed
+    out to a pool of threads, since listing many files is bound by the latency
+    of the storage rather than by the CPU.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// The outcome of listing a single archive
+//
+typedef enum _MD_LIST_STATUS
+{
+    MdListOk,
+    MdListChecksumError,
+    MdListUnsupported,
+    MdListInvalid,
+    MdListUnreadable,
+} MD_LIST_STATUS;
+
+const char* k_ListStatusNames[] =
+{
+    "ok",
+    "checksum error",
+    "unsupported",
+    "invalid",
+    "unreadable",
+};
+
+//
+// A single archive to list
+//
+typedef struct _MD_LIST_ENTRY
+{
+    const char* Path;
+    uint64_t InputSize;
+    XZ_STREAM_INFO Info;
+    MD_LIST_STATUS Status;
+} MD_LIST_ENTRY, *PMD_LIST_ENTRY;
+
+//
+// The archives being listed, and the next one to hand out
+//
+typedef struct _MD_LIST
+{
+    pthread_mutex_t Lock;
+    PMD_LIST_ENTRY Entries;
+    uint32_t EntryCount;
+    uint32_t NextEntry;
+} MD_LIST, *PMD_LIST;
+
+void
+MdListFile (
+    PMD_LIST_ENTRY Entry
+    )
+{
+    struct stat stat;
+    uint8_t* input;
+    int file;
+
+    //
+    // Map the whole file, since only the pages holding the metadata will ever
+    // be faulted in
+    //
+    Entry->Status = MdListUnreadable;
+    file = open(Entry->Path, O_RDONLY);
+    if (file < 0)
+    {
+        return;
+    }
+    if ((fstat(file, &stat) != 0) || !S_ISREG(stat.st_mode))
+    {
+        close(file);
+        return;
+    }
+    Entry->InputSize = (uint64_t)stat.st_size;
+    Entry->Status = MdListInvalid;
+    if ((Entry->InputSize == 0) || (Entry->InputSize > UINT32_MAX))
+    {
+        close(file);
+        return;
+    }
+    input = mmap(NULL, (size_t)Entry->InputSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (input == MAP_FAILED)
+    {
+        Entry->Status = MdListUnreadable;
+        return;
+    }
+
+    //
+    // Checksum errors win over the file not being decodable by us
+    //
+    if (XzGetStreamInfo(input, (uint32_t)Entry->InputSize, &Entry->Info))
+    {
+        Entry->Status = Entry->Info.ChecksumError ? MdListChecksumError :
+                        !Entry->Info.Supported ? MdListUnsupported : MdListOk;
+    }
+    munmap(input, (size_t)Entry->InputSize);
+}
+
+void*
+MdListWorkerThread (
+    void* Context
+    )
+{
+    PMD_LIST list;
+    uint32_t entry;
+
+    //
+    // Claim archives one at a time until they are all taken
+    //
+    list = (PMD_LIST)Context;
+    for (;;)
+    {
+        pthread_mutex_lock(&list->Lock);
+        entry = list->NextEntry;
+        if (entry == list->EntryCount)
+        {
+            pthread_mutex_unlock(&list->Lock);
+            break;
+        }
+        list->NextEntry++;
+        pthread_mutex_unlock(&list->Lock);
+
+        MdListFile(&list->Entries[entry]);
+    }
+    return NULL;
+}
+
+void
+MdListFormatSize (
+    char* Buffer,
+    size_t BufferSize,
+    uint64_t Size
+    )
+{
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    double value;
+    uint32_t unit;
+
+    //
+    // Like xz, sizes are shown in the largest binary unit that keeps them
+    // at or above 1
+    //
+    value = (double)Size;
+    for (unit = 0; (value >= 1024) && (unit < 4); unit++)
+    {
+        value /= 1024;
+    }
+    if (unit == 0)
+    {
+        snprintf(Buffer, BufferSize, "%u B", (uint32_t)Size);
+    }
+    else
+    {
+        snprintf(Buffer, BufferSize, "%.1f %s", value, units[unit]);
+    }
+}
+
+void
+MdListFormatChecks (
+    char* Buffer,
+    size_t BufferSize,
+    uint32_t CheckTypes
+    )
+{
+    const char* names[16] = { "None", "CRC32", NULL, NULL, "CRC64", NULL, NULL,
+                              NULL, NULL, NULL, "SHA-256" };
+    size_t length;
+    uint32_t i;
+
+    //
+    // Concatenated streams can each use a different check
+    //
+    Buffer[0] = '\0';
+    for (i = 0, length = 0; i < 16; i++)
+    {
+        if ((CheckTypes & (1 << i)) && (length < BufferSize))
+        {
+            if (names[i] != NULL)
+            {
+                length += (size_t)snprintf(&Buffer[length], BufferSize - length,
+                                           "%s%s", (length != 0) ? "," : "", names[i]);
+            }
+            else
+            {
+                length += (size_t)snprintf(&Buffer[length], BufferSize - length,
+                                           "%sUnknown-%u", (length != 0) ? "," : "", i);
+            }
+        }
+    }
+}
+
+void
+MdListPrintEntry (
+    const char* Streams,
+    const char* Blocks,
+    uint64_t InputSize,
+    uint64_t OutputSize,
+    const char* Checks,
+    uint32_t DictionarySize,
+    const char* Status,
+    const char* Name
+    )
+{
+    char compressed[16], uncompressed[16], ratio[16], dictionary[16];
+
+    MdListFormatSize(compressed, sizeof(compressed), InputSize);
+    MdListFormatSize(uncompressed, sizeof(uncompressed), OutputSize);
+    MdListFormatSize(dictionary, sizeof(dictionary), DictionarySize);
+    if (OutputSize != 0)
+    {
+        snprintf(ratio, sizeof(ratio), "%.3f", (double)InputSize / (double)OutputSize);
+    }
+    else
+    {
+        snprintf(ratio, sizeof(ratio), "---");
+    }
+    printf("%5s %7s %11s %12s %6s  %-14s %9s  %-14s %s\n",
+           Streams,
+           Blocks,
+           compressed,
+           uncompressed,
+           ratio,
+           Checks,
+           dictionary,
+           Status,
+           Name);
+}
+
+bool
+MdListFiles (
+    char* Files[],
+    uint32_t FileCount
+    )
+{
+    MD_LIST list;
+    pthread_t* threads;
+    PMD_LIST_ENTRY entry;
+    uint64_t totalInput, totalOutput;
+    uint32_t i, started, threadCount, totalStreams, totalBlocks, totalChecks;
+    uint32_t maxDictionary, failed;
+    char streams[16], blocks[16], checks[64];
+    long cpuCount;
+
+    //
+    // Use one thread per CPU, but never more than there are archives
+    //
+    cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = (cpuCount > 0) ? (uint32_t)cpuCount : 1;
+    if (threadCount > FileCount)
+    {
+        threadCount = FileCount;
+    }
+    list.Entries = calloc(FileCount, sizeof(*list.Entries));
+    threads = calloc(threadCount, sizeof(*threads));
+    if ((list.Entries == NULL) || (threads == NULL))
+    {
+        printf("Out of memory for allocating the archive list\n");
+        free(threads);
+        free(list.Entries);
+        return false;
+    }
+    for (i = 0; i < FileCount; i++)
+    {
+        list.Entries[i].Path = Files[i];
+    }
+
+    //
+    // Run the workers, and if none could be started, list on this thread
+    //
+    pthread_mutex_init(&list.Lock, NULL);
+    list.EntryCount = FileCount;
+    list.NextEntry = 0;
+    for (started = 0; started < threadCount; started++)
+    {
+        if (pthread_create(&threads[started], NULL, MdListWorkerThread, &list) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        MdListWorkerThread(&list);
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&list.Lock);
+
+    //
+    // Print the archives in the order they were given, then the totals
+    //
+    printf("%5s %7s %11s %12s %6s  %-14s %9s  %-14s %s\n",
+           "Strms", "Blocks", "Compressed", "Uncompressed", "Ratio",
+           "Check", "Dict", "Status", "Filename");
+    totalInput = totalOutput = 0;
+    totalStreams = totalBlocks = totalChecks = maxDictionary = failed = 0;
+    for (i = 0; i < FileCount; i++)
+    {
+        entry = &list.Entries[i];
+        if ((entry->Status == MdListInvalid) || (entry->Status == MdListUnreadable))
+        {
+            printf("%5s %7s %11s %12s %6s  %-14s %9s  %-14s %s\n",
+                   "-", "-", "-", "-", "-", "-", "-",
+                   k_ListStatusNames[entry->Status], entry->Path);
+            failed++;
+            continue;
+        }
+        snprintf(streams, sizeof(streams), "%u", entry->Info.StreamCount);
+        snprintf(blocks, sizeof(blocks), "%u", entry->Info.BlockCount);
+        MdListFormatChecks(checks, sizeof(checks), entry->Info.CheckTypes);
+        MdListPrintEntry(streams,
+                         blocks,
+                         entry->InputSize,
+                         entry->Info.UncompressedSize,
+                         checks,
+                         entry->Info.DictionarySize,
+                         k_ListStatusNames[entry->Status],
+                         entry->Path);
+        failed += (entry->Status == MdListChecksumError);
+        totalInput += entry->InputSize;
+        totalOutput += entry->Info.UncompressedSize;
+        totalStreams += entry->Info.StreamCount;
+        totalBlocks += entry->Info.BlockCount;
+        totalChecks |= entry->Info.CheckTypes;
+        if (entry->Info.DictionarySize > maxDictionary)
+        {
+            maxDictionary = entry->Info.DictionarySize;
+        }
+    }
+    if (FileCount > 1)
+    {
+        snprintf(streams, sizeof(streams), "%u", totalStreams);
+        snprintf(blocks, sizeof(blocks), "%u", totalBlocks);
+        MdListFormatChecks(checks, sizeof(checks), totalChecks);
+        MdListPrintEntry(streams,
+                         blocks,
+                         totalInput,
+                         totalOutput,
+                         checks,
+                         maxDictionary,
+                         (failed == 0) ? "ok" : "errors",
+                         "(totals)");
+    }
+    free(threads);
+    free(list.Entries);
+    return failed == 0;
+}
+#else
+bool
+MdListFiles (
+    char* Files[],
+    uint32_t FileCount
+    )
+{
+    (void)(Files);
+    (void)(FileCount);
+    printf("Listing archives is not supported on this platform\n");
+    return false;
+}
+#endif
@@ -0,0 +1,219 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzip.c
+
+Abstract:
+
+    This module implements decoding of lzip (.lz) files. Files written by
+    plzip are made of many members, each of which is an independent LZMA
+    stream, so the members are handed out to a pool of threads, which decode
+    them straight into their own slice of the output buffer. Files made of a
+    single member (or when the output must be hashed in order) are decoded by
+    the calling thread.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+bool
+MdIsLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize
+    )
+{
+    //
+    // lzip members start with "LZIP", which can never start an XZ stream
+    //
+    return (InputSize >= 4) && (memcmp(InputBuffer, "LZIP", 4) == 0);
+}
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+
+//
+// The members being decoded, and the next one to hand out
+//
+typedef struct _MD_LZIP_DECODE
+{
+    pthread_mutex_t Lock;
+    const uint8_t* InputBuffer;
+    uint32_t InputSize;
+    uint8_t* OutputBuffer;
+    PXZ_LZIP_MEMBER Members;
+    uint32_t MemberCount;
+    uint32_t NextMember;
+    bool Failed;
+    bool ChecksumError;
+} MD_LZIP_DECODE, *PMD_LZIP_DECODE;
+
+void*
+MdLzipWorkerThread (
+    void* Context
+    )
+{
+    PMD_LZIP_DECODE decode;
+    uint32_t member;
+    bool result, checksumError;
+
+    //
+    // Check the members like the main thread would, then claim them one at a
+    // time until they are all taken, or one of them failed, since the output
+    // is useless by then
+    //
+    decode = (PMD_LZIP_DECODE)Context;
+    XzSetCpuLevel(MdCpuLevel);
+    XzSetIntegrityLevel(MdIntegrityLevel);
+    XzSetDecodeEngine(MdDecodeEngine);
+    for (;;)
+    {
+        pthread_mutex_lock(&decode->Lock);
+        member = decode->NextMember;
+        if ((member == decode->MemberCount) || decode->Failed)
+        {
+            pthread_mutex_unlock(&decode->Lock);
+            break;
+        }
+        decode->NextMember++;
+        pthread_mutex_unlock(&decode->Lock);
+
+        result = XzDecodeLzipMember(decode->InputBuffer,
+                                    decode->InputSize,
+                                    &decode->Members[member],
+                                    decode->OutputBuffer);
+        checksumError = XzChecksumError();
+
+        pthread_mutex_lock(&decode->Lock);
+        decode->Failed |= !result;
+        decode->ChecksumError |= checksumError;
+        pthread_mutex_unlock(&decode->Lock);
+    }
+    return NULL;
+}
+
+bool
+MdDecodeLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize,
+    uint32_t ThreadCount,
+    bool* ChecksumError
+    )
+{
+    MD_LZIP_DECODE decode;
+    pthread_t* threads;
+    uint32_t i, started;
+    long cpuCount;
+    bool result;
+
+    //
+    // Use one thread per CPU by default, but never more than there are members
+    //
+    decode.MemberCount = 0;
+    if (!XzGetLzipMembers(InputBuffer, InputSize, NULL, &decode.MemberCount))
+    {
+        return false;
+    }
+    if (ThreadCount == 0)
+    {
+        cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        ThreadCount = (cpuCount > 0) ? (uint32_t)cpuCount : 1;
+    }
+    if (ThreadCount > decode.MemberCount)
+    {
+        ThreadCount = decode.MemberCount;
+    }
+
+    //
+    // A single thread might as well decode the file on the calling thread
+    //
+    if (ThreadCount <= 1)
+    {
+        result = XzDecodeLzip(InputBuffer, InputSize, OutputBuffer, OutputSize);
+        *ChecksumError = XzChecksumError();
+        return result;
+    }
+
+    decode.Members = calloc(decode.MemberCount, sizeof(*decode.Members));
+    threads = calloc(ThreadCount, sizeof(*threads));
+    if ((decode.Members == NULL) || (threads == NULL) ||
+        !XzGetLzipMembers(InputBuffer, InputSize, decode.Members, &decode.MemberCount) ||
+        (*OutputSize < (decode.Members[decode.MemberCount - 1].OutputOffset +
+                        decode.Members[decode.MemberCount - 1].OutputSize)))
+    {
+        free(threads);
+        free(decode.Members);
+        return false;
+    }
+
+    //
+    // Run the workers, and if none could be started, decode on this thread
+    //
+    pthread_mutex_init(&decode.Lock, NULL);
+    decode.InputBuffer = InputBuffer;
+    decode.InputSize = InputSize;
+    decode.OutputBuffer = OutputBuffer;
+    decode.NextMember = 0;
+    decode.Failed = false;
+    decode.ChecksumError = false;
+    for (started = 0; started < ThreadCount; started++)
+    {
+        if (pthread_create(&threads[started], NULL, MdLzipWorkerThread, &decode) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0)
+    {
+        MdLzipWorkerThread(&decode);
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&decode.Lock);
+
+    *OutputSize = decode.Failed ? 0 :
+                  (decode.Members[decode.MemberCount - 1].OutputOffset +
+                   decode.Members[decode.MemberCount - 1].OutputSize);
+    *ChecksumError = decode.ChecksumError;
+    free(threads);
+    free(decode.Members);
+    return !decode.Failed;
+}
+#else
+bool
+MdDecodeLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize,
+    uint32_t ThreadCount,
+    bool* ChecksumError
+    )
+{
+    bool result;
+
+    //
+    // Members are decoded one after the other on this platform
+    //
+    (void)(ThreadCount);
+    result = XzDecodeLzip(InputBuffer, InputSize, OutputBuffer, OutputSize);
+    *ChecksumError = XzChecksumError();
+    return result;
+}
+#endif
@@ -0,0 +1,118 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    metrics.c
+
+Abstract:
+
+    This module implements the clock that minlzdec (and minlzd) install to time
+    the decodes counted in the minlzlib metrics, and the formatting of those
+    metrics in the Prometheus text exposition format, so that they can be
+    scraped from a file written by minlzdec or requested from minlzd.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <time.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+uint64_t
+MdGetTime (
+    void
+    )
+{
+    struct timespec now;
+
+#ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+}
+
+void
+MdWriteCounter (
+    FILE* File,
+    const char* Name,
+    const char* Help,
+    uint64_t Value
+    )
+{
+    fprintf(File, "# HELP %s %s\n", Name, Help);
+    fprintf(File, "# TYPE %s counter\n", Name);
+    fprintf(File, "%s %llu\n", Name, (unsigned long long)Value);
+}
+
+bool
+MdWriteMetrics (
+    FILE* File,
+    const XZ_METRICS* Metrics
+    )
+{
+    uint64_t count, total;
+    uint32_t i;
+
+    MdWriteCounter(File,
+                   "minlz_decodes_total",
+                   "Streams decoded.",
+                   Metrics->DecodesStarted);
+    MdWriteCounter(File,
+                   "minlz_decode_failures_total",
+                   "Streams that failed to decode.",
+                   Metrics->DecodesFailed);
+    MdWriteCounter(File,
+                   "minlz_checksum_errors_total",
+                   "Streams decoded with a checksum error.",
+                   Metrics->ChecksumErrors);
+    MdWriteCounter(File,
+                   "minlz_compressed_bytes_total",
+                   "Bytes of input decoded.",
+                   Metrics->CompressedBytes);
+    MdWriteCounter(File,
+                   "minlz_decompressed_bytes_total",
+                   "Bytes of output produced.",
+                   Metrics->DecompressedBytes);
+
+    //
+    // Split the decoding time between its phases
+    //
+    fprintf(File, "# HELP minlz_phase_seconds_total Time spent decoding, by phase.\n");
+    fprintf(File, "# TYPE minlz_phase_seconds_total counter\n");
+    fprintf(File, "minlz_phase_seconds_total{phase=\"lzma\"} %.9f\n",
+            (double)Metrics->LzmaTime / 1e9);
+    fprintf(File, "minlz_phase_seconds_total{phase=\"crc\"} %.9f\n",
+            (double)Metrics->CrcTime / 1e9);
+    fprintf(File, "minlz_phase_seconds_total{phase=\"container\"} %.9f\n",
+            (double)Metrics->ContainerTime / 1e9);
+
+    //
+    // The library's buckets are exclusive, while Prometheus expects each one
+    // to also count the decodes of all of the faster buckets
+    //
+    fprintf(File, "# HELP minlz_decode_duration_seconds Time taken by each decode.\n");
+    fprintf(File, "# TYPE minlz_decode_duration_seconds histogram\n");
+    for (i = 0, count = 0; i < (XZ_METRICS_LATENCY_BUCKETS - 1); i++)
+    {
+        count += Metrics->LatencyBuckets[i];
+        fprintf(File, "minlz_decode_duration_seconds_bucket{le=\"%.9f\"} %llu\n",
+                (double)(UINT64_C(1024) << i) / 1e9,
+                (unsigned long long)count);
+    }
+    count += Metrics->LatencyBuckets[i];
+    total = Metrics->LzmaTime + Metrics->CrcTime + Metrics->ContainerTime;
+    fprintf(File, "minlz_decode_duration_seconds_bucket{le=\"+Inf\"} %llu\n",
+            (unsigned long long)count);
+    fprintf(File, "minlz_decode_duration_seconds_sum %.9f\n", (double)total / 1e9);
+    fprintf(File, "minlz_decode_duration_seconds_count %llu\n", (unsigned long long)count);
+    return !ferror(File);
+}
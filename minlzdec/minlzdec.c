@@ -6,8 +6,290 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <minlzma.h>
+#include "minlzdec.h"
+
+const char* k_CpuLevelNames[] =
+{
+    "generic", "sse4.2", "avx2", "avx512"
+};
+XZ_CPU_LEVEL MdCpuLevel = XzCpuLevelBest;
+
+bool
+MdSetCpuLevel (
+    void
+    )
+{
+    const char* levelName;
+    uint32_t level;
+
+    //
+    // Allow forcing a specific CPU feature level (e.g.: for benchmarking)
+    //
+    levelName = getenv("MINLZ_CPU_LEVEL");
+    if (levelName == NULL)
+    {
+        return true;
+    }
+    for (level = 0; level < XzCpuLevelBest; level++)
+    {
+        if (strcmp(levelName, k_CpuLevelNames[level]) == 0)
+        {
+            break;
+        }
+    }
+    if ((level == XzCpuLevelBest) || !XzSetCpuLevel((XZ_CPU_LEVEL)level))
+    {
+        printf("Unsupported CPU level: %s\n", levelName);
+        return false;
+    }
+    MdCpuLevel = (XZ_CPU_LEVEL)level;
+    printf("Using CPU level: %s\n", k_CpuLevelNames[XzGetCpuLevel()]);
+    return true;
+}
+
+const char* k_IntegrityLevelNames[] =
+{
+    "none", "meta", "full"
+};
+XZ_INTEGRITY_LEVEL MdIntegrityLevel = XzIntegrityLevelBest;
+
+bool
+MdSetIntegrityLevel (
+    void
+    )
+{
+    const char* levelName;
+    uint32_t level;
+
+    //
+    // Allow skipping the checks for trusted input, in builds that have them
+    //
+    levelName = getenv("MINLZ_INTEGRITY");
+    if (levelName == NULL)
+    {
+        return true;
+    }
+    for (level = 0; level < XzIntegrityLevelBest; level++)
+    {
+        if (strcmp(levelName, k_IntegrityLevelNames[level]) == 0)
+        {
+            break;
+        }
+    }
+    if ((level == XzIntegrityLevelBest) ||
+        !XzSetIntegrityLevel((XZ_INTEGRITY_LEVEL)level))
+    {
+        printf("Unsupported integrity level: %s\n", levelName);
+        return false;
+    }
+    MdIntegrityLevel = (XZ_INTEGRITY_LEVEL)level;
+    printf("Using integrity level: %s\n", k_IntegrityLevelNames[level]);
+    return true;
+}
+
+const char* k_DecodeEngineNames[] =
+{
+    "calltree", "statemachine", "assembly"
+};
+XZ_DECODE_ENGINE MdDecodeEngine = XzDecodeEngineCallTree;
+
+bool
+MdSetDecodeEngine (
+    void
+    )
+{
+    const char* engineName;
+    uint32_t engine;
+
+    //
+    // Allow picking the LZMA decode engine (e.g.: for benchmarking)
+    //
+    engineName = getenv("MINLZ_ENGINE");
+    if (engineName == NULL)
+    {
+        return true;
+    }
+    for (engine = 0; engine < XzDecodeEngineMax; engine++)
+    {
+        if (strcmp(engineName, k_DecodeEngineNames[engine]) == 0)
+        {
+            break;
+        }
+    }
+    if ((engine == XzDecodeEngineMax) ||
+        !XzSetDecodeEngine((XZ_DECODE_ENGINE)engine))
+    {
+        printf("Unsupported decode engine: %s\n", engineName);
+        return false;
+    }
+    MdDecodeEngine = (XZ_DECODE_ENGINE)engine;
+    printf("Using decode engine: %s\n", k_DecodeEngineNames[engine]);
+    return true;
+}
+
+const char* k_DigestNames[] =
+{
+    NULL, "xxh3", "sha256"
+};
+
+bool
+MdSetDigest (
+    XZ_DIGEST_TYPE* DigestType
+    )
+{
+    const char* digestName;
+    uint32_t type;
+
+    //
+    // Allow computing a digest of the output while it is being decoded
+    //
+    *DigestType = XzDigestNone;
+    digestName = getenv("MINLZ_DIGEST");
+    if (digestName == NULL)
+    {
+        return true;
+    }
+    for (type = XzDigestXxh3; type < XzDigestCallback; type++)
+    {
+        if (strcmp(digestName, k_DigestNames[type]) == 0)
+        {
+            *DigestType = (XZ_DIGEST_TYPE)type;
+            XzSetDigest(*DigestType, NULL, NULL);
+            return true;
+        }
+    }
+    printf("Unsupported digest: %s\n", digestName);
+    return false;
+}
+
+void
+MdPrintDigest (
+    XZ_DIGEST_TYPE DigestType
+    )
+{
+    uint8_t digest[32];
+    uint32_t i, digestSize;
+
+    digestSize = XzGetDigest(digest, sizeof(digest));
+    if (digestSize == 0)
+    {
+        return;
+    }
+    printf("%s: ", k_DigestNames[DigestType]);
+    for (i = 0; i < digestSize; i++)
+    {
+        printf("%02x", digest[i]);
+    }
+    printf("\n");
+}
+
+void
+MdSetCache (
+    void
+    )
+{
+    const char* cacheSize;
+
+    //
+    // Share decoded blocks with other minlzdec processes, if requested
+    //
+    cacheSize = getenv("MINLZ_CACHE_SIZE");
+    if ((cacheSize != NULL) &&
+        !MdCacheInitialize((uint64_t)strtoull(cacheSize, NULL, 0) * 1024 * 1024))
+    {
+        printf("Failed to open the shared cache, continuing without it\n");
+    }
+}
+
+const char* MdMetricsPath;
+
+void
+MdReportMetrics (
+    void
+    )
+{
+    XZ_METRICS metrics;
+    FILE* file;
+
+    //
+    // Write the metrics of every decode done by this run on the way out
+    //
+    XzGetMetrics(&metrics);
+    file = (strcmp(MdMetricsPath, "-") == 0) ? stderr : fopen(MdMetricsPath, "w");
+    if ((file == NULL) || !MdWriteMetrics(file, &metrics))
+    {
+        fprintf(stderr, "Failed to write the metrics to %s\n", MdMetricsPath);
+    }
+    if ((file != NULL) && (file != stderr))
+    {
+        fclose(file);
+    }
+}
+
+void
+MdSetMetrics (
+    void
+    )
+{
+    //
+    // Time the decodes and report the metrics when exiting, if requested
+    //
+    MdMetricsPath = getenv("MINLZ_METRICS");
+    if (MdMetricsPath != NULL)
+    {
+        XzSetMetricsClock(MdGetTime);
+        atexit(MdReportMetrics);
+    }
+}
+
+bool
+MdContinueAfterChecksumError (
+    void
+    )
+{
+    char continueResult;
+
+    printf("WARNING: Checksum error was encountered, continue decompression? [Y/N]\n");
+    fgets(&continueResult, 1, stdin);
+    return (continueResult == L'Y');
+}
+
+bool
+MdGetOutputSize (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint32_t* OutputSize
+    )
+{
+    XZ_STREAM_INFO info;
+
+    //
+    // The index of an XZ file has the size of its output, so read it instead
+    // of decoding the file a first time to walk all of its LZMA2 chunks, which
+    // is most of the time it takes to get the output of a small message. lzip
+    // files (and XZ files that XzDecode would reject anyway) take that path.
+    //
+    if (!MdIsLzip(InputBuffer, InputSize) &&
+        XzGetStreamInfo(InputBuffer, InputSize, &info) &&
+        info.Supported &&
+        (info.UncompressedSize <= UINT32_MAX))
+    {
+        *OutputSize = (uint32_t)info.UncompressedSize;
+        return true;
+    }
+    *OutputSize = 0;
+    return MdIsLzip(InputBuffer, InputSize) ?
+           XzDecodeLzip(InputBuffer, InputSize, NULL, OutputSize) :
+           XzDecode(InputBuffer, InputSize, NULL, OutputSize);
+}
 
 int32_t
 main (
@@ -19,24 +301,129 @@ main (
     FILE* outputFile;
     size_t fileSize;
     size_t sizeRead;
-    uint32_t inputSize, outputSize;
+    uint32_t inputSize, outputSize, outputBufferSize;
+    uint32_t zeroRunCount, bytesSkipped;
+    PXZ_ZERO_RUN zeroRuns;
     uint8_t* inputBuffer;
     uint8_t* outputBuffer;
-    char continueResult;
     struct stat stat;
-    bool decodeResult;
+    bool decodeResult, checksumError, isLzip;
+    XZ_DIGEST_TYPE digestType;
+    MD_CACHE_KEY cacheKey;
+    bool cacheable;
+    const char* indexPath;
+    int32_t firstArgument;
 
     inputFile = NULL;
     outputFile = NULL;
     inputBuffer = NULL;
     outputBuffer = NULL;
+    outputBufferSize = 0;
+    zeroRuns = NULL;
+
+    //
+    // When writing the output to standard output, keep a private handle to it
+    // and send all of our messages to standard error instead.
+    //
+    if ((ArgumentCount == 3) && (strcmp(Arguments[2], "-") == 0))
+    {
+        outputFile = fdopen(dup(fileno(stdout)), "wb");
+        dup2(fileno(stderr), fileno(stdout));
+        if (outputFile == 0)
+        {
+            printf("Failed to open standard output\n");
+            return errno;
+        }
+    }
 
     printf("minlzdec v.1.1.5 -- http://ionescu007.github.io/minlzma\n");
     printf("Copyright(c) 2020-2021 Alex Ionescu (@aionescu)\n\n");
+    if (!MdSetCpuLevel() ||
+        !MdSetIntegrityLevel() ||
+        !MdSetDecodeEngine() ||
+        !MdSetDigest(&digestType))
+    {
+        errno = EINVAL;
+        goto Cleanup;
+    }
+    MdSetCache();
+    MdSetMetrics();
+
+    if ((ArgumentCount >= 4) && (strcmp(Arguments[1], "-j") == 0))
+    {
+        errno = MdDecodeParallel(&Arguments[3],
+                                 (uint32_t)(ArgumentCount - 3),
+                                 (uint32_t)strtoul(Arguments[2], NULL, 0)) ?
+                0 : EIO;
+        return errno;
+    }
+
+    if ((ArgumentCount >= 3) && (strcmp(Arguments[1], "--list") == 0))
+    {
+        errno = MdListFiles(&Arguments[2], (uint32_t)(ArgumentCount - 2)) ?
+                0 : EIO;
+        return errno;
+    }
+
+    if ((ArgumentCount == 4) && (strcmp(Arguments[1], "-b") == 0))
+    {
+        errno = MdBenchmark(Arguments[3],
+                            (uint32_t)strtoul(Arguments[2], NULL, 0)) ?
+                0 : EIO;
+        return errno;
+    }
+
+    if ((ArgumentCount >= 4) && (strcmp(Arguments[1], "-t") == 0))
+    {
+        errno = MdBenchLatency(&Arguments[3],
+                               (uint32_t)(ArgumentCount - 3),
+                               (uint32_t)strtoul(Arguments[2], NULL, 0)) ?
+                0 : EIO;
+        return errno;
+    }
+
+    if ((ArgumentCount >= 3) && (strcmp(Arguments[1], "-x") == 0))
+    {
+        //
+        // Extract members of a tar archive, with an optional index (-i) of
+        // where they are in the decompressed archive
+        //
+        firstArgument = 2;
+        indexPath = NULL;
+        if ((ArgumentCount >= 5) && (strcmp(Arguments[2], "-i") == 0))
+        {
+            indexPath = Arguments[3];
+            firstArgument = 4;
+        }
+        errno = MdExtractTar(Arguments[firstArgument],
+                             indexPath,
+                             &Arguments[firstArgument + 1],
+                             (uint32_t)(ArgumentCount - firstArgument - 1)) ?
+                0 : EIO;
+        return errno;
+    }
+
     if (ArgumentCount != 3)
     {
         printf("Usage: minlzdec [INPUT FILE] [OUTPUT FILE]\n");
-        printf("Decompress INPUT FILE in the .xz format into OUTPUT FILE.\n");
+        printf("       minlzdec -j [THREADS] [INPUT FILE]...\n");
+        printf("       minlzdec -x [-i INDEX] [ARCHIVE] [MEMBER]...\n");
+        printf("       minlzdec --list [INPUT FILE]...\n");
+        printf("       minlzdec -b [ITERATIONS] [INPUT FILE]\n");
+        printf("       minlzdec -t [ITERATIONS] [INPUT FILE]...\n");
+        printf("Decompress INPUT FILE in the .xz or .lz format into OUTPUT FILE.\n");
+        printf("Use - as OUTPUT FILE to write to standard output.\n");
+        printf("With -j, decompress each INPUT FILE next to itself (without\n");
+        printf("its .xz or .lz extension), using THREADS worker threads.\n");
+        printf("With -x, extract each MEMBER (or all files) of the compressed\n");
+        printf("tar ARCHIVE, decoding no further than needed. With -i, use\n");
+        printf("INDEX to find the members, creating it on the first run.\n");
+        printf("With --list, show the sizes, checks and dictionary size of\n");
+        printf("each .xz INPUT FILE, reading only its headers and index.\n");
+        printf("With -b, decode INPUT FILE in memory ITERATIONS times with\n");
+        printf("each decode engine, then as trusted input, and compare them.\n");
+        printf("With -t, time how long it takes to get the output of each\n");
+        printf("INPUT FILE in memory, on average over ITERATIONS decodes.\n");
         errno = EINVAL;
         goto Cleanup;
     }
@@ -68,35 +455,75 @@ main (
 
     inputSize = (uint32_t)fileSize;
     outputSize = 0;
-    decodeResult = XzDecode(inputBuffer, inputSize, outputBuffer, &outputSize);
+    isLzip = MdIsLzip(inputBuffer, inputSize);
+    cacheable = !isLzip &&
+                MdCacheGetKey(inputFile, inputBuffer, inputSize, &cacheKey);
+    if (cacheable)
+    {
+        outputBuffer = MdReadCachedBlock(&cacheKey, &outputSize);
+        if (outputBuffer != NULL)
+        {
+            outputBufferSize = outputSize;
+            printf("Found %d decompressed bytes in the shared cache\n", outputSize);
+            zeroRunCount = 0;
+            goto WriteOutput;
+        }
+    }
+
+    decodeResult = MdGetOutputSize(inputBuffer, inputSize, &outputSize);
     if (decodeResult == false)
     {
         printf("Decoding failed after %d bytes\n", outputSize);
         errno = ENOTSUP;
         goto Cleanup;
     }
-    else if (XzChecksumError())
+    else if (XzChecksumError() && !MdContinueAfterChecksumError())
     {
-        printf("WARNING: Checksum error was encountered, continue decompression? [Y/N]\n");
-        fgets(&continueResult, 1, stdin);
-        if (continueResult != L'Y')
-        {
-            errno = EIO;
-            goto Cleanup;
-        }
+        errno = EIO;
+        goto Cleanup;
     }
 
     printf("Decompressed file will be %d bytes (%f%% ratio)\n",
             outputSize, (double)inputSize / (double)outputSize);
 
-    outputBuffer = malloc(outputSize);
+    outputBufferSize = outputSize;
+    outputBuffer = MdAllocateOutput(outputBufferSize);
     if (outputBuffer == NULL)
     {
         printf("Out of memory for allocating output buffer\n");
         goto Cleanup;
     }
 
-    decodeResult = XzDecode(inputBuffer, inputSize, outputBuffer, &outputSize);
+    if (isLzip)
+    {
+        //
+        // Decode the members of lzip files in parallel, unless the digest of
+        // the output has to be computed in order. The zero runs are only seen
+        // by the threads decoding them, so they are not reported.
+        //
+        zeroRunCount = 0;
+        decodeResult = MdDecodeLzip(inputBuffer,
+                                    inputSize,
+                                    outputBuffer,
+                                    &outputSize,
+                                    (digestType != XzDigestNone) ? 1 : 0,
+                                    &checksumError);
+    }
+    else
+    {
+        //
+        // Have the decoder report runs of zeroes, so they can be skipped over
+        // in the output file. Zero runs are at least a few dozen bytes long.
+        //
+        zeroRunCount = (outputSize / 1024) + 16;
+        zeroRuns = malloc(zeroRunCount * sizeof(*zeroRuns));
+        XzSetZeroRunBuffer(zeroRuns, (zeroRuns != NULL) ? zeroRunCount : 0);
+
+        decodeResult = XzDecode(inputBuffer, inputSize, outputBuffer, &outputSize);
+        zeroRunCount = (zeroRuns != NULL) ? XzGetZeroRunCount() : 0;
+        XzSetZeroRunBuffer(NULL, 0);
+        checksumError = XzChecksumError();
+    }
     if (decodeResult == false)
     {
         printf("Decoding failed after %d bytes\n", outputSize);
@@ -104,27 +531,57 @@ main (
         goto Cleanup;
     }
 
+    //
+    // The CRC32 of lzip members is only checked once they have been decoded
+    //
+    if (isLzip && checksumError && !MdContinueAfterChecksumError())
+    {
+        errno = EIO;
+        goto Cleanup;
+    }
+
     printf("Decompressed %d bytes\n", outputSize);
+    MdPrintDigest(digestType);
+    if (cacheable && !checksumError)
+    {
+        MdCacheInsert(&cacheKey, outputBuffer, outputSize);
+    }
 
-    outputFile = fopen(Arguments[2], "wb");
+WriteOutput:
+    if (outputFile == 0)
+    {
+        outputFile = fopen(Arguments[2], "wb");
+    }
     if (outputFile == 0)
     {
         printf("Failed to open output file: %s\n", Arguments[1]);
         goto Cleanup;
     }
 
-    fileSize = fwrite(outputBuffer, 1, outputSize, outputFile);
-    if (fileSize != outputSize)
+    if (!MdWriteOutput(outputFile,
+                       outputBuffer,
+                       outputSize,
+                       zeroRuns,
+                       zeroRunCount,
+                       &bytesSkipped))
     {
-        printf("File write failed (%zd vs %d bytes)\n", fileSize, outputSize);
+        printf("File write failed (%d bytes)\n", outputSize);
         goto Cleanup;
     }
+    if (bytesSkipped != 0)
+    {
+        printf("Skipped %d bytes of zeroes in the output file\n", bytesSkipped);
+    }
     errno = 0;
 
 Cleanup:
+    if (zeroRuns != NULL)
+    {
+        free(zeroRuns);
+    }
     if (outputBuffer != NULL)
     {
-        free(outputBuffer);
+        MdFreeOutput(outputBuffer, outputBufferSize);
     }
     if (inputBuffer != NULL)
     {
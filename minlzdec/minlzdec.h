@@ -0,0 +1,222 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    minlzdec.h
+
+Abstract:
+
+    This header file contains the definitions shared between the modules of the
+    minlzdec command-line tool, beyond the basic single-file decoding performed
+    by main().
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <minlzma.h>
+
+//
+// CPU level selected with MINLZ_CPU_LEVEL, which every decoding thread also
+// applies to itself (minlzdec.c)
+//
+extern XZ_CPU_LEVEL MdCpuLevel;
+
+//
+// Integrity level selected with MINLZ_INTEGRITY, which every decoding thread
+// applies to itself, since the level belongs to each thread (minlzdec.c)
+//
+extern XZ_INTEGRITY_LEVEL MdIntegrityLevel;
+
+//
+// Decode engine selected with MINLZ_ENGINE, which every decoding thread also
+// applies to itself (minlzdec.c)
+//
+extern XZ_DECODE_ENGINE MdDecodeEngine;
+
+//
+// Output size of an XZ or lzip file, from its index when it has one (minlzdec.c)
+//
+bool
+MdGetOutputSize (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint32_t* OutputSize
+    );
+
+//
+// Multi-archive decoding (parallel.c)
+//
+bool
+MdDecodeParallel (
+    char* Files[],
+    uint32_t FileCount,
+    uint32_t ThreadCount
+    );
+
+//
+// lzip file decoding (lzip.c)
+//
+bool
+MdIsLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize
+    );
+
+bool
+MdDecodeLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize,
+    uint32_t ThreadCount,
+    bool* ChecksumError
+    );
+
+//
+// Tar member extraction (tar.c)
+//
+bool
+MdExtractTar (
+    const char* ArchivePath,
+    const char* IndexPath,
+    char* Members[],
+    uint32_t MemberCount
+    );
+
+//
+// Archive listing (list.c)
+//
+bool
+MdListFiles (
+    char* Files[],
+    uint32_t FileCount
+    );
+
+//
+// Decode loop and time-to-result benchmarks (bench.c)
+//
+bool
+MdBenchmark (
+    const char* InputPath,
+    uint32_t Iterations
+    );
+
+bool
+MdBenchLatency (
+    char* Files[],
+    uint32_t FileCount,
+    uint32_t Iterations
+    );
+
+//
+// Output file writing (output.c)
+//
+uint8_t*
+MdAllocateOutput (
+    uint32_t Size
+    );
+
+void
+MdFreeOutput (
+    uint8_t* Buffer,
+    uint32_t Size
+    );
+
+uint8_t*
+MdReallocateOutput (
+    uint8_t* Buffer,
+    uint32_t OldSize,
+    uint32_t NewSize
+    );
+
+extern const XZ_ALLOCATOR MdOutputAllocator;
+
+bool
+MdWriteOutput (
+    FILE* File,
+    const uint8_t* Buffer,
+    uint32_t Size,
+    const XZ_ZERO_RUN* ZeroRuns,
+    uint32_t ZeroRunCount,
+    uint32_t* BytesSkipped
+    );
+
+//
+// Shared cache of decoded blocks (cache.c)
+//
+typedef struct _MD_CACHE_KEY
+{
+    uint64_t Device;
+    uint64_t Inode;
+    uint64_t FileSize;
+    uint64_t ModifyTime;
+    uint32_t BlockIndex;
+    uint32_t CheckSize;
+    uint8_t Check[64];
+} MD_CACHE_KEY, *PMD_CACHE_KEY;
+
+bool
+MdCacheInitialize (
+    uint64_t Size
+    );
+
+bool
+MdCacheGetKey (
+    FILE* File,
+    const uint8_t* Input,
+    uint32_t InputSize,
+    PMD_CACHE_KEY Key
+    );
+
+bool
+MdCacheRead (
+    const MD_CACHE_KEY* Key,
+    uint8_t* Buffer,
+    uint32_t* Size
+    );
+
+void
+MdCacheInsert (
+    const MD_CACHE_KEY* Key,
+    const uint8_t* Buffer,
+    uint32_t Size
+    );
+
+uint8_t*
+MdReadCachedBlock (
+    const MD_CACHE_KEY* Key,
+    uint32_t* Size
+    );
+
+//
+// Decoder metrics (metrics.c)
+//
+uint64_t
+MdGetTime (
+    void
+    );
+
+void
+MdWriteCounter (
+    FILE* File,
+    const char* Name,
+    const char* Help,
+    uint64_t Value
+    );
+
+bool
+MdWriteMetrics (
+    FILE* File,
+    const XZ_METRICS* Metrics
+    );
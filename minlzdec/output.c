@@ -0,0 +1,336 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    output.c
+
+Abstract:
+
+    This module implements writing the decompressed buffer to the output file.
+    On Linux, when the output is a pipe, the whole pages of the output buffer
+    are handed to the pipe with vmsplice instead of being copied through stdio
+    buffers, and when the output is a socket, they are vmspliced into a private
+    pipe and then spliced into the socket. Other outputs (and the final partial
+    page) use fwrite. When writing to a regular file, the page-aligned parts of
+    the zero runs reported by the decoder are seeked over, which produces a
+    sparse file.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+#include <sys/stat.h>
+
+//
+// Only whole pages of the output buffer are handed off or skipped
+//
+#define MD_PAGE_SIZE    4096
+
+#ifdef _WIN32
+#define MdSeek _fseeki64
+#ifndef S_ISREG
+#define S_ISREG(m) (((m) & _S_IFMT) == _S_IFREG)
+#endif
+#else
+#define MdSeek fseeko
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+//
+// Pipes are grown to this size so each vmsplice call can move more pages
+//
+#define MD_PIPE_SIZE    (1024 * 1024)
+
+void
+MdVmspliceToPipe (
+    int PipeFds[2],
+    int SocketFd,
+    const uint8_t* Buffer,
+    uint32_t Size,
+    uint32_t* Written
+    )
+{
+    struct iovec iov;
+    ssize_t moved, sent;
+
+    //
+    // Hand the pages to the pipe by reference. The buffer must then not be
+    // modified until the reader has consumed them, which holds since we only
+    // unmap it right before exiting. If a socket was given, drain what we put
+    // in the pipe straight into it before pushing more pages. Only count what
+    // actually reached the output, so the caller can write the rest normally.
+    //
+    while (*Written < Size)
+    {
+        iov.iov_base = (void*)(Buffer + *Written);
+        iov.iov_len = Size - *Written;
+        moved = vmsplice(PipeFds[1], &iov, 1, 0);
+        if ((moved < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (moved <= 0)
+        {
+            return;
+        }
+        if (SocketFd == -1)
+        {
+            *Written += (uint32_t)moved;
+            continue;
+        }
+        while (moved != 0)
+        {
+            sent = splice(PipeFds[0], NULL, SocketFd, NULL, (size_t)moved, SPLICE_F_MOVE);
+            if ((sent < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (sent <= 0)
+            {
+                return;
+            }
+            moved -= sent;
+            *Written += (uint32_t)sent;
+        }
+    }
+}
+
+uint32_t
+MdSpliceOutput (
+    int Fd,
+    const uint8_t* Buffer,
+    uint32_t Size
+    )
+{
+    struct stat fileStat;
+    int pipeFds[2];
+    uint32_t written;
+
+    //
+    // Only pipes and sockets benefit from this path
+    //
+    written = 0;
+    if (fstat(Fd, &fileStat) != 0)
+    {
+        return 0;
+    }
+    if (S_ISFIFO(fileStat.st_mode))
+    {
+        fcntl(Fd, F_SETPIPE_SZ, MD_PIPE_SIZE);
+        pipeFds[0] = -1;
+        pipeFds[1] = Fd;
+        MdVmspliceToPipe(pipeFds, -1, Buffer, Size, &written);
+    }
+    else if (S_ISSOCK(fileStat.st_mode) && (pipe(pipeFds) == 0))
+    {
+        //
+        // Sockets can't be vmspliced to, so use a pipe as the intermediate
+        //
+        fcntl(pipeFds[1], F_SETPIPE_SZ, MD_PIPE_SIZE);
+        MdVmspliceToPipe(pipeFds, Fd, Buffer, Size, &written);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+    return written;
+}
+#endif
+
+uint8_t*
+MdAllocateOutput (
+    uint32_t Size
+    )
+{
+#ifdef __linux__
+    void* buffer;
+
+    //
+    // Map the output directly, so that it is page-aligned for vmsplice, and so
+    // that releasing it unmaps the pages rather than letting the heap reuse
+    // them (and write its own metadata in them) while a pipe still holds them.
+    //
+    buffer = mmap(NULL, (size_t)Size + 1, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (buffer != MAP_FAILED) ? buffer : NULL;
+#else
+    return malloc((size_t)Size + 1);
+#endif
+}
+
+void
+MdFreeOutput (
+    uint8_t* Buffer,
+    uint32_t Size
+    )
+{
+#ifdef __linux__
+    munmap(Buffer, (size_t)Size + 1);
+#else
+    (void)(Size);
+    free(Buffer);
+#endif
+}
+
+uint8_t*
+MdReallocateOutput (
+    uint8_t* Buffer,
+    uint32_t OldSize,
+    uint32_t NewSize
+    )
+{
+#ifdef __linux__
+    void* buffer;
+
+    //
+    // Let the kernel move the pages of the buffer around if it cannot grow it
+    // in place, so that the output is never copied
+    //
+    buffer = mremap(Buffer, (size_t)OldSize + 1, (size_t)NewSize + 1, MREMAP_MAYMOVE);
+    return (buffer != MAP_FAILED) ? buffer : NULL;
+#else
+    (void)(OldSize);
+    return realloc(Buffer, (size_t)NewSize + 1);
+#endif
+}
+
+void*
+MdAllocateRoutine (
+    void* Context,
+    uint32_t Size
+    )
+{
+    (void)(Context);
+    return MdAllocateOutput(Size);
+}
+
+void*
+MdReallocateRoutine (
+    void* Context,
+    void* Buffer,
+    uint32_t OldSize,
+    uint32_t NewSize
+    )
+{
+    (void)(Context);
+    return MdReallocateOutput(Buffer, OldSize, NewSize);
+}
+
+void
+MdFreeRoutine (
+    void* Context,
+    void* Buffer,
+    uint32_t Size
+    )
+{
+    (void)(Context);
+    MdFreeOutput(Buffer, Size);
+}
+
+//
+// Allocator handed to XzDecodeAlloc, so that its output can be released with
+// MdFreeOutput like any other
+//
+const XZ_ALLOCATOR MdOutputAllocator =
+{
+    MdAllocateRoutine,
+    MdReallocateRoutine,
+    MdFreeRoutine,
+    NULL
+};
+
+bool
+MdWriteSparse (
+    FILE* File,
+    const uint8_t* Buffer,
+    uint32_t Size,
+    const XZ_ZERO_RUN* ZeroRuns,
+    uint32_t ZeroRunCount,
+    uint32_t* BytesSkipped
+    )
+{
+    uint32_t i, offset, holeStart, holeEnd;
+
+    //
+    // Write the data up to each page-aligned portion of a zero run, and seek
+    // over that portion instead of writing it, which leaves a hole in the file
+    //
+    for (i = 0, offset = 0; i < ZeroRunCount; i++)
+    {
+        holeStart = (ZeroRuns[i].Offset + MD_PAGE_SIZE - 1) & ~(MD_PAGE_SIZE - 1);
+        holeEnd = (ZeroRuns[i].Offset + ZeroRuns[i].Length) & ~(MD_PAGE_SIZE - 1);
+        if ((holeEnd <= holeStart) || (holeStart < offset) || (holeEnd > Size))
+        {
+            continue;
+        }
+        if ((fwrite(&Buffer[offset], 1, holeStart - offset, File) !=
+             (holeStart - offset)) ||
+            (MdSeek(File, (int64_t)(holeEnd - holeStart), SEEK_CUR) != 0))
+        {
+            return false;
+        }
+        *BytesSkipped += holeEnd - holeStart;
+        offset = holeEnd;
+    }
+
+    //
+    // Write whatever is left. If the file ends with a hole, write its last byte
+    // so that the file gets extended to its full size.
+    //
+    if ((offset == Size) && (*BytesSkipped != 0))
+    {
+        return (MdSeek(File, -1, SEEK_CUR) == 0) && (fputc(0, File) == 0);
+    }
+    return fwrite(&Buffer[offset], 1, Size - offset, File) == (Size - offset);
+}
+
+bool
+MdWriteOutput (
+    FILE* File,
+    const uint8_t* Buffer,
+    uint32_t Size,
+    const XZ_ZERO_RUN* ZeroRuns,
+    uint32_t ZeroRunCount,
+    uint32_t* BytesSkipped
+    )
+{
+    uint32_t written;
+    struct stat fileStat;
+
+    //
+    // Regular files can be written sparsely, if the decoder found zero runs
+    //
+    *BytesSkipped = 0;
+    if ((ZeroRunCount != 0) &&
+        (fstat(fileno(File), &fileStat) == 0) &&
+        S_ISREG(fileStat.st_mode))
+    {
+        return MdWriteSparse(File, Buffer, Size, ZeroRuns, ZeroRunCount, BytesSkipped);
+    }
+
+    //
+    // Try the zero-copy path first, then write whatever it didn't (or could
+    // not) hand off the regular way.
+    //
+    written = 0;
+#ifdef __linux__
+    fflush(File);
+    written = MdSpliceOutput(fileno(File), Buffer, Size & ~(MD_PAGE_SIZE - 1));
+#endif
+    return fwrite(Buffer + written, 1, Size - written, File) == (Size - written);
+}
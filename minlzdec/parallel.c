@@ -0,0 +1,485 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    parallel.c
+
+Abstract:
+
+    This module implements decoding of many XZ archives at the same time, using
+    a pool of worker threads with a work-stealing scheduler. Each archive is a
+    single task (minlzlib only supports single-block streams, so an archive and
+    its block are the same unit of work). Tasks are sorted by size and dealt
+    round-robin into per-worker double-ended queues: a worker pops from the
+    front of its own queue, and once it runs dry, steals from the back of the
+    other workers' queues, so that a few large archives cannot leave the other
+    cores idle. Each worker decodes with its own copy of the minlzlib state.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minlzdec.h"
+#include <minlzma.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+//
+// A single archive to decode
+//
+typedef struct _MD_TASK
+{
+    const char* InputPath;
+    uint64_t InputSize;
+    uint32_t OutputSize;
+    bool Succeeded;
+} MD_TASK, *PMD_TASK;
+
+//
+// Per-worker double-ended queue of task indices. The owner pops from the head
+// while thieves take from the tail.
+//
+typedef struct _MD_DEQUE
+{
+    pthread_mutex_t Lock;
+    uint32_t Head;
+    uint32_t Tail;
+    uint32_t* Tasks;
+} MD_DEQUE, *PMD_DEQUE;
+
+//
+// Per-worker statistics
+//
+typedef struct _MD_WORKER
+{
+    pthread_t Thread;
+    uint32_t Index;
+    uint32_t Decoded;
+    uint32_t Stolen;
+    uint64_t Bytes;
+} MD_WORKER, *PMD_WORKER;
+
+//
+// Scheduler state shared by all the workers
+//
+typedef struct _MD_SCHEDULER
+{
+    PMD_TASK Tasks;
+    uint32_t TaskCount;
+    PMD_DEQUE Deques;
+    PMD_WORKER Workers;
+    uint32_t WorkerCount;
+} MD_SCHEDULER, *PMD_SCHEDULER;
+MD_SCHEDULER Scheduler;
+
+bool
+MdPopTask (
+    PMD_DEQUE Deque,
+    uint32_t* TaskIndex
+    )
+{
+    bool found;
+
+    //
+    // Take the next (largest remaining) task from the front of our own queue
+    //
+    pthread_mutex_lock(&Deque->Lock);
+    found = (Deque->Head != Deque->Tail);
+    if (found)
+    {
+        *TaskIndex = Deque->Tasks[Deque->Head++];
+    }
+    pthread_mutex_unlock(&Deque->Lock);
+    return found;
+}
+
+bool
+MdStealTask (
+    PMD_WORKER Worker,
+    uint32_t* TaskIndex
+    )
+{
+    PMD_DEQUE victim;
+    uint32_t i;
+    bool found;
+
+    //
+    // Walk the other workers, starting with our neighbour so that thieves do
+    // not all pile up on the same victim, and take from the back of the first
+    // non-empty queue. Since no tasks are ever added once decoding started, a
+    // full pass that finds nothing means that all the work has been claimed.
+    //
+    for (i = 1; i < Scheduler.WorkerCount; i++)
+    {
+        victim = &Scheduler.Deques[(Worker->Index + i) % Scheduler.WorkerCount];
+        pthread_mutex_lock(&victim->Lock);
+        found = (victim->Head != victim->Tail);
+        if (found)
+        {
+            *TaskIndex = victim->Tasks[--victim->Tail];
+        }
+        pthread_mutex_unlock(&victim->Lock);
+        if (found)
+        {
+            Worker->Stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+MdDecodeTask (
+    PMD_TASK Task
+    )
+{
+    FILE* file;
+    uint8_t* inputBuffer;
+    uint8_t* outputBuffer;
+    uint32_t outputBufferSize;
+    char* outputPath;
+    size_t pathLength;
+    MD_CACHE_KEY cacheKey;
+    bool result, decoded, cacheable, isLzip;
+
+    result = false;
+    file = NULL;
+    inputBuffer = NULL;
+    outputBuffer = NULL;
+    outputBufferSize = 0;
+    outputPath = NULL;
+
+    //
+    // minlzlib works on 32-bit sizes
+    //
+    if (Task->InputSize > UINT32_MAX)
+    {
+        printf("%s: input file too large\n", Task->InputPath);
+        goto Cleanup;
+    }
+
+    //
+    // Read the whole archive in memory
+    //
+    file = fopen(Task->InputPath, "rb");
+    inputBuffer = malloc((size_t)Task->InputSize + 1);
+    if ((file == NULL) || (inputBuffer == NULL) ||
+        (fread(inputBuffer, 1, Task->InputSize, file) != Task->InputSize))
+    {
+        printf("%s: failed to read input file\n", Task->InputPath);
+        goto Cleanup;
+    }
+    isLzip = MdIsLzip(inputBuffer, (uint32_t)Task->InputSize);
+    cacheable = !isLzip &&
+                MdCacheGetKey(file, inputBuffer, (uint32_t)Task->InputSize, &cacheKey);
+    fclose(file);
+    file = NULL;
+
+    //
+    // Use the copy in the shared cache if there is one. Otherwise, decode into
+    // a buffer that XzDecodeAlloc sizes (and grows) itself. lzip files need a
+    // size query first, and their members are decoded in order, since the other
+    // workers are busy with the other archives. The size of the buffer is kept
+    // apart from the size of the output, which a failed decode overwrites.
+    //
+    Task->OutputSize = 0;
+    if (cacheable)
+    {
+        outputBuffer = MdReadCachedBlock(&cacheKey, &Task->OutputSize);
+        outputBufferSize = Task->OutputSize;
+    }
+    if (outputBuffer == NULL)
+    {
+        if (!isLzip)
+        {
+            decoded = XzDecodeAlloc(inputBuffer,
+                                    (uint32_t)Task->InputSize,
+                                    &MdOutputAllocator,
+                                    &outputBuffer,
+                                    &Task->OutputSize);
+            outputBufferSize = Task->OutputSize;
+        }
+        else
+        {
+            decoded = XzDecodeLzip(inputBuffer, (uint32_t)Task->InputSize, NULL, &Task->OutputSize);
+            if (decoded)
+            {
+                outputBufferSize = Task->OutputSize;
+                outputBuffer = MdAllocateOutput(outputBufferSize);
+                decoded = (outputBuffer != NULL) &&
+                          XzDecodeLzip(inputBuffer,
+                                       (uint32_t)Task->InputSize,
+                                       outputBuffer,
+                                       &Task->OutputSize);
+            }
+        }
+        if (!decoded)
+        {
+            printf("%s: decoding failed\n", Task->InputPath);
+            goto Cleanup;
+        }
+        if (XzChecksumError())
+        {
+            printf("%s: checksum error\n", Task->InputPath);
+            goto Cleanup;
+        }
+        if (cacheable && (outputBuffer != NULL))
+        {
+            MdCacheInsert(&cacheKey, outputBuffer, Task->OutputSize);
+        }
+    }
+
+    //
+    // Write the output next to the input, dropping the .xz or .lz extension
+    // (or adding .out if there isn't one).
+    //
+    pathLength = strlen(Task->InputPath);
+    outputPath = malloc(pathLength + sizeof(".out"));
+    if (outputPath == NULL)
+    {
+        goto Cleanup;
+    }
+    strcpy(outputPath, Task->InputPath);
+    if ((pathLength > 3) &&
+        ((strcmp(&outputPath[pathLength - 3], ".xz") == 0) ||
+         (strcmp(&outputPath[pathLength - 3], ".lz") == 0)))
+    {
+        outputPath[pathLength - 3] = '\0';
+    }
+    else
+    {
+        strcat(outputPath, ".out");
+    }
+    file = fopen(outputPath, "wb");
+    if ((file == NULL) ||
+        (fwrite(outputBuffer, 1, Task->OutputSize, file) != Task->OutputSize))
+    {
+        printf("%s: failed to write output file\n", outputPath);
+        goto Cleanup;
+    }
+    result = true;
+
+Cleanup:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    free(outputPath);
+    if (outputBuffer != NULL)
+    {
+        MdFreeOutput(outputBuffer, outputBufferSize);
+    }
+    free(inputBuffer);
+    return result;
+}
+
+void*
+MdWorkerThread (
+    void* Context
+    )
+{
+    PMD_WORKER worker;
+    PMD_TASK task;
+    uint32_t taskIndex;
+
+    //
+    // Check the archives like the main thread would, then drain our own queue
+    // first, and help the others until nothing is left
+    //
+    worker = (PMD_WORKER)Context;
+    XzSetCpuLevel(MdCpuLevel);
+    XzSetIntegrityLevel(MdIntegrityLevel);
+    XzSetDecodeEngine(MdDecodeEngine);
+    while (MdPopTask(&Scheduler.Deques[worker->Index], &taskIndex) ||
+           MdStealTask(worker, &taskIndex))
+    {
+        task = &Scheduler.Tasks[taskIndex];
+        task->Succeeded = MdDecodeTask(task);
+        worker->Decoded++;
+        worker->Bytes += task->Succeeded ? task->OutputSize : 0;
+    }
+    return NULL;
+}
+
+int
+MdCompareTasks (
+    const void* Left,
+    const void* Right
+    )
+{
+    uint64_t leftSize, rightSize;
+
+    //
+    // Sort task indices by descending input size
+    //
+    leftSize = Scheduler.Tasks[*(const uint32_t*)Left].InputSize;
+    rightSize = Scheduler.Tasks[*(const uint32_t*)Right].InputSize;
+    return (leftSize < rightSize) - (leftSize > rightSize);
+}
+
+bool
+MdDecodeParallel (
+    char* Files[],
+    uint32_t FileCount,
+    uint32_t ThreadCount
+    )
+{
+    struct stat fileStat;
+    struct timespec start, end;
+    uint32_t* order;
+    uint32_t i, failed, started, deques;
+    uint64_t totalBytes;
+    double seconds;
+    PMD_DEQUE deque;
+
+    order = NULL;
+    failed = 0;
+    started = 0;
+    deques = 0;
+    totalBytes = 0;
+    if ((ThreadCount == 0) || (FileCount == 0))
+    {
+        return false;
+    }
+    if (ThreadCount > FileCount)
+    {
+        ThreadCount = FileCount;
+    }
+
+    //
+    // Build one task per archive
+    //
+    Scheduler.TaskCount = FileCount;
+    Scheduler.WorkerCount = ThreadCount;
+    Scheduler.Tasks = calloc(FileCount, sizeof(*Scheduler.Tasks));
+    Scheduler.Deques = calloc(ThreadCount, sizeof(*Scheduler.Deques));
+    Scheduler.Workers = calloc(ThreadCount, sizeof(*Scheduler.Workers));
+    order = calloc(FileCount, sizeof(*order));
+    if ((Scheduler.Tasks == NULL) || (Scheduler.Deques == NULL) ||
+        (Scheduler.Workers == NULL) || (order == NULL))
+    {
+        printf("Out of memory for allocating the scheduler\n");
+        goto Cleanup;
+    }
+    for (i = 0; i < FileCount; i++)
+    {
+        Scheduler.Tasks[i].InputPath = Files[i];
+        if (stat(Files[i], &fileStat) == 0)
+        {
+            Scheduler.Tasks[i].InputSize = (uint64_t)fileStat.st_size;
+        }
+        order[i] = i;
+    }
+
+    //
+    // Deal the tasks, largest first, round-robin into each worker's queue so
+    // every worker starts with a similar share of the large archives.
+    //
+    qsort(order, FileCount, sizeof(*order), MdCompareTasks);
+    for (deques = 0; deques < ThreadCount; deques++)
+    {
+        deque = &Scheduler.Deques[deques];
+        deque->Tasks = calloc((FileCount / ThreadCount) + 1, sizeof(uint32_t));
+        if (deque->Tasks == NULL)
+        {
+            printf("Out of memory for allocating the scheduler\n");
+            goto Cleanup;
+        }
+        pthread_mutex_init(&deque->Lock, NULL);
+    }
+    for (i = 0; i < FileCount; i++)
+    {
+        deque = &Scheduler.Deques[i % ThreadCount];
+        deque->Tasks[deque->Tail++] = order[i];
+    }
+
+    //
+    // Run the workers and wait for all of the tasks to be consumed
+    //
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (started = 0; started < ThreadCount; started++)
+    {
+        Scheduler.Workers[started].Index = started;
+        if (pthread_create(&Scheduler.Workers[started].Thread,
+                           NULL,
+                           MdWorkerThread,
+                           &Scheduler.Workers[started]) != 0)
+        {
+            printf("Failed to create worker thread %d\n", started);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(Scheduler.Workers[i].Thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    //
+    // If not all of the workers could be started, the ones that did will have
+    // stolen the orphaned tasks, so only report per-task failures.
+    //
+    for (i = 0; i < FileCount; i++)
+    {
+        failed += Scheduler.Tasks[i].Succeeded ? 0 : 1;
+    }
+    for (i = 0; i < started; i++)
+    {
+        printf("Worker %d: %d archives (%d stolen), %llu bytes\n",
+               i,
+               Scheduler.Workers[i].Decoded,
+               Scheduler.Workers[i].Stolen,
+               (unsigned long long)Scheduler.Workers[i].Bytes);
+        totalBytes += Scheduler.Workers[i].Bytes;
+    }
+    seconds = (double)(end.tv_sec - start.tv_sec) +
+              (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Decompressed %d of %d archives, %llu bytes in %f seconds (%f MB/s)\n",
+           FileCount - failed,
+           FileCount,
+           (unsigned long long)totalBytes,
+           seconds,
+           (seconds > 0) ? ((double)totalBytes / seconds / 1e6) : 0);
+
+Cleanup:
+    //
+    // Only the deques that were fully set up have a lock to destroy
+    //
+    for (i = 0; i < deques; i++)
+    {
+        pthread_mutex_destroy(&Scheduler.Deques[i].Lock);
+        free(Scheduler.Deques[i].Tasks);
+    }
+    free(order);
+    free(Scheduler.Workers);
+    free(Scheduler.Deques);
+    free(Scheduler.Tasks);
+    return (started != 0) && (failed == 0);
+}
+#else
+bool
+MdDecodeParallel (
+    char* Files[],
+    uint32_t FileCount,
+    uint32_t ThreadCount
+    )
+{
+    (void)(Files);
+    (void)(FileCount);
+    (void)(ThreadCount);
+    printf("Multi-archive decoding is not supported on this platform\n");
+    return false;
+}
+#endif
@@ -0,0 +1,854 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    tar.c
+
+Abstract:
+
+    This module implements extracting members of a .tar.xz (or .tar.lz) archive
+    without decompressing the rest of it. The ustar headers (along with pax and
+    GNU long names) are parsed as the output is decoded in steps, each member
+    that was asked for is written out as soon as its data has been decoded, and
+    decoding stops once the last of them is out. An optional index of the
+    member offsets can be written on the first pass, after which the members
+    are found without parsing any header: XZ archives are then only decoded up
+    to the end of the last member that was asked for, and lzip archives only
+    have the members (i.e.: blocks) that hold the member data decoded.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MdMakeDirectory(Path) _mkdir(Path)
+#else
+#define MdMakeDirectory(Path) mkdir(Path, 0755)
+#endif
+#include "minlzdec.h"
+#include <minlzma.h>
+
+//
+// Headers and member data are laid out in 512-byte blocks, and the output is
+// decoded at least a window at a time while looking for headers
+//
+#define MD_TAR_BLOCK_SIZE       512
+#define MD_TAR_NAME_SIZE        4096
+#define MD_TAR_WINDOW           (1024 * 1024)
+#define MD_TAR_INDEX_SIGNATURE  "minlzdec-tar-index 1"
+
+//
+// A ustar header, as written by POSIX tar, GNU tar and bsdtar
+//
+typedef struct _MD_TAR_HEADER
+{
+    char Name[100];
+    char Mode[8];
+    char Uid[8];
+    char Gid[8];
+    char Size[12];
+    char ModifyTime[12];
+    char Checksum[8];
+    char Type;
+    char LinkName[100];
+    char Magic[6];
+    char Version[2];
+    char UserName[32];
+    char GroupName[32];
+    char DeviceMajor[8];
+    char DeviceMinor[8];
+    char Prefix[155];
+    char Padding[12];
+} MD_TAR_HEADER, *PMD_TAR_HEADER;
+
+//
+// A member of the archive, with the name given by its pax or GNU long name
+// header, if it had one
+//
+typedef struct _MD_TAR_ENTRY
+{
+    char Name[MD_TAR_NAME_SIZE];
+    uint32_t DataOffset;
+    uint32_t Size;
+    char Type;
+} MD_TAR_ENTRY, *PMD_TAR_ENTRY;
+
+//
+// An archive whose output is decoded on demand. XZ streams can only be decoded
+// from the start, while the members of lzip files are decoded independently.
+//
+typedef struct _MD_TAR_ARCHIVE
+{
+    uint8_t* Input;
+    uint32_t InputSize;
+    uint8_t* Output;
+    uint32_t OutputSize;
+    bool IsLzip;
+    PXZ_STREAM Stream;
+    uint32_t Decoded;
+    XZ_STEP_STATUS Status;
+    PXZ_LZIP_MEMBER Members;
+    uint32_t MemberCount;
+    bool* MemberDecoded;
+    uint32_t MembersDecoded;
+    bool ChecksumError;
+} MD_TAR_ARCHIVE, *PMD_TAR_ARCHIVE;
+
+bool
+MdTarDecode (
+    PMD_TAR_ARCHIVE Archive,
+    uint32_t Start,
+    uint32_t End
+    )
+{
+    XZ_STEP_BUDGET budget;
+    PXZ_LZIP_MEMBER member;
+    uint32_t i;
+
+    if (Archive->IsLzip)
+    {
+        //
+        // Only decode the members that overlap the range
+        //
+        for (i = 0; i < Archive->MemberCount; i++)
+        {
+            member = &Archive->Members[i];
+            if (Archive->MemberDecoded[i] ||
+                (member->OutputOffset >= End) ||
+                ((member->OutputOffset + member->OutputSize) <= Start))
+            {
+                continue;
+            }
+            if (!XzDecodeLzipMember(Archive->Input,
+                                    Archive->InputSize,
+                                    member,
+                                    Archive->Output))
+            {
+                return false;
+            }
+            Archive->ChecksumError |= XzChecksumError();
+            Archive->MemberDecoded[i] = true;
+            Archive->MembersDecoded++;
+        }
+        return true;
+    }
+
+    //
+    // Keep stepping the stream until the end of the range has been decoded
+    //
+    while ((Archive->Decoded < End) && (Archive->Status == XzStepInProgress))
+    {
+        budget.MaxOutput = ((End - Archive->Decoded) > MD_TAR_WINDOW) ?
+                           (End - Archive->Decoded) : MD_TAR_WINDOW;
+        budget.MaxSequences = 0;
+        budget.MaxTime = 0;
+        budget.MaxInput = 0;
+        Archive->Status = XzDecodeStep(Archive->Stream, &budget, &Archive->Decoded);
+        if (Archive->Status == XzStepComplete)
+        {
+            Archive->ChecksumError = XzChecksumError();
+        }
+    }
+    return (Archive->Decoded >= End);
+}
+
+bool
+MdTarOpen (
+    PMD_TAR_ARCHIVE Archive,
+    const char* Path
+    )
+{
+    FILE* file;
+    struct stat fileStat;
+
+    //
+    // Read the whole archive in memory
+    //
+    memset(Archive, 0, sizeof(*Archive));
+    file = fopen(Path, "rb");
+    if ((file == NULL) ||
+        (fstat(fileno(file), &fileStat) != 0) ||
+        ((uint64_t)fileStat.st_size > UINT32_MAX))
+    {
+        printf("%s: failed to open the archive\n", Path);
+        goto Failure;
+    }
+    Archive->InputSize = (uint32_t)fileStat.st_size;
+    Archive->Input = malloc((size_t)Archive->InputSize + 1);
+    if ((Archive->Input == NULL) ||
+        (fread(Archive->Input, 1, Archive->InputSize, file) != Archive->InputSize))
+    {
+        printf("%s: failed to read the archive\n", Path);
+        goto Failure;
+    }
+    fclose(file);
+    file = NULL;
+
+    //
+    // Size the output, which is only mapped and not touched, so that the parts
+    // of it that are never decoded cost nothing
+    //
+    Archive->IsLzip = MdIsLzip(Archive->Input, Archive->InputSize);
+    if (Archive->IsLzip ?
+        !XzDecodeLzip(Archive->Input, Archive->InputSize, NULL, &Archive->OutputSize) :
+        !XzDecode(Archive->Input, Archive->InputSize, NULL, &Archive->OutputSize))
+    {
+        printf("%s: not a valid .xz or .lz file\n", Path);
+        goto Failure;
+    }
+    Archive->Output = MdAllocateOutput(Archive->OutputSize);
+    if (Archive->Output == NULL)
+    {
+        printf("Out of memory for allocating output buffer\n");
+        goto Failure;
+    }
+
+    //
+    // Get the stream ready to be stepped, or the members ready to be decoded
+    //
+    if (Archive->IsLzip)
+    {
+        XzGetLzipMembers(Archive->Input, Archive->InputSize, NULL, &Archive->MemberCount);
+        Archive->Members = calloc(Archive->MemberCount, sizeof(*Archive->Members));
+        Archive->MemberDecoded = calloc(Archive->MemberCount, sizeof(bool));
+        if ((Archive->Members == NULL) || (Archive->MemberDecoded == NULL) ||
+            !XzGetLzipMembers(Archive->Input,
+                              Archive->InputSize,
+                              Archive->Members,
+                              &Archive->MemberCount))
+        {
+            printf("%s: failed to read the lzip members\n", Path);
+            goto Failure;
+        }
+        return true;
+    }
+    Archive->Stream = malloc(XzGetStreamSize());
+    if ((Archive->Stream == NULL) ||
+        !XzDecodeStart(Archive->Stream,
+                       Archive->Input,
+                       Archive->InputSize,
+                       Archive->Output,
+                       Archive->OutputSize))
+    {
+        printf("%s: failed to start decoding\n", Path);
+        goto Failure;
+    }
+    Archive->Status = XzStepInProgress;
+    return true;
+
+Failure:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    return false;
+}
+
+void
+MdTarClose (
+    PMD_TAR_ARCHIVE Archive
+    )
+{
+    if (Archive->Output != NULL)
+    {
+        MdFreeOutput(Archive->Output, Archive->OutputSize);
+    }
+    free(Archive->MemberDecoded);
+    free(Archive->Members);
+    free(Archive->Stream);
+    free(Archive->Input);
+}
+
+bool
+MdTarParseNumber (
+    const char* Field,
+    uint32_t Length,
+    uint64_t* Value
+    )
+{
+    uint32_t i;
+
+    //
+    // Numbers are octal, padded with spaces or NULs, unless the top bit of the
+    // first byte is set, in which case they are big-endian binary (base-256)
+    //
+    *Value = 0;
+    if ((uint8_t)Field[0] & 0x80)
+    {
+        *Value = (uint8_t)Field[0] & 0x7F;
+        for (i = 1; i < Length; i++)
+        {
+            if (*Value >> 56)
+            {
+                return false;
+            }
+            *Value = (*Value << 8) | (uint8_t)Field[i];
+        }
+        return true;
+    }
+    for (i = 0; (i < Length) && (Field[i] == ' '); i++);
+    for (; (i < Length) && (Field[i] >= '0') && (Field[i] <= '7'); i++)
+    {
+        *Value = (*Value << 3) | (uint64_t)(Field[i] - '0');
+    }
+    return (i == Length) || (Field[i] == ' ') || (Field[i] == '\0');
+}
+
+bool
+MdTarCheckHeader (
+    const uint8_t* Block,
+    bool* IsEmpty
+    )
+{
+    PMD_TAR_HEADER header;
+    uint64_t checksum;
+    uint32_t i, sum;
+
+    //
+    // The checksum is the sum of all the bytes of the header, with the bytes
+    // of the checksum field itself counted as spaces
+    //
+    header = (PMD_TAR_HEADER)Block;
+    sum = 0;
+    for (i = 0; i < MD_TAR_BLOCK_SIZE; i++)
+    {
+        sum += Block[i];
+    }
+    *IsEmpty = (sum == 0);
+    if (*IsEmpty)
+    {
+        return true;
+    }
+    for (i = 0; i < sizeof(header->Checksum); i++)
+    {
+        sum += (uint32_t)' ' - (uint8_t)header->Checksum[i];
+    }
+    return MdTarParseNumber(header->Checksum, sizeof(header->Checksum), &checksum) &&
+           (checksum == sum);
+}
+
+void
+MdTarParsePax (
+    const char* Records,
+    uint32_t Size,
+    PMD_TAR_ENTRY Entry
+    )
+{
+    const char* record;
+    const char* value;
+    uint32_t length, offset;
+
+    //
+    // Each record is "LENGTH KEY=VALUE\n", where LENGTH covers the whole record.
+    // Only the path matters to us.
+    //
+    for (offset = 0; offset < Size; offset += length)
+    {
+        record = &Records[offset];
+        for (length = 0; (offset + length < Size) && (record[length] >= '0') &&
+                         (record[length] <= '9'); )
+        {
+            length++;
+        }
+        if ((length == 0) || ((offset + length) == Size) || (record[length] != ' '))
+        {
+            return;
+        }
+        length = (uint32_t)strtoul(record, NULL, 10);
+        if ((length == 0) || (length > (Size - offset)) || (record[length - 1] != '\n'))
+        {
+            return;
+        }
+        value = (const char*)memchr(record, ' ', length) + 1;
+        if ((strncmp(value, "path=", 5) == 0) &&
+            ((length - (uint32_t)(value + 5 - record)) <= sizeof(Entry->Name)))
+        {
+            value += 5;
+            memcpy(Entry->Name, value, (size_t)(&record[length - 1] - value));
+            Entry->Name[&record[length - 1] - value] = '\0';
+        }
+    }
+}
+
+bool
+MdTarReadEntry (
+    PMD_TAR_ARCHIVE Archive,
+    uint32_t* Offset,
+    PMD_TAR_ENTRY Entry,
+    bool* EndOfArchive
+    )
+{
+    PMD_TAR_HEADER header;
+    uint64_t size, next;
+    bool isEmpty, hasName;
+    size_t length;
+
+    //
+    // Walk the headers until one for an actual member is found, collecting the
+    // name from the pax or GNU long name headers that come before it
+    //
+    *EndOfArchive = false;
+    hasName = false;
+    for (;;)
+    {
+        if (*Offset == Archive->OutputSize)
+        {
+            *EndOfArchive = true;
+            return true;
+        }
+        if (((Archive->OutputSize - *Offset) < MD_TAR_BLOCK_SIZE) ||
+            !MdTarDecode(Archive, *Offset, *Offset + MD_TAR_BLOCK_SIZE))
+        {
+            return false;
+        }
+        header = (PMD_TAR_HEADER)&Archive->Output[*Offset];
+        if (!MdTarCheckHeader((const uint8_t*)header, &isEmpty))
+        {
+            printf("Invalid tar header at offset %u\n", *Offset);
+            return false;
+        }
+        if (isEmpty)
+        {
+            *EndOfArchive = true;
+            return true;
+        }
+
+        //
+        // Make sure the data is within the output, and skip past it (note that
+        // the padding of the last member may be missing)
+        //
+        if (!MdTarParseNumber(header->Size, sizeof(header->Size), &size) ||
+            (size > (Archive->OutputSize - *Offset - MD_TAR_BLOCK_SIZE)))
+        {
+            printf("Invalid tar member size at offset %u\n", *Offset);
+            return false;
+        }
+        Entry->DataOffset = *Offset + MD_TAR_BLOCK_SIZE;
+        Entry->Size = (uint32_t)size;
+        Entry->Type = header->Type;
+        next = (uint64_t)Entry->DataOffset +
+               ((size + MD_TAR_BLOCK_SIZE - 1) & ~(uint64_t)(MD_TAR_BLOCK_SIZE - 1));
+        *Offset = (next < Archive->OutputSize) ? (uint32_t)next : Archive->OutputSize;
+
+        if ((Entry->Type == 'x') || (Entry->Type == 'L'))
+        {
+            if (!MdTarDecode(Archive, Entry->DataOffset, Entry->DataOffset + Entry->Size))
+            {
+                return false;
+            }
+            if (Entry->Type == 'x')
+            {
+                Entry->Name[0] = '\0';
+                MdTarParsePax((const char*)&Archive->Output[Entry->DataOffset],
+                              Entry->Size,
+                              Entry);
+                hasName = (Entry->Name[0] != '\0');
+            }
+            else if (Entry->Size < sizeof(Entry->Name))
+            {
+                memcpy(Entry->Name, &Archive->Output[Entry->DataOffset], Entry->Size);
+                Entry->Name[Entry->Size] = '\0';
+                hasName = true;
+            }
+            continue;
+        }
+        if ((Entry->Type == 'g') || (Entry->Type == 'K'))
+        {
+            continue;
+        }
+
+        //
+        // Otherwise, the name is the prefix (for ustar) and the name fields
+        //
+        if (!hasName)
+        {
+            Entry->Name[0] = '\0';
+            if ((memcmp(header->Magic, "ustar", 5) == 0) && (header->Prefix[0] != '\0'))
+            {
+                length = strnlen(header->Prefix, sizeof(header->Prefix));
+                memcpy(Entry->Name, header->Prefix, length);
+                Entry->Name[length++] = '/';
+                Entry->Name[length] = '\0';
+            }
+            length = strlen(Entry->Name);
+            memcpy(&Entry->Name[length],
+                   header->Name,
+                   strnlen(header->Name, sizeof(header->Name)));
+            Entry->Name[length + strnlen(header->Name, sizeof(header->Name))] = '\0';
+        }
+        return true;
+    }
+}
+
+const char*
+MdTarNormalizeName (
+    const char* Name
+    )
+{
+    //
+    // "./dir/file" and "dir/file" are the same member
+    //
+    while ((Name[0] == '.') && (Name[1] == '/'))
+    {
+        Name += 2;
+    }
+    return Name;
+}
+
+bool
+MdTarIsRequested (
+    const char* Name,
+    char* Members[],
+    uint32_t MemberCount,
+    bool* Found,
+    uint32_t* Remaining
+    )
+{
+    uint32_t i;
+    bool requested;
+
+    //
+    // With no member list, everything is requested
+    //
+    if (MemberCount == 0)
+    {
+        return true;
+    }
+    requested = false;
+    Name = MdTarNormalizeName(Name);
+    for (i = 0; i < MemberCount; i++)
+    {
+        if (strcmp(Name, MdTarNormalizeName(Members[i])) == 0)
+        {
+            if (!Found[i])
+            {
+                Found[i] = true;
+                (*Remaining)--;
+            }
+            requested = true;
+        }
+    }
+    return requested;
+}
+
+bool
+MdTarWriteMember (
+    PMD_TAR_ARCHIVE Archive,
+    const char* Name,
+    uint32_t DataOffset,
+    uint32_t Size
+    )
+{
+    char path[MD_TAR_NAME_SIZE];
+    FILE* file;
+    char* separator;
+    uint32_t bytesSkipped;
+    bool result;
+
+    //
+    // Never write outside of the current directory
+    //
+    Name = MdTarNormalizeName(Name);
+    if ((Name[0] == '\0') || (Name[0] == '/') ||
+        (strcmp(Name, "..") == 0) || (strncmp(Name, "../", 3) == 0) ||
+        (strstr(Name, "/../") != NULL) ||
+        ((strlen(Name) >= 3) && (strcmp(&Name[strlen(Name) - 3], "/..") == 0)))
+    {
+        printf("%s: skipping unsafe member name\n", Name);
+        return true;
+    }
+
+    //
+    // Make sure all the member data was decoded, then create its directories
+    //
+    if (!MdTarDecode(Archive, DataOffset, DataOffset + Size))
+    {
+        printf("%s: decoding failed\n", Name);
+        return false;
+    }
+    strcpy(path, Name);
+    for (separator = strchr(path, '/');
+         separator != NULL;
+         separator = strchr(separator + 1, '/'))
+    {
+        *separator = '\0';
+        if ((MdMakeDirectory(path) != 0) && (errno != EEXIST))
+        {
+            printf("%s: failed to create directory\n", path);
+            return false;
+        }
+        *separator = '/';
+    }
+
+    file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        printf("%s: failed to open output file\n", path);
+        return false;
+    }
+    result = MdWriteOutput(file, &Archive->Output[DataOffset], Size, NULL, 0, &bytesSkipped);
+    fclose(file);
+    if (!result)
+    {
+        printf("%s: failed to write output file\n", path);
+        return false;
+    }
+    printf("%s: %u bytes\n", path, Size);
+    return true;
+}
+
+bool
+MdTarExtractScan (
+    PMD_TAR_ARCHIVE Archive,
+    FILE* IndexFile,
+    char* Members[],
+    uint32_t MemberCount,
+    bool* Found
+    )
+{
+    MD_TAR_ENTRY* entry;
+    uint32_t offset, remaining;
+    bool endOfArchive, result;
+
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    //
+    // Walk the headers as the output gets decoded, and stop as soon as every
+    // member that was asked for has been written, unless an index is being
+    // built, which requires the whole archive to be walked
+    //
+    offset = 0;
+    remaining = MemberCount;
+    result = true;
+    endOfArchive = false;
+    while (result &&
+           ((remaining != 0) || (MemberCount == 0) || (IndexFile != NULL)) &&
+           MdTarReadEntry(Archive, &offset, entry, &endOfArchive) &&
+           !endOfArchive)
+    {
+        if ((entry->Type != '0') && (entry->Type != '\0') && (entry->Type != '7'))
+        {
+            continue;
+        }
+        if ((IndexFile != NULL) && (strchr(entry->Name, '\n') == NULL))
+        {
+            fprintf(IndexFile, "%u %u %s\n", entry->DataOffset, entry->Size, entry->Name);
+        }
+        if (MdTarIsRequested(entry->Name, Members, MemberCount, Found, &remaining))
+        {
+            result = MdTarWriteMember(Archive, entry->Name, entry->DataOffset, entry->Size);
+        }
+    }
+
+    //
+    // Reading stopped early only if something went wrong
+    //
+    result = result &&
+             (((remaining == 0) && (MemberCount != 0) && (IndexFile == NULL)) ||
+              endOfArchive);
+    free(entry);
+    return result;
+}
+
+bool
+MdTarExtractIndexed (
+    PMD_TAR_ARCHIVE Archive,
+    FILE* IndexFile,
+    char* Members[],
+    uint32_t MemberCount,
+    bool* Found
+    )
+{
+    char* line;
+    char* name;
+    unsigned long offset, size;
+    uint32_t remaining;
+    size_t length;
+    bool result;
+
+    line = malloc(MD_TAR_NAME_SIZE + 32);
+    if (line == NULL)
+    {
+        return false;
+    }
+
+    //
+    // Every member is at a known offset, so no header needs to be decoded
+    //
+    remaining = MemberCount;
+    result = true;
+    while (result &&
+           ((remaining != 0) || (MemberCount == 0)) &&
+           (fgets(line, MD_TAR_NAME_SIZE + 32, IndexFile) != NULL))
+    {
+        length = strlen(line);
+        if ((length == 0) || (line[length - 1] != '\n'))
+        {
+            continue;
+        }
+        line[length - 1] = '\0';
+        offset = strtoul(line, &name, 10);
+        size = strtoul(name, &name, 10);
+        if ((*name++ != ' ') ||
+            (offset > Archive->OutputSize) ||
+            (size > (Archive->OutputSize - offset)))
+        {
+            printf("Invalid index entry: %s\n", line);
+            result = false;
+            break;
+        }
+        if (MdTarIsRequested(name, Members, MemberCount, Found, &remaining))
+        {
+            result = MdTarWriteMember(Archive, name, (uint32_t)offset, (uint32_t)size);
+        }
+    }
+    free(line);
+    return result;
+}
+
+bool
+MdExtractTar (
+    const char* ArchivePath,
+    const char* IndexPath,
+    char* Members[],
+    uint32_t MemberCount
+    )
+{
+    MD_TAR_ARCHIVE archive;
+    char signature[64];
+    char line[64];
+    FILE* indexFile;
+    bool* found;
+    bool result, buildIndex;
+    uint32_t i;
+
+    found = NULL;
+    indexFile = NULL;
+    result = false;
+    buildIndex = false;
+    if (!MdTarOpen(&archive, ArchivePath))
+    {
+        goto Cleanup;
+    }
+    found = calloc(MemberCount + 1, sizeof(bool));
+    if (found == NULL)
+    {
+        goto Cleanup;
+    }
+
+    //
+    // Use the index if there is one for this exact archive, otherwise build it
+    // while walking the headers
+    //
+    snprintf(signature,
+             sizeof(signature),
+             "%s %u %u\n",
+             MD_TAR_INDEX_SIGNATURE,
+             archive.InputSize,
+             archive.OutputSize);
+    if (IndexPath != NULL)
+    {
+        indexFile = fopen(IndexPath, "r");
+        if ((indexFile != NULL) &&
+            ((fgets(line, sizeof(line), indexFile) == NULL) ||
+             (strcmp(line, signature) != 0)))
+        {
+            printf("%s: index does not match the archive, rebuilding it\n", IndexPath);
+            fclose(indexFile);
+            indexFile = NULL;
+        }
+        if (indexFile == NULL)
+        {
+            buildIndex = true;
+            indexFile = fopen(IndexPath, "w");
+            if (indexFile == NULL)
+            {
+                printf("%s: failed to create the index\n", IndexPath);
+                goto Cleanup;
+            }
+            fputs(signature, indexFile);
+        }
+    }
+    if ((indexFile != NULL) && !buildIndex)
+    {
+        result = MdTarExtractIndexed(&archive, indexFile, Members, MemberCount, found);
+    }
+    else
+    {
+        result = MdTarExtractScan(&archive, indexFile, Members, MemberCount, found);
+
+        //
+        // When extracting everything, finish decoding past the last header, so
+        // that the whole archive has its checksums verified
+        //
+        if (result && (MemberCount == 0))
+        {
+            result = MdTarDecode(&archive, 0, archive.OutputSize);
+        }
+
+        //
+        // Don't leave an index behind unless all of the headers were walked
+        //
+        if (buildIndex && !result)
+        {
+            fclose(indexFile);
+            indexFile = NULL;
+            remove(IndexPath);
+        }
+    }
+
+    for (i = 0; i < MemberCount; i++)
+    {
+        if (!found[i])
+        {
+            printf("%s: not found in the archive\n", Members[i]);
+            result = false;
+        }
+    }
+
+    //
+    // Checksums can only be checked for what was decoded, which is the whole
+    // stream for XZ archives, and the members that were decoded for lzip ones
+    //
+    if (archive.ChecksumError)
+    {
+        printf("WARNING: Checksum error was encountered\n");
+        result = false;
+    }
+    if (archive.IsLzip)
+    {
+        printf("Decoded %u of %u lzip members\n", archive.MembersDecoded, archive.MemberCount);
+    }
+    else
+    {
+        printf("Decoded %u of %u bytes%s\n",
+               archive.Decoded,
+               archive.OutputSize,
+               (archive.Status == XzStepComplete) ?
+               "" : " (the block checksum was not verified)");
+    }
+
+Cleanup:
+    if (indexFile != NULL)
+    {
+        fclose(indexFile);
+    }
+    free(found);
+    MdTarClose(&archive);
+    return result;
+}
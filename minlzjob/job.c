@@ -0,0 +1,707 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    job.c
+
+Abstract:
+
+    This module implements minlzjob, the asynchronous decoding interface. A
+    pool of worker threads takes jobs from a single submission queue, in order,
+    and decodes each one with the step interface of minlzlib, in steps of 1MB
+    of output, so that a cancelled job stops soon after it is cancelled, even
+    when it is already running. Completed jobs are appended to a completion
+    queue, and the eventfd of the pool is signalled whenever that queue stops
+    being empty, then drained by the reaper once it has emptied it, so that the
+    descriptor is readable exactly when there are jobs to reap, at the cost of
+    one write and one read per batch of completions rather than per job. With
+    a memory budget, the job at the head of the queue is only started once its
+    memory fits next to that of the running jobs, and the workers that cannot
+    start it wait until a running job releases its memory.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "minlzjob.h"
+#include <minlzma.h>
+
+//
+// Output decoded by a job between two checks of its cancellation
+//
+#define JB_STEP_SIZE        (1024 * 1024)
+
+typedef enum _JB_JOB_STATE
+{
+    JbJobIdle,
+    JbJobQueued,
+    JbJobRunning,
+    JbJobComplete
+} JB_JOB_STATE;
+
+//
+// A worker thread, along with the stream that it decodes its jobs into
+//
+typedef struct _JB_WORKER
+{
+    pthread_t Thread;
+    PJB_POOL Pool;
+    PXZ_STREAM Stream;
+    PJB_JOB Job;
+} JB_WORKER, *PJB_WORKER;
+
+//
+// The submission queue is doubly linked, so that a queued job can be taken
+// out of it when cancelled, while the completion queue only needs the Next
+// link. Both are protected by the lock of the pool.
+//
+struct _JB_POOL
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t Wakeup;
+    PJB_JOB QueueHead;
+    PJB_JOB QueueTail;
+    PJB_JOB CompletedHead;
+    PJB_JOB CompletedTail;
+    int EventFd;
+    bool ShuttingDown;
+    PJB_WORKER Workers;
+    uint32_t WorkerCount;
+    uint32_t StartedCount;
+    uint32_t RunningCount;
+    uint32_t QueuedCount;
+    uint64_t MemoryBudget;
+    uint64_t MemoryInUse;
+    uint64_t MemoryPeak;
+    uint64_t StartedJobs;
+    uint64_t TotalQueueTime;
+    uint64_t MaxQueueTime;
+};
+
+uint64_t
+JbGetTime (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000) + (uint64_t)now.tv_nsec;
+}
+
+void
+JbMeasureJob (
+    PJB_JOB Job
+    )
+{
+    XZ_STREAM_INFO info;
+
+    //
+    // Keep the size of the output from the index, if the stream has one that
+    // is usable and intact, for sizing the output when the job runs
+    //
+    Job->Memory = XzGetStreamSize();
+    Job->UncompressedSize = UINT64_MAX;
+    if (!XzGetStreamInfo(Job->Input, Job->InputSize, &info) ||
+        !info.Supported ||
+        info.ChecksumError)
+    {
+        return;
+    }
+    Job->UncompressedSize = info.UncompressedSize;
+
+    //
+    // The output is also the dictionary. When the caller brings its own, only
+    // the window that the decoder reads matches back from is charged, rather
+    // than memory that the caller already paid for.
+    //
+    if (Job->Output == NULL)
+    {
+        Job->Memory += info.UncompressedSize;
+    }
+    else
+    {
+        Job->Memory += (info.DictionarySize < info.UncompressedSize) ?
+                       info.DictionarySize : info.UncompressedSize;
+    }
+}
+
+bool
+JbCanStartJob (
+    PJB_POOL Pool,
+    PJB_JOB Job
+    )
+{
+    //
+    // A job larger than the whole budget still runs, once it has the pool to
+    // itself, rather than blocking the queue forever
+    //
+    return (Pool->MemoryBudget == 0) ||
+           (Pool->RunningCount == 0) ||
+           ((Pool->MemoryInUse + Job->Memory) <= Pool->MemoryBudget);
+}
+
+void
+JbCompleteJob (
+    PJB_POOL Pool,
+    PJB_JOB Job
+    )
+{
+    uint64_t value;
+    ssize_t written;
+
+    //
+    // Signal the eventfd only when the completion queue stops being empty, as
+    // the reaper drains it once it has emptied the queue
+    //
+    Job->State = JbJobComplete;
+    Job->Next = NULL;
+    Job->Previous = NULL;
+    if (Pool->CompletedHead == NULL)
+    {
+        Pool->CompletedHead = Job;
+        value = 1;
+        do
+        {
+            written = write(Pool->EventFd, &value, sizeof(value));
+        } while ((written < 0) && (errno == EINTR));
+    }
+    else
+    {
+        Pool->CompletedTail->Next = Job;
+    }
+    Pool->CompletedTail = Job;
+}
+
+void
+JbUnlinkJob (
+    PJB_POOL Pool,
+    PJB_JOB Job
+    )
+{
+    if (Job->Previous != NULL)
+    {
+        Job->Previous->Next = Job->Next;
+    }
+    else
+    {
+        Pool->QueueHead = Job->Next;
+    }
+    if (Job->Next != NULL)
+    {
+        Job->Next->Previous = Job->Previous;
+    }
+    else
+    {
+        Pool->QueueTail = Job->Previous;
+    }
+    Pool->QueuedCount--;
+    Job->QueueTime = JbGetTime() - Job->QueueTime;
+}
+
+int
+JbDecodeJob (
+    PJB_WORKER Worker,
+    PJB_JOB Job
+    )
+{
+    XZ_STEP_BUDGET budget;
+    XZ_STEP_STATUS status;
+    uint32_t size;
+    bool allocated;
+
+    //
+    // Size the output of the job ourselves if the caller did not, from the
+    // index that was read when the job was submitted. Streams without a usable
+    // index need a size query, which only walks the LZMA2 chunk headers, but
+    // can still take a while on a large stream, so look for a cancellation on
+    // either side of it.
+    //
+    allocated = false;
+    if (Job->Output == NULL)
+    {
+        if (Job->UncompressedSize <= UINT32_MAX)
+        {
+            size = (uint32_t)Job->UncompressedSize;
+        }
+        else
+        {
+            if (__atomic_load_n(&Job->Cancelled, __ATOMIC_RELAXED))
+            {
+                return ECANCELED;
+            }
+            size = 0;
+            if (!XzDecode(Job->Input, Job->InputSize, NULL, &size))
+            {
+                return EINVAL;
+            }
+            if (__atomic_load_n(&Job->Cancelled, __ATOMIC_RELAXED))
+            {
+                return ECANCELED;
+            }
+        }
+        Job->Output = malloc((size != 0) ? size : 1);
+        if (Job->Output == NULL)
+        {
+            return ENOMEM;
+        }
+        Job->OutputSize = size;
+        allocated = true;
+    }
+
+    //
+    // Decode one step at a time, looking for a cancellation in between
+    //
+    memset(&budget, 0, sizeof(budget));
+    budget.MaxOutput = JB_STEP_SIZE;
+    status = XzStepFailed;
+    if (XzDecodeStart(Worker->Stream,
+                      Job->Input,
+                      Job->InputSize,
+                      Job->Output,
+                      Job->OutputSize))
+    {
+        do
+        {
+            if (__atomic_load_n(&Job->Cancelled, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            status = XzDecodeStep(Worker->Stream, &budget, &size);
+        } while (status == XzStepInProgress);
+    }
+    if (status == XzStepComplete)
+    {
+        Job->OutputSize = size;
+        Job->ChecksumError = XzChecksumError();
+        return 0;
+    }
+
+    //
+    // The decoder tells a caller-supplied buffer that was too small apart from
+    // a stream that is invalid. A stream that does not fit in the buffer that
+    // we sized ourselves has an index that does not match its blocks, which
+    // makes it invalid as well.
+    //
+    if (allocated)
+    {
+        free(Job->Output);
+        Job->Output = NULL;
+        Job->OutputSize = 0;
+    }
+    if (status == XzStepInProgress)
+    {
+        return ECANCELED;
+    }
+    return ((status == XzStepOutputFull) && !allocated) ? ENOBUFS : EINVAL;
+}
+
+void*
+JbWorkerThread (
+    void* Parameter
+    )
+{
+    PJB_WORKER worker;
+    PJB_POOL pool;
+    PJB_JOB job;
+    int status;
+
+    worker = (PJB_WORKER)Parameter;
+    pool = worker->Pool;
+    pthread_mutex_lock(&pool->Lock);
+    for (;;)
+    {
+        //
+        // Take the oldest job once there is enough memory left for it, or exit
+        // once the pool is being destroyed, in which case the queue was already
+        // emptied
+        //
+        while (((pool->QueueHead == NULL) || !JbCanStartJob(pool, pool->QueueHead)) &&
+               !pool->ShuttingDown)
+        {
+            pthread_cond_wait(&pool->Wakeup, &pool->Lock);
+        }
+        if (pool->ShuttingDown)
+        {
+            break;
+        }
+        job = pool->QueueHead;
+        JbUnlinkJob(pool, job);
+        job->State = JbJobRunning;
+        worker->Job = job;
+        pool->RunningCount++;
+        pool->MemoryInUse += job->Memory;
+        if (pool->MemoryInUse > pool->MemoryPeak)
+        {
+            pool->MemoryPeak = pool->MemoryInUse;
+        }
+        pool->StartedJobs++;
+        pool->TotalQueueTime += job->QueueTime;
+        if (job->QueueTime > pool->MaxQueueTime)
+        {
+            pool->MaxQueueTime = job->QueueTime;
+        }
+
+        //
+        // Other workers may have given up on the job that was at the head of
+        // the queue, while the next one could still fit
+        //
+        if ((pool->MemoryBudget != 0) && (pool->QueueHead != NULL))
+        {
+            pthread_cond_signal(&pool->Wakeup);
+        }
+        pthread_mutex_unlock(&pool->Lock);
+
+        status = JbDecodeJob(worker, job);
+
+        pthread_mutex_lock(&pool->Lock);
+        worker->Job = NULL;
+        job->Status = status;
+        JbCompleteJob(pool, job);
+
+        //
+        // Let the workers that are waiting for memory look at the queue again
+        //
+        pool->RunningCount--;
+        pool->MemoryInUse -= job->Memory;
+        if ((pool->MemoryBudget != 0) && (pool->QueueHead != NULL))
+        {
+            pthread_cond_broadcast(&pool->Wakeup);
+        }
+    }
+    pthread_mutex_unlock(&pool->Lock);
+    return NULL;
+}
+
+PJB_POOL
+JbCreatePool (
+    uint32_t WorkerCount
+    )
+{
+    PJB_POOL pool;
+    uint32_t i, started;
+    long cpus;
+    int error;
+
+    //
+    // Default to a worker per CPU
+    //
+    if (WorkerCount == 0)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        WorkerCount = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->EventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pool->EventFd == -1)
+    {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->Lock, NULL);
+    pthread_cond_init(&pool->Wakeup, NULL);
+
+    //
+    // Give each worker its own stream, which it reuses for all of its jobs,
+    // so that steps of the same job never have to reload the decoder state
+    //
+    pool->Workers = calloc(WorkerCount, sizeof(*pool->Workers));
+    if (pool->Workers == NULL)
+    {
+        error = ENOMEM;
+        goto Failure;
+    }
+    pool->WorkerCount = WorkerCount;
+    for (i = 0; i < WorkerCount; i++)
+    {
+        pool->Workers[i].Pool = pool;
+        pool->Workers[i].Stream = malloc(XzGetStreamSize());
+        if (pool->Workers[i].Stream == NULL)
+        {
+            error = ENOMEM;
+            goto Failure;
+        }
+    }
+    for (started = 0; started < WorkerCount; started++)
+    {
+        error = pthread_create(&pool->Workers[started].Thread,
+                               NULL,
+                               JbWorkerThread,
+                               &pool->Workers[started]);
+        if (error != 0)
+        {
+            pool->StartedCount = started;
+            goto Failure;
+        }
+    }
+    pool->StartedCount = started;
+    return pool;
+
+Failure:
+    JbDestroyPool(pool);
+    errno = error;
+    return NULL;
+}
+
+void
+JbSetMemoryBudget (
+    PJB_POOL Pool,
+    uint64_t Budget
+    )
+{
+    //
+    // A larger budget (or none) may let queued jobs start right away
+    //
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->MemoryBudget = Budget;
+    pthread_cond_broadcast(&Pool->Wakeup);
+    pthread_mutex_unlock(&Pool->Lock);
+}
+
+void
+JbGetStatistics (
+    PJB_POOL Pool,
+    PJB_STATISTICS Statistics
+    )
+{
+    pthread_mutex_lock(&Pool->Lock);
+    Statistics->MemoryBudget = Pool->MemoryBudget;
+    Statistics->MemoryInUse = Pool->MemoryInUse;
+    Statistics->MemoryPeak = Pool->MemoryPeak;
+    Statistics->RunningJobs = Pool->RunningCount;
+    Statistics->QueuedJobs = Pool->QueuedCount;
+    Statistics->StartedJobs = Pool->StartedJobs;
+    Statistics->TotalQueueTime = Pool->TotalQueueTime;
+    Statistics->MaxQueueTime = Pool->MaxQueueTime;
+    pthread_mutex_unlock(&Pool->Lock);
+}
+
+int
+JbGetEventFd (
+    PJB_POOL Pool
+    )
+{
+    return Pool->EventFd;
+}
+
+bool
+JbSubmit (
+    PJB_POOL Pool,
+    PJB_JOB* Jobs,
+    uint32_t Count
+    )
+{
+    PJB_JOB job;
+    uint64_t now;
+    uint32_t i;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Jobs[i]->Input == NULL)
+        {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    //
+    // Work out the memory and output size of each job outside of the lock,
+    // which only needs the headers and the index of its stream
+    //
+    for (i = 0; i < Count; i++)
+    {
+        JbMeasureJob(Jobs[i]);
+    }
+
+    //
+    // Queue the whole batch under a single acquisition of the lock, then wake
+    // up as many workers as there are new jobs
+    //
+    now = JbGetTime();
+    pthread_mutex_lock(&Pool->Lock);
+    if (Pool->ShuttingDown)
+    {
+        pthread_mutex_unlock(&Pool->Lock);
+        errno = ESHUTDOWN;
+        return false;
+    }
+    for (i = 0; i < Count; i++)
+    {
+        job = Jobs[i];
+        job->Status = 0;
+        job->ChecksumError = false;
+        job->Cancelled = false;
+        job->QueueTime = now;
+        job->State = JbJobQueued;
+        job->Next = NULL;
+        job->Previous = Pool->QueueTail;
+        if (Pool->QueueTail != NULL)
+        {
+            Pool->QueueTail->Next = job;
+        }
+        else
+        {
+            Pool->QueueHead = job;
+        }
+        Pool->QueueTail = job;
+    }
+    Pool->QueuedCount += Count;
+    if (Count >= Pool->WorkerCount)
+    {
+        pthread_cond_broadcast(&Pool->Wakeup);
+    }
+    else
+    {
+        for (i = 0; i < Count; i++)
+        {
+            pthread_cond_signal(&Pool->Wakeup);
+        }
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+    return true;
+}
+
+bool
+JbCancel (
+    PJB_POOL Pool,
+    PJB_JOB Job
+    )
+{
+    bool outstanding;
+
+    //
+    // A queued job completes right away, while a running one is flagged for
+    // its worker to notice at the end of the current step
+    //
+    pthread_mutex_lock(&Pool->Lock);
+    outstanding = true;
+    if (Job->State == JbJobQueued)
+    {
+        JbUnlinkJob(Pool, Job);
+        Job->Status = ECANCELED;
+        JbCompleteJob(Pool, Job);
+
+        //
+        // The job may have been holding up the queue while waiting for memory
+        //
+        if ((Pool->MemoryBudget != 0) && (Pool->QueueHead != NULL))
+        {
+            pthread_cond_broadcast(&Pool->Wakeup);
+        }
+    }
+    else if (Job->State == JbJobRunning)
+    {
+        __atomic_store_n(&Job->Cancelled, true, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        outstanding = false;
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+    return outstanding;
+}
+
+uint32_t
+JbReap (
+    PJB_POOL Pool,
+    PJB_JOB* Jobs,
+    uint32_t MaxJobs
+    )
+{
+    uint64_t value;
+    uint32_t count;
+    ssize_t bytes;
+
+    pthread_mutex_lock(&Pool->Lock);
+    for (count = 0; (count < MaxJobs) && (Pool->CompletedHead != NULL); count++)
+    {
+        Jobs[count] = Pool->CompletedHead;
+        Pool->CompletedHead = Pool->CompletedHead->Next;
+        Jobs[count]->Next = NULL;
+        Jobs[count]->State = JbJobIdle;
+    }
+
+    //
+    // Once the queue is empty, drain the eventfd so that it stops polling as
+    // readable until the next completion
+    //
+    if ((count != 0) && (Pool->CompletedHead == NULL))
+    {
+        Pool->CompletedTail = NULL;
+        do
+        {
+            bytes = read(Pool->EventFd, &value, sizeof(value));
+        } while ((bytes < 0) && (errno == EINTR));
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+    return count;
+}
+
+void
+JbDestroyPool (
+    PJB_POOL Pool
+    )
+{
+    PJB_JOB job;
+    uint32_t i;
+
+    //
+    // Cancel everything that is still outstanding, and wait for the workers
+    // to finish their current step and exit
+    //
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->ShuttingDown = true;
+    while (Pool->QueueHead != NULL)
+    {
+        job = Pool->QueueHead;
+        JbUnlinkJob(Pool, job);
+        job->Status = ECANCELED;
+        JbCompleteJob(Pool, job);
+    }
+    for (i = 0; i < Pool->WorkerCount; i++)
+    {
+        if (Pool->Workers[i].Job != NULL)
+        {
+            __atomic_store_n(&Pool->Workers[i].Job->Cancelled, true, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_cond_broadcast(&Pool->Wakeup);
+    pthread_mutex_unlock(&Pool->Lock);
+    for (i = 0; i < Pool->StartedCount; i++)
+    {
+        pthread_join(Pool->Workers[i].Thread, NULL);
+    }
+
+    //
+    // Jobs that were never reaped keep their final status
+    //
+    for (job = Pool->CompletedHead; job != NULL; job = job->Next)
+    {
+        job->State = JbJobIdle;
+    }
+    for (i = 0; i < Pool->WorkerCount; i++)
+    {
+        free(Pool->Workers[i].Stream);
+    }
+    free(Pool->Workers);
+    close(Pool->EventFd);
+    pthread_cond_destroy(&Pool->Wakeup);
+    pthread_mutex_destroy(&Pool->Lock);
+    free(Pool);
+}
@@ -0,0 +1,215 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    minlzjob.h
+
+Abstract:
+
+    This header file contains the interface of minlzjob, which decodes .xz
+    streams asynchronously on a pool of worker threads owned by the library.
+    Jobs are submitted in batches, and come back through a completion queue,
+    whose eventfd becomes readable whenever completed jobs are waiting to be
+    reaped, so that an epoll (or poll) based server can wait for decodes along
+    with its sockets, without dedicating a thread to each request. A pool can
+    be given a memory budget, which caps the memory that its running jobs may
+    use at once, so that large decodes wait for each other instead of running
+    together and exhausting the memory of the host.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+//
+// A pool of decoding threads, along with its queues
+//
+typedef struct _JB_POOL JB_POOL, *PJB_POOL;
+
+//
+// A decode job. The caller fills in the input (and optionally the output)
+// buffers before submitting it, and owns the job and its buffers until it is
+// reaped. When Output is NULL, the pool allocates a buffer of the size of the
+// decompressed stream with malloc(), which the caller releases with free().
+// Once the job completes, OutputSize holds the size of the decoded output, and
+// Status is 0 when the stream was decoded, ECANCELED when the job was
+// cancelled, ENOBUFS when the output buffer is too small, ENOMEM when the
+// output could not be allocated, and EINVAL when the stream is invalid.
+// QueueTime holds the time (in nanoseconds) that the job spent queued before a
+// worker started it, including any time spent waiting for memory.
+//
+typedef struct _JB_JOB
+{
+    const uint8_t* Input;
+    uint32_t InputSize;
+    uint8_t* Output;
+    uint32_t OutputSize;
+    void* Context;
+    int Status;
+    bool ChecksumError;
+    uint64_t QueueTime;
+
+    //
+    // Owned by the pool while the job is outstanding
+    //
+    struct _JB_JOB* Next;
+    struct _JB_JOB* Previous;
+    uint32_t State;
+    bool Cancelled;
+    uint64_t Memory;
+    uint64_t UncompressedSize;
+} JB_JOB, *PJB_JOB;
+
+//
+// Counters of a pool, as returned by JbGetStatistics. Queue times only cover
+// the jobs that were started.
+//
+typedef struct _JB_STATISTICS
+{
+    uint64_t MemoryBudget;
+    uint64_t MemoryInUse;
+    uint64_t MemoryPeak;
+    uint32_t RunningJobs;
+    uint32_t QueuedJobs;
+    uint64_t StartedJobs;
+    uint64_t TotalQueueTime;
+    uint64_t MaxQueueTime;
+} JB_STATISTICS, *PJB_STATISTICS;
+
+/*!
+ * @brief          Creates a pool of decoding threads.
+ *
+ * @param[in]      WorkerCount - The number of threads, or 0 for one per CPU.
+ *
+ * @return         The pool, or NULL (with errno set) if it could not be made.
+ */
+PJB_POOL
+JbCreatePool (
+    uint32_t WorkerCount
+    );
+
+/*!
+ * @brief          Caps the memory used by the jobs that a pool runs at once.
+ *
+ * @detail         Each job is charged, when it is submitted, for the decoder
+ *                 state of a worker plus its output, which is also its
+ *                 dictionary: all of it when the pool allocates the output,
+ *                 but only the dictionary size from its block header (or the
+ *                 output size, if smaller) when the caller brings its own
+ *                 buffer, since only that window of it keeps being read back.
+ *                 Sizes are read from the index of the stream, and streams
+ *                 without a usable one are only charged for the decoder state.
+ *                 The job at the head of the queue only starts once its charge
+ *                 fits in what is left of the budget, so fewer jobs than there
+ *                 are workers run at once when they are large, and a job that
+ *                 is larger than the whole budget runs on its own.
+ *
+ * @param[in]      Budget - The budget in bytes, or 0 for no limit (the default).
+ */
+void
+JbSetMemoryBudget (
+    PJB_POOL Pool,
+    uint64_t Budget
+    );
+
+/*!
+ * @brief          Takes a snapshot of the counters of a pool.
+ */
+void
+JbGetStatistics (
+    PJB_POOL Pool,
+    PJB_STATISTICS Statistics
+    );
+
+/*!
+ * @brief          Returns the descriptor of the completion queue of a pool.
+ *
+ * @detail         The descriptor is a non-blocking eventfd, which is readable
+ *                 for as long as completed jobs are waiting to be reaped. It
+ *                 must not be read from or closed by the caller. With edge-
+ *                 triggered epoll, call JbReap until it returns fewer jobs than
+ *                 it was asked for, since no new edge is signalled while the
+ *                 queue is not empty.
+ */
+int
+JbGetEventFd (
+    PJB_POOL Pool
+    );
+
+/*!
+ * @brief          Queues a batch of jobs, which are decoded in order of
+ *                 submission (though they can complete in any order).
+ *
+ * @return         true - All of the jobs were queued.
+ *                 false - None were, since the pool is being destroyed or one
+ *                 of the jobs has no input.
+ */
+bool
+JbSubmit (
+    PJB_POOL Pool,
+    PJB_JOB* Jobs,
+    uint32_t Count
+    );
+
+/*!
+ * @brief          Cancels an outstanding job.
+ *
+ * @detail         A job that is still queued is completed right away, while
+ *                 a job that is being decoded stops at its next step, within
+ *                 about 1MB of output. Either way, the job still has to be
+ *                 reaped, and a job that was about to finish may still do so
+ *                 successfully.
+ *
+ * @return         true - The job will complete with ECANCELED (or succeed).
+ *                 false - The job had already completed.
+ */
+bool
+JbCancel (
+    PJB_POOL Pool,
+    PJB_JOB Job
+    );
+
+/*!
+ * @brief          Takes completed jobs off the completion queue, without
+ *                 waiting.
+ *
+ * @param[out]     Jobs - Receives the completed jobs, oldest first.
+ * @param[in]      MaxJobs - The number of jobs that Jobs can hold.
+ *
+ * @return         The number of jobs that were reaped.
+ */
+uint32_t
+JbReap (
+    PJB_POOL Pool,
+    PJB_JOB* Jobs,
+    uint32_t MaxJobs
+    );
+
+/*!
+ * @brief          Cancels all outstanding jobs, waits for the workers to exit
+ *                 and frees the pool, closing its eventfd.
+ *
+ * @detail         Jobs that were not reaped yet are left with their final
+ *                 Status, and queued jobs with ECANCELED.
+ */
+void
+JbDestroyPool (
+    PJB_POOL Pool
+    );
+
+#if defined (__cplusplus)
+}
+#endif
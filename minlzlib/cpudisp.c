@@ -0,0 +1,321 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    cpudisp.c
+
+Abstract:
+
+    This module implements the selection of the hot kernels used by the rest of
+    the library (dictionary match copies, and the CRC32/CRC64 checksums) based
+    on the features of the processor that the library is running on. The level
+    is resolved once, with CPUID, the first time a stream is decoded, and each
+    kernel is then called through the dispatch table. Callers may also request
+    a lower level, which is mostly useful for benchmarking. The vectorized copy
+    kernels also live here, while the checksum kernels live in xzcrc.c.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+
+#ifdef MINLZ_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//
+// Level requested by the caller (the best one supported, by default). Like the
+// dispatch table that each thread resolves from it the first time it decodes a
+// stream, it belongs to the calling thread.
+//
+MINLZ_STATE CPU_LEVEL CpuRequestedLevel = CpuLevelBest;
+MINLZ_STATE KERNEL_DISPATCH Kernels;
+
+void
+CpuCopyGeneric (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // Copy forward one byte at a time, which correctly repeats the pattern in
+    // the case where the source overlaps the bytes we are writing.
+    //
+    do
+    {
+        *Destination++ = *Source++;
+    } while (--Length > 0);
+}
+
+#ifdef MINLZ_X64
+MINLZ_TARGET("sse2")
+void
+CpuCopySse (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // As long as the match distance is at least one vector long, each vector
+    // load only reads bytes that have already been written. Vectors are never
+    // stored past the end of the match, as that may be the end of the buffer.
+    //
+    if ((size_t)(Destination - Source) >= sizeof(__m128i))
+    {
+        while (Length >= sizeof(__m128i))
+        {
+            _mm_storeu_si128((__m128i*)Destination,
+                             _mm_loadu_si128((const __m128i*)Source));
+            Destination += sizeof(__m128i);
+            Source += sizeof(__m128i);
+            Length -= (uint32_t)sizeof(__m128i);
+        }
+        if (Length == 0)
+        {
+            return;
+        }
+    }
+    CpuCopyGeneric(Destination, Source, Length);
+}
+
+MINLZ_TARGET("avx2")
+void
+CpuCopyAvx2 (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // Same as the SSE version, with 32-byte vectors
+    //
+    if ((size_t)(Destination - Source) >= sizeof(__m256i))
+    {
+        while (Length >= sizeof(__m256i))
+        {
+            _mm256_storeu_si256((__m256i*)Destination,
+                                _mm256_loadu_si256((const __m256i*)Source));
+            Destination += sizeof(__m256i);
+            Source += sizeof(__m256i);
+            Length -= (uint32_t)sizeof(__m256i);
+        }
+        if (Length == 0)
+        {
+            return;
+        }
+    }
+    CpuCopySse(Destination, Source, Length);
+}
+
+MINLZ_TARGET("avx512f")
+void
+CpuCopyAvx512 (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // Same as the SSE version, with 64-byte vectors
+    //
+    if ((size_t)(Destination - Source) >= sizeof(__m512i))
+    {
+        while (Length >= sizeof(__m512i))
+        {
+            _mm512_storeu_si512((void*)Destination,
+                                _mm512_loadu_si512((const void*)Source));
+            Destination += sizeof(__m512i);
+            Source += sizeof(__m512i);
+            Length -= (uint32_t)sizeof(__m512i);
+        }
+        if (Length == 0)
+        {
+            return;
+        }
+    }
+    CpuCopyAvx2(Destination, Source, Length);
+}
+
+void
+CpuId (
+    uint32_t Leaf,
+    uint32_t Registers[4]
+    )
+{
+#ifdef _MSC_VER
+    __cpuidex((int*)Registers, (int)Leaf, 0);
+#else
+    __cpuid_count(Leaf, 0, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+}
+
+uint64_t
+CpuGetXcr0 (
+    void
+    )
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t low, high;
+    __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((uint64_t)high << 32) | low;
+#endif
+}
+#endif
+
+CPU_LEVEL
+CpuGetSupportedLevel (
+    void
+    )
+{
+#ifdef MINLZ_X64
+    uint32_t regs[4];
+    uint32_t maxLeaf, features1, features7;
+    uint64_t xcr0;
+
+    //
+    // Read the basic (leaf 1) and extended (leaf 7) feature flags
+    //
+    CpuId(0, regs);
+    maxLeaf = regs[0];
+    CpuId(1, regs);
+    features1 = regs[2];
+    features7 = 0;
+    if (maxLeaf >= 7)
+    {
+        CpuId(7, regs);
+        features7 = regs[1];
+    }
+
+    //
+    // SSE4.2 level also requires PCLMULQDQ for the folding CRC kernels
+    //
+    if (!(features1 & (1 << 20)) || !(features1 & (1 << 1)))
+    {
+        return CpuLevelGeneric;
+    }
+
+    //
+    // AVX2 needs the CPU support, and the OS to save YMM state (XCR0 bits 1-2)
+    //
+    if (!(features1 & (1 << 27)) || !(features1 & (1 << 28)))
+    {
+        return CpuLevelSse42;
+    }
+    xcr0 = CpuGetXcr0();
+    if (((xcr0 & 0x6) != 0x6) || !(features7 & (1 << 5)))
+    {
+        return CpuLevelSse42;
+    }
+
+    //
+    // AVX-512 additionally needs the OS to save opmask and ZMM state (5-7)
+    //
+    if (((xcr0 & 0xE0) != 0xE0) || !(features7 & (1 << 16)))
+    {
+        return CpuLevelAvx2;
+    }
+    return CpuLevelAvx512;
+#else
+    return CpuLevelGeneric;
+#endif
+}
+
+void
+CpuInitialize (
+    void
+    )
+{
+    CPU_LEVEL level;
+
+    //
+    // Only resolve the dispatch table once per thread
+    //
+    if (Kernels.Initialized)
+    {
+        return;
+    }
+
+    //
+    // Pick the best level the CPU supports, unless a lower one was requested
+    //
+    level = CpuGetSupportedLevel();
+    if (CpuRequestedLevel < level)
+    {
+        level = CpuRequestedLevel;
+    }
+
+    //
+    // Start from the portable kernels and upgrade the ones that have variants
+    //
+    Kernels.Level = level;
+    Kernels.Copy = CpuCopyGeneric;
+#ifdef MINLZ_INTEGRITY_CHECKS
+    Kernels.ComputeCrc32 = XzCrc32Generic;
+    Kernels.ComputeCrc64 = XzCrc64Generic;
+#endif
+#ifdef MINLZ_X64
+    if (level >= CpuLevelSse42)
+    {
+        Kernels.Copy = CpuCopySse;
+#ifdef MINLZ_INTEGRITY_CHECKS
+        Kernels.ComputeCrc32 = XzCrc32Clmul;
+        Kernels.ComputeCrc64 = XzCrc64Clmul;
+#endif
+    }
+    if (level >= CpuLevelAvx2)
+    {
+        Kernels.Copy = CpuCopyAvx2;
+    }
+    if (level >= CpuLevelAvx512)
+    {
+        Kernels.Copy = CpuCopyAvx512;
+    }
+#endif
+    Kernels.Initialized = true;
+}
+
+bool
+XzSetCpuLevel (
+    CPU_LEVEL Level
+    )
+{
+    //
+    // Record the requested level for the calling thread, and reset its dispatch
+    // table so that the next decode picks it up. Fail if the processor can't
+    // run at the requested level.
+    //
+    if ((Level > CpuLevelBest) ||
+        ((Level != CpuLevelBest) && (Level > CpuGetSupportedLevel())))
+    {
+        return false;
+    }
+    CpuRequestedLevel = Level;
+    Kernels.Initialized = false;
+    return true;
+}
+
+CPU_LEVEL
+XzGetCpuLevel (
+    void
+    )
+{
+    //
+    // Return the level in use by the calling thread
+    //
+    CpuInitialize();
+    return Kernels.Level;
+}
@@ -28,6 +28,11 @@ Environment:
 
 #include "minlzlib.h"
 
+//
+// Shorter zero runs are not reported unless they extend a previous run
+//
+#define DT_MIN_ZERO_RUN     32
+
 //
 // State used for the history buffer (dictionary)
 //
@@ -41,8 +46,26 @@ typedef struct _DICTIONARY_STATE
     uint32_t Start;
     uint32_t Offset;
     uint32_t Limit;
+    //
+    // Set when a chunk did not fit in the buffer, so that callers can tell a
+    // buffer that is too small apart from a corrupt stream
+    //
+    bool Full;
+    //
+    // Optional caller-supplied array of zero runs seen while decoding, and the
+    // offset of the buffer in the output, which the runs are relative to
+    //
+    PZERO_RUN ZeroRuns;
+    uint32_t ZeroRunCount;
+    uint32_t ZeroRunLimit;
+    uint32_t ZeroRunBase;
+    //
+    // Optional caller-supplied allocator, which grows the buffer when a chunk
+    // does not fit in it, instead of failing the decode
+    //
+    const ALLOCATOR* Allocator;
 } DICTIONARY_STATE, *PDICTIONARY_STATE;
-DICTIONARY_STATE Dictionary;
+MINLZ_STATE DICTIONARY_STATE Dictionary;
 
 void
 DtInitialize (
@@ -57,6 +80,136 @@ DtInitialize (
     Dictionary.Buffer = HistoryBuffer;
     Dictionary.Offset = Offset;
     Dictionary.BufferSize = Size;
+    Dictionary.ZeroRunCount = 0;
+    Dictionary.ZeroRunBase = 0;
+    Dictionary.Allocator = NULL;
+    Dictionary.Full = false;
+}
+
+void
+DtSetAllocator (
+    const ALLOCATOR* Allocator
+    )
+{
+    Dictionary.Allocator = Allocator;
+}
+
+uint8_t*
+DtGetBuffer (
+    uint32_t* Size
+    )
+{
+    //
+    // Return the buffer, which may have moved if it was grown, and its size
+    //
+    *Size = Dictionary.BufferSize;
+    return Dictionary.Buffer;
+}
+
+bool
+DtGrow (
+    uint32_t Size
+    )
+{
+    uint64_t newSize;
+    uint8_t* buffer;
+
+    //
+    // Double the size of the buffer, or more if that is still not enough, as
+    // long as the output fits in 32 bits. The allocator is free to move it,
+    // since nobody holds on to a pointer into the dictionary between chunks.
+    //
+    newSize = (uint64_t)Dictionary.BufferSize * 2;
+    if (newSize < Size)
+    {
+        newSize = Size;
+    }
+    if (newSize > UINT32_MAX)
+    {
+        newSize = UINT32_MAX;
+    }
+    buffer = Dictionary.Allocator->Reallocate(Dictionary.Allocator->Context,
+                                              Dictionary.Buffer,
+                                              Dictionary.BufferSize,
+                                              (uint32_t)newSize);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    Dictionary.Buffer = buffer;
+    Dictionary.BufferSize = (uint32_t)newSize;
+    return true;
+}
+
+void
+DtRebase (
+    uint8_t* HistoryBuffer,
+    uint32_t Size,
+    uint32_t OutputOffset
+    )
+{
+    //
+    // Start a new, independent dictionary OutputOffset bytes into the output
+    // (e.g.: for the next member of an lzip file), keeping the zero runs that
+    // were seen so far
+    //
+    Dictionary.Buffer = HistoryBuffer;
+    Dictionary.Offset = 0;
+    Dictionary.BufferSize = Size;
+    Dictionary.ZeroRunBase = OutputOffset;
+}
+
+void
+DtSetZeroRunBuffer (
+    PZERO_RUN ZeroRuns,
+    uint32_t MaxZeroRuns
+    )
+{
+    //
+    // Save the array that will receive the zero runs of the next stream
+    //
+    Dictionary.ZeroRuns = ZeroRuns;
+    Dictionary.ZeroRunLimit = (ZeroRuns != NULL) ? MaxZeroRuns : 0;
+    Dictionary.ZeroRunCount = 0;
+}
+
+uint32_t
+DtGetZeroRunCount (
+    void
+    )
+{
+    return Dictionary.ZeroRunCount;
+}
+
+void
+DtRecordZeroRun (
+    uint32_t Length
+    )
+{
+    PZERO_RUN lastRun;
+
+    //
+    // Extend the last run if this one directly follows it. Otherwise, start a
+    // new run, as long as it is long enough to be worth reporting and we have
+    // space left for it.
+    //
+    if (Dictionary.ZeroRunCount != 0)
+    {
+        lastRun = &Dictionary.ZeroRuns[Dictionary.ZeroRunCount - 1];
+        if ((lastRun->Offset + lastRun->Length) ==
+            (Dictionary.ZeroRunBase + Dictionary.Offset))
+        {
+            lastRun->Length += Length;
+            return;
+        }
+    }
+    if ((Length >= DT_MIN_ZERO_RUN) &&
+        (Dictionary.ZeroRunCount < Dictionary.ZeroRunLimit))
+    {
+        lastRun = &Dictionary.ZeroRuns[Dictionary.ZeroRunCount++];
+        lastRun->Offset = Dictionary.ZeroRunBase + Dictionary.Offset;
+        lastRun->Length = Length;
+    }
 }
 
 bool
@@ -65,18 +218,33 @@ DtSetLimit (
     )
 {
     //
-    // Make sure that the passed in dictionary limit fits within the size, and
-    // then set this as the new limit. Save the starting point (current offset)
+    // Make sure that the passed in dictionary limit fits within the size, by
+    // growing the buffer if we were given an allocator, and then set this as
+    // the new limit. Save the starting point (current offset)
     //
     if ((Dictionary.Offset + Limit) > Dictionary.BufferSize)
     {
-        return false;
+        if ((Dictionary.Allocator == NULL) ||
+            (((uint64_t)Dictionary.Offset + Limit) > UINT32_MAX) ||
+            !DtGrow(Dictionary.Offset + Limit))
+        {
+            Dictionary.Full = true;
+            return false;
+        }
     }
     Dictionary.Limit = Dictionary.Offset + Limit;
     Dictionary.Start = Dictionary.Offset;
     return true;
 }
 
+bool
+DtIsFull (
+    void
+    )
+{
+    return Dictionary.Full;
+}
+
 bool
 DtIsComplete (
     uint32_t* BytesProcessed
@@ -89,6 +257,18 @@ DtIsComplete (
     return (Dictionary.Offset == Dictionary.Limit);
 }
 
+const uint8_t*
+DtGetChunk (
+    uint32_t* Size
+    )
+{
+    //
+    // Return the bytes written since the current chunk's limit was set
+    //
+    *Size = Dictionary.Offset - Dictionary.Start;
+    return &Dictionary.Buffer[Dictionary.Start];
+}
+
 bool
 DtCanWrite (
     uint32_t* Position
@@ -146,11 +326,66 @@ DtRepeatSymbol (
     }
 
     //
-    // Now rewrite the stream of past symbols forward into the dictionary.
+    // Long runs of zeroes (such as in disk images) are encoded as repeats of a
+    // zero byte at distance 1. Report them if the caller asked for it.
     //
-    do
+    if ((Distance == 1) &&
+        (Dictionary.ZeroRunLimit != 0) &&
+        (Dictionary.Buffer[Dictionary.Offset - 1] == 0))
     {
-        DtPutSymbol(DtGetSymbol(Distance));
-    } while (--Length > 0);
+        DtRecordZeroRun(Length);
+    }
+
+    //
+    // Now rewrite the stream of past symbols forward into the dictionary, with
+    // the best copy kernel for this CPU.
+    //
+    Kernels.Copy(&Dictionary.Buffer[Dictionary.Offset],
+                 &Dictionary.Buffer[Dictionary.Offset - Distance],
+                 Length);
+    Dictionary.Offset += Length;
     return true;
 }
+
+uint8_t*
+DtGetWindow (
+    uint32_t* Offset,
+    uint32_t* Limit
+    )
+{
+    //
+    // Hand out the buffer, position and limit of the current chunk to a decode
+    // loop that keeps them in locals
+    //
+    *Offset = Dictionary.Offset;
+    *Limit = Dictionary.Limit;
+    return Dictionary.Buffer;
+}
+
+void
+DtSetOffset (
+    uint32_t Offset
+    )
+{
+    //
+    // Take back the position from such a decode loop
+    //
+    Dictionary.Offset = Offset;
+}
+
+bool
+DtIsRecordingZeroRuns (
+    void
+    )
+{
+    return Dictionary.ZeroRunLimit != 0;
+}
+
+void*
+DtGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Dictionary);
+    return &Dictionary;
+}
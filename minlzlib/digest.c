@@ -0,0 +1,703 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    digest.c
+
+Abstract:
+
+    This module implements the optional digest of the decompressed output. The
+    LZMA2 decoder feeds each chunk to the digest as soon as it is complete, so
+    the bytes are hashed while they are still in the processor's caches rather
+    than in a second pass over the whole output. Built-in implementations are
+    provided for XXH3 (64-bit variant, with the default secret and a zero seed)
+    and SHA-256, and callers can also supply their own routine.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+
+//
+// XXH3 constants, see the xxHash specification
+//
+#define XXH_PRIME32_1           UINT64_C(0x9E3779B1)
+#define XXH_PRIME32_2           UINT64_C(0x85EBCA77)
+#define XXH_PRIME32_3           UINT64_C(0xC2B2AE3D)
+#define XXH_PRIME64_1           UINT64_C(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2           UINT64_C(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3           UINT64_C(0x165667B19E3779F9)
+#define XXH_PRIME64_4           UINT64_C(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5           UINT64_C(0x27D4EB2F165667C5)
+#define XXH_PRIME_MX1           UINT64_C(0x165667919E3779F9)
+#define XXH_PRIME_MX2           UINT64_C(0x9FB21C651E98DF25)
+#define XXH_STRIPE_SIZE         64
+#define XXH_STRIPES_PER_BLOCK   ((sizeof(k_Xxh3Secret) - XXH_STRIPE_SIZE) / 8)
+#define XXH_MIDSIZE_MAX         240
+#define XXH_BUFFER_SIZE         256
+
+const uint8_t k_Xxh3Secret[192] =
+{
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+//
+// SHA-256 constants, see FIPS 180-4
+//
+const uint32_t k_Sha256Initial[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const uint32_t k_Sha256Rounds[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+//
+// Digest State
+//
+typedef struct _DIGEST_STATE
+{
+    //
+    // Digest selected by the caller, or the caller's own routine
+    //
+    DIGEST_TYPE Type;
+    PDIGEST_ROUTINE Routine;
+    void* Context;
+    //
+    // Running state of the built-in digests
+    //
+    union
+    {
+        uint32_t Sha256[8];
+        struct
+        {
+            uint64_t Accumulators[8];
+            uint32_t StripeCount;
+        } Xxh3;
+    } u;
+    uint64_t TotalLength;
+    //
+    // Bytes not yet consumed by the digest. For XXH3, this also holds the last
+    // stripe that was consumed at its very end, as the final stripe overlaps it.
+    //
+    uint32_t BufferedSize;
+    uint8_t Buffer[XXH_BUFFER_SIZE];
+} DIGEST_STATE, *PDIGEST_STATE;
+MINLZ_STATE DIGEST_STATE Digest;
+
+void
+DgCopy (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // The library does not link with the C runtime, so copy bytes manually
+    //
+    while (Length-- > 0)
+    {
+        *Destination++ = *Source++;
+    }
+}
+
+uint32_t
+DgRead32 (
+    const uint8_t* Bytes
+    )
+{
+    return (uint32_t)Bytes[0] |
+           ((uint32_t)Bytes[1] << 8) |
+           ((uint32_t)Bytes[2] << 16) |
+           ((uint32_t)Bytes[3] << 24);
+}
+
+uint64_t
+DgRead64 (
+    const uint8_t* Bytes
+    )
+{
+    return (uint64_t)DgRead32(Bytes) | ((uint64_t)DgRead32(Bytes + 4) << 32);
+}
+
+uint64_t
+DgRotate64 (
+    uint64_t Value,
+    uint8_t Bits
+    )
+{
+    return (Value << Bits) | (Value >> (64 - Bits));
+}
+
+uint64_t
+DgSwap64 (
+    uint64_t Value
+    )
+{
+    uint64_t result;
+    uint8_t i;
+
+    for (i = 0, result = 0; i < 8; i++, Value >>= 8)
+    {
+        result = (result << 8) | (Value & 0xFF);
+    }
+    return result;
+}
+
+uint64_t
+DgMultiplyFold64 (
+    uint64_t Left,
+    uint64_t Right
+    )
+{
+    uint64_t ll, lh, hl, hh, cross, low, high;
+
+    //
+    // Compute the full 128-bit product from 32-bit halves, then fold its upper
+    // half into the lower half
+    //
+    ll = (Left & 0xFFFFFFFF) * (Right & 0xFFFFFFFF);
+    lh = (Left & 0xFFFFFFFF) * (Right >> 32);
+    hl = (Left >> 32) * (Right & 0xFFFFFFFF);
+    hh = (Left >> 32) * (Right >> 32);
+    cross = (ll >> 32) + (lh & 0xFFFFFFFF) + hl;
+    low = (cross << 32) | (ll & 0xFFFFFFFF);
+    high = (lh >> 32) + (cross >> 32) + hh;
+    return low ^ high;
+}
+
+uint64_t
+DgXxh64Avalanche (
+    uint64_t Hash
+    )
+{
+    Hash ^= Hash >> 33;
+    Hash *= XXH_PRIME64_2;
+    Hash ^= Hash >> 29;
+    Hash *= XXH_PRIME64_3;
+    return Hash ^ (Hash >> 32);
+}
+
+uint64_t
+DgXxh3Avalanche (
+    uint64_t Hash
+    )
+{
+    Hash ^= Hash >> 37;
+    Hash *= XXH_PRIME_MX1;
+    return Hash ^ (Hash >> 32);
+}
+
+uint64_t
+DgXxh3Mix16 (
+    const uint8_t* Input,
+    const uint8_t* Secret
+    )
+{
+    return DgMultiplyFold64(DgRead64(Input) ^ DgRead64(Secret),
+                            DgRead64(Input + 8) ^ DgRead64(Secret + 8));
+}
+
+uint64_t
+DgXxh3HashShort (
+    const uint8_t* Input,
+    uint32_t Length
+    )
+{
+    const uint8_t* secret;
+    uint64_t hash, low, high;
+    uint32_t i;
+
+    //
+    // Inputs of up to 240 bytes are hashed in one go, with a different mixing
+    // function for each range of lengths
+    //
+    secret = k_Xxh3Secret;
+    if (Length == 0)
+    {
+        return DgXxh64Avalanche(DgRead64(secret + 56) ^ DgRead64(secret + 64));
+    }
+    if (Length <= 3)
+    {
+        hash = ((uint64_t)Input[0] << 16) |
+               ((uint64_t)Input[Length >> 1] << 24) |
+               (uint64_t)Input[Length - 1] |
+               ((uint64_t)Length << 8);
+        return DgXxh64Avalanche(hash ^ (DgRead32(secret) ^ DgRead32(secret + 4)));
+    }
+    if (Length <= 8)
+    {
+        hash = ((uint64_t)DgRead32(Input) << 32) + DgRead32(Input + Length - 4);
+        hash ^= DgRead64(secret + 8) ^ DgRead64(secret + 16);
+        hash ^= DgRotate64(hash, 49) ^ DgRotate64(hash, 24);
+        hash *= XXH_PRIME_MX2;
+        hash ^= (hash >> 35) + Length;
+        hash *= XXH_PRIME_MX2;
+        return hash ^ (hash >> 28);
+    }
+    if (Length <= 16)
+    {
+        low = DgRead64(Input) ^ DgRead64(secret + 24) ^ DgRead64(secret + 32);
+        high = DgRead64(Input + Length - 8) ^ DgRead64(secret + 40) ^ DgRead64(secret + 48);
+        hash = Length + DgSwap64(low) + high + DgMultiplyFold64(low, high);
+        return DgXxh3Avalanche(hash);
+    }
+
+    //
+    // Beyond 16 bytes, mix 16-byte pairs working inwards from both ends
+    //
+    hash = Length * XXH_PRIME64_1;
+    if (Length <= 128)
+    {
+        for (i = (Length - 1) / 32; i != UINT32_MAX; i--)
+        {
+            hash += DgXxh3Mix16(Input + (16 * i), secret + (32 * i));
+            hash += DgXxh3Mix16(Input + Length - (16 * (i + 1)), secret + (32 * i) + 16);
+        }
+        return DgXxh3Avalanche(hash);
+    }
+    for (i = 0; i < 8; i++)
+    {
+        hash += DgXxh3Mix16(Input + (16 * i), secret + (16 * i));
+    }
+    hash = DgXxh3Avalanche(hash);
+    for (i = 8; i < (Length / 16); i++)
+    {
+        hash += DgXxh3Mix16(Input + (16 * i), secret + (16 * (i - 8)) + 3);
+    }
+    hash += DgXxh3Mix16(Input + Length - 16, secret + 136 - 17);
+    return DgXxh3Avalanche(hash);
+}
+
+void
+DgXxh3Stripe (
+    uint64_t Accumulators[8],
+    const uint8_t* Input,
+    const uint8_t* Secret
+    )
+{
+    uint64_t data, key;
+    uint8_t i;
+
+    for (i = 0; i < 8; i++)
+    {
+        data = DgRead64(Input + (8 * i));
+        key = data ^ DgRead64(Secret + (8 * i));
+        Accumulators[i ^ 1] += data;
+        Accumulators[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+}
+
+void
+DgXxh3ConsumeStripes (
+    const uint8_t* Input,
+    uint32_t Count
+    )
+{
+    const uint8_t* scrambleSecret;
+    uint64_t value;
+    uint8_t i;
+
+    //
+    // Each stripe uses the secret at an 8-byte offset from the previous one,
+    // until a block of stripes is complete and the accumulators get scrambled
+    //
+    scrambleSecret = &k_Xxh3Secret[sizeof(k_Xxh3Secret) - XXH_STRIPE_SIZE];
+    for (; Count != 0; Count--, Input += XXH_STRIPE_SIZE)
+    {
+        DgXxh3Stripe(Digest.u.Xxh3.Accumulators,
+                     Input,
+                     &k_Xxh3Secret[8 * Digest.u.Xxh3.StripeCount]);
+        if (++Digest.u.Xxh3.StripeCount == XXH_STRIPES_PER_BLOCK)
+        {
+            for (i = 0; i < 8; i++)
+            {
+                value = Digest.u.Xxh3.Accumulators[i];
+                value ^= value >> 47;
+                value ^= DgRead64(scrambleSecret + (8 * i));
+                Digest.u.Xxh3.Accumulators[i] = value * XXH_PRIME32_1;
+            }
+            Digest.u.Xxh3.StripeCount = 0;
+        }
+    }
+}
+
+void
+DgXxh3Update (
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+    uint32_t copy, stripes;
+
+    //
+    // Only consume the buffered bytes once more input shows up behind them,
+    // as the last (up to 240) bytes of the input are hashed differently
+    //
+    while ((Digest.BufferedSize + Length) > XXH_BUFFER_SIZE)
+    {
+        if (Digest.BufferedSize != 0)
+        {
+            copy = XXH_BUFFER_SIZE - Digest.BufferedSize;
+            DgCopy(&Digest.Buffer[Digest.BufferedSize], Buffer, copy);
+            Buffer += copy;
+            Length -= copy;
+            DgXxh3ConsumeStripes(Digest.Buffer, XXH_BUFFER_SIZE / XXH_STRIPE_SIZE);
+            Digest.BufferedSize = 0;
+            continue;
+        }
+
+        //
+        // Hash large inputs in place, always keeping at least one byte back,
+        // and save the last stripe consumed at the end of the buffer
+        //
+        stripes = (Length - 1) / XXH_STRIPE_SIZE;
+        DgXxh3ConsumeStripes(Buffer, stripes);
+        Buffer += stripes * XXH_STRIPE_SIZE;
+        Length -= stripes * XXH_STRIPE_SIZE;
+        DgCopy(&Digest.Buffer[XXH_BUFFER_SIZE - XXH_STRIPE_SIZE],
+               Buffer - XXH_STRIPE_SIZE,
+               XXH_STRIPE_SIZE);
+    }
+    DgCopy(&Digest.Buffer[Digest.BufferedSize], Buffer, Length);
+    Digest.BufferedSize += Length;
+}
+
+uint64_t
+DgXxh3Finalize (
+    void
+    )
+{
+    uint8_t lastStripe[XXH_STRIPE_SIZE];
+    const uint8_t* secret;
+    uint32_t stripes, fromPrevious;
+    uint64_t hash;
+    uint8_t i;
+
+    //
+    // Short inputs are still entirely in the buffer
+    //
+    if (Digest.TotalLength <= XXH_MIDSIZE_MAX)
+    {
+        return DgXxh3HashShort(Digest.Buffer, (uint32_t)Digest.TotalLength);
+    }
+
+    //
+    // Consume all but the last stripe, which is then hashed with a separate
+    // secret offset. If fewer than 64 bytes are buffered, the last stripe also
+    // covers the end of the previously consumed stripe.
+    //
+    secret = k_Xxh3Secret;
+    stripes = (Digest.BufferedSize - 1) / XXH_STRIPE_SIZE;
+    DgXxh3ConsumeStripes(Digest.Buffer, stripes);
+    if (Digest.BufferedSize >= XXH_STRIPE_SIZE)
+    {
+        DgCopy(lastStripe, &Digest.Buffer[Digest.BufferedSize - XXH_STRIPE_SIZE], XXH_STRIPE_SIZE);
+    }
+    else
+    {
+        fromPrevious = XXH_STRIPE_SIZE - Digest.BufferedSize;
+        DgCopy(lastStripe, &Digest.Buffer[XXH_BUFFER_SIZE - fromPrevious], fromPrevious);
+        DgCopy(&lastStripe[fromPrevious], Digest.Buffer, Digest.BufferedSize);
+    }
+    DgXxh3Stripe(Digest.u.Xxh3.Accumulators,
+                 lastStripe,
+                 &secret[sizeof(k_Xxh3Secret) - XXH_STRIPE_SIZE - 7]);
+
+    //
+    // Merge the accumulators
+    //
+    hash = Digest.TotalLength * XXH_PRIME64_1;
+    for (i = 0; i < 4; i++)
+    {
+        hash += DgMultiplyFold64(
+                    Digest.u.Xxh3.Accumulators[2 * i] ^ DgRead64(secret + 11 + (16 * i)),
+                    Digest.u.Xxh3.Accumulators[(2 * i) + 1] ^ DgRead64(secret + 19 + (16 * i)));
+    }
+    return DgXxh3Avalanche(hash);
+}
+
+uint32_t
+DgRotate32 (
+    uint32_t Value,
+    uint8_t Bits
+    )
+{
+    return (Value >> Bits) | (Value << (32 - Bits));
+}
+
+void
+DgSha256Block (
+    const uint8_t* Block
+    )
+{
+    uint32_t w[64], s[8];
+    uint32_t t1, t2;
+    uint8_t i, j;
+
+    //
+    // Expand the message schedule from the big-endian block words
+    //
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)Block[4 * i] << 24) |
+               ((uint32_t)Block[(4 * i) + 1] << 16) |
+               ((uint32_t)Block[(4 * i) + 2] << 8) |
+               (uint32_t)Block[(4 * i) + 3];
+    }
+    for (i = 16; i < 64; i++)
+    {
+        w[i] = w[i - 16] + w[i - 7] +
+               (DgRotate32(w[i - 15], 7) ^ DgRotate32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               (DgRotate32(w[i - 2], 17) ^ DgRotate32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+
+    //
+    // Run the 64 rounds of the compression function and add them to the state
+    //
+    for (i = 0; i < 8; i++)
+    {
+        s[i] = Digest.u.Sha256[i];
+    }
+    for (i = 0; i < 64; i++)
+    {
+        t1 = s[7] +
+             (DgRotate32(s[4], 6) ^ DgRotate32(s[4], 11) ^ DgRotate32(s[4], 25)) +
+             ((s[4] & s[5]) ^ (~s[4] & s[6])) +
+             k_Sha256Rounds[i] + w[i];
+        t2 = (DgRotate32(s[0], 2) ^ DgRotate32(s[0], 13) ^ DgRotate32(s[0], 22)) +
+             ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        for (j = 7; j > 0; j--)
+        {
+            s[j] = s[j - 1];
+        }
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (i = 0; i < 8; i++)
+    {
+        Digest.u.Sha256[i] += s[i];
+    }
+}
+
+void
+DgSha256Update (
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+    uint32_t copy;
+
+    //
+    // Complete any partial block first, then hash whole blocks in place
+    //
+    if (Digest.BufferedSize != 0)
+    {
+        copy = 64 - Digest.BufferedSize;
+        if (copy > Length)
+        {
+            copy = Length;
+        }
+        DgCopy(&Digest.Buffer[Digest.BufferedSize], Buffer, copy);
+        Digest.BufferedSize += copy;
+        Buffer += copy;
+        Length -= copy;
+        if (Digest.BufferedSize < 64)
+        {
+            return;
+        }
+        DgSha256Block(Digest.Buffer);
+        Digest.BufferedSize = 0;
+    }
+    for (; Length >= 64; Length -= 64, Buffer += 64)
+    {
+        DgSha256Block(Buffer);
+    }
+    DgCopy(Digest.Buffer, Buffer, Length);
+    Digest.BufferedSize = Length;
+}
+
+void
+DgSha256Finalize (
+    uint8_t Hash[32]
+    )
+{
+    uint8_t padding[72];
+    uint32_t padLength;
+    uint64_t bits;
+    uint8_t i;
+
+    //
+    // Pad with a single set bit, then zeroes up to 8 bytes short of a block,
+    // then the big-endian length of the message in bits
+    //
+    bits = Digest.TotalLength * 8;
+    padLength = ((Digest.BufferedSize < 56) ? 56 : 120) - Digest.BufferedSize;
+    padding[0] = 0x80;
+    for (i = 1; i < sizeof(padding); i++)
+    {
+        padding[i] = 0;
+    }
+    for (i = 0; i < 8; i++)
+    {
+        padding[padLength + i] = (uint8_t)(bits >> (56 - (8 * i)));
+    }
+    DgSha256Update(padding, padLength + 8);
+    for (i = 0; i < 32; i++)
+    {
+        Hash[i] = (uint8_t)(Digest.u.Sha256[i / 4] >> (24 - (8 * (i % 4))));
+    }
+}
+
+void
+DgSetDigest (
+    DIGEST_TYPE Type,
+    PDIGEST_ROUTINE Routine,
+    void* Context
+    )
+{
+    //
+    // Save the digest that will be computed by the next decodes
+    //
+    Digest.Type = Type;
+    Digest.Routine = Routine;
+    Digest.Context = Context;
+    DgInitialize();
+}
+
+void
+DgInitialize (
+    void
+    )
+{
+    //
+    // Reset the running digest at the start of a stream
+    //
+    Digest.TotalLength = 0;
+    Digest.BufferedSize = 0;
+    if (Digest.Type == DigestSha256)
+    {
+        DgCopy((uint8_t*)Digest.u.Sha256,
+               (const uint8_t*)k_Sha256Initial,
+               sizeof(Digest.u.Sha256));
+    }
+    else if (Digest.Type == DigestXxh3)
+    {
+        Digest.u.Xxh3.Accumulators[0] = XXH_PRIME32_3;
+        Digest.u.Xxh3.Accumulators[1] = XXH_PRIME64_1;
+        Digest.u.Xxh3.Accumulators[2] = XXH_PRIME64_2;
+        Digest.u.Xxh3.Accumulators[3] = XXH_PRIME64_3;
+        Digest.u.Xxh3.Accumulators[4] = XXH_PRIME64_4;
+        Digest.u.Xxh3.Accumulators[5] = XXH_PRIME32_2;
+        Digest.u.Xxh3.Accumulators[6] = XXH_PRIME64_5;
+        Digest.u.Xxh3.Accumulators[7] = XXH_PRIME32_1;
+        Digest.u.Xxh3.StripeCount = 0;
+    }
+}
+
+void
+DgUpdate (
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+    //
+    // Feed a finished chunk of output to the selected digest
+    //
+    Digest.TotalLength += Length;
+    if (Digest.Type == DigestXxh3)
+    {
+        DgXxh3Update(Buffer, Length);
+    }
+    else if (Digest.Type == DigestSha256)
+    {
+        DgSha256Update(Buffer, Length);
+    }
+    else if (Digest.Type == DigestCallback)
+    {
+        Digest.Routine(Digest.Context, Buffer, Length);
+    }
+}
+
+uint32_t
+DgGetDigest (
+    uint8_t* Hash,
+    uint32_t HashSize
+    )
+{
+    DIGEST_STATE savedState;
+    uint64_t xxh3;
+    uint32_t size;
+    uint8_t i;
+
+    //
+    // Finalizing pads and consumes the buffered bytes, so do it on a copy of
+    // the state, which lets callers query the digest more than once.
+    //
+    size = (Digest.Type == DigestSha256) ? 32 :
+           (Digest.Type == DigestXxh3) ? 8 : 0;
+    if ((size == 0) || (HashSize < size))
+    {
+        return 0;
+    }
+    savedState = Digest;
+    if (Digest.Type == DigestSha256)
+    {
+        DgSha256Finalize(Hash);
+    }
+    else
+    {
+        //
+        // Return XXH3 in its canonical (big-endian) form
+        //
+        xxh3 = DgXxh3Finalize();
+        for (i = 0; i < 8; i++)
+        {
+            Hash[i] = (uint8_t)(xxh3 >> (56 - (8 * i)));
+        }
+    }
+    Digest = savedState;
+    return size;
+}
+
+void*
+DgGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Digest);
+    return &Digest;
+}
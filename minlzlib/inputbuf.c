@@ -40,7 +40,7 @@ typedef struct _BUFFER_STATE
     uint32_t SoftLimit;
     uint32_t Size;
 } BUFFER_STATE, * PBUFFER_STATE;
-BUFFER_STATE In;
+MINLZ_STATE BUFFER_STATE In;
 
 bool
 BfAlign (
@@ -74,6 +74,23 @@ BfSetSoftLimit (
     return true;
 }
 
+bool
+BfIsAvailable (
+    uint32_t Length,
+    uint32_t Limit
+    )
+{
+    //
+    // Check if the next Length bytes of input (or all that is left, if fewer)
+    // sit below Limit, which is how much of the buffer the caller has filled
+    //
+    if ((In.Size - In.Offset) < Length)
+    {
+        Length = In.Size - In.Offset;
+    }
+    return (In.Offset + Length) <= Limit;
+}
+
 void
 BfResetSoftLimit (
     void
@@ -134,3 +151,12 @@ BfInitialize (
     In.SoftLimit = InputSize;
     In.Offset = 0;
 }
+
+void*
+BfGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(In);
+    return &In;
+}
@@ -0,0 +1,352 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzipstream.c
+
+Abstract:
+
+    This module implements the lzip container format. Each member holds a
+    single LZMA stream, which always uses the same properties as the LZMA2
+    chunks of XZ, and is terminated by an end marker instead of having a known
+    compressed size. Since only the trailer of a member records its size, the
+    members are located by walking the file backwards from its end, after which
+    each member can be decoded on its own, into its slice of the output buffer,
+    making it possible for the caller to decode members in parallel.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+#include "lzipstream.h"
+
+bool
+LpReadMember (
+    const uint8_t* InputBuffer,
+    uint32_t EndOffset,
+    PLZIP_MEMBER Member
+    )
+{
+    PLZIP_HEADER header;
+    PLZIP_TRAILER trailer;
+    uint32_t dictionarySize;
+
+    //
+    // The trailer is at the very end of the member, and tells us where its
+    // header is
+    //
+    if (EndOffset < LZIP_MIN_MEMBER_SIZE)
+    {
+        return false;
+    }
+    trailer = (PLZIP_TRAILER)&InputBuffer[EndOffset - sizeof(*trailer)];
+    if ((trailer->MemberSize < LZIP_MIN_MEMBER_SIZE) ||
+        (trailer->MemberSize > EndOffset))
+    {
+        return false;
+    }
+
+    //
+    // Validate the header, whose dictionary size must be between 4KB and 512MB
+    //
+    header = (PLZIP_HEADER)&InputBuffer[EndOffset - trailer->MemberSize];
+    if ((header->Magic != k_LzipMagic) || (header->Version != k_LzipVersion))
+    {
+        return false;
+    }
+    if ((header->DictionarySize.s.Bits < LZIP_MIN_DICTIONARY_BITS) ||
+        (header->DictionarySize.s.Bits > LZIP_MAX_DICTIONARY_BITS))
+    {
+        return false;
+    }
+    dictionarySize = 1 << header->DictionarySize.s.Bits;
+    dictionarySize -= (dictionarySize / 16) * header->DictionarySize.s.Fraction;
+    if (dictionarySize < (1 << LZIP_MIN_DICTIONARY_BITS))
+    {
+        return false;
+    }
+
+    //
+    // Our output buffer is limited to 4GB, like the input buffer
+    //
+    if (trailer->DataSize > UINT32_MAX)
+    {
+        return false;
+    }
+    Member->InputOffset = EndOffset - (uint32_t)trailer->MemberSize;
+    Member->InputSize = (uint32_t)trailer->MemberSize;
+    Member->OutputSize = (uint32_t)trailer->DataSize;
+    return true;
+}
+
+bool
+LpReadMembers (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    PLZIP_MEMBER Members,
+    uint32_t* MemberCount,
+    uint32_t* OutputSize
+    )
+{
+    LZIP_MEMBER member;
+    uint64_t totalSize;
+    uint32_t endOffset, count, i;
+
+    //
+    // Walk the members backwards, from the end of the file. Since there is no
+    // room for trailing data in the format, every byte must belong to one.
+    //
+    totalSize = 0;
+    count = 0;
+    for (endOffset = InputSize; endOffset != 0; endOffset = member.InputOffset)
+    {
+        if (!LpReadMember(InputBuffer, endOffset, &member))
+        {
+            return false;
+        }
+        totalSize += member.OutputSize;
+        if (totalSize > UINT32_MAX)
+        {
+            return false;
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        return false;
+    }
+
+    //
+    // Walk them once more to return them in order, now that we know how many
+    // there are, then lay out their output one after the other
+    //
+    if (Members != NULL)
+    {
+        if (*MemberCount < count)
+        {
+            *MemberCount = count;
+            return false;
+        }
+        i = count;
+        for (endOffset = InputSize; endOffset != 0; endOffset = Members[i].InputOffset)
+        {
+            LpReadMember(InputBuffer, endOffset, &Members[--i]);
+        }
+        for (i = 0, endOffset = 0; i < count; i++)
+        {
+            Members[i].OutputOffset = endOffset;
+            endOffset += Members[i].OutputSize;
+        }
+    }
+    *MemberCount = count;
+    *OutputSize = (uint32_t)totalSize;
+    return true;
+}
+
+bool
+LpDecodeMember (
+    const uint8_t* InputBuffer,
+    const LZIP_MEMBER* Member,
+    uint8_t* OutputBuffer
+    )
+{
+    DECODE_BUDGET budget;
+    const uint8_t* chunk;
+    uint32_t streamSize, bytesProcessed;
+    uint64_t start;
+#ifdef MINLZ_INTEGRITY_CHECKS
+    PLZIP_TRAILER trailer;
+#endif
+
+    //
+    // The LZMA stream sits between the header and the trailer, and its output
+    // goes into the slice of the output buffer that belongs to this member,
+    // with no history from the members before it
+    //
+    streamSize = Member->InputSize -
+                 (uint32_t)(sizeof(LZIP_HEADER) + sizeof(LZIP_TRAILER));
+    BfInitialize(&InputBuffer[Member->InputOffset + sizeof(LZIP_HEADER)],
+                 streamSize);
+    DtRebase(&OutputBuffer[Member->OutputOffset],
+             Member->OutputSize,
+             Member->OutputOffset);
+    if (!DtSetLimit(Member->OutputSize) ||
+        !LzInitialize(k_LzipProperties, false) ||
+        !RcInitialize(&streamSize))
+    {
+        return false;
+    }
+    LzSetTrusted(XzGetTrustedInput());
+    LzSetEngine(XzGetDecodeEngine());
+
+    //
+    // Decode the whole member, after which the end marker must follow, and the
+    // range decoder must have consumed exactly all of the compressed data
+    //
+    start = MtGetTime();
+    budget.OutputLimit = UINT32_MAX;
+    budget.Sequences = UINT32_MAX;
+    budget.InputLimit = UINT32_MAX;
+    budget.Exhausted = false;
+    if (!LzDecode(&budget) ||
+        budget.Exhausted ||
+        !DtIsComplete(&bytesProcessed) ||
+        !LzDecodeEndMarker() ||
+        !RcIsComplete(&bytesProcessed) ||
+        (bytesProcessed != streamSize))
+    {
+        return false;
+    }
+    chunk = DtGetChunk(&bytesProcessed);
+    DgUpdate(chunk, bytesProcessed);
+    start = MtAddPhaseTime(MetricsPhaseLzma, start);
+
+#ifdef MINLZ_INTEGRITY_CHECKS
+    //
+    // Like the block checks of XZ, a CRC32 mismatch is reported separately,
+    // since the member was otherwise decoded successfully. Only the full level
+    // checks it, since the data is all that there is to check.
+    //
+    if (XzGetIntegrityLevel() != IntegrityLevelFull)
+    {
+        return true;
+    }
+    trailer = (PLZIP_TRAILER)&InputBuffer[Member->InputOffset +
+                                          Member->InputSize -
+                                          sizeof(*trailer)];
+    if (Crc32(&OutputBuffer[Member->OutputOffset], Member->OutputSize) !=
+        trailer->Crc32)
+    {
+        XzSetChecksumError();
+    }
+    MtAddPhaseTime(MetricsPhaseCrc, start);
+#endif
+    return true;
+}
+
+bool
+XzGetLzipMembers (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    PLZIP_MEMBER Members,
+    uint32_t* MemberCount
+    )
+{
+    uint32_t outputSize;
+
+    return LpReadMembers(InputBuffer,
+                         InputSize,
+                         Members,
+                         MemberCount,
+                         &outputSize);
+}
+
+bool
+XzDecodeLzipMember (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    const LZIP_MEMBER* Member,
+    uint8_t* OutputBuffer
+    )
+{
+    LZIP_MEMBER member;
+    bool result;
+
+    //
+    // Make sure the member really is one, rather than trusting the caller
+    //
+    XzResetContainer();
+    if ((Member->InputOffset > InputSize) ||
+        (Member->InputSize > (InputSize - Member->InputOffset)) ||
+        !LpReadMember(InputBuffer,
+                      Member->InputOffset + Member->InputSize,
+                      &member) ||
+        (member.InputOffset != Member->InputOffset) ||
+        (member.OutputSize != Member->OutputSize))
+    {
+        return false;
+    }
+    member.OutputOffset = Member->OutputOffset;
+
+    //
+    // Decode it on its own, as if it were a stream
+    //
+    MtBeginDecode();
+    CpuInitialize();
+    DtInitialize(&OutputBuffer[member.OutputOffset], member.OutputSize, 0);
+    LzResetTokenCount();
+    DgInitialize();
+    result = LpDecodeMember(InputBuffer, &member, OutputBuffer);
+    MtEndDecode(result,
+                member.InputSize,
+                result ? member.OutputSize : 0,
+                XzChecksumError());
+    return result;
+}
+
+bool
+XzDecodeLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize
+    )
+{
+    LZIP_MEMBER member;
+    uint32_t count, outputSize, endOffset, i, j;
+    bool result;
+
+    //
+    // Locate all the members first, which also returns the total output size
+    //
+    XzResetContainer();
+    if (!LpReadMembers(InputBuffer, InputSize, NULL, &count, &outputSize))
+    {
+        return false;
+    }
+    if (OutputBuffer == NULL)
+    {
+        *OutputSize = outputSize;
+        return true;
+    }
+    if (*OutputSize < outputSize)
+    {
+        return false;
+    }
+
+    //
+    // Decode the members in order, so that the digest and the zero runs are
+    // built up in order as well. Without a C runtime, there is nowhere to keep
+    // the member list, so each member is found again from the end of the file,
+    // which is cheap given how few members there typically are.
+    //
+    MtBeginDecode();
+    CpuInitialize();
+    DtInitialize(OutputBuffer, outputSize, 0);
+    LzResetTokenCount();
+    DgInitialize();
+    result = true;
+    member.OutputOffset = 0;
+    member.OutputSize = 0;
+    for (i = 0; result && (i < count); i++)
+    {
+        member.OutputOffset += member.OutputSize;
+        for (j = i, endOffset = InputSize; j < count; j++)
+        {
+            LpReadMember(InputBuffer, endOffset, &member);
+            endOffset = member.InputOffset;
+        }
+        result = LpDecodeMember(InputBuffer, &member, OutputBuffer);
+    }
+    *OutputSize = member.OutputOffset + (result ? member.OutputSize : 0);
+    MtEndDecode(result,
+                InputSize,
+                result ? *OutputSize : 0,
+                XzChecksumError());
+    return result;
+}
@@ -0,0 +1,81 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzipstream.h
+
+Abstract:
+
+    This header file contains C-style data structures that map back to the
+    lzip file format, which is made of one or more members, each holding an
+    LZMA stream (terminated by an end marker) between a 6-byte header and a
+    20-byte trailer.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#pragma once
+#ifdef _MSC_VER
+#pragma warning(disable:4214)
+#endif
+
+//
+// These are the magic bytes at the beginning of every member, and the only
+// version of the format that records the member size in the trailer
+//
+const uint32_t k_LzipMagic = 'PIZL';
+const uint8_t k_LzipVersion = 1;
+
+//
+// The smallest possible member holds an empty LZMA stream (the 5 bytes that
+// initialize the range decoder and the end marker), while the dictionary size
+// has to be between 4KB and 512MB
+//
+#define LZIP_MIN_MEMBER_SIZE        36
+#define LZIP_MIN_DICTIONARY_BITS    12
+#define LZIP_MAX_DICTIONARY_BITS    29
+
+//
+// This describes the first 6 bytes of an lzip member. The dictionary size is
+// encoded as a power of two, minus 0-7 sixteenths of it.
+//
+#pragma pack(push, 1)
+typedef struct _LZIP_HEADER
+{
+    uint32_t Magic;
+    uint8_t Version;
+    union
+    {
+        struct
+        {
+            uint8_t Bits : 5;
+            uint8_t Fraction : 3;
+        } s;
+        uint8_t Value;
+    } DictionarySize;
+} LZIP_HEADER, *PLZIP_HEADER;
+
+//
+// This describes the last 20 bytes of an lzip member, whose sizes are those
+// of the uncompressed data and of the whole member (header and trailer too)
+//
+typedef struct _LZIP_TRAILER
+{
+    uint32_t Crc32;
+    uint64_t DataSize;
+    uint64_t MemberSize;
+} LZIP_TRAILER, *PLZIP_TRAILER;
+#pragma pack(pop)
+static_assert(sizeof(LZIP_HEADER) == 6, "Invalid lzip Header Size");
+static_assert(sizeof(LZIP_TRAILER) == 20, "Invalid lzip Trailer Size");
+
+//
+// lzip does not store the LZMA properties, as it always uses the defaults of
+// {lc = 3, lp = 0, pb = 2}
+//
+const uint8_t k_LzipProperties = (2 * 45) + (0 * 9) + 3;
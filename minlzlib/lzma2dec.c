@@ -27,29 +27,94 @@ Environment:
 #include "minlzlib.h"
 #include "lzma2dec.h"
 
+//
+// LZMA2 Stream State, which lets decoding stop in the middle of a chunk (for
+// example, once the caller's budget for this step has run out) and pick back
+// up where it left off on the next call.
+//
+typedef struct _LZMA2_STATE
+{
+    //
+    // Bytes of output produced by the chunks that were fully decoded
+    //
+    uint32_t BytesProcessed;
+    //
+    // Sizes of the LZMA chunk currently being decoded, if any
+    //
+    uint32_t RawSize;
+    uint32_t CompressedSize;
+    bool InChunk;
+} LZMA2_STATE, *PLZMA2_STATE;
+MINLZ_STATE LZMA2_STATE Lzma2;
+
+void
+Lz2Initialize (
+    void
+    )
+{
+    Lzma2.BytesProcessed = 0;
+    Lzma2.InChunk = false;
+}
+
+bool
+Lz2IsInputAvailable (
+    PDECODE_BUDGET Budget
+    )
+{
+    //
+    // Check if the whole next chunk (or the rest of the stream, which is how
+    // the end of the block, the index and the footer are covered) is in
+    //
+    return BfIsAvailable(LZMA2_MAX_CHUNK_INPUT, Budget->InputLimit);
+}
+
+bool
+Lz2IsBudgetExhausted (
+    PDECODE_BUDGET Budget
+    )
+{
+    uint32_t position;
+
+    //
+    // Check the budget between two chunks, the same way LzDecode does between
+    // two sequences, and also stop if the next chunk has not fully arrived yet
+    //
+    DtCanWrite(&position);
+    if ((position >= Budget->OutputLimit) ||
+        (Budget->Sequences == 0) ||
+        !Lz2IsInputAvailable(Budget))
+    {
+        Budget->Exhausted = true;
+    }
+    return Budget->Exhausted;
+}
+
 bool
 Lz2DecodeChunk (
-    uint32_t* BytesProcessed,
-    uint32_t RawSize,
-    uint16_t CompressedSize
+    PDECODE_BUDGET Budget
     )
 {
     uint32_t bytesProcessed;
 
     //
-    // Go and decode this chunk, sequence by sequence
+    // Go and decode this chunk, sequence by sequence, until it is done or the
+    // budget runs out
     //
-    if (!LzDecode())
+    if (!LzDecode(Budget))
     {
         return false;
     }
+    if (Budget->Exhausted)
+    {
+        return true;
+    }
 
     //
     // In a correctly formatted stream, the last arithmetic-coded sequence must
     // be zero once we finished with the last chunk. Make sure the stream ended
     // exactly where we expected it to.
     //
-    if (!RcIsComplete(&bytesProcessed) || (bytesProcessed != CompressedSize))
+    if (!RcIsComplete(&bytesProcessed) || (bytesProcessed != Lzma2.CompressedSize))
     {
         return false;
     }
@@ -58,38 +123,74 @@ Lz2DecodeChunk (
     // The entire output stream must have been written to, and the dictionary
     // must be full now.
     //
-    if (!DtIsComplete(&bytesProcessed) || (bytesProcessed != RawSize))
+    if (!DtIsComplete(&bytesProcessed) || (bytesProcessed != Lzma2.RawSize))
     {
         return false;
     }
-    *BytesProcessed += bytesProcessed;
+
+    //
+    // Hash the chunk while it is still hot in the cache
+    //
+    DgUpdate(DtGetChunk(&bytesProcessed), bytesProcessed);
+    Lzma2.BytesProcessed += bytesProcessed;
+    Lzma2.InChunk = false;
     return true;
 }
 
 bool
 Lz2DecodeStream (
     uint32_t* BytesProcessed,
-    bool GetSizeOnly
+    bool GetSizeOnly,
+    PDECODE_BUDGET Budget
     )
 {
     const uint8_t* inBytes;
     LZMA2_CONTROL_BYTE controlByte;
     uint8_t propertyByte;
-    uint32_t rawSize;
-    uint16_t compressedSize;
+    uint32_t rawSize, compressedSize;
 
-    //
-    // Read the first control byte
-    //
-    *BytesProcessed = 0;
-    while (BfRead(&controlByte.Value))
+    for (;;)
     {
+        //
+        // Finish decoding the LZMA chunk that was started, which may have been
+        // by a previous call. Having decoded that chunk, reset our soft limit
+        // (to the full input stream) so we can read the next chunk.
+        //
+        if (Lzma2.InChunk)
+        {
+            if (!Lz2DecodeChunk(Budget))
+            {
+                break;
+            }
+            if (Budget->Exhausted)
+            {
+                *BytesProcessed = Lzma2.BytesProcessed;
+                return true;
+            }
+            BfResetSoftLimit();
+        }
+
+        //
+        // Otherwise, stop at this chunk boundary if the budget has run out, or
+        // read the next control byte
+        //
+        if (!GetSizeOnly && Lz2IsBudgetExhausted(Budget))
+        {
+            *BytesProcessed = Lzma2.BytesProcessed;
+            return true;
+        }
+        if (!BfRead(&controlByte.Value))
+        {
+            break;
+        }
+
         //
         // When the LZMA2 control byte is 0, the entire stream is decoded. This
-        // is the only success path out of this function.
+        // is the only path out of this function where the stream is complete.
         //
         if (controlByte.Value == 0)
         {
+            *BytesProcessed = Lzma2.BytesProcessed;
             return true;
         }
 
@@ -108,7 +209,7 @@ Lz2DecodeStream (
         if (controlByte.u.Common.IsLzma == 1)
         {
             rawSize = controlByte.u.Lzma.RawSize << 16;
-            compressedSize = (uint16_t)(inBytes[2] << 8);
+            compressedSize = inBytes[2] << 8;
             compressedSize += inBytes[3] + 1;
         }
         else
@@ -139,16 +240,20 @@ Lz2DecodeStream (
             (controlByte.u.Lzma.ResetState == Lzma2PropertyReset))
         {
             //
-            // Read the LZMA properties and then initialize the decoder.
+            // Read the LZMA properties and then initialize the decoder, which
+            // only has to check them if we're just calculating the size.
             //
-            if (!BfRead(&propertyByte) || !LzInitialize(propertyByte))
+            if (!BfRead(&propertyByte) || !LzInitialize(propertyByte, GetSizeOnly))
             {
                 break;
             }
         }
         else if (controlByte.u.Lzma.ResetState == Lzma2SimpleReset)
         {
-            LzResetState();
+            if (!GetSizeOnly)
+            {
+                LzResetState();
+            }
         }
         else if (controlByte.u.Lzma.ResetState == Lzma2NoReset)
         {
@@ -160,7 +265,7 @@ Lz2DecodeStream (
         //
         if (GetSizeOnly)
         {
-            *BytesProcessed += rawSize;
+            Lzma2.BytesProcessed += rawSize;
             BfSeek((controlByte.u.Common.IsLzma == 1) ? compressedSize : rawSize,
                    &inBytes);
             continue;
@@ -183,10 +288,19 @@ Lz2DecodeStream (
                 DtPutSymbol(inBytes[i]);
             }
 
+            //
+            // Stored data is reported as a run of literals in the token stream
+            //
+            if (!LzRecordLiterals(rawSize))
+            {
+                return false;
+            }
+            DgUpdate(DtGetChunk(&rawSize), rawSize);
+
             //
             // Update bytes and keep going to the next chunk
             //
-            *BytesProcessed += rawSize;
+            Lzma2.BytesProcessed += rawSize;
             continue;
         }
 
@@ -213,16 +327,19 @@ Lz2DecodeStream (
         //
         // Start decoding the LZMA sequences in this chunk
         //
-        if (!Lz2DecodeChunk(BytesProcessed, rawSize, compressedSize))
-        {
-            break;
-        }
-
-        //
-        // Having decoded that chunk, reset our soft limit (to the full
-        // input stream) so we can read the next chunk.
-        //
-        BfResetSoftLimit();
+        Lzma2.RawSize = rawSize;
+        Lzma2.CompressedSize = compressedSize;
+        Lzma2.InChunk = true;
     }
+    *BytesProcessed = Lzma2.BytesProcessed;
     return false;
 }
+
+void*
+Lz2GetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Lzma2);
+    return &Lzma2;
+}
@@ -53,6 +53,13 @@ Environment:
 //
 #define LZMA_MAX_SEQUENCE_SIZE              21
 
+//
+// An LZMA2 chunk is at most 64KB of input, plus a control byte, 4 bytes of
+// sizes, and a property byte. When the input is still arriving, a chunk is only
+// started once this much of it is there, so that it never has to wait midway.
+//
+#define LZMA2_MAX_CHUNK_INPUT               (6 + (64 * 1024))
+
 //
 // This describes the different ways an LZMA2 control byte can request a reset
 //
@@ -0,0 +1,164 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzmaasm.c
+
+Abstract:
+
+    This module implements the assembly LZMA decode engine, which hands the
+    range decoder, the dictionary and the decoder's own state to the x86-64
+    decode loop in lzmax64.S, and takes them back once it returns. The loop
+    decodes the same sequences as the state machine engine in lzmafsm.c, with
+    the same checks, only checking the input once per sequence, and leaving
+    the last few sequences of each chunk to LzDecode. Runs of zeroes are handed
+    back to this module, which reports and copies them before going back in.
+
+Environment:
+
+    Linux, user mode.
+
+--*/
+
+#include "minlzlib.h"
+#include "lzmadec.h"
+#include <stddef.h>
+
+//
+// Everything the assembly loop works on, at the offsets it expects (CTX_* in
+// lzmax64.S)
+//
+typedef struct _LZ_ASM_CONTEXT
+{
+    const uint8_t* Input;
+    const uint8_t* InputLimit;
+    uint8_t* Dictionary;
+    uint16_t* Probabilities;
+    uint32_t Offset;
+    uint32_t Limit;
+    uint32_t ChunkLimit;
+    uint32_t Sequences;
+    uint32_t Range;
+    uint32_t Code;
+    uint32_t State;
+    uint32_t Rep0;
+    uint32_t Rep1;
+    uint32_t Rep2;
+    uint32_t Rep3;
+    uint32_t Length;
+    uint32_t ZeroRuns;
+} LZ_ASM_CONTEXT, *PLZ_ASM_CONTEXT;
+static_assert(offsetof(LZ_ASM_CONTEXT, Offset) == 32, "Invalid context layout");
+static_assert(offsetof(LZ_ASM_CONTEXT, Range) == 48, "Invalid context layout");
+static_assert(offsetof(LZ_ASM_CONTEXT, Rep3) == 72, "Invalid context layout");
+static_assert(offsetof(LZ_ASM_CONTEXT, ZeroRuns) == 80, "Invalid context layout");
+
+//
+// The assembly loop also expects the probabilities at these offsets (PROB_* and
+// LEN_* in lzmax64.S)
+//
+#define LA_PROBABILITY_OFFSET(Field)                                        \
+    (offsetof(DECODER_STATE, u.BitModel.Field) - offsetof(DECODER_STATE, u))
+static_assert(LA_PROBABILITY_OFFSET(Rep) == 12288, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Rep0) == 12312, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Rep0Long) == 12336, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Rep1) == 12432, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Rep2) == 12456, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(RepLen) == 12480, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Match) == 13124, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(DistSlot) == 13220, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Dist) == 13732, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(Align) == 13960, "Invalid bit model layout");
+static_assert(LA_PROBABILITY_OFFSET(MatchLen) == 13992, "Invalid bit model layout");
+static_assert(offsetof(LENGTH_DECODER_STATE, Low) == 4, "Invalid length model layout");
+static_assert(offsetof(LENGTH_DECODER_STATE, Mid) == 68, "Invalid length model layout");
+static_assert(offsetof(LENGTH_DECODER_STATE, High) == 132, "Invalid length model layout");
+
+//
+// Why the assembly loop returned
+//
+typedef enum _LZ_ASM_STATUS
+{
+    LzAsmStopped,
+    LzAsmInvalid,
+    LzAsmZeroRun
+} LZ_ASM_STATUS;
+
+uint32_t
+LzDecodeLoopX64 (
+    PLZ_ASM_CONTEXT Context
+    );
+
+bool
+LzDecodeAssembly (
+    PDECODE_BUDGET Budget
+    )
+{
+    LZ_ASM_CONTEXT context;
+    const uint8_t* inputStart;
+    uint32_t status;
+
+    //
+    // Hand the state of the range decoder, the input buffer and the dictionary
+    // to the assembly loop, along with the decoder's own
+    //
+    BfSeek(0, &inputStart);
+    context.Input = inputStart;
+    context.InputLimit = inputStart + RcGetAvailable();
+    context.Dictionary = DtGetWindow(&context.Offset, &context.ChunkLimit);
+    context.Probabilities = Decoder.u.RawProbabilities;
+    context.Limit = (Budget->OutputLimit < context.ChunkLimit) ?
+                    Budget->OutputLimit : context.ChunkLimit;
+    context.Sequences = Budget->Sequences;
+    RcGetCoder(&context.Range, &context.Code);
+    context.State = Decoder.Sequence;
+    context.Rep0 = Decoder.Rep0;
+    context.Rep1 = Decoder.Rep1;
+    context.Rep2 = Decoder.Rep2;
+    context.Rep3 = Decoder.Rep3;
+    context.Length = 0;
+    context.ZeroRuns = DtIsRecordingZeroRuns();
+
+    //
+    // The loop has already checked a run of zeroes against the dictionary when
+    // it returns one, so report it and copy it like lzmafsm.c does, then let
+    // the loop carry on
+    //
+    for (;;)
+    {
+        status = LzDecodeLoopX64(&context);
+        if (status != LzAsmZeroRun)
+        {
+            break;
+        }
+        DtSetOffset(context.Offset);
+        DtRecordZeroRun(context.Length);
+        Kernels.Copy(&context.Dictionary[context.Offset],
+                     &context.Dictionary[context.Offset - 1],
+                     context.Length);
+        context.Offset += context.Length;
+    }
+
+    //
+    // Give the state back, for LzDecode to carry on from here, and tell it if
+    // the loop stopped because the caller's budget ran out
+    //
+    BfSeek((uint32_t)(context.Input - inputStart), &inputStart);
+    RcSetCoder(context.Range, context.Code);
+    DtSetOffset(context.Offset);
+    Decoder.Sequence = (LZMA_SEQUENCE_STATE)context.State;
+    Decoder.Rep0 = context.Rep0;
+    Decoder.Rep1 = context.Rep1;
+    Decoder.Rep2 = context.Rep2;
+    Decoder.Rep3 = context.Rep3;
+    Budget->Sequences = context.Sequences;
+    if ((status == LzAsmStopped) &&
+        (context.Offset < context.ChunkLimit) &&
+        ((context.Offset >= Budget->OutputLimit) || (context.Sequences == 0)))
+    {
+        Budget->Exhausted = true;
+    }
+    return (status == LzAsmStopped);
+}
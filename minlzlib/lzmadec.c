@@ -27,77 +27,7 @@ Environment:
 #include "minlzlib.h"
 #include "lzmadec.h"
 
-//
-// Probability Bit Model for Lenghts in Rep and in Match sequences
-//
-typedef struct _LENGTH_DECODER_STATE
-{
-    //
-    // Bit Model for the choosing the type of length encoding
-    //
-    uint16_t Choice;
-    uint16_t Choice2;
-    //
-    // Bit Model for each of the length encodings
-    //
-    uint16_t Low[LZMA_POSITION_COUNT][LZMA_MAX_LOW_LENGTH];
-    uint16_t Mid[LZMA_POSITION_COUNT][LZMA_MAX_MID_LENGTH];
-    uint16_t High[LZMA_MAX_HIGH_LENGTH];
-} LENGTH_DECODER_STATE, * PLENGTH_DECODER_STATE;
-
-//
-// State used for LZMA decoding
-//
-typedef struct _DECODER_STATE
-{
-    //
-    // Current type of sequence last decoded
-    //
-    LZMA_SEQUENCE_STATE Sequence;
-    //
-    // History of last 4 decoded distances
-    //
-    uint32_t Rep0;
-    uint32_t Rep1;
-    uint32_t Rep2;
-    uint32_t Rep3;
-    //
-    // Pending length to repeat from dictionary
-    //
-    uint32_t Len;
-    //
-    // Probability Bit Models for all sequence types
-    //
-    union
-    {
-        struct
-        {
-            //
-            // Literal model
-            //
-            uint16_t Literal[LZMA_LITERAL_CODERS][LZMA_LC_MODEL_SIZE];
-            //
-            // Last-used-distance based models
-            //
-            uint16_t Rep[LzmaMaxState];
-            uint16_t Rep0[LzmaMaxState];
-            uint16_t Rep0Long[LzmaMaxState][LZMA_POSITION_COUNT];
-            uint16_t Rep1[LzmaMaxState];
-            uint16_t Rep2[LzmaMaxState];
-            LENGTH_DECODER_STATE RepLen;
-            //
-            // Explicit distance match based models
-            //
-            uint16_t Match[LzmaMaxState][LZMA_POSITION_COUNT];
-            uint16_t DistSlot[LZMA_FIRST_CONTEXT_DISTANCE_SLOT][LZMA_DISTANCE_SLOTS];
-            uint16_t Dist[(1 << 7) - LZMA_FIRST_FIXED_DISTANCE_SLOT];
-            uint16_t Align[LZMA_DISTANCE_ALIGN_SLOTS];
-            LENGTH_DECODER_STATE MatchLen;
-        } BitModel;
-        uint16_t RawProbabilities[LZMA_BIT_MODEL_SLOTS];
-    } u;
-} DECODER_STATE, *PDECODER_STATE;
-DECODER_STATE Decoder;
+MINLZ_STATE DECODER_STATE Decoder;
 
 //
 // LZMA decoding uses 3 "properties" which determine how the probability
@@ -117,6 +47,13 @@ DECODER_STATE Decoder;
 const uint8_t k_LzSupportedProperties =
     (LZMA_PB * 45) + (LZMA_LP * 9) + (LZMA_LC);
 
+//
+// Past this much output since the last reset, all of the literal coders are
+// assumed to have been used, rather than looking at each byte (see
+// LzTrackLiteralCoders)
+//
+#define LZ_MAX_TRACKED_OUTPUT   4096
+
 void
 LzSetLiteral (
     PLZMA_SEQUENCE_STATE State
@@ -411,6 +348,7 @@ LzDecodeMatch (
     // Indicate that the last sequence was a "match"
     //
     LzSetMatch(&Decoder.Sequence);
+    Decoder.TokenType = LzTokenMatch;
 }
 
 void
@@ -449,6 +387,7 @@ LzDecodeRep0(
     // position bit (0-3).
     //
     bit = RcIsBitSet(&Decoder.u.BitModel.Rep0Long[Decoder.Sequence][PosBit]);
+    Decoder.TokenType = bit ? LzTokenRep0 : LzTokenShortRep;
     LzDecodeRepLen(PosBit, bit);
 }
 
@@ -482,16 +421,19 @@ LzDecodeLongRep (
         {
             newRep = Decoder.Rep3;
             Decoder.Rep3 = Decoder.Rep2;
+            Decoder.TokenType = LzTokenRep3;
         }
         else
         {
             newRep = Decoder.Rep2;
+            Decoder.TokenType = LzTokenRep2;
         }
         Decoder.Rep2 = Decoder.Rep1;
     }
     else
     {
         newRep = Decoder.Rep1;
+        Decoder.TokenType = LzTokenRep1;
     }
     Decoder.Rep1 = Decoder.Rep0;
     Decoder.Rep0 = newRep;
@@ -531,13 +473,244 @@ LzDecodeRep (
     }
 }
 
-bool
-LzDecode (
+void
+LzSetTokenBuffer (
+    PLZ_TOKEN Tokens,
+    uint32_t MaxTokens
+    )
+{
+    //
+    // Save the array that will receive the sequences of the next stream
+    //
+    Decoder.Tokens = Tokens;
+    Decoder.TokenLimit = MaxTokens;
+    Decoder.TokenCount = 0;
+}
+
+uint32_t
+LzGetTokenCount (
     void
     )
 {
-    uint32_t position;
+    return Decoder.TokenCount;
+}
+
+void
+LzResetTokenCount (
+    void
+    )
+{
+    Decoder.TokenCount = 0;
+}
+
+bool
+LzRecordToken (
+    LZ_TOKEN_TYPE Type,
+    uint32_t Length,
+    uint32_t Distance
+    )
+{
+    PLZ_TOKEN token;
+
+    //
+    // Fail decoding if the caller's array is too small to hold the full parse
+    //
+    if (Decoder.TokenCount == Decoder.TokenLimit)
+    {
+        return false;
+    }
+    token = &Decoder.Tokens[Decoder.TokenCount++];
+    token->Type = Type;
+    token->Length = Length;
+    token->Distance = Distance;
+    return true;
+}
+
+bool
+LzRecordLiterals (
+    uint32_t Count
+    )
+{
+    PLZ_TOKEN token;
+
+    //
+    // Literals are grouped into runs, with the bytes themselves being found in
+    // the output buffer. Extend the last run if the previous sequence was also
+    // a literal, otherwise start a new run.
+    //
+    if (Decoder.Tokens == NULL)
+    {
+        return true;
+    }
+    if (Decoder.TokenCount != 0)
+    {
+        token = &Decoder.Tokens[Decoder.TokenCount - 1];
+        if (token->Type == LzTokenLiterals)
+        {
+            token->Length += Count;
+            return true;
+        }
+    }
+    return LzRecordToken(LzTokenLiterals, Count, 0);
+}
+
+uint32_t
+LzLocalIsBitSet (
+    PLOCAL_CODER Coder,
+    uint16_t* Probability
+    )
+{
+    uint32_t bound;
+
+    //
+    // Same as RcIsBitSet, on a range decoder kept in locals
+    //
+    if (Coder->Range < LZMA_RC_MIN_RANGE)
+    {
+        Coder->Range <<= 8;
+        Coder->Code = (Coder->Code << 8) | *Coder->Input++;
+    }
+    bound = (Coder->Range >> LZMA_RC_PROBABILITY_BITS) * *Probability;
+    if (Coder->Code < bound)
+    {
+        Coder->Range = bound;
+        *Probability = (uint16_t)(*Probability +
+                                  ((LZMA_RC_MAX_PROBABILITY - *Probability) >>
+                                   LZMA_RC_ADAPTATION_RATE_SHIFT));
+        return 0;
+    }
+    Coder->Range -= bound;
+    Coder->Code -= bound;
+    *Probability = (uint16_t)(*Probability -
+                              (*Probability >> LZMA_RC_ADAPTATION_RATE_SHIFT));
+    return 1;
+}
+
+bool
+LzDecodeLiteralRun (
+    uint32_t OutputLimit,
+    uint32_t* Sequences,
+    uint8_t* PosBit,
+    uint32_t* Count
+    )
+{
+    LOCAL_CODER coder;
+    const uint8_t* inputStart;
+    const uint8_t* inputLimit;
+    uint16_t* probArray;
+    uint8_t* dictionary;
+    uint32_t position, limit, sequences, symbol;
+    LZMA_SEQUENCE_STATE state;
+    uint8_t posBit;
+    bool isMatch;
+
+    //
+    // Text is mostly made of runs of literals, and once a literal has been
+    // decoded, the next one can only be a plain one (see LzDecodeLiteral). So
+    // keep the range decoder, the position, the previous byte and the state in
+    // locals, and decode literals for as long as their flags say so, within
+    // the chunk and the caller's budget. Instead of checking every input byte,
+    // the loop stops once the chunk may not have enough input left for another
+    // literal, and lets LzDecode handle the rest of it.
+    //
+    dictionary = DtGetWindow(&position, &limit);
+    if (limit > OutputLimit)
+    {
+        limit = OutputLimit;
+    }
+    BfSeek(0, &inputStart);
+    inputLimit = inputStart + RcGetAvailable();
+    coder.Input = inputStart;
+    RcGetCoder(&coder.Range, &coder.Code);
+    sequences = *Sequences;
+    state = Decoder.Sequence;
+    symbol = dictionary[position - 1];
+    isMatch = false;
+    while ((position < limit) &&
+           (sequences != 0) &&
+           ((inputLimit - coder.Input) >= LZMA_RC_MAX_LITERAL_BYTES))
+    {
+        sequences--;
+        posBit = position & (LZMA_POSITION_COUNT - 1);
+        if (LzLocalIsBitSet(&coder, &Decoder.u.BitModel.Match[state][posBit]))
+        {
+            *PosBit = posBit;
+            isMatch = true;
+            break;
+        }
+        probArray = Decoder.u.BitModel.Literal[symbol >> (8 - LZMA_LC)];
+        for (symbol = 1; symbol < (1 << 8); )
+        {
+            symbol = (symbol << 1) | LzLocalIsBitSet(&coder, &probArray[symbol]);
+        }
+        symbol &= 0xFF;
+        dictionary[position++] = (uint8_t)symbol;
+        LzSetLiteral(&state);
+        *Count += 1;
+    }
+
+    //
+    // Hand the range decoder, the position and the state back, along with what
+    // is left of the budget
+    //
+    BfSeek((uint32_t)(coder.Input - inputStart), &inputStart);
+    RcSetCoder(coder.Range, coder.Code);
+    DtSetOffset(position);
+    Decoder.Sequence = state;
+    *Sequences = sequences;
+    return isMatch;
+}
+
+bool
+LzDecodeSequences (
+    PDECODE_BUDGET Budget
+    )
+{
+    uint32_t position, outputLimit, sequences, count;
     uint8_t posBit;
+    bool isMatch;
+
+    //
+    // Input that we produced ourselves goes through the unchecked loop, unless
+    // the sequences have to be recorded, which only this loop knows how to do.
+    // The same goes for the state machine and assembly engines, which leave
+    // the end of the chunk to this loop, as they do not check every input byte.
+    //
+    if (Decoder.Trusted && (Decoder.Tokens == NULL))
+    {
+        return LzDecodeTrusted(Budget);
+    }
+    if ((Decoder.Engine == DecodeEngineStateMachine) && (Decoder.Tokens == NULL))
+    {
+        if (!LzDecodeStateMachine(Budget))
+        {
+            return false;
+        }
+        if (Budget->Exhausted)
+        {
+            return true;
+        }
+    }
+#ifdef MINLZ_ASM_DECODE
+    if ((Decoder.Engine == DecodeEngineAssembly) && (Decoder.Tokens == NULL))
+    {
+        if (!LzDecodeAssembly(Budget))
+        {
+            return false;
+        }
+        if (Budget->Exhausted)
+        {
+            return true;
+        }
+    }
+#endif
+
+    //
+    // Keep the budget in locals, as the compiler can't otherwise tell that the
+    // dictionary writes don't modify it
+    //
+    outputLimit = Budget->OutputLimit;
+    sequences = Budget->Sequences;
 
     //
     // Get the current position in dictionary, making sure we have input bytes.
@@ -546,6 +719,19 @@ LzDecode (
     //
     while (DtCanWrite(&position) && RcCanRead())
     {
+        //
+        // Stop between two sequences once the caller's budget has run out. The
+        // range decoder normalizes before each bit, so the next call can just
+        // pick up from here.
+        //
+        if ((position >= outputLimit) || (sequences == 0))
+        {
+            Budget->Sequences = sequences;
+            Budget->Exhausted = true;
+            return true;
+        }
+        sequences--;
+
         //
         // An LZMA packet begins here, which can have 3 possible initial bit
         // sequences that correspond to the type of encoding that was chosen
@@ -567,32 +753,162 @@ LzDecode (
         // buffer "Rep0" bytes and repeat that character "Len" times.
         //
         posBit = position & (LZMA_POSITION_COUNT - 1);
-        if (RcIsBitSet(&Decoder.u.BitModel.Match[Decoder.Sequence][posBit]))
+        if (!RcIsBitSet(&Decoder.u.BitModel.Match[Decoder.Sequence][posBit]))
         {
-            if (RcIsBitSet(&Decoder.u.BitModel.Rep[Decoder.Sequence]))
+            //
+            // Decode the literal, then all the literals that directly follow it
+            // in a tighter loop. When that loop stops on the flag of a match or
+            // a rep, that sequence has already begun, so decode it right away.
+            //
+            LzDecodeLiteral();
+            count = 1;
+            isMatch = LzDecodeLiteralRun(outputLimit, &sequences, &posBit, &count);
+            if ((Decoder.Tokens != NULL) && !LzRecordLiterals(count))
             {
-                LzDecodeRep(posBit);
+                return false;
             }
-            else
+            if (!isMatch)
             {
-                LzDecodeMatch(posBit);
+                continue;
             }
+        }
 
-            if (!DtRepeatSymbol(Decoder.Len, Decoder.Rep0 + 1))
-            {
-                return false;
-            }
-            Decoder.Len = 0;
+        if (RcIsBitSet(&Decoder.u.BitModel.Rep[Decoder.Sequence]))
+        {
+            LzDecodeRep(posBit);
         }
         else
         {
-            LzDecodeLiteral();
+            LzDecodeMatch(posBit);
         }
+
+        if (!DtRepeatSymbol(Decoder.Len, Decoder.Rep0 + 1))
+        {
+            return false;
+        }
+        if ((Decoder.Tokens != NULL) &&
+            !LzRecordToken(Decoder.TokenType, Decoder.Len, Decoder.Rep0 + 1))
+        {
+            return false;
+        }
+        Decoder.Len = 0;
     }
+    Budget->Sequences = sequences;
     RcNormalize();
     return (Decoder.Len == 0);
 }
 
+void
+LzTrackLiteralCoders (
+    const uint8_t* Dictionary,
+    uint32_t Start,
+    uint32_t End
+    )
+{
+    uint32_t offset;
+    uint8_t previousByte;
+
+    //
+    // Once enough output was decoded, assume that all literal coders were used
+    //
+    if ((End - Start) > (LZ_MAX_TRACKED_OUTPUT - Decoder.TrackedOutput))
+    {
+        Decoder.CleanLiteralCoders = 0;
+        return;
+    }
+    Decoder.TrackedOutput += End - Start;
+
+    //
+    // Each literal is decoded with the coder picked by the byte before it (or
+    // by a 0 at the start of the dictionary), which includes a literal whose
+    // decoding was cut short at the end
+    //
+    for (offset = Start; offset <= End; offset++)
+    {
+        previousByte = (offset != 0) ? Dictionary[offset - 1] : 0;
+        Decoder.CleanLiteralCoders = (uint8_t)(Decoder.CleanLiteralCoders &
+                                               ~(1 << (previousByte >> (8 - LZMA_LC))));
+    }
+}
+
+bool
+LzDecode (
+    PDECODE_BUDGET Budget
+    )
+{
+    const uint8_t* dictionary;
+    uint32_t start, end, limit;
+    bool result;
+
+    //
+    // Decode the sequences, then note which of the literal coders the output
+    // could have used, so that the next reset only has to go over those
+    //
+    dictionary = DtGetWindow(&start, &limit);
+    result = LzDecodeSequences(Budget);
+    if (Decoder.CleanLiteralCoders != 0)
+    {
+        DtGetWindow(&end, &limit);
+        LzTrackLiteralCoders(dictionary, start, end);
+    }
+    return result;
+}
+
+bool
+LzDecodeEndMarker (
+    void
+    )
+{
+    uint32_t position;
+    uint8_t posBit;
+
+    //
+    // Unlike LZMA2 chunks, whose sizes are known up front, LZMA streams can be
+    // terminated by an "end marker", which is a match whose distance is all
+    // ones. Once the expected number of bytes has been decoded, make sure that
+    // this is what comes next, then normalize the range decoder one last time
+    // so that its code can be checked.
+    //
+    DtCanWrite(&position);
+    posBit = position & (LZMA_POSITION_COUNT - 1);
+    if (!RcIsBitSet(&Decoder.u.BitModel.Match[Decoder.Sequence][posBit]) ||
+        RcIsBitSet(&Decoder.u.BitModel.Rep[Decoder.Sequence]))
+    {
+        return false;
+    }
+    LzDecodeMatch(posBit);
+    RcNormalize();
+
+    //
+    // The marker has nothing to copy, so don't leave its length behind for
+    // the next stream that this thread decodes
+    //
+    Decoder.Len = 0;
+    return (Decoder.Rep0 == UINT32_MAX);
+}
+
+void
+LzSetTrusted (
+    bool Trusted
+    )
+{
+    //
+    // Select the decode loop for the stream that is starting
+    //
+    Decoder.Trusted = Trusted;
+}
+
+void
+LzSetEngine (
+    DECODE_ENGINE Engine
+    )
+{
+    //
+    // Select the engine for the stream that is starting
+    //
+    Decoder.Engine = Engine;
+}
+
 void
 LzResetState (
     void
@@ -607,21 +923,50 @@ LzResetState (
     Decoder.Rep0 = Decoder.Rep1 = Decoder.Rep2 = Decoder.Rep3 = 0;
     static_assert((LZMA_BIT_MODEL_SLOTS * 2) == sizeof(Decoder.u.BitModel),
                   "Invalid size");
-    for (int i = 0; i < LZMA_BIT_MODEL_SLOTS; i++)
+
+    //
+    // The literal coders make up most of the model, and only the ones that the
+    // output since the last reset could have used have to be reset again (see
+    // LzTrackLiteralCoders), which is all it takes for a small message. The
+    // rest of the model is small enough to always be reset.
+    //
+    for (uint32_t i = 0; i < LZMA_LITERAL_CODERS; i++)
     {
-        RcSetDefaultProbability(&Decoder.u.RawProbabilities[i]);
+        if ((Decoder.CleanLiteralCoders & (1 << i)) == 0)
+        {
+            RcSetDefaultProbabilities(Decoder.u.BitModel.Literal[i],
+                                      LZMA_LC_MODEL_SIZE);
+        }
     }
+    RcSetDefaultProbabilities(
+        &Decoder.u.RawProbabilities[LZMA_LITERAL_CODERS * LZMA_LC_MODEL_SIZE],
+        LZMA_BIT_MODEL_SLOTS - (LZMA_LITERAL_CODERS * LZMA_LC_MODEL_SIZE));
+    Decoder.CleanLiteralCoders = UINT8_MAX;
+    Decoder.TrackedOutput = 0;
 }
 
 bool
 LzInitialize (
-    uint8_t Properties
+    uint8_t Properties,
+    bool CheckOnly
     )
 {
     if (Properties != k_LzSupportedProperties)
     {
         return false;
     }
-    LzResetState();
+    if (!CheckOnly)
+    {
+        LzResetState();
+    }
     return true;
 }
+
+void*
+LzGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Decoder);
+    return &Decoder;
+}
@@ -24,6 +24,37 @@ Environment:
 
 #pragma once
 
+//
+// The range decoder uses 11 probability bits, where 2048 is 100% chance of a 0
+//
+#define LZMA_RC_PROBABILITY_BITS            11
+#define LZMA_RC_MAX_PROBABILITY             (1 << LZMA_RC_PROBABILITY_BITS)
+
+//
+// The range decoder uses an exponential moving average of the last probability
+// hit (match or miss) with an adaptation rate of 5 bits (which falls in the
+// middle of its 11 bits used to encode a probability.
+//
+#define LZMA_RC_ADAPTATION_RATE_SHIFT       5
+
+//
+// The range decoder has enough precision for the range only as long as the top
+// 8 bits are still set. Once it falls below, it needs a renormalization step.
+//
+#define LZMA_RC_MIN_RANGE                   (1 << 24)
+
+//
+// A literal is made of its flag and 8 bits, each of which reads at most one
+// input byte when it normalizes the range
+//
+#define LZMA_RC_MAX_LITERAL_BYTES           9
+
+//
+// A sequence is made of at most 2 flags, then for a match, a length of up to
+// 10 bits, a distance slot of 6 bits and up to 30 distance bits
+//
+#define LZMA_RC_MAX_SEQUENCE_BYTES          (2 + 10 + 6 + 30)
+
 //
 // Literals can be 0-255 and are encoded in 3 different types of slots based on
 // the previous literal decoded and the "match byte" used.
@@ -112,3 +143,114 @@ typedef enum _LZMA_SEQUENCE_STATE
     //
     LzmaMaxState
 } LZMA_SEQUENCE_STATE, * PLZMA_SEQUENCE_STATE;
+
+//
+// Probability Bit Model for Lenghts in Rep and in Match sequences
+//
+typedef struct _LENGTH_DECODER_STATE
+{
+    //
+    // Bit Model for the choosing the type of length encoding
+    //
+    uint16_t Choice;
+    uint16_t Choice2;
+    //
+    // Bit Model for each of the length encodings
+    //
+    uint16_t Low[LZMA_POSITION_COUNT][LZMA_MAX_LOW_LENGTH];
+    uint16_t Mid[LZMA_POSITION_COUNT][LZMA_MAX_MID_LENGTH];
+    uint16_t High[LZMA_MAX_HIGH_LENGTH];
+} LENGTH_DECODER_STATE, * PLENGTH_DECODER_STATE;
+
+//
+// The range decoder, when a decode loop keeps its state in locals (see
+// RcGetCoder and RcSetCoder)
+//
+typedef struct _LOCAL_CODER
+{
+    const uint8_t* Input;
+    uint32_t Range;
+    uint32_t Code;
+} LOCAL_CODER, *PLOCAL_CODER;
+
+//
+// State used for LZMA decoding
+//
+typedef struct _DECODER_STATE
+{
+    //
+    // Current type of sequence last decoded
+    //
+    LZMA_SEQUENCE_STATE Sequence;
+    //
+    // History of last 4 decoded distances
+    //
+    uint32_t Rep0;
+    uint32_t Rep1;
+    uint32_t Rep2;
+    uint32_t Rep3;
+    //
+    // Pending length to repeat from dictionary
+    //
+    uint32_t Len;
+    //
+    // Optional caller-supplied array receiving the decoded sequences, and the
+    // type of the last non-literal sequence that was decoded
+    //
+    PLZ_TOKEN Tokens;
+    uint32_t TokenCount;
+    uint32_t TokenLimit;
+    LZ_TOKEN_TYPE TokenType;
+    //
+    // Whether the stream was produced by us, and can be decoded without the
+    // per-sequence bounds checks (see lzmatrust.c)
+    //
+    bool Trusted;
+    //
+    // Which engine decodes the sequences when they are checked (see lzmafsm.c)
+    //
+    DECODE_ENGINE Engine;
+    //
+    // Literal coders that are known to still have their default probabilities,
+    // and how much output was decoded since they were last reset, as long as
+    // it is small enough to be worth tracking (see LzTrackLiteralCoders)
+    //
+    uint8_t CleanLiteralCoders;
+    uint32_t TrackedOutput;
+    //
+    // Probability Bit Models for all sequence types
+    //
+    union
+    {
+        struct
+        {
+            //
+            // Literal model
+            //
+            uint16_t Literal[LZMA_LITERAL_CODERS][LZMA_LC_MODEL_SIZE];
+            //
+            // Last-used-distance based models
+            //
+            uint16_t Rep[LzmaMaxState];
+            uint16_t Rep0[LzmaMaxState];
+            uint16_t Rep0Long[LzmaMaxState][LZMA_POSITION_COUNT];
+            uint16_t Rep1[LzmaMaxState];
+            uint16_t Rep2[LzmaMaxState];
+            LENGTH_DECODER_STATE RepLen;
+            //
+            // Explicit distance match based models
+            //
+            uint16_t Match[LzmaMaxState][LZMA_POSITION_COUNT];
+            uint16_t DistSlot[LZMA_FIRST_CONTEXT_DISTANCE_SLOT][LZMA_DISTANCE_SLOTS];
+            uint16_t Dist[(1 << 7) - LZMA_FIRST_FIXED_DISTANCE_SLOT];
+            uint16_t Align[LZMA_DISTANCE_ALIGN_SLOTS];
+            LENGTH_DECODER_STATE MatchLen;
+        } BitModel;
+        uint16_t RawProbabilities[LZMA_BIT_MODEL_SLOTS];
+    } u;
+} DECODER_STATE, *PDECODER_STATE;
+
+//
+// The decoder state is shared with the trusted decode loop in lzmatrust.c
+//
+extern MINLZ_STATE DECODER_STATE Decoder;
@@ -0,0 +1,470 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzmafsm.c
+
+Abstract:
+
+    This module implements an alternative LZMA decode engine, written as one
+    function that works as a state machine. Where LzDecode goes through a tree
+    of calls for each sequence (LzDecodeRep, LzDecodeLongRep, LzDecodeRepLen,
+    LzDecodeLen, and the range decoder and dictionary functions under them,
+    which the compiler can't flatten across modules), this engine keeps the
+    range decoder and the dictionary in locals and decodes each part of a
+    sequence in a step of its own, jumping from one step to the next through a
+    table of label addresses where the compiler supports it (computed goto), or
+    through a switch otherwise. It makes exactly the same checks as LzDecode,
+    except for the input, which it only checks once per sequence, and leaves
+    the last few sequences of each chunk to LzDecode.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+#include "lzmadec.h"
+
+//
+// The steps of the state machine, one for each part of a sequence
+//
+typedef enum _LZ_STEP
+{
+    LzStepSequence,
+    LzStepLiteral,
+    LzStepMatchedLiteral,
+    LzStepMatchOrRep,
+    LzStepMatch,
+    LzStepRep,
+    LzStepLength,
+    LzStepDistance,
+    LzStepCopy,
+    LzStepMax
+} LZ_STEP;
+
+//
+// GCC and Clang can jump straight to the next step through the address of its
+// label. Other compilers go back to a switch between each step.
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define LZ_COMPUTED_GOTO
+#define LZ_DISPATCH(Step)       goto *k_StepLabels[(Step)]
+#else
+#define LZ_DISPATCH(Step)       do { step = (Step); goto Dispatch; } while (0)
+#endif
+
+//
+// Matches shorter than this are copied byte by byte, instead of going through
+// the copy kernel of the CPU (see cpudisp.c)
+//
+#define LS_MAX_INLINE_COPY      16
+
+//
+// The step that follows the first flag of a sequence, for each state: a plain
+// literal after a literal, a matched literal after a match or a rep, and the
+// second flag for either of them
+//
+const uint8_t k_LsFlagSteps[2][LzmaMaxState] =
+{
+    {
+        LzStepLiteral, LzStepLiteral, LzStepLiteral, LzStepLiteral,
+        LzStepLiteral, LzStepLiteral, LzStepLiteral,
+        LzStepMatchedLiteral, LzStepMatchedLiteral, LzStepMatchedLiteral,
+        LzStepMatchedLiteral, LzStepMatchedLiteral
+    },
+    {
+        LzStepMatchOrRep, LzStepMatchOrRep, LzStepMatchOrRep, LzStepMatchOrRep,
+        LzStepMatchOrRep, LzStepMatchOrRep, LzStepMatchOrRep,
+        LzStepMatchOrRep, LzStepMatchOrRep, LzStepMatchOrRep,
+        LzStepMatchOrRep, LzStepMatchOrRep
+    }
+};
+
+//
+// The sequence state that follows a literal (see LzSetLiteral)
+//
+const uint8_t k_LsLiteralState[LzmaMaxState] =
+{
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaMatchLitLitState,
+    LzmaRepLitLitState,
+    LzmaLitShortrepLitLitState,
+    LzmaMatchLitState,
+    LzmaRepLitState,
+    LzmaLitShortrepLitState,
+    LzmaMatchLitState,
+    LzmaRepLitState
+};
+
+uint32_t
+LsIsBitSet (
+    PLOCAL_CODER Coder,
+    uint16_t* Probability
+    )
+{
+    uint32_t bound;
+
+    //
+    // Same as RcIsBitSet, on a range decoder kept in locals
+    //
+    if (Coder->Range < LZMA_RC_MIN_RANGE)
+    {
+        Coder->Range <<= 8;
+        Coder->Code = (Coder->Code << 8) | *Coder->Input++;
+    }
+    bound = (Coder->Range >> LZMA_RC_PROBABILITY_BITS) * *Probability;
+    if (Coder->Code < bound)
+    {
+        Coder->Range = bound;
+        *Probability = (uint16_t)(*Probability +
+                                  ((LZMA_RC_MAX_PROBABILITY - *Probability) >>
+                                   LZMA_RC_ADAPTATION_RATE_SHIFT));
+        return 0;
+    }
+    Coder->Range -= bound;
+    Coder->Code -= bound;
+    *Probability = (uint16_t)(*Probability -
+                              (*Probability >> LZMA_RC_ADAPTATION_RATE_SHIFT));
+    return 1;
+}
+
+bool
+LzDecodeStateMachine (
+    PDECODE_BUDGET Budget
+    )
+{
+#ifdef LZ_COMPUTED_GOTO
+    static const void* const k_StepLabels[LzStepMax] =
+    {
+        &&Sequence,
+        &&Literal,
+        &&MatchedLiteral,
+        &&MatchOrRep,
+        &&Match,
+        &&Rep,
+        &&Length,
+        &&Distance,
+        &&Copy
+    };
+#else
+    LZ_STEP step;
+#endif
+    LOCAL_CODER coder;
+    PLENGTH_DECODER_STATE lenState;
+    const uint8_t* inputStart;
+    const uint8_t* inputLimit;
+    uint8_t* dictionary;
+    uint16_t* probArray;
+    uint32_t offset, chunkLimit, outputLimit, sequences, length, symbol, limit;
+    uint32_t rep0, rep1, rep2, rep3, newRep, matchByte, matchBit, bit;
+    uint8_t state, posBit, distSlot, distBits, previousByte;
+    LZ_STEP afterLength;
+    bool zeroRuns, result;
+
+    //
+    // Take the state of the range decoder, the input buffer and the dictionary
+    // into locals, along with the decoder's own
+    //
+    BfSeek(0, &inputStart);
+    inputLimit = inputStart + RcGetAvailable();
+    coder.Input = inputStart;
+    RcGetCoder(&coder.Range, &coder.Code);
+    dictionary = DtGetWindow(&offset, &chunkLimit);
+    zeroRuns = DtIsRecordingZeroRuns();
+    outputLimit = Budget->OutputLimit;
+    sequences = Budget->Sequences;
+    state = (uint8_t)Decoder.Sequence;
+    rep0 = Decoder.Rep0;
+    rep1 = Decoder.Rep1;
+    rep2 = Decoder.Rep2;
+    rep3 = Decoder.Rep3;
+    previousByte = (offset != 0) ? dictionary[offset - 1] : 0;
+    lenState = NULL;
+    posBit = 0;
+    afterLength = LzStepCopy;
+    length = 0;
+    result = true;
+    LZ_DISPATCH(LzStepSequence);
+
+#ifndef LZ_COMPUTED_GOTO
+Dispatch:
+    switch (step)
+    {
+        case LzStepSequence: goto Sequence;
+        case LzStepLiteral: goto Literal;
+        case LzStepMatchedLiteral: goto MatchedLiteral;
+        case LzStepMatchOrRep: goto MatchOrRep;
+        case LzStepMatch: goto Match;
+        case LzStepRep: goto Rep;
+        case LzStepLength: goto Length;
+        case LzStepDistance: goto Distance;
+        case LzStepCopy: goto Copy;
+        default: goto Done;
+    }
+#endif
+
+Sequence:
+    //
+    // Stop once the chunk is full, or between two sequences once the caller's
+    // budget has run out, like LzDecode. Since a sequence can't read more than
+    // LZMA_RC_MAX_SEQUENCE_BYTES, that is all of the input that is checked, and
+    // the sequences that come after that are left to LzDecode.
+    //
+    if (offset >= chunkLimit)
+    {
+        goto Done;
+    }
+    if ((offset >= outputLimit) || (sequences == 0))
+    {
+        Budget->Exhausted = true;
+        goto Done;
+    }
+    if ((inputLimit - coder.Input) < LZMA_RC_MAX_SEQUENCE_BYTES)
+    {
+        goto Done;
+    }
+    sequences--;
+    posBit = offset & (LZMA_POSITION_COUNT - 1);
+    bit = LsIsBitSet(&coder, &Decoder.u.BitModel.Match[state][posBit]);
+    LZ_DISPATCH(k_LsFlagSteps[bit][state]);
+
+Literal:
+    //
+    // {0, n} after a literal, whose bit tree is picked by the previous byte
+    //
+    probArray = Decoder.u.BitModel.Literal[previousByte >> (8 - LZMA_LC)];
+    for (symbol = 1; symbol < 0x100; )
+    {
+        symbol = (symbol << 1) | LsIsBitSet(&coder, &probArray[symbol]);
+    }
+    previousByte = (uint8_t)symbol;
+    dictionary[offset++] = previousByte;
+    state = k_LsLiteralState[state];
+    LZ_DISPATCH(LzStepSequence);
+
+MatchedLiteral:
+    //
+    // {0, n} after a match or a rep, which is decoded along with the byte at
+    // Rep0 (see RcDecodeMatchedBitTree), or 0 if it is not in the dictionary
+    //
+    probArray = Decoder.u.BitModel.Literal[previousByte >> (8 - LZMA_LC)];
+    matchByte = ((rep0 + 1) > offset) ? 0 : dictionary[offset - rep0 - 1];
+    for (symbol = 1; symbol < 0x100; matchByte <<= 1)
+    {
+        matchBit = (matchByte >> 7) & 1;
+        bit = LsIsBitSet(&coder, &probArray[symbol + (0x100 * (matchBit + 1))]);
+        symbol = (symbol << 1) | bit;
+        if (matchBit != bit)
+        {
+            while (symbol < 0x100)
+            {
+                symbol = (symbol << 1) | LsIsBitSet(&coder, &probArray[symbol]);
+            }
+            break;
+        }
+    }
+    previousByte = (uint8_t)symbol;
+    dictionary[offset++] = previousByte;
+    state = k_LsLiteralState[state];
+    LZ_DISPATCH(LzStepSequence);
+
+MatchOrRep:
+    //
+    // {1, 0} is a match, and {1, 1} is a rep
+    //
+    bit = LsIsBitSet(&coder, &Decoder.u.BitModel.Rep[state]);
+    LZ_DISPATCH(bit ? LzStepRep : LzStepMatch);
+
+Match:
+    //
+    // A match has a length, then an explicit distance, which pushes out the
+    // oldest of the recent distances
+    //
+    rep3 = rep2;
+    rep2 = rep1;
+    rep1 = rep0;
+    state = (state < LzmaMaxLitState) ? LzmaLitMatchState : LzmaNonlitMatchState;
+    lenState = &Decoder.u.BitModel.MatchLen;
+    afterLength = LzStepDistance;
+    LZ_DISPATCH(LzStepLength);
+
+Rep:
+    //
+    // A rep is either a short rep of 1 byte at Rep0, or has a length, and is
+    // at Rep0, or at one of the 3 other recent distances, which moves to the
+    // front
+    //
+    if (!LsIsBitSet(&coder, &Decoder.u.BitModel.Rep0[state]))
+    {
+        if (!LsIsBitSet(&coder, &Decoder.u.BitModel.Rep0Long[state][posBit]))
+        {
+            state = (state < LzmaMaxLitState) ?
+                    LzmaLitShortrepState : LzmaNonlitRepState;
+            length = 1;
+            LZ_DISPATCH(LzStepCopy);
+        }
+    }
+    else
+    {
+        if (!LsIsBitSet(&coder, &Decoder.u.BitModel.Rep1[state]))
+        {
+            newRep = rep1;
+        }
+        else
+        {
+            if (!LsIsBitSet(&coder, &Decoder.u.BitModel.Rep2[state]))
+            {
+                newRep = rep2;
+            }
+            else
+            {
+                newRep = rep3;
+                rep3 = rep2;
+            }
+            rep2 = rep1;
+        }
+        rep1 = rep0;
+        rep0 = newRep;
+    }
+    state = (state < LzmaMaxLitState) ? LzmaLitRepState : LzmaNonlitRepState;
+    lenState = &Decoder.u.BitModel.RepLen;
+    afterLength = LzStepCopy;
+    LZ_DISPATCH(LzStepLength);
+
+Length:
+    //
+    // Lengths of matches and reps are both decoded like LzDecodeLen does
+    //
+    if (!LsIsBitSet(&coder, &lenState->Choice))
+    {
+        probArray = lenState->Low[posBit];
+        limit = LZMA_MAX_LOW_LENGTH;
+        length = LZMA_MIN_LENGTH;
+    }
+    else if (!LsIsBitSet(&coder, &lenState->Choice2))
+    {
+        probArray = lenState->Mid[posBit];
+        limit = LZMA_MAX_MID_LENGTH;
+        length = LZMA_MIN_LENGTH + LZMA_MAX_LOW_LENGTH;
+    }
+    else
+    {
+        probArray = lenState->High;
+        limit = LZMA_MAX_HIGH_LENGTH;
+        length = LZMA_MIN_LENGTH + LZMA_MAX_LOW_LENGTH + LZMA_MAX_MID_LENGTH;
+    }
+    for (symbol = 1; symbol < limit; )
+    {
+        symbol = (symbol << 1) | LsIsBitSet(&coder, &probArray[symbol]);
+    }
+    length += symbol - limit;
+    LZ_DISPATCH(afterLength);
+
+Distance:
+    //
+    // The distance slot is picked by the length, and gives the top 2 bits of
+    // the distance along with the number of bits that follow, which are either
+    // all in a reverse bit tree, or fixed bits and the 4 aligned ones
+    //
+    probArray = Decoder.u.BitModel.DistSlot[
+        (length < (LZMA_FIRST_CONTEXT_DISTANCE_SLOT + LZMA_MIN_LENGTH)) ?
+        (length - LZMA_MIN_LENGTH) : (LZMA_FIRST_CONTEXT_DISTANCE_SLOT - 1)];
+    for (symbol = 1; symbol < LZMA_DISTANCE_SLOTS; )
+    {
+        symbol = (symbol << 1) | LsIsBitSet(&coder, &probArray[symbol]);
+    }
+    distSlot = (uint8_t)(symbol - LZMA_DISTANCE_SLOTS);
+    if (distSlot < LZMA_FIRST_CONTEXT_DISTANCE_SLOT)
+    {
+        rep0 = distSlot;
+        LZ_DISPATCH(LzStepCopy);
+    }
+    distBits = (distSlot >> 1) - 1;
+    rep0 = (0b10 | (distSlot & 1)) << distBits;
+    if (distSlot < LZMA_FIRST_FIXED_DISTANCE_SLOT)
+    {
+        probArray = &Decoder.u.BitModel.Dist[rep0 - distSlot];
+    }
+    else
+    {
+        for (symbol = 0, distBits -= LZMA_DISTANCE_ALIGN_BITS; distBits > 0; distBits--)
+        {
+            if (coder.Range < LZMA_RC_MIN_RANGE)
+            {
+                coder.Range <<= 8;
+                coder.Code = (coder.Code << 8) | *coder.Input++;
+            }
+            coder.Range >>= 1;
+            symbol <<= 1;
+            if (coder.Code >= coder.Range)
+            {
+                coder.Code -= coder.Range;
+                symbol |= 1;
+            }
+        }
+        rep0 |= symbol << LZMA_DISTANCE_ALIGN_BITS;
+        distBits = LZMA_DISTANCE_ALIGN_BITS;
+        probArray = Decoder.u.BitModel.Align;
+    }
+    for (symbol = 1, bit = 0; bit < distBits; bit++)
+    {
+        matchBit = LsIsBitSet(&coder, &probArray[symbol]);
+        symbol = (symbol << 1) | matchBit;
+        rep0 |= matchBit << bit;
+    }
+    LZ_DISPATCH(LzStepCopy);
+
+Copy:
+    //
+    // Check the match against the dictionary like DtRepeatSymbol, report it if
+    // it is a run of zeroes, then copy it forward, inline if it is short
+    //
+    if (((length + offset) > chunkLimit) || ((rep0 + 1) > offset))
+    {
+        result = false;
+        goto Done;
+    }
+    if (zeroRuns && (rep0 == 0) && (previousByte == 0))
+    {
+        DtSetOffset(offset);
+        DtRecordZeroRun(length);
+    }
+    if (length < LS_MAX_INLINE_COPY)
+    {
+        do
+        {
+            dictionary[offset] = dictionary[offset - rep0 - 1];
+            offset++;
+        } while (--length != 0);
+    }
+    else
+    {
+        Kernels.Copy(&dictionary[offset], &dictionary[offset - rep0 - 1], length);
+        offset += length;
+    }
+    previousByte = dictionary[offset - 1];
+    LZ_DISPATCH(LzStepSequence);
+
+Done:
+    //
+    // Give the state back, for LzDecode to carry on from here. The input that
+    // was read can't be past the end of the chunk.
+    //
+    BfSeek((uint32_t)(coder.Input - inputStart), &inputStart);
+    RcSetCoder(coder.Range, coder.Code);
+    DtSetOffset(offset);
+    Decoder.Sequence = (LZMA_SEQUENCE_STATE)state;
+    Decoder.Rep0 = rep0;
+    Decoder.Rep1 = rep1;
+    Decoder.Rep2 = rep2;
+    Decoder.Rep3 = rep3;
+    Budget->Sequences = sequences;
+    return result;
+}
@@ -0,0 +1,395 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    lzmatrust.c
+
+Abstract:
+
+    This module implements the LZMA decode loop used for trusted input, such as
+    streams that we produced ourselves and authenticated before decoding them.
+    It decodes the same sequences as LzDecode, but keeps the range decoder, the
+    input position and the dictionary in locals, and leaves out the checks that
+    are otherwise made for every byte and every sequence: input bytes are read
+    without checking for the end of the chunk, previous symbols are read and
+    matches are copied without checking their distance and length against the
+    dictionary. The sizes of each chunk are still validated by the LZMA2 decoder
+    once the chunk is done, so corrupt input still fails to decode, but only
+    after the fact, which is why this loop must never see untrusted input.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+#include "lzmadec.h"
+
+//
+// The sequence state that follows a literal (see LzSetLiteral)
+//
+const uint8_t k_LtLiteralState[LzmaMaxState] =
+{
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaLitLitLitState,
+    LzmaMatchLitLitState,
+    LzmaRepLitLitState,
+    LzmaLitShortrepLitLitState,
+    LzmaMatchLitState,
+    LzmaRepLitState,
+    LzmaLitShortrepLitState,
+    LzmaMatchLitState,
+    LzmaRepLitState
+};
+
+void
+LtNormalize (
+    PLOCAL_CODER Coder
+    )
+{
+    //
+    // Same as RcNormalize, without checking for the end of the input
+    //
+    if (Coder->Range < LZMA_RC_MIN_RANGE)
+    {
+        Coder->Range <<= 8;
+        Coder->Code = (Coder->Code << 8) | *Coder->Input++;
+    }
+}
+
+uint32_t
+LtIsBitSet (
+    PLOCAL_CODER Coder,
+    uint16_t* Probability
+    )
+{
+    uint32_t bound;
+
+    //
+    // Same as RcIsBitSet, with the adaptation of the probability folded in
+    //
+    LtNormalize(Coder);
+    bound = (Coder->Range >> LZMA_RC_PROBABILITY_BITS) * *Probability;
+    if (Coder->Code < bound)
+    {
+        Coder->Range = bound;
+        *Probability = (uint16_t)(*Probability +
+                                  ((LZMA_RC_MAX_PROBABILITY - *Probability) >>
+                                   LZMA_RC_ADAPTATION_RATE_SHIFT));
+        return 0;
+    }
+    Coder->Range -= bound;
+    Coder->Code -= bound;
+    *Probability = (uint16_t)(*Probability -
+                              (*Probability >> LZMA_RC_ADAPTATION_RATE_SHIFT));
+    return 1;
+}
+
+uint32_t
+LtGetBitTree (
+    PLOCAL_CODER Coder,
+    uint16_t* BitModel,
+    uint32_t Limit
+    )
+{
+    uint32_t symbol;
+
+    for (symbol = 1; symbol < Limit; )
+    {
+        symbol = (symbol << 1) | LtIsBitSet(Coder, &BitModel[symbol]);
+    }
+    return symbol - Limit;
+}
+
+uint32_t
+LtGetReverseBitTree (
+    PLOCAL_CODER Coder,
+    uint16_t* BitModel,
+    uint8_t HighestBit
+    )
+{
+    uint32_t symbol, bit, result;
+    uint8_t i;
+
+    for (i = 0, symbol = 1, result = 0; i < HighestBit; i++)
+    {
+        bit = LtIsBitSet(Coder, &BitModel[symbol]);
+        symbol = (symbol << 1) | bit;
+        result |= bit << i;
+    }
+    return result;
+}
+
+uint32_t
+LtGetFixed (
+    PLOCAL_CODER Coder,
+    uint8_t HighestBit
+    )
+{
+    uint32_t symbol;
+
+    //
+    // Same as RcGetFixed, with the 50% probability bits decoded inline
+    //
+    symbol = 0;
+    do
+    {
+        LtNormalize(Coder);
+        Coder->Range >>= 1;
+        symbol <<= 1;
+        if (Coder->Code >= Coder->Range)
+        {
+            Coder->Code -= Coder->Range;
+            symbol |= 1;
+        }
+    } while (--HighestBit > 0);
+    return symbol;
+}
+
+uint32_t
+LtDecodeMatchedLiteral (
+    PLOCAL_CODER Coder,
+    uint16_t* BitModel,
+    uint32_t MatchByte
+    )
+{
+    uint32_t symbol, matchBit, bit;
+
+    //
+    // Same as RcDecodeMatchedBitTree
+    //
+    for (symbol = 1; symbol < 0x100; MatchByte <<= 1)
+    {
+        matchBit = (MatchByte >> 7) & 1;
+        bit = LtIsBitSet(Coder, &BitModel[symbol + (0x100 * (matchBit + 1))]);
+        symbol = (symbol << 1) | bit;
+        if (matchBit != bit)
+        {
+            while (symbol < 0x100)
+            {
+                symbol = (symbol << 1) | LtIsBitSet(Coder, &BitModel[symbol]);
+            }
+            break;
+        }
+    }
+    return symbol & 0xFF;
+}
+
+uint32_t
+LtDecodeLen (
+    PLOCAL_CODER Coder,
+    PLENGTH_DECODER_STATE LenState,
+    uint8_t PosBit
+    )
+{
+    //
+    // Same as LzDecodeLen, returning the length instead of storing it
+    //
+    if (!LtIsBitSet(Coder, &LenState->Choice))
+    {
+        return LZMA_MIN_LENGTH +
+               LtGetBitTree(Coder, LenState->Low[PosBit], LZMA_MAX_LOW_LENGTH);
+    }
+    if (!LtIsBitSet(Coder, &LenState->Choice2))
+    {
+        return LZMA_MIN_LENGTH + LZMA_MAX_LOW_LENGTH +
+               LtGetBitTree(Coder, LenState->Mid[PosBit], LZMA_MAX_MID_LENGTH);
+    }
+    return LZMA_MIN_LENGTH + LZMA_MAX_LOW_LENGTH + LZMA_MAX_MID_LENGTH +
+           LtGetBitTree(Coder, LenState->High, LZMA_MAX_HIGH_LENGTH);
+}
+
+bool
+LzDecodeTrusted (
+    PDECODE_BUDGET Budget
+    )
+{
+    LOCAL_CODER coder;
+    const uint8_t* inputStart;
+    uint8_t* dictionary;
+    uint16_t* probArray;
+    uint32_t offset, chunkLimit, outputLimit, sequences, length, newRep;
+    uint32_t rep0, rep1, rep2, rep3;
+    uint8_t state, posBit, distSlot, distBits, previousByte;
+    bool zeroRuns, exhausted;
+
+    //
+    // Take the state of the range decoder, the input buffer and the dictionary
+    // into locals, along with the decoder's own
+    //
+    BfSeek(0, &inputStart);
+    coder.Input = inputStart;
+    RcGetCoder(&coder.Range, &coder.Code);
+    dictionary = DtGetWindow(&offset, &chunkLimit);
+    zeroRuns = DtIsRecordingZeroRuns();
+    outputLimit = Budget->OutputLimit;
+    sequences = Budget->Sequences;
+    state = (uint8_t)Decoder.Sequence;
+    rep0 = Decoder.Rep0;
+    rep1 = Decoder.Rep1;
+    rep2 = Decoder.Rep2;
+    rep3 = Decoder.Rep3;
+    previousByte = (offset != 0) ? dictionary[offset - 1] : 0;
+    exhausted = false;
+
+    //
+    // Decode sequences until the chunk is full. The only check that is left is
+    // the caller's budget, between two sequences, like in LzDecode.
+    //
+    while (offset < chunkLimit)
+    {
+        if ((offset >= outputLimit) || (sequences == 0))
+        {
+            exhausted = true;
+            break;
+        }
+        sequences--;
+
+        //
+        // {0, n} is a literal, whose bit tree is picked by the previous byte,
+        // and which is decoded along with the byte at Rep0 if it follows a
+        // match or a rep
+        //
+        posBit = offset & (LZMA_POSITION_COUNT - 1);
+        if (!LtIsBitSet(&coder, &Decoder.u.BitModel.Match[state][posBit]))
+        {
+            probArray = Decoder.u.BitModel.Literal[previousByte >> (8 - LZMA_LC)];
+            if (state < LzmaMaxLitState)
+            {
+                previousByte = (uint8_t)LtGetBitTree(&coder, probArray, 0x100);
+            }
+            else
+            {
+                previousByte = (uint8_t)
+                    LtDecodeMatchedLiteral(&coder,
+                                           probArray,
+                                           dictionary[offset - rep0 - 1]);
+            }
+            dictionary[offset++] = previousByte;
+            state = k_LtLiteralState[state];
+            continue;
+        }
+
+        if (LtIsBitSet(&coder, &Decoder.u.BitModel.Rep[state]))
+        {
+            //
+            // {1, 1} is a rep: a short rep of 1 byte at Rep0, a long rep0, or
+            // a long rep of one of the 3 other recent distances, which moves
+            // to the front
+            //
+            if (!LtIsBitSet(&coder, &Decoder.u.BitModel.Rep0[state]))
+            {
+                if (!LtIsBitSet(&coder, &Decoder.u.BitModel.Rep0Long[state][posBit]))
+                {
+                    length = 1;
+                    state = (state < LzmaMaxLitState) ?
+                            LzmaLitShortrepState : LzmaNonlitRepState;
+                    goto Repeat;
+                }
+            }
+            else
+            {
+                if (!LtIsBitSet(&coder, &Decoder.u.BitModel.Rep1[state]))
+                {
+                    newRep = rep1;
+                }
+                else
+                {
+                    if (!LtIsBitSet(&coder, &Decoder.u.BitModel.Rep2[state]))
+                    {
+                        newRep = rep2;
+                    }
+                    else
+                    {
+                        newRep = rep3;
+                        rep3 = rep2;
+                    }
+                    rep2 = rep1;
+                }
+                rep1 = rep0;
+                rep0 = newRep;
+            }
+            length = LtDecodeLen(&coder, &Decoder.u.BitModel.RepLen, posBit);
+            state = (state < LzmaMaxLitState) ? LzmaLitRepState : LzmaNonlitRepState;
+        }
+        else
+        {
+            //
+            // {1, 0} is a match with an explicit distance (see LzDecodeMatch)
+            //
+            length = LtDecodeLen(&coder, &Decoder.u.BitModel.MatchLen, posBit);
+            rep3 = rep2;
+            rep2 = rep1;
+            rep1 = rep0;
+            probArray = Decoder.u.BitModel.DistSlot[
+                (length < (LZMA_FIRST_CONTEXT_DISTANCE_SLOT + LZMA_MIN_LENGTH)) ?
+                (length - LZMA_MIN_LENGTH) : (LZMA_FIRST_CONTEXT_DISTANCE_SLOT - 1)];
+            distSlot = (uint8_t)LtGetBitTree(&coder, probArray, LZMA_DISTANCE_SLOTS);
+            if (distSlot < LZMA_FIRST_CONTEXT_DISTANCE_SLOT)
+            {
+                rep0 = distSlot;
+            }
+            else
+            {
+                distBits = (distSlot >> 1) - 1;
+                rep0 = (0b10 | (distSlot & 1)) << distBits;
+                if (distSlot < LZMA_FIRST_FIXED_DISTANCE_SLOT)
+                {
+                    probArray = &Decoder.u.BitModel.Dist[rep0 - distSlot];
+                }
+                else
+                {
+                    rep0 |= LtGetFixed(&coder, distBits - LZMA_DISTANCE_ALIGN_BITS) <<
+                            LZMA_DISTANCE_ALIGN_BITS;
+                    distBits = LZMA_DISTANCE_ALIGN_BITS;
+                    probArray = Decoder.u.BitModel.Align;
+                }
+                rep0 |= LtGetReverseBitTree(&coder, probArray, distBits);
+            }
+            state = (state < LzmaMaxLitState) ? LzmaLitMatchState : LzmaNonlitMatchState;
+        }
+
+    Repeat:
+        //
+        // Copy the match forward, reporting runs of zeroes as DtRepeatSymbol
+        // does, which needs the dictionary to know where we are
+        //
+        if (zeroRuns && (rep0 == 0) && (previousByte == 0))
+        {
+            DtSetOffset(offset);
+            DtRecordZeroRun(length);
+        }
+        Kernels.Copy(&dictionary[offset], &dictionary[offset - rep0 - 1], length);
+        offset += length;
+        previousByte = dictionary[offset - 1];
+    }
+
+    //
+    // Normalize the last bit once the chunk is full, as LzDecode does, then
+    // give the state back. Reading past the end of the chunk can only happen
+    // with corrupt input, which is reported as early as we can.
+    //
+    if (!exhausted)
+    {
+        LtNormalize(&coder);
+    }
+    if (!BfSeek((uint32_t)(coder.Input - inputStart), &inputStart))
+    {
+        return false;
+    }
+    RcSetCoder(coder.Range, coder.Code);
+    DtSetOffset(offset);
+    Decoder.Sequence = (LZMA_SEQUENCE_STATE)state;
+    Decoder.Rep0 = rep0;
+    Decoder.Rep1 = rep1;
+    Decoder.Rep2 = rep2;
+    Decoder.Rep3 = rep3;
+    Budget->Sequences = sequences;
+    Budget->Exhausted |= exhausted;
+    return true;
+}
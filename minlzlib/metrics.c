@@ -0,0 +1,217 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    metrics.c
+
+Abstract:
+
+    This module implements the process-wide decoder metrics: how many streams
+    were decoded (and how many failed), how many bytes went in and came out,
+    how many checksum errors were seen, and where the time went, split between
+    the LZMA decoder, the block checksum and the rest of the container parsing,
+    along with a log2 histogram of the decode latencies. Every thread updates
+    the same counters with relaxed atomic additions once per decode, so there
+    is no lock to take, and the hot decoding loops are never touched. Timing is
+    only collected once the caller has installed a clock, since the library
+    itself has no time source in kernel mode.
+
+Environment:
+
+    Windows & Linux, user mode and kernel mode.
+
+--*/
+
+#include "minlzlib.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//
+// Counters shared by all threads, and the clock used to time the decodes
+//
+METRICS Metrics;
+PCLOCK_ROUTINE MetricsClock;
+
+//
+// Timing of the decode in progress on this thread. A stream that is decoded
+// in steps is only timed while it is being stepped.
+//
+typedef struct _DECODE_TIMES
+{
+    uint64_t Start;
+    uint64_t Active;
+    uint64_t Phases[MetricsPhaseMax];
+} DECODE_TIMES, *PDECODE_TIMES;
+MINLZ_STATE DECODE_TIMES Times;
+
+void
+MtSetClock (
+    PCLOCK_ROUTINE Clock
+    )
+{
+    //
+    // The clock returns a monotonic time in nanoseconds. Passing NULL turns
+    // timing off, leaving only the counters.
+    //
+    MetricsClock = Clock;
+}
+
+uint64_t
+MtGetTime (
+    void
+    )
+{
+    PCLOCK_ROUTINE clock;
+
+    clock = MetricsClock;
+    return (clock != NULL) ? clock() : 0;
+}
+
+void
+MtBeginDecode (
+    void
+    )
+{
+    uint32_t i;
+
+    for (i = 0; i < MetricsPhaseMax; i++)
+    {
+        Times.Phases[i] = 0;
+    }
+    Times.Active = 0;
+    Times.Start = MtGetTime();
+}
+
+uint64_t
+MtResumeDecode (
+    void
+    )
+{
+    Times.Start = MtGetTime();
+    return Times.Start;
+}
+
+void
+MtSuspendDecode (
+    void
+    )
+{
+    uint64_t now;
+
+    //
+    // The clock may have been installed or removed between two steps
+    //
+    now = MtGetTime();
+    if ((now != 0) && (Times.Start != 0))
+    {
+        Times.Active += now - Times.Start;
+    }
+}
+
+uint64_t
+MtAddPhaseTime (
+    METRICS_PHASE Phase,
+    uint64_t Start
+    )
+{
+    uint64_t now;
+
+    //
+    // Return the end of this phase, so the caller can start the next one at
+    // the same time without reading the clock again
+    //
+    now = MtGetTime();
+    Times.Phases[Phase] += now - Start;
+    return now;
+}
+
+void
+MtEndDecode (
+    bool Succeeded,
+    uint32_t InputSize,
+    uint32_t OutputSize,
+    bool ChecksumError
+    )
+{
+    uint64_t total, phases, value;
+    uint32_t bucket;
+
+    //
+    // Account for the decode itself
+    //
+    MINLZ_ATOMIC_ADD(&Metrics.DecodesStarted, 1);
+    if (!Succeeded)
+    {
+        MINLZ_ATOMIC_ADD(&Metrics.DecodesFailed, 1);
+    }
+    if (ChecksumError)
+    {
+        MINLZ_ATOMIC_ADD(&Metrics.ChecksumErrors, 1);
+    }
+    MINLZ_ATOMIC_ADD(&Metrics.CompressedBytes, InputSize);
+    MINLZ_ATOMIC_ADD(&Metrics.DecompressedBytes, OutputSize);
+
+    //
+    // Without a clock (or if it was only installed during this decode), there
+    // is no time to account for
+    //
+    if ((MetricsClock == NULL) || (Times.Start == 0))
+    {
+        return;
+    }
+    total = Times.Active + MtGetTime() - Times.Start;
+    phases = Times.Phases[MetricsPhaseLzma] + Times.Phases[MetricsPhaseCrc];
+    MINLZ_ATOMIC_ADD(&Metrics.LzmaTime, Times.Phases[MetricsPhaseLzma]);
+    MINLZ_ATOMIC_ADD(&Metrics.CrcTime, Times.Phases[MetricsPhaseCrc]);
+    MINLZ_ATOMIC_ADD(&Metrics.ContainerTime, (total > phases) ? (total - phases) : 0);
+
+    //
+    // Bucket 0 counts decodes under 1us (2^10ns), and each following bucket
+    // counts the ones under twice the previous limit. The last one takes the
+    // rest.
+    //
+    for (bucket = 0, value = total >> 10;
+         (value != 0) && (bucket < (METRICS_LATENCY_BUCKETS - 1));
+         bucket++)
+    {
+        value >>= 1;
+    }
+    MINLZ_ATOMIC_ADD(&Metrics.LatencyBuckets[bucket], 1);
+}
+
+void
+MtGetMetrics (
+    PMETRICS Snapshot
+    )
+{
+    uint32_t i;
+
+    //
+    // Each counter is read atomically, but the snapshot as a whole is not, so
+    // decodes finishing meanwhile may only be partially reflected in it
+    //
+    Snapshot->DecodesStarted = MINLZ_ATOMIC_READ(&Metrics.DecodesStarted);
+    Snapshot->DecodesFailed = MINLZ_ATOMIC_READ(&Metrics.DecodesFailed);
+    Snapshot->CompressedBytes = MINLZ_ATOMIC_READ(&Metrics.CompressedBytes);
+    Snapshot->DecompressedBytes = MINLZ_ATOMIC_READ(&Metrics.DecompressedBytes);
+    Snapshot->ChecksumErrors = MINLZ_ATOMIC_READ(&Metrics.ChecksumErrors);
+    Snapshot->LzmaTime = MINLZ_ATOMIC_READ(&Metrics.LzmaTime);
+    Snapshot->CrcTime = MINLZ_ATOMIC_READ(&Metrics.CrcTime);
+    Snapshot->ContainerTime = MINLZ_ATOMIC_READ(&Metrics.ContainerTime);
+    for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        Snapshot->LatencyBuckets[i] = MINLZ_ATOMIC_READ(&Metrics.LatencyBuckets[i]);
+    }
+}
+
+void*
+MtGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Times);
+    return &Times;
+}
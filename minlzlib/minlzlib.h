@@ -32,6 +32,99 @@ Environment:
 #include <stdbool.h>
 #include <assert.h>
 
+//
+// The decoder keeps its input, dictionary, range coder, LZMA and container
+// state in module-level globals. Multi-threaded user-mode builds give each
+// thread its own copy, so that independent streams can be decoded at the same
+// time (one stream per thread). Kernel-mode and single-threaded builds keep
+// plain globals.
+//
+#ifdef MINLZ_MULTI_THREADED
+#ifdef _MSC_VER
+#define MINLZ_STATE __declspec(thread)
+#else
+#define MINLZ_STATE _Thread_local
+#endif
+#else
+#define MINLZ_STATE
+#endif
+
+//
+// The vector kernels are only built for x64 user mode, since kernel-mode code
+// would otherwise have to save the extended processor state around decoding.
+// Each of them is compiled for its own instruction set, and only called when
+// the CPU supports it.
+//
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_KERNEL_MODE)
+#define MINLZ_X64 1
+#ifdef _MSC_VER
+#define MINLZ_TARGET(x)
+#else
+#define MINLZ_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+//
+// CPU Feature Levels, each of which implies the previous ones
+//
+typedef enum _CPU_LEVEL
+{
+    CpuLevelGeneric,
+    CpuLevelSse42,
+    CpuLevelAvx2,
+    CpuLevelAvx512,
+    CpuLevelBest
+} CPU_LEVEL;
+
+//
+// Hot Kernels, selected based on the CPU level
+//
+typedef struct _KERNEL_DISPATCH
+{
+    void (*Copy)(uint8_t* Destination, const uint8_t* Source, uint32_t Length);
+    uint32_t (*ComputeCrc32)(uint32_t Crc, const uint8_t* Buffer, uint32_t Length);
+    uint64_t (*ComputeCrc64)(uint64_t Crc, const uint8_t* Buffer, uint32_t Length);
+    CPU_LEVEL Level;
+    bool Initialized;
+} KERNEL_DISPATCH, *PKERNEL_DISPATCH;
+extern MINLZ_STATE KERNEL_DISPATCH Kernels;
+
+//
+// CPU Feature Dispatch
+//
+void CpuInitialize(void);
+CPU_LEVEL CpuGetSupportedLevel(void);
+bool XzSetCpuLevel(CPU_LEVEL Level);
+CPU_LEVEL XzGetCpuLevel(void);
+
+//
+// Integrity Levels, each of which implies the previous ones
+//
+typedef enum _INTEGRITY_LEVEL
+{
+    IntegrityLevelNone,
+    IntegrityLevelMeta,
+    IntegrityLevelFull,
+    IntegrityLevelBest
+} INTEGRITY_LEVEL;
+bool XzSetIntegrityLevel(INTEGRITY_LEVEL Level);
+INTEGRITY_LEVEL XzGetIntegrityLevel(void);
+void XzSetTrustedInput(bool Trusted);
+bool XzGetTrustedInput(void);
+
+//
+// Decode Engine Selection
+//
+typedef enum _DECODE_ENGINE
+{
+    DecodeEngineCallTree,
+    DecodeEngineStateMachine,
+    DecodeEngineAssembly,
+    DecodeEngineMax
+} DECODE_ENGINE;
+bool XzSetDecodeEngine(DECODE_ENGINE Engine);
+DECODE_ENGINE XzGetDecodeEngine(void);
+
 //
 // Input Buffer Management
 //
@@ -40,18 +133,109 @@ bool BfSeek(uint32_t Length, const uint8_t** Bytes);
 bool BfAlign(void);
 void BfInitialize(const uint8_t* InputBuffer, uint32_t InputSize);
 bool BfSetSoftLimit(uint32_t Remaining);
+bool BfIsAvailable(uint32_t Length, uint32_t Limit);
 void BfResetSoftLimit(void);
+void* BfGetState(uint32_t* Size);
 
 //
 // Dictionary (History Buffer) Management
 //
+typedef struct _ZERO_RUN
+{
+    uint32_t Offset;
+    uint32_t Length;
+} ZERO_RUN, *PZERO_RUN;
+typedef void* (*PALLOCATE_ROUTINE)(void* Context, uint32_t Size);
+typedef void* (*PREALLOCATE_ROUTINE)(void* Context, void* Buffer, uint32_t OldSize, uint32_t NewSize);
+typedef void (*PFREE_ROUTINE)(void* Context, void* Buffer, uint32_t Size);
+typedef struct _ALLOCATOR
+{
+    PALLOCATE_ROUTINE Allocate;
+    PREALLOCATE_ROUTINE Reallocate;
+    PFREE_ROUTINE Free;
+    void* Context;
+} ALLOCATOR, *PALLOCATOR;
+void DtSetAllocator(const ALLOCATOR* Allocator);
+uint8_t* DtGetBuffer(uint32_t* Size);
+bool DtGrow(uint32_t Size);
+void DtSetZeroRunBuffer(PZERO_RUN ZeroRuns, uint32_t MaxZeroRuns);
+uint32_t DtGetZeroRunCount(void);
 bool DtRepeatSymbol(uint32_t Length, uint32_t Distance);
 void DtInitialize(uint8_t* HistoryBuffer, uint32_t Position, uint32_t Offset);
+void DtRebase(uint8_t* HistoryBuffer, uint32_t Size, uint32_t OutputOffset);
 bool DtSetLimit(uint32_t Limit);
+bool DtIsFull(void);
 void DtPutSymbol(uint8_t Symbol);
 uint8_t DtGetSymbol(uint32_t Distance);
 bool DtCanWrite(uint32_t* Position);
 bool DtIsComplete(uint32_t* BytesProcessed);
+const uint8_t* DtGetChunk(uint32_t* Size);
+uint8_t* DtGetWindow(uint32_t* Offset, uint32_t* Limit);
+void DtSetOffset(uint32_t Offset);
+bool DtIsRecordingZeroRuns(void);
+void DtRecordZeroRun(uint32_t Length);
+void* DtGetState(uint32_t* Size);
+
+//
+// Output Digest
+//
+typedef enum _DIGEST_TYPE
+{
+    DigestNone,
+    DigestXxh3,
+    DigestSha256,
+    DigestCallback
+} DIGEST_TYPE;
+typedef void (*PDIGEST_ROUTINE)(void* Context, const uint8_t* Buffer, uint32_t Length);
+void DgSetDigest(DIGEST_TYPE Type, PDIGEST_ROUTINE Routine, void* Context);
+void DgInitialize(void);
+void DgUpdate(const uint8_t* Buffer, uint32_t Length);
+uint32_t DgGetDigest(uint8_t* Hash, uint32_t HashSize);
+void* DgGetState(uint32_t* Size);
+
+//
+// Decoder Metrics, shared by all threads and updated with relaxed atomics
+//
+#ifdef _MSC_VER
+#define MINLZ_ATOMIC_ADD(Target, Value) \
+    _InterlockedExchangeAdd64((volatile long long*)(Target), (long long)(Value))
+#define MINLZ_ATOMIC_READ(Target) \
+    (uint64_t)_InterlockedCompareExchange64((volatile long long*)(Target), 0, 0)
+#else
+#define MINLZ_ATOMIC_ADD(Target, Value) \
+    __atomic_fetch_add((Target), (Value), __ATOMIC_RELAXED)
+#define MINLZ_ATOMIC_READ(Target) \
+    __atomic_load_n((Target), __ATOMIC_RELAXED)
+#endif
+#define METRICS_LATENCY_BUCKETS 32
+typedef enum _METRICS_PHASE
+{
+    MetricsPhaseLzma,
+    MetricsPhaseCrc,
+    MetricsPhaseMax
+} METRICS_PHASE;
+typedef struct _METRICS
+{
+    uint64_t DecodesStarted;
+    uint64_t DecodesFailed;
+    uint64_t CompressedBytes;
+    uint64_t DecompressedBytes;
+    uint64_t ChecksumErrors;
+    uint64_t LzmaTime;
+    uint64_t CrcTime;
+    uint64_t ContainerTime;
+    uint64_t LatencyBuckets[METRICS_LATENCY_BUCKETS];
+} METRICS, *PMETRICS;
+typedef uint64_t (*PCLOCK_ROUTINE)(void);
+void MtSetClock(PCLOCK_ROUTINE Clock);
+uint64_t MtGetTime(void);
+void MtBeginDecode(void);
+uint64_t MtResumeDecode(void);
+void MtSuspendDecode(void);
+uint64_t MtAddPhaseTime(METRICS_PHASE Phase, uint64_t Start);
+void MtEndDecode(bool Succeeded, uint32_t InputSize, uint32_t OutputSize, bool ChecksumError);
+void MtGetMetrics(PMETRICS Snapshot);
+void* MtGetState(uint32_t* Size);
 
 //
 // Range Decoder
@@ -60,24 +244,119 @@ uint8_t RcGetBitTree(uint16_t* BitModel, uint16_t Limit);
 uint8_t RcGetReverseBitTree(uint16_t* BitModel, uint8_t HighestBit);
 uint8_t RcDecodeMatchedBitTree(uint16_t* BitModel, uint8_t MatchByte);
 uint32_t RcGetFixed(uint8_t HighestBit);
-bool RcInitialize(uint16_t* ChunkSize);
+bool RcInitialize(uint32_t* ChunkSize);
 uint8_t RcIsBitSet(uint16_t* Probability);
 void RcNormalize(void);
 bool RcCanRead(void);
 bool RcIsComplete(uint32_t* Offset);
-void RcSetDefaultProbability(uint16_t* Probability);
+void RcSetDefaultProbabilities(uint16_t* Probabilities, uint32_t Count);
+void RcGetCoder(uint32_t* Range, uint32_t* Code);
+void RcSetCoder(uint32_t Range, uint32_t Code);
+uint32_t RcGetAvailable(void);
+void* RcGetState(uint32_t* Size);
 
 //
 // LZMA Decoder
 //
-bool LzDecode(void);
-bool LzInitialize(uint8_t Properties);
+typedef enum _LZ_TOKEN_TYPE
+{
+    LzTokenLiterals,
+    LzTokenMatch,
+    LzTokenRep0,
+    LzTokenRep1,
+    LzTokenRep2,
+    LzTokenRep3,
+    LzTokenShortRep
+} LZ_TOKEN_TYPE;
+typedef struct _LZ_TOKEN
+{
+    uint32_t Type;
+    uint32_t Length;
+    uint32_t Distance;
+} LZ_TOKEN, *PLZ_TOKEN;
+void LzSetTokenBuffer(PLZ_TOKEN Tokens, uint32_t MaxTokens);
+uint32_t LzGetTokenCount(void);
+void LzResetTokenCount(void);
+bool LzRecordToken(LZ_TOKEN_TYPE Type, uint32_t Length, uint32_t Distance);
+bool LzRecordLiterals(uint32_t Count);
+typedef struct _DECODE_BUDGET
+{
+    //
+    // Dictionary offset and number of sequences at which decoding stops, input
+    // offset that the next LZMA2 chunk must fit under (when the rest of the
+    // input is still arriving), and whether it stopped because of them
+    //
+    uint32_t OutputLimit;
+    uint32_t Sequences;
+    uint32_t InputLimit;
+    bool Exhausted;
+} DECODE_BUDGET, *PDECODE_BUDGET;
+bool LzDecode(PDECODE_BUDGET Budget);
+bool LzDecodeEndMarker(void);
+bool LzInitialize(uint8_t Properties, bool CheckOnly);
 void LzResetState(void);
+void LzSetTrusted(bool Trusted);
+bool LzDecodeTrusted(PDECODE_BUDGET Budget);
+void LzSetEngine(DECODE_ENGINE Engine);
+bool LzDecodeStateMachine(PDECODE_BUDGET Budget);
+bool LzDecodeAssembly(PDECODE_BUDGET Budget);
+void* LzGetState(uint32_t* Size);
 
 //
 // LZMA2 Decoder
 //
-bool Lz2DecodeStream(uint32_t* BytesProcessed, bool GetSizeOnly);
+void Lz2Initialize(void);
+bool Lz2DecodeStream(uint32_t* BytesProcessed, bool GetSizeOnly, PDECODE_BUDGET Budget);
+bool Lz2IsInputAvailable(PDECODE_BUDGET Budget);
+void* Lz2GetState(uint32_t* Size);
+
+//
+// Resumable XZ Stream Decoding
+//
+typedef enum _STEP_STATUS
+{
+    StepFailed,
+    StepInProgress,
+    StepComplete,
+    StepOutputFull
+} STEP_STATUS;
+typedef struct _STEP_BUDGET
+{
+    uint32_t MaxOutput;
+    uint32_t MaxSequences;
+    uint64_t MaxTime;
+    uint32_t MaxInput;
+} STEP_BUDGET, *PSTEP_BUDGET;
+typedef void* (*PSTATE_ROUTINE)(uint32_t* Size);
+void XzResetContainer(void);
+void XzSetChecksumError(void);
+bool XzChecksumError(void);
+
+//
+// Stream Inventory
+//
+typedef struct _STREAM_INFO
+{
+    uint64_t UncompressedSize;
+    uint32_t StreamCount;
+    uint32_t BlockCount;
+    uint32_t CheckTypes;
+    uint32_t DictionarySize;
+    uint32_t StreamPadding;
+    bool ChecksumError;
+    bool Supported;
+} STREAM_INFO, *PSTREAM_INFO;
+
+//
+// lzip Container
+//
+typedef struct _LZIP_MEMBER
+{
+    uint32_t InputOffset;
+    uint32_t InputSize;
+    uint32_t OutputOffset;
+    uint32_t OutputSize;
+} LZIP_MEMBER, *PLZIP_MEMBER;
 
 #ifdef MINLZ_INTEGRITY_CHECKS
 //
@@ -90,6 +369,10 @@ bool Lz2DecodeStream(uint32_t* BytesProcessed, bool GetSizeOnly);
 //
 uint32_t XzCrc32(uint32_t Crc, const uint8_t* Buffer, uint32_t Length);
 uint64_t XzCrc64(uint64_t Crc, const uint8_t* Buffer, uint32_t Length);
+uint32_t XzCrc32Generic(uint32_t Crc, const uint8_t* Buffer, uint32_t Length);
+uint64_t XzCrc64Generic(uint64_t Crc, const uint8_t* Buffer, uint32_t Length);
+uint32_t XzCrc32Clmul(uint32_t Crc, const uint8_t* Buffer, uint32_t Length);
+uint64_t XzCrc64Clmul(uint64_t Crc, const uint8_t* Buffer, uint32_t Length);
 #define Crc32(Buffer, Length) XzCrc32(0, (const uint8_t*)Buffer, Length)
 #define Crc64(Buffer, Length) XzCrc64(0, (const uint8_t*)Buffer, Length)
 #endif
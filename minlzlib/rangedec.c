@@ -32,27 +32,13 @@ Environment:
 --*/
 
 #include "minlzlib.h"
+#include "lzmadec.h"
 
 //
-// The range decoder uses 11 probability bits, where 2048 is 100% chance of a 0
+// Probabilities start out at 50%, as nothing has been seen yet
 //
-#define LZMA_RC_PROBABILITY_BITS            11
-#define LZMA_RC_MAX_PROBABILITY             (1 << LZMA_RC_PROBABILITY_BITS)
 const uint16_t k_LzmaRcHalfProbability = LZMA_RC_MAX_PROBABILITY / 2;
 
-//
-// The range decoder uses an exponential moving average of the last probability
-// hit (match or miss) with an adaptation rate of 5 bits (which falls in the
-// middle of its 11 bits used to encode a probability.
-//
-#define LZMA_RC_ADAPTATION_RATE_SHIFT   5
-
-//
-// The range decoder has enough precision for the range only as long as the top
-// 8 bits are still set. Once it falls below, it needs a renormalization step.
-//
-#define LZMA_RC_MIN_RANGE               (1 << 24)
-
 //
 // The range decoder must be initialized with 5 bytes, the first of which is
 // ignored
@@ -75,11 +61,11 @@ typedef struct _RANGE_DECODER_STATE
     uint32_t Range;
     uint32_t Code;
 } RANGE_DECODER_STATE, *PRANGE_DECODER_STATE;
-RANGE_DECODER_STATE RcState;
+MINLZ_STATE RANGE_DECODER_STATE RcState;
 
 bool
 RcInitialize (
-    uint16_t* ChunkSize
+    uint32_t* ChunkSize
     )
 {
     uint8_t i, rcByte;
@@ -191,12 +177,15 @@ RcAdapt (
     //
     if (Miss)
     {
-        *Probability -= *Probability >> LZMA_RC_ADAPTATION_RATE_SHIFT;
+        *Probability = (uint16_t)(*Probability -
+                                  (*Probability >>
+                                   LZMA_RC_ADAPTATION_RATE_SHIFT));
     }
     else
     {
-        *Probability += (LZMA_RC_MAX_PROBABILITY - *Probability) >>
-                        LZMA_RC_ADAPTATION_RATE_SHIFT;
+        *Probability = (uint16_t)(*Probability +
+                                  ((LZMA_RC_MAX_PROBABILITY - *Probability) >>
+                                   LZMA_RC_ADAPTATION_RATE_SHIFT));
     }
 }
 
@@ -294,7 +283,7 @@ RcGetBitTree (
     {
         symbol = (uint16_t)(symbol << 1) | RcIsBitSet(&BitModel[symbol]);
     }
-    return (symbol - Limit) & 0xFF;
+    return (uint8_t)((symbol - Limit) & 0xFF);
 }
 
 uint8_t
@@ -316,7 +305,7 @@ RcGetReverseBitTree (
     {
         bit = RcIsBitSet(&BitModel[symbol]);
         symbol = (uint16_t)(symbol << 1) | bit;
-        result |= bit << i;
+        result = (uint8_t)(result | (bit << i));
     }
     return result;
 }
@@ -359,7 +348,7 @@ RcDecodeMatchedBitTree (
             break;
         }
     }
-    return symbol & 0xFF;
+    return (uint8_t)(symbol & 0xFF);
 }
 
 uint32_t
@@ -384,12 +373,68 @@ RcGetFixed (
 }
 
 void
-RcSetDefaultProbability (
-    uint16_t* Probability
+RcSetDefaultProbabilities (
+    uint16_t* Probabilities,
+    uint32_t Count
+    )
+{
+    //
+    // By default, we initialize the probabilities to 0.5 (50% chance). This is
+    // done for a whole array at once, which the compiler can then fill with a
+    // few vector stores, instead of a call for each probability.
+    //
+    while (Count-- > 0)
+    {
+        *Probabilities++ = k_LzmaRcHalfProbability;
+    }
+}
+
+void
+RcGetCoder (
+    uint32_t* Range,
+    uint32_t* Code
+    )
+{
+    //
+    // Hand out the range and code to a decode loop that keeps them in locals
+    //
+    *Range = RcState.Range;
+    *Code = RcState.Code;
+}
+
+void
+RcSetCoder (
+    uint32_t Range,
+    uint32_t Code
     )
 {
     //
-    // By default, we initialize the probabilities to 0.5 (50% chance).
+    // And take them back once it is done
     //
-    *Probability = k_LzmaRcHalfProbability;
+    RcState.Range = Range;
+    RcState.Code = Code;
+}
+
+uint32_t
+RcGetAvailable (
+    void
+    )
+{
+    const uint8_t* pos;
+
+    //
+    // Return how many bytes are left before the end of the chunk, which a
+    // decode loop can read without checking each of them
+    //
+    BfSeek(0, &pos);
+    return (pos < RcState.Limit) ? (uint32_t)(RcState.Limit - pos) : 0;
+}
+
+void*
+RcGetState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(RcState);
+    return &RcState;
 }
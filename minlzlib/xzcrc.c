@@ -11,7 +11,10 @@ Abstract:
     This module implements the XZ checksum algorithms for CRC32 and CRC64. The
     latter is a specialized implementation (ofter mislabelled "ECMA-182") which
     is only available in Go, making it highly unlikely to be found in any other
-    OS or language runtime. See the XZ Format Specification, Section 6.
+    OS or language runtime. See the XZ Format Specification, Section 6. On x64
+    processors with PCLMULQDQ, large buffers are first folded 64 bytes at a time
+    with carry-less multiplications, and only the final bytes go through the
+    table-driven algorithm.
 
 Author:
 
@@ -24,100 +27,185 @@ Environment:
 --*/
 
 #include "minlzlib.h"
+#ifdef MINLZ_X64
+#include <immintrin.h>
+#endif
 
 #ifdef MINLZ_INTEGRITY_CHECKS
-const uint32_t k_Crc32Polynomial = UINT32_C(0xEDB88320);
-const uint64_t k_Crc64Polynomial = UINT64_C(0xC96C5795D7870F42);
-
 //
-// XZ CRC State
+// Tables of all possible CRC values for each byte, essentially the checksums of
+// 00 00 00 XX in the case of 32-bit CRC or of 00 00 00 00 00 00 00 XX in the
+// case of 64-bit CRC. Each entry divides its byte, taken as 8 coefficients (the
+// LSB being the coefficient of the highest degree term of the dividend), by the
+// polynomial: 0xEDB88320 for CRC32, and 0xC96C5795D7870F42 for CRC64, moving
+// to the next coefficient and adding the rest of the divisor whenever the
+// current coefficient is set. They are precomputed, rather than built by each
+// thread on its first checksum, which would dominate the decode of a small
+// message.
 //
-typedef struct _CHECKSUM_STATE
+const uint32_t k_Crc32Table[256] =
 {
-    uint32_t Crc32Table[256];
-    uint64_t Crc64Table[256];
-    bool Initialized;
-} CHECKSUM_STATE, * PCHECKSUM_STATE;
-CHECKSUM_STATE Checksum;
-
-void
-XzCrcInitialize (
-    void
-    )
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+const uint64_t k_Crc64Table[256] =
 {
-    uint32_t i;
-    uint32_t j;
-    uint32_t crc32;
-    uint64_t crc64;
+    UINT64_C(0x0000000000000000), UINT64_C(0xB32E4CBE03A75F6F), UINT64_C(0xF4843657A840A05B),
+    UINT64_C(0x47AA7AE9ABE7FF34), UINT64_C(0x7BD0C384FF8F5E33), UINT64_C(0xC8FE8F3AFC28015C),
+    UINT64_C(0x8F54F5D357CFFE68), UINT64_C(0x3C7AB96D5468A107), UINT64_C(0xF7A18709FF1EBC66),
+    UINT64_C(0x448FCBB7FCB9E309), UINT64_C(0x0325B15E575E1C3D), UINT64_C(0xB00BFDE054F94352),
+    UINT64_C(0x8C71448D0091E255), UINT64_C(0x3F5F08330336BD3A), UINT64_C(0x78F572DAA8D1420E),
+    UINT64_C(0xCBDB3E64AB761D61), UINT64_C(0x7D9BA13851336649), UINT64_C(0xCEB5ED8652943926),
+    UINT64_C(0x891F976FF973C612), UINT64_C(0x3A31DBD1FAD4997D), UINT64_C(0x064B62BCAEBC387A),
+    UINT64_C(0xB5652E02AD1B6715), UINT64_C(0xF2CF54EB06FC9821), UINT64_C(0x41E11855055BC74E),
+    UINT64_C(0x8A3A2631AE2DDA2F), UINT64_C(0x39146A8FAD8A8540), UINT64_C(0x7EBE1066066D7A74),
+    UINT64_C(0xCD905CD805CA251B), UINT64_C(0xF1EAE5B551A2841C), UINT64_C(0x42C4A90B5205DB73),
+    UINT64_C(0x056ED3E2F9E22447), UINT64_C(0xB6409F5CFA457B28), UINT64_C(0xFB374270A266CC92),
+    UINT64_C(0x48190ECEA1C193FD), UINT64_C(0x0FB374270A266CC9), UINT64_C(0xBC9D3899098133A6),
+    UINT64_C(0x80E781F45DE992A1), UINT64_C(0x33C9CD4A5E4ECDCE), UINT64_C(0x7463B7A3F5A932FA),
+    UINT64_C(0xC74DFB1DF60E6D95), UINT64_C(0x0C96C5795D7870F4), UINT64_C(0xBFB889C75EDF2F9B),
+    UINT64_C(0xF812F32EF538D0AF), UINT64_C(0x4B3CBF90F69F8FC0), UINT64_C(0x774606FDA2F72EC7),
+    UINT64_C(0xC4684A43A15071A8), UINT64_C(0x83C230AA0AB78E9C), UINT64_C(0x30EC7C140910D1F3),
+    UINT64_C(0x86ACE348F355AADB), UINT64_C(0x3582AFF6F0F2F5B4), UINT64_C(0x7228D51F5B150A80),
+    UINT64_C(0xC10699A158B255EF), UINT64_C(0xFD7C20CC0CDAF4E8), UINT64_C(0x4E526C720F7DAB87),
+    UINT64_C(0x09F8169BA49A54B3), UINT64_C(0xBAD65A25A73D0BDC), UINT64_C(0x710D64410C4B16BD),
+    UINT64_C(0xC22328FF0FEC49D2), UINT64_C(0x85895216A40BB6E6), UINT64_C(0x36A71EA8A7ACE989),
+    UINT64_C(0x0ADDA7C5F3C4488E), UINT64_C(0xB9F3EB7BF06317E1), UINT64_C(0xFE5991925B84E8D5),
+    UINT64_C(0x4D77DD2C5823B7BA), UINT64_C(0x64B62BCAEBC387A1), UINT64_C(0xD7986774E864D8CE),
+    UINT64_C(0x90321D9D438327FA), UINT64_C(0x231C512340247895), UINT64_C(0x1F66E84E144CD992),
+    UINT64_C(0xAC48A4F017EB86FD), UINT64_C(0xEBE2DE19BC0C79C9), UINT64_C(0x58CC92A7BFAB26A6),
+    UINT64_C(0x9317ACC314DD3BC7), UINT64_C(0x2039E07D177A64A8), UINT64_C(0x67939A94BC9D9B9C),
+    UINT64_C(0xD4BDD62ABF3AC4F3), UINT64_C(0xE8C76F47EB5265F4), UINT64_C(0x5BE923F9E8F53A9B),
+    UINT64_C(0x1C4359104312C5AF), UINT64_C(0xAF6D15AE40B59AC0), UINT64_C(0x192D8AF2BAF0E1E8),
+    UINT64_C(0xAA03C64CB957BE87), UINT64_C(0xEDA9BCA512B041B3), UINT64_C(0x5E87F01B11171EDC),
+    UINT64_C(0x62FD4976457FBFDB), UINT64_C(0xD1D305C846D8E0B4), UINT64_C(0x96797F21ED3F1F80),
+    UINT64_C(0x2557339FEE9840EF), UINT64_C(0xEE8C0DFB45EE5D8E), UINT64_C(0x5DA24145464902E1),
+    UINT64_C(0x1A083BACEDAEFDD5), UINT64_C(0xA9267712EE09A2BA), UINT64_C(0x955CCE7FBA6103BD),
+    UINT64_C(0x267282C1B9C65CD2), UINT64_C(0x61D8F8281221A3E6), UINT64_C(0xD2F6B4961186FC89),
+    UINT64_C(0x9F8169BA49A54B33), UINT64_C(0x2CAF25044A02145C), UINT64_C(0x6B055FEDE1E5EB68),
+    UINT64_C(0xD82B1353E242B407), UINT64_C(0xE451AA3EB62A1500), UINT64_C(0x577FE680B58D4A6F),
+    UINT64_C(0x10D59C691E6AB55B), UINT64_C(0xA3FBD0D71DCDEA34), UINT64_C(0x6820EEB3B6BBF755),
+    UINT64_C(0xDB0EA20DB51CA83A), UINT64_C(0x9CA4D8E41EFB570E), UINT64_C(0x2F8A945A1D5C0861),
+    UINT64_C(0x13F02D374934A966), UINT64_C(0xA0DE61894A93F609), UINT64_C(0xE7741B60E174093D),
+    UINT64_C(0x545A57DEE2D35652), UINT64_C(0xE21AC88218962D7A), UINT64_C(0x5134843C1B317215),
+    UINT64_C(0x169EFED5B0D68D21), UINT64_C(0xA5B0B26BB371D24E), UINT64_C(0x99CA0B06E7197349),
+    UINT64_C(0x2AE447B8E4BE2C26), UINT64_C(0x6D4E3D514F59D312), UINT64_C(0xDE6071EF4CFE8C7D),
+    UINT64_C(0x15BB4F8BE788911C), UINT64_C(0xA6950335E42FCE73), UINT64_C(0xE13F79DC4FC83147),
+    UINT64_C(0x521135624C6F6E28), UINT64_C(0x6E6B8C0F1807CF2F), UINT64_C(0xDD45C0B11BA09040),
+    UINT64_C(0x9AEFBA58B0476F74), UINT64_C(0x29C1F6E6B3E0301B), UINT64_C(0xC96C5795D7870F42),
+    UINT64_C(0x7A421B2BD420502D), UINT64_C(0x3DE861C27FC7AF19), UINT64_C(0x8EC62D7C7C60F076),
+    UINT64_C(0xB2BC941128085171), UINT64_C(0x0192D8AF2BAF0E1E), UINT64_C(0x4638A2468048F12A),
+    UINT64_C(0xF516EEF883EFAE45), UINT64_C(0x3ECDD09C2899B324), UINT64_C(0x8DE39C222B3EEC4B),
+    UINT64_C(0xCA49E6CB80D9137F), UINT64_C(0x7967AA75837E4C10), UINT64_C(0x451D1318D716ED17),
+    UINT64_C(0xF6335FA6D4B1B278), UINT64_C(0xB199254F7F564D4C), UINT64_C(0x02B769F17CF11223),
+    UINT64_C(0xB4F7F6AD86B4690B), UINT64_C(0x07D9BA1385133664), UINT64_C(0x4073C0FA2EF4C950),
+    UINT64_C(0xF35D8C442D53963F), UINT64_C(0xCF273529793B3738), UINT64_C(0x7C0979977A9C6857),
+    UINT64_C(0x3BA3037ED17B9763), UINT64_C(0x888D4FC0D2DCC80C), UINT64_C(0x435671A479AAD56D),
+    UINT64_C(0xF0783D1A7A0D8A02), UINT64_C(0xB7D247F3D1EA7536), UINT64_C(0x04FC0B4DD24D2A59),
+    UINT64_C(0x3886B22086258B5E), UINT64_C(0x8BA8FE9E8582D431), UINT64_C(0xCC0284772E652B05),
+    UINT64_C(0x7F2CC8C92DC2746A), UINT64_C(0x325B15E575E1C3D0), UINT64_C(0x8175595B76469CBF),
+    UINT64_C(0xC6DF23B2DDA1638B), UINT64_C(0x75F16F0CDE063CE4), UINT64_C(0x498BD6618A6E9DE3),
+    UINT64_C(0xFAA59ADF89C9C28C), UINT64_C(0xBD0FE036222E3DB8), UINT64_C(0x0E21AC88218962D7),
+    UINT64_C(0xC5FA92EC8AFF7FB6), UINT64_C(0x76D4DE52895820D9), UINT64_C(0x317EA4BB22BFDFED),
+    UINT64_C(0x8250E80521188082), UINT64_C(0xBE2A516875702185), UINT64_C(0x0D041DD676D77EEA),
+    UINT64_C(0x4AAE673FDD3081DE), UINT64_C(0xF9802B81DE97DEB1), UINT64_C(0x4FC0B4DD24D2A599),
+    UINT64_C(0xFCEEF8632775FAF6), UINT64_C(0xBB44828A8C9205C2), UINT64_C(0x086ACE348F355AAD),
+    UINT64_C(0x34107759DB5DFBAA), UINT64_C(0x873E3BE7D8FAA4C5), UINT64_C(0xC094410E731D5BF1),
+    UINT64_C(0x73BA0DB070BA049E), UINT64_C(0xB86133D4DBCC19FF), UINT64_C(0x0B4F7F6AD86B4690),
+    UINT64_C(0x4CE50583738CB9A4), UINT64_C(0xFFCB493D702BE6CB), UINT64_C(0xC3B1F050244347CC),
+    UINT64_C(0x709FBCEE27E418A3), UINT64_C(0x3735C6078C03E797), UINT64_C(0x841B8AB98FA4B8F8),
+    UINT64_C(0xADDA7C5F3C4488E3), UINT64_C(0x1EF430E13FE3D78C), UINT64_C(0x595E4A08940428B8),
+    UINT64_C(0xEA7006B697A377D7), UINT64_C(0xD60ABFDBC3CBD6D0), UINT64_C(0x6524F365C06C89BF),
+    UINT64_C(0x228E898C6B8B768B), UINT64_C(0x91A0C532682C29E4), UINT64_C(0x5A7BFB56C35A3485),
+    UINT64_C(0xE955B7E8C0FD6BEA), UINT64_C(0xAEFFCD016B1A94DE), UINT64_C(0x1DD181BF68BDCBB1),
+    UINT64_C(0x21AB38D23CD56AB6), UINT64_C(0x9285746C3F7235D9), UINT64_C(0xD52F0E859495CAED),
+    UINT64_C(0x6601423B97329582), UINT64_C(0xD041DD676D77EEAA), UINT64_C(0x636F91D96ED0B1C5),
+    UINT64_C(0x24C5EB30C5374EF1), UINT64_C(0x97EBA78EC690119E), UINT64_C(0xAB911EE392F8B099),
+    UINT64_C(0x18BF525D915FEFF6), UINT64_C(0x5F1528B43AB810C2), UINT64_C(0xEC3B640A391F4FAD),
+    UINT64_C(0x27E05A6E926952CC), UINT64_C(0x94CE16D091CE0DA3), UINT64_C(0xD3646C393A29F297),
+    UINT64_C(0x604A2087398EADF8), UINT64_C(0x5C3099EA6DE60CFF), UINT64_C(0xEF1ED5546E415390),
+    UINT64_C(0xA8B4AFBDC5A6ACA4), UINT64_C(0x1B9AE303C601F3CB), UINT64_C(0x56ED3E2F9E224471),
+    UINT64_C(0xE5C372919D851B1E), UINT64_C(0xA26908783662E42A), UINT64_C(0x114744C635C5BB45),
+    UINT64_C(0x2D3DFDAB61AD1A42), UINT64_C(0x9E13B115620A452D), UINT64_C(0xD9B9CBFCC9EDBA19),
+    UINT64_C(0x6A978742CA4AE576), UINT64_C(0xA14CB926613CF817), UINT64_C(0x1262F598629BA778),
+    UINT64_C(0x55C88F71C97C584C), UINT64_C(0xE6E6C3CFCADB0723), UINT64_C(0xDA9C7AA29EB3A624),
+    UINT64_C(0x69B2361C9D14F94B), UINT64_C(0x2E184CF536F3067F), UINT64_C(0x9D36004B35545910),
+    UINT64_C(0x2B769F17CF112238), UINT64_C(0x9858D3A9CCB67D57), UINT64_C(0xDFF2A94067518263),
+    UINT64_C(0x6CDCE5FE64F6DD0C), UINT64_C(0x50A65C93309E7C0B), UINT64_C(0xE388102D33392364),
+    UINT64_C(0xA4226AC498DEDC50), UINT64_C(0x170C267A9B79833F), UINT64_C(0xDCD7181E300F9E5E),
+    UINT64_C(0x6FF954A033A8C131), UINT64_C(0x28532E49984F3E05), UINT64_C(0x9B7D62F79BE8616A),
+    UINT64_C(0xA707DB9ACF80C06D), UINT64_C(0x14299724CC279F02), UINT64_C(0x5383EDCD67C06036),
+    UINT64_C(0xE0ADA17364673F59)
+};
 
-    //
-    // Don't do anything if the tables are already computed
-    //
-    if (!Checksum.Initialized)
-    {
-        //
-        // Build a table of all possible CRC values for each byte, essentially
-        // creating the checksums for either 00 00 00 XX in the case of 32-bit
-        // CRC or for 00 00 00 00 00 00 XX in the base of 64-bit CRC.
-        //
-        for (i = 0; i < 256; i++)
-        {
-            crc32 = i;
-            crc64 = i;
-
-            //
-            // Divide the input in the 8 coefficients, where the LSB represents
-            // the coefficient of the highest degree term of the dividend.
-            //
-            for (j = 0; j < 8; j++)
-            {
-                //
-                // Is the current coefficient set?
-                //
-                if (crc32 & 1)
-                {
-                    //
-                    // Move to next coefficient and add the rest of the divisor
-                    //
-                    crc32 = (crc32 >> 1) ^ k_Crc32Polynomial;
-                }
-                else
-                {
-                    //
-                    // Skip this and move to the next coefficient
-                    //
-                    crc32 >>= 1;
-                }
-
-                //
-                // Compute the 64-bit entry using the same algorithm
-                //
-                if (crc64 & 1)
-                {
-                    crc64 = (crc64 >> 1) ^ k_Crc64Polynomial;
-                }
-                else
-                {
-                    crc64 >>= 1;
-                }
-            }
-
-            //
-            // Store the final generated result
-            //
-            Checksum.Crc32Table[i] = crc32;
-            Checksum.Crc64Table[i] = crc64;
-        }
-
-        //
-        // No need to do this again
-        //
-        Checksum.Initialized = true;
-    }
-}
+#ifdef MINLZ_X64
+//
+// Folding constants, see XzCrcFoldBlock. Each pair is x^(n+63) mod P(x) and
+// x^(n-1) mod P(x), for folding n = 512 and n = 128 bits forward, computed by
+// starting from x^0 and multiplying by x one degree at a time. In the
+// bit-reflected representation that the XZ CRCs use, the highest bit holds x^0,
+// so multiplying by x is a right shift and the x^Bits term that falls off the
+// bottom is reduced by adding P(x) back (which is exactly one step of the
+// bitwise CRC algorithm). They are stored as 64-bit reflected values, which is
+// what the carry-less multiplications operate on.
+//
+const uint64_t k_Crc32Fold[4] =
+{
+    UINT64_C(0x653D982200000000), UINT64_C(0xCAD38E8F00000000),
+    UINT64_C(0x65673B4600000000), UINT64_C(0x9BA54C6F00000000)
+};
+
+const uint64_t k_Crc64Fold[4] =
+{
+    UINT64_C(0x6AE3EFBB9DD441F3), UINT64_C(0x081F6054A7842DF4),
+    UINT64_C(0xE05DD497CA393AE4), UINT64_C(0xDABE95AFC7875F40)
+};
+#endif
 
 uint32_t
-XzCrc32 (
+XzCrc32Generic (
     uint32_t Crc,
     const uint8_t *Buffer,
     uint32_t Length
@@ -133,15 +221,15 @@ XzCrc32 (
     //
     // Mod(A * x^n, P(x)) = Mod(x^n * Mod(A, P(X)), P(X))
     //
-    for (XzCrcInitialize(), Crc = ~Crc, i = 0; i < Length; ++i)
+    for (Crc = ~Crc, i = 0; i < Length; ++i)
     {
-        Crc = Checksum.Crc32Table[Buffer[i] ^ (Crc & 0xFF)] ^ (Crc >> 8);
+        Crc = k_Crc32Table[Buffer[i] ^ (Crc & 0xFF)] ^ (Crc >> 8);
     }
     return ~Crc;
 }
 
 uint64_t
-XzCrc64 (
+XzCrc64Generic (
     uint64_t Crc,
     const uint8_t *Buffer,
     uint32_t Length
@@ -150,13 +238,167 @@ XzCrc64 (
     uint32_t i;
     //
     // Use the same algorithm to the 64-bit case too. Note that for very large
-    // input data, a parallel "slicing by 8" approach would yield much faster
-    // results (as would a "slicing by 4" approach for the 32-bit CRC case).
+    // input data, the folding approach in XzCrc64Clmul is much faster.
     //
-    for (XzCrcInitialize(), Crc = ~Crc, i = 0; i < Length; ++i)
+    for (Crc = ~Crc, i = 0; i < Length; ++i)
     {
-        Crc = Checksum.Crc64Table[Buffer[i] ^ (Crc & 0xFF)] ^ (Crc >> 8);
+        Crc = k_Crc64Table[Buffer[i] ^ (Crc & 0xFF)] ^ (Crc >> 8);
     }
     return ~Crc;
 }
+
+#ifdef MINLZ_X64
+MINLZ_TARGET("sse2,pclmul")
+__m128i
+XzCrcFoldBlock (
+    __m128i Block,
+    __m128i Constants
+    )
+{
+    //
+    // A 128-bit block B(x) that is followed by n more bits of message adds the
+    // term B(x) * x^n to the message. Splitting B into its high (first) and low
+    // (second) 64-bit halves, this is Bh * x^(n+64) + Bl * x^n, which has the
+    // same remainder as Bh * (x^(n+64) mod P) + Bl * (x^n mod P), a value that
+    // fits in 128 bits, and can be added into the block found n bits later.
+    // In the reflected representation, the carry-less product comes out one
+    // bit short, which is why the constants are computed for x^(n+63) and for
+    // x^(n-1) instead.
+    //
+    return _mm_xor_si128(_mm_clmulepi64_si128(Block, Constants, 0x00),
+                         _mm_clmulepi64_si128(Block, Constants, 0x11));
+}
+
+MINLZ_TARGET("sse2,pclmul")
+uint32_t
+XzCrcFold (
+    uint64_t Crc,
+    const uint8_t* Buffer,
+    uint32_t Length,
+    const uint64_t Constants[4],
+    uint8_t Folded[16]
+    )
+{
+    __m128i x0, x1, x2, x3, k512, k128;
+    uint32_t offset;
+
+    //
+    // Starting the CRC from a non-zero value is the same as adding it to the
+    // first bytes of the message. Then load 4 independent blocks, so that the
+    // multiplications of each iteration don't have to wait on each other.
+    //
+    k512 = _mm_set_epi64x((long long)Constants[1], (long long)Constants[0]);
+    k128 = _mm_set_epi64x((long long)Constants[3], (long long)Constants[2]);
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&Buffer[0]),
+                       _mm_cvtsi64_si128((long long)Crc));
+    x1 = _mm_loadu_si128((const __m128i*)&Buffer[16]);
+    x2 = _mm_loadu_si128((const __m128i*)&Buffer[32]);
+    x3 = _mm_loadu_si128((const __m128i*)&Buffer[48]);
+
+    //
+    // Fold each block 512 bits forward, into the next 64 bytes of input
+    //
+    for (offset = 64; (Length - offset) >= 64; offset += 64)
+    {
+        x0 = _mm_xor_si128(XzCrcFoldBlock(x0, k512),
+                           _mm_loadu_si128((const __m128i*)&Buffer[offset]));
+        x1 = _mm_xor_si128(XzCrcFoldBlock(x1, k512),
+                           _mm_loadu_si128((const __m128i*)&Buffer[offset + 16]));
+        x2 = _mm_xor_si128(XzCrcFoldBlock(x2, k512),
+                           _mm_loadu_si128((const __m128i*)&Buffer[offset + 32]));
+        x3 = _mm_xor_si128(XzCrcFoldBlock(x3, k512),
+                           _mm_loadu_si128((const __m128i*)&Buffer[offset + 48]));
+    }
+
+    //
+    // Then fold the 4 blocks into a single one, and keep folding it 128 bits
+    // forward into any remaining full blocks of input.
+    //
+    x1 = _mm_xor_si128(XzCrcFoldBlock(x0, k128), x1);
+    x2 = _mm_xor_si128(XzCrcFoldBlock(x1, k128), x2);
+    x3 = _mm_xor_si128(XzCrcFoldBlock(x2, k128), x3);
+    for (; (Length - offset) >= 16; offset += 16)
+    {
+        x3 = _mm_xor_si128(XzCrcFoldBlock(x3, k128),
+                           _mm_loadu_si128((const __m128i*)&Buffer[offset]));
+    }
+
+    //
+    // The folded block has the same remainder as all of the input consumed so
+    // far, so the caller can finish by running the table-driven CRC over it,
+    // followed by the rest of the input.
+    //
+    _mm_storeu_si128((__m128i*)Folded, x3);
+    return offset;
+}
+
+uint32_t
+XzCrc32Clmul (
+    uint32_t Crc,
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+    uint8_t folded[16];
+    uint32_t offset;
+
+    //
+    // Short buffers are faster to do with the table
+    //
+    if (Length < 64)
+    {
+        return XzCrc32Generic(Crc, Buffer, Length);
+    }
+    offset = XzCrcFold(~Crc, Buffer, Length, k_Crc32Fold, folded);
+    Crc = XzCrc32Generic(UINT32_MAX, folded, sizeof(folded));
+    return XzCrc32Generic(Crc, &Buffer[offset], Length - offset);
+}
+
+uint64_t
+XzCrc64Clmul (
+    uint64_t Crc,
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+    uint8_t folded[16];
+    uint32_t offset;
+
+    //
+    // Same as the 32-bit case
+    //
+    if (Length < 64)
+    {
+        return XzCrc64Generic(Crc, Buffer, Length);
+    }
+    offset = XzCrcFold(~Crc, Buffer, Length, k_Crc64Fold, folded);
+    Crc = XzCrc64Generic(UINT64_MAX, folded, sizeof(folded));
+    return XzCrc64Generic(Crc, &Buffer[offset], Length - offset);
+}
+#endif
+
+uint32_t
+XzCrc32 (
+    uint32_t Crc,
+    const uint8_t *Buffer,
+    uint32_t Length
+    )
+{
+    //
+    // Call the best implementation for this CPU
+    //
+    CpuInitialize();
+    return Kernels.ComputeCrc32(Crc, Buffer, Length);
+}
+
+uint64_t
+XzCrc64 (
+    uint64_t Crc,
+    const uint8_t *Buffer,
+    uint32_t Length
+    )
+{
+    CpuInitialize();
+    return Kernels.ComputeCrc64(Crc, Buffer, Length);
+}
 #endif
@@ -35,6 +35,29 @@ Environment:
 void __security_check_cookie(_In_ uintptr_t _StackCookie) { (void)(_StackCookie); }
 #endif
 
+//
+// The highest level of checking that was compiled in, and the level that this
+// thread asked for, which the streams it starts will use
+//
+#if defined(MINLZ_INTEGRITY_CHECKS)
+#define XZ_SUPPORTED_INTEGRITY_LEVEL    IntegrityLevelFull
+#elif defined(MINLZ_META_CHECKS)
+#define XZ_SUPPORTED_INTEGRITY_LEVEL    IntegrityLevelMeta
+#else
+#define XZ_SUPPORTED_INTEGRITY_LEVEL    IntegrityLevelNone
+#endif
+MINLZ_STATE INTEGRITY_LEVEL IntegrityLevel = IntegrityLevelBest;
+
+//
+// Whether this thread asked for its streams to be decoded as trusted input
+//
+MINLZ_STATE bool TrustedInput;
+
+//
+// The engine that this thread asked for its streams to be decoded with
+//
+MINLZ_STATE DECODE_ENGINE DecodeEngine;
+
 #ifdef MINLZ_META_CHECKS
 //
 // XZ Stream Container State
@@ -47,8 +70,10 @@ typedef struct _CONTAINER_STATE
     uint32_t HeaderSize;
     uint32_t IndexSize;
     //
-    // Size of the uncompressed block
+    // Number of blocks, which is 0 for empty streams, and the size of the
+    // uncompressed block
     //
+    uint32_t BlockCount;
     uint32_t UncompressedBlockSize;
     uint32_t UnpaddedBlockSize;
     //
@@ -57,10 +82,62 @@ typedef struct _CONTAINER_STATE
     uint32_t ChecksumSize;
     uint8_t ChecksumType;
     bool ChecksumError;
+    //
+    // Start of the compressed block data, which may be decoded over many calls
+    //
+    const uint8_t* BlockStart;
 } CONTAINER_STATE, * PCONTAINER_STATE;
-CONTAINER_STATE Container;
+MINLZ_STATE CONTAINER_STATE Container;
 #endif
 
+//
+// Progress of the stream being decoded by this thread
+//
+typedef struct _STREAM_STATE
+{
+    uint8_t* OutputBuffer;
+    uint32_t InputSize;
+    uint32_t BlockSize;
+    bool InBlock;
+    STEP_STATUS Status;
+    INTEGRITY_LEVEL IntegrityLevel;
+} STREAM_STATE, *PSTREAM_STATE;
+MINLZ_STATE STREAM_STATE Stream;
+
+//
+// Header of the caller-allocated buffer holding a stream that is decoded in
+// steps, followed by the saved state of each module. Every save is stamped
+// with a new process-wide generation, so that a thread only skips restoring
+// a stream if it was also the last one to save it.
+//
+typedef struct _SAVED_STREAM
+{
+    uint64_t Generation;
+} SAVED_STREAM, *PSAVED_STREAM;
+uint64_t StreamGeneration;
+MINLZ_STATE PSAVED_STREAM LoadedStream;
+MINLZ_STATE uint64_t LoadedGeneration;
+
+//
+// Unlimited budget, which is used when decoding a whole stream at once
+//
+#define XZ_STEP_UNLIMITED           UINT32_MAX
+
+//
+// Without an index to size the output from, XzDecodeAlloc starts out with a
+// buffer this many times larger than the input. With one, it still never starts
+// out with more than the maximum ratio, as a tiny input can carry a forged index
+// claiming gigabytes of output.
+//
+#define XZ_ALLOC_INITIAL_RATIO      4
+#define XZ_ALLOC_MAX_INITIAL_RATIO  256
+
+//
+// When stepping with a time budget, the clock is checked every so many bytes
+// of output
+//
+#define XZ_STEP_TIME_SLICE          (16 * 1024)
+
 #ifdef MINLZ_META_CHECKS
 bool
 XzDecodeVli (
@@ -135,27 +212,30 @@ XzDecodeIndex (
     }
 
     //
-    // Then the count of blocks, which we expect to be 1
+    // Then the count of blocks, which we expect to be 1, unless the stream is
+    // empty, in which case there are no block records at all
     //
-    if (!XzDecodeVli(&vli) || (vli != 1))
+    if (!XzDecodeVli(&vli) || (vli != Container.BlockCount))
     {
         return false;
     }
-
-    //
-    // Then the unpadded block size, which should match
-    //
-    if (!XzDecodeVli(&vli) || (Container.UnpaddedBlockSize != vli))
+    if (Container.BlockCount != 0)
     {
-        return false;
-    }
+        //
+        // Then the unpadded block size, which should match
+        //
+        if (!XzDecodeVli(&vli) || (Container.UnpaddedBlockSize != vli))
+        {
+            return false;
+        }
 
-    //
-    // Then the uncompressed block size, which should match
-    //
-    if (!XzDecodeVli(&vli) || (Container.UncompressedBlockSize != vli))
-    {
-        return false;
+        //
+        // Then the uncompressed block size, which should match
+        //
+        if (!XzDecodeVli(&vli) || (Container.UncompressedBlockSize != vli))
+        {
+            return false;
+        }
     }
 
     //
@@ -273,29 +353,50 @@ XzCrc (
 bool
 XzDecodeBlock (
     uint8_t* OutputBuffer,
-    uint32_t* BlockSize
+    uint32_t* BlockSize,
+    PDECODE_BUDGET Budget
     )
 {
 #ifdef MINLZ_META_CHECKS
-    const uint8_t *inputStart, *inputEnd;
+    const uint8_t *inputEnd;
 #endif
+    uint64_t start;
+    uint32_t bufferSize;
+
     //
-    // Decode the LZMA2 stream. If full integrity checking is enabled, also
-    // save the offset before and after decoding, so we can save the block
-    // sizes and compare them against the footer and index after decoding.
+    // Decode the LZMA2 stream, or as much of it as the budget allows. If full
+    // integrity checking is enabled, also use the offset where the block began
+    // and where it ended, so we can save the block sizes and compare them
+    // against the footer and index after decoding.
     //
-#ifdef MINLZ_META_CHECKS
-    BfSeek(0, &inputStart);
-#endif
-    if (!Lz2DecodeStream(BlockSize, OutputBuffer == NULL))
+    start = MtGetTime();
+    if (!Lz2DecodeStream(BlockSize, OutputBuffer == NULL, Budget))
     {
         return false;
     }
+
+    //
+    // The output buffer may have been grown, and moved, by XzDecodeAlloc's
+    // allocator in the meantime
+    //
+    if (OutputBuffer != NULL)
+    {
+        OutputBuffer = DtGetBuffer(&bufferSize);
+        Stream.OutputBuffer = OutputBuffer;
+    }
+    start = MtAddPhaseTime(MetricsPhaseLzma, start);
+    if (Budget->Exhausted)
+    {
+        return true;
+    }
 #ifdef MINLZ_META_CHECKS
-    BfSeek(0, &inputEnd);
-    Container.UnpaddedBlockSize = Container.HeaderSize +
-                                  (uint32_t)(inputEnd - inputStart);
-    Container.UncompressedBlockSize = *BlockSize;
+    if (Stream.IntegrityLevel >= IntegrityLevelMeta)
+    {
+        BfSeek(0, &inputEnd);
+        Container.UnpaddedBlockSize = Container.HeaderSize +
+                                      (uint32_t)(inputEnd - Container.BlockStart);
+        Container.UncompressedBlockSize = *BlockSize;
+    }
 #endif
     //
     // After the block data, we need to pad to 32-bit alignment
@@ -309,8 +410,13 @@ XzDecodeBlock (
     // Finally, move past the size of the checksum if any, then compare it with
     // with the actual checksum of the block, if integrity checks are enabled.
     // If meta checks are enabled, update the block size so the index checking
-    // can validate it.
+    // can validate it. Trusted input skips all of this, as the index and the
+    // footer will not be looked at either.
     //
+    if (Stream.IntegrityLevel == IntegrityLevelNone)
+    {
+        return true;
+    }
     if (!BfSeek(Container.ChecksumSize, &inputEnd))
     {
         return false;
@@ -318,9 +424,13 @@ XzDecodeBlock (
 #endif
     (void)(OutputBuffer);
 #ifdef MINLZ_INTEGRITY_CHECKS
-    if ((OutputBuffer != NULL) && !(XzCrc(OutputBuffer, *BlockSize, inputEnd)))
+    if ((OutputBuffer != NULL) && (Stream.IntegrityLevel == IntegrityLevelFull))
     {
-        Container.ChecksumError = true;
+        if (XzCrc(OutputBuffer, *BlockSize, inputEnd))
+        {
+            Container.ChecksumError = true;
+        }
+        MtAddPhaseTime(MetricsPhaseCrc, start);
     }
 #endif
 #ifdef MINLZ_META_CHECKS
@@ -344,6 +454,14 @@ XzDecodeStreamHeader (
         return false;
     }
 #ifdef MINLZ_META_CHECKS
+    //
+    // Trusted input is assumed to have a valid header
+    //
+    if (Stream.IntegrityLevel == IntegrityLevelNone)
+    {
+        return true;
+    }
+
     //
     // Validate the header magic
     //
@@ -410,6 +528,14 @@ XzDecodeBlockHeader (
         return false;
     }
 #ifdef MINLZ_META_CHECKS
+    //
+    // Trusted input is assumed to only have the block header we support
+    //
+    if (Stream.IntegrityLevel == IntegrityLevelNone)
+    {
+        return true;
+    }
+
     //
     // Validate that the size of the header is what we expect
     //
@@ -467,29 +593,46 @@ XzDecodeBlockHeader (
     // Compute the header's CRC32 and make sure it's not corrupted
     //
     if (Crc32(blockHeader,
-              Container.HeaderSize - sizeof(blockHeader->Crc32)) !=
+              Container.HeaderSize - (uint32_t)sizeof(blockHeader->Crc32)) !=
         blockHeader->Crc32)
     {
         Container.ChecksumError = true;
     }
 #endif
+    BfSeek(0, &Container.BlockStart);
+    Container.BlockCount = 1;
 #endif
     return true;
 }
 
 bool
-XzDecode (
+XzBeginStream (
     const uint8_t* InputBuffer,
     uint32_t InputSize,
     uint8_t* OutputBuffer,
-    uint32_t* OutputSize
+    uint32_t OutputSize
     )
 {
     //
-    // Initialize the input buffer descriptor and history buffer (dictionary)
+    // Pick the kernels for this CPU, then initialize the input buffer
+    // descriptor and history buffer (dictionary)
     //
+    CpuInitialize();
     BfInitialize(InputBuffer, InputSize);
-    DtInitialize(OutputBuffer, *OutputSize, 0);
+    DtInitialize(OutputBuffer, OutputSize, 0);
+    LzResetTokenCount();
+    DgInitialize();
+    Lz2Initialize();
+#ifdef MINLZ_META_CHECKS
+    Container.ChecksumError = false;
+    Container.BlockCount = 0;
+#endif
+    Stream.OutputBuffer = OutputBuffer;
+    Stream.InputSize = InputSize;
+    Stream.BlockSize = 0;
+    Stream.IntegrityLevel = XzGetIntegrityLevel();
+    LzSetTrusted(TrustedInput);
+    LzSetEngine(DecodeEngine);
 
     //
     // Decode the stream header to check for validity
@@ -500,21 +643,43 @@ XzDecode (
     }
 
     //
-    // Decode the block header to check for validity. If it appears valid, go
-    // decode the block. Otherwise, this may be a blockless (empty input) file.
+    // Decode the block header to check for validity. If it appears valid, the
+    // block gets decoded next. Otherwise, this may be a blockless (empty input)
+    // file.
     //
-    if (XzDecodeBlockHeader())
+    Stream.InBlock = XzDecodeBlockHeader();
+    return true;
+}
+
+bool
+XzContinueStream (
+    PDECODE_BUDGET Budget
+    )
+{
+    //
+    // Decode the block, or as much of it as the budget allows
+    //
+    if (Stream.InBlock)
     {
-        if (!XzDecodeBlock(OutputBuffer, OutputSize))
+        if (!XzDecodeBlock(Stream.OutputBuffer, &Stream.BlockSize, Budget))
         {
             return false;
         }
+        if (Budget->Exhausted)
+        {
+            return true;
+        }
+        Stream.InBlock = false;
     }
-    else
+#ifdef MINLZ_META_CHECKS
+    //
+    // Trusted input ends right after the block, as far as we are concerned
+    //
+    if (Stream.IntegrityLevel == IntegrityLevelNone)
     {
-        *OutputSize = 0;
+        return true;
     }
-#ifdef MINLZ_META_CHECKS
+
     //
     // Decode the index for validity checks
     //
@@ -534,6 +699,923 @@ XzDecode (
     return true;
 }
 
+bool
+XzDecode (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize
+    )
+{
+    DECODE_BUDGET budget;
+    bool result, checksumError;
+
+    //
+    // This overwrites the state of any stream this thread was decoding in steps
+    //
+    LoadedStream = NULL;
+
+    //
+    // Only account for real decodes in the metrics, not for size queries
+    //
+    if (OutputBuffer != NULL)
+    {
+        MtBeginDecode();
+    }
+
+    //
+    // Decode the whole stream at once
+    //
+    budget.OutputLimit = XZ_STEP_UNLIMITED;
+    budget.Sequences = XZ_STEP_UNLIMITED;
+    budget.InputLimit = XZ_STEP_UNLIMITED;
+    budget.Exhausted = false;
+    result = XzBeginStream(InputBuffer, InputSize, OutputBuffer, *OutputSize) &&
+             XzContinueStream(&budget) &&
+             !budget.Exhausted;
+    *OutputSize = Stream.BlockSize;
+    if (OutputBuffer == NULL)
+    {
+        return result;
+    }
+#ifdef MINLZ_INTEGRITY_CHECKS
+    checksumError = Container.ChecksumError;
+#else
+    checksumError = false;
+#endif
+    MtEndDecode(result, InputSize, result ? *OutputSize : 0, checksumError);
+    return result;
+}
+
+void*
+XzGetStreamState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Stream);
+    return &Stream;
+}
+
+#ifdef MINLZ_META_CHECKS
+void*
+XzGetContainerState (
+    uint32_t* Size
+    )
+{
+    *Size = sizeof(Container);
+    return &Container;
+}
+#endif
+
+void
+XzCopyMemory (
+    uint8_t* Destination,
+    const uint8_t* Source,
+    uint32_t Length
+    )
+{
+    //
+    // The library does not link with the C runtime, so copy bytes manually
+    //
+    while (Length-- > 0)
+    {
+        *Destination++ = *Source++;
+    }
+}
+
+const PSTATE_ROUTINE k_StreamStateRoutines[] =
+{
+    BfGetState,
+    DtGetState,
+    RcGetState,
+    LzGetState,
+    Lz2GetState,
+    DgGetState,
+    MtGetState,
+    XzGetStreamState,
+#ifdef MINLZ_META_CHECKS
+    XzGetContainerState,
+#endif
+};
+
+uint32_t
+XzCopyStreamState (
+    PSAVED_STREAM SavedStream,
+    bool Save
+    )
+{
+    uint8_t* saved;
+    uint8_t* state;
+    uint32_t i, size, offset;
+
+    //
+    // Copy the state of each module to (or back from) the caller's buffer,
+    // keeping each one 8-byte aligned. Passing NULL only computes the size.
+    //
+    offset = sizeof(*SavedStream);
+    for (i = 0; i < (sizeof(k_StreamStateRoutines) / sizeof(k_StreamStateRoutines[0])); i++)
+    {
+        state = k_StreamStateRoutines[i](&size);
+        if (SavedStream != NULL)
+        {
+            saved = (uint8_t*)SavedStream + offset;
+            XzCopyMemory(Save ? saved : state, Save ? state : saved, size);
+        }
+        offset += (size + 7) & ~7;
+    }
+    return offset;
+}
+
+void
+XzSaveStream (
+    PSAVED_STREAM SavedStream
+    )
+{
+    //
+    // Save the stream after every step, so that any thread can take the next
+    // one, and remember that this thread still holds the same state
+    //
+    XzCopyStreamState(SavedStream, true);
+    SavedStream->Generation = MINLZ_ATOMIC_ADD(&StreamGeneration, 1) + 1;
+    LoadedStream = SavedStream;
+    LoadedGeneration = SavedStream->Generation;
+}
+
+uint32_t
+XzGetStreamSize (
+    void
+    )
+{
+    return XzCopyStreamState(NULL, false);
+}
+
+bool
+XzDecodeStart (
+    void* SavedStream,
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t OutputSize
+    )
+{
+    PSAVED_STREAM savedStream;
+    bool result;
+
+    //
+    // The output buffer must be allocated up front, as it is the dictionary
+    //
+    savedStream = (PSAVED_STREAM)SavedStream;
+    LoadedStream = NULL;
+    if (OutputBuffer == NULL)
+    {
+        return false;
+    }
+    MtBeginDecode();
+    result = XzBeginStream(InputBuffer, InputSize, OutputBuffer, OutputSize);
+    if (result)
+    {
+        Stream.Status = StepInProgress;
+        MtSuspendDecode();
+    }
+    else
+    {
+        Stream.Status = StepFailed;
+        MtEndDecode(false, InputSize, 0, false);
+    }
+    XzSaveStream(savedStream);
+    return result;
+}
+
+STEP_STATUS
+XzDecodeStep (
+    void* SavedStream,
+    const STEP_BUDGET* Budget,
+    uint32_t* OutputSize
+    )
+{
+    PSAVED_STREAM savedStream;
+    DECODE_BUDGET slice;
+    uint32_t position, outputLimit, sequences, sliceSequences;
+    uint64_t now, deadline;
+    STEP_STATUS status;
+    bool checksumError;
+
+    //
+    // Bring the stream back into this thread, unless it already holds it
+    //
+    savedStream = (PSAVED_STREAM)SavedStream;
+    CpuInitialize();
+    if ((LoadedStream != savedStream) || (LoadedGeneration != savedStream->Generation))
+    {
+        XzCopyStreamState(savedStream, false);
+    }
+    if (Stream.Status != StepInProgress)
+    {
+        *OutputSize = Stream.BlockSize;
+        return Stream.Status;
+    }
+
+    //
+    // Turn the budget into a limit on the dictionary offset, a number of
+    // sequences and a limit on the input offset. The time limit, if any, can
+    // only be checked between slices of work, so make them small enough.
+    //
+    now = MtResumeDecode();
+    deadline = ((Budget->MaxTime != 0) && (now != 0)) ? (now + Budget->MaxTime) : 0;
+    DtCanWrite(&position);
+    outputLimit = ((Budget->MaxOutput == 0) ||
+                   (Budget->MaxOutput > (XZ_STEP_UNLIMITED - position))) ?
+                  XZ_STEP_UNLIMITED : (position + Budget->MaxOutput);
+    sequences = (Budget->MaxSequences == 0) ? XZ_STEP_UNLIMITED : Budget->MaxSequences;
+    slice.InputLimit = (Budget->MaxInput == 0) ? XZ_STEP_UNLIMITED : Budget->MaxInput;
+    for (;;)
+    {
+        slice.OutputLimit = outputLimit;
+        if ((deadline != 0) && ((outputLimit - position) > XZ_STEP_TIME_SLICE))
+        {
+            slice.OutputLimit = position + XZ_STEP_TIME_SLICE;
+        }
+        slice.Sequences = sliceSequences = sequences;
+        slice.Exhausted = false;
+        if (!XzContinueStream(&slice))
+        {
+            status = DtIsFull() ? StepOutputFull : StepFailed;
+            break;
+        }
+        if (!slice.Exhausted)
+        {
+            status = StepComplete;
+            break;
+        }
+
+        //
+        // Keep going until the caller's own budget runs out, or until the next
+        // chunk needs more input than the caller has
+        //
+        DtCanWrite(&position);
+        sequences -= sliceSequences - slice.Sequences;
+        if ((position >= outputLimit) ||
+            (sequences == 0) ||
+            !Lz2IsInputAvailable(&slice) ||
+            ((deadline != 0) && (MtGetTime() >= deadline)))
+        {
+            status = StepInProgress;
+            break;
+        }
+    }
+
+    //
+    // Report the progress, and account for the decode in the metrics once it
+    // is over
+    //
+    DtCanWrite(&position);
+    *OutputSize = (status == StepComplete) ? Stream.BlockSize : position;
+    if (status == StepInProgress)
+    {
+        MtSuspendDecode();
+    }
+    else
+    {
+#ifdef MINLZ_INTEGRITY_CHECKS
+        checksumError = Container.ChecksumError;
+#else
+        checksumError = false;
+#endif
+        MtEndDecode(status == StepComplete,
+                    Stream.InputSize,
+                    (status == StepComplete) ? *OutputSize : 0,
+                    checksumError);
+    }
+    Stream.Status = status;
+    XzSaveStream(savedStream);
+    return status;
+}
+
+void
+XzSetZeroRunBuffer (
+    PZERO_RUN ZeroRuns,
+    uint32_t MaxZeroRuns
+    )
+{
+    //
+    // Have the dictionary record zero runs into the caller's array
+    //
+    DtSetZeroRunBuffer(ZeroRuns, MaxZeroRuns);
+}
+
+uint32_t
+XzGetZeroRunCount (
+    void
+    )
+{
+    return DtGetZeroRunCount();
+}
+
+void
+XzSetTokenBuffer (
+    PLZ_TOKEN Tokens,
+    uint32_t MaxTokens
+    )
+{
+    //
+    // Have the LZMA decoder record its sequences into the caller's array
+    //
+    LzSetTokenBuffer(Tokens, MaxTokens);
+}
+
+uint32_t
+XzGetTokenCount (
+    void
+    )
+{
+    return LzGetTokenCount();
+}
+
+void
+XzSetDigest (
+    DIGEST_TYPE Type,
+    PDIGEST_ROUTINE Routine,
+    void* Context
+    )
+{
+    //
+    // Select the digest that the LZMA2 decoder computes over its output
+    //
+    DgSetDigest(Type, Routine, Context);
+}
+
+uint32_t
+XzGetDigest (
+    uint8_t* Digest,
+    uint32_t DigestSize
+    )
+{
+    return DgGetDigest(Digest, DigestSize);
+}
+
+void
+XzSetMetricsClock (
+    PCLOCK_ROUTINE Clock
+    )
+{
+    //
+    // Start (or stop) timing the decodes with the caller's clock
+    //
+    MtSetClock(Clock);
+}
+
+void
+XzGetMetrics (
+    PMETRICS Metrics
+    )
+{
+    MtGetMetrics(Metrics);
+}
+
+bool
+XzSetIntegrityLevel (
+    INTEGRITY_LEVEL Level
+    )
+{
+    //
+    // Record the level for the streams that this thread starts from now on,
+    // failing if the checks for it were not compiled in. Streams decoded in
+    // steps keep the level they were started with.
+    //
+    if ((Level > IntegrityLevelBest) ||
+        ((Level != IntegrityLevelBest) && (Level > XZ_SUPPORTED_INTEGRITY_LEVEL)))
+    {
+        return false;
+    }
+    IntegrityLevel = Level;
+    return true;
+}
+
+INTEGRITY_LEVEL
+XzGetIntegrityLevel (
+    void
+    )
+{
+    //
+    // Return the level that the next stream started by this thread will use
+    //
+    return (IntegrityLevel == IntegrityLevelBest) ?
+           XZ_SUPPORTED_INTEGRITY_LEVEL : IntegrityLevel;
+}
+
+void
+XzSetTrustedInput (
+    bool Trusted
+    )
+{
+    //
+    // Record the choice for the streams that this thread starts from now on.
+    // Like the integrity level, streams decoded in steps keep theirs.
+    //
+    TrustedInput = Trusted;
+}
+
+bool
+XzGetTrustedInput (
+    void
+    )
+{
+    return TrustedInput;
+}
+
+bool
+XzSetDecodeEngine (
+    DECODE_ENGINE Engine
+    )
+{
+    //
+    // Record the engine for the streams that this thread starts from now on,
+    // as long as it was built in
+    //
+    if (Engine >= DecodeEngineMax)
+    {
+        return false;
+    }
+#ifndef MINLZ_ASM_DECODE
+    if (Engine == DecodeEngineAssembly)
+    {
+        return false;
+    }
+#endif
+    DecodeEngine = Engine;
+    return true;
+}
+
+DECODE_ENGINE
+XzGetDecodeEngine (
+    void
+    )
+{
+    return DecodeEngine;
+}
+
+uint32_t
+XzInfoCrc32 (
+    const uint8_t* Buffer,
+    uint32_t Length
+    )
+{
+#ifdef MINLZ_INTEGRITY_CHECKS
+    return Crc32(Buffer, Length);
+#else
+    uint32_t crc;
+    uint8_t i;
+
+    //
+    // Without integrity checks, there are no CRC tables, but the metadata is
+    // only a few dozen bytes, so compute its CRC32 one bit at a time
+    //
+    for (crc = UINT32_MAX; Length-- > 0; Buffer++)
+    {
+        for (crc ^= *Buffer, i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? UINT32_C(0xEDB88320) : 0);
+        }
+    }
+    return ~crc;
+#endif
+}
+
+bool
+XzInfoReadVli (
+    const uint8_t** Cursor,
+    const uint8_t* End,
+    uint64_t* Vli
+    )
+{
+    uint8_t vliByte, bitPos;
+
+    //
+    // Same encoding as XzDecodeVli, but with the full 63 bits that the format
+    // allows, since the index may describe blocks we cannot decode
+    //
+    *Vli = 0;
+    for (bitPos = 0; bitPos < 63; bitPos += 7)
+    {
+        if (*Cursor == End)
+        {
+            return false;
+        }
+        vliByte = *(*Cursor)++;
+        if ((vliByte == 0) && (bitPos != 0))
+        {
+            return false;
+        }
+        *Vli |= (uint64_t)(vliByte & 0x7F) << bitPos;
+        if ((vliByte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+XzInfoReadBlockHeader (
+    const uint8_t* BlockHeader,
+    const uint8_t* End,
+    PSTREAM_INFO Info,
+    bool* Supported
+    )
+{
+    const uint8_t* cursor;
+    const uint8_t* headerEnd;
+    uint64_t filterId, propertiesSize, size;
+    uint32_t headerSize, dictionarySize;
+    uint8_t flags, filterCount, properties;
+
+    //
+    // The header is 4-byte aligned, with its size (in units of 4 bytes) in the
+    // first byte and a CRC32 at the end
+    //
+    headerSize = (BlockHeader[0] + 1) * 4;
+    if ((BlockHeader[0] == 0) || (headerSize > (uint32_t)(End - BlockHeader)))
+    {
+        return false;
+    }
+    headerEnd = BlockHeader + headerSize - sizeof(uint32_t);
+    if (XzInfoCrc32(BlockHeader, headerSize - (uint32_t)sizeof(uint32_t)) !=
+        *(const uint32_t*)headerEnd)
+    {
+        Info->ChecksumError = true;
+    }
+    flags = BlockHeader[1];
+    if ((flags & 0x3C) != 0)
+    {
+        return false;
+    }
+
+    //
+    // minlzlib only decodes blocks with a single filter and no sizes in their
+    // header, which is exactly a 12-byte header
+    //
+    *Supported = (flags == 0) && (headerSize == sizeof(XZ_BLOCK_HEADER));
+    cursor = &BlockHeader[2];
+    if (((flags & 0x40) && !XzInfoReadVli(&cursor, headerEnd, &size)) ||
+        ((flags & 0x80) && !XzInfoReadVli(&cursor, headerEnd, &size)))
+    {
+        return false;
+    }
+
+    //
+    // Walk the filter chain, looking for the LZMA2 filter (which has to be the
+    // last one) to get its dictionary size
+    //
+    for (filterCount = (flags & 3) + 1; filterCount > 0; filterCount--)
+    {
+        if (!XzInfoReadVli(&cursor, headerEnd, &filterId) ||
+            !XzInfoReadVli(&cursor, headerEnd, &propertiesSize) ||
+            (propertiesSize > (uint64_t)(headerEnd - cursor)))
+        {
+            return false;
+        }
+        if ((filterId == k_XzLzma2FilterIdentifier) && (propertiesSize == 1))
+        {
+            properties = *cursor;
+            if (properties > 40)
+            {
+                return false;
+            }
+            dictionarySize = (properties == 40) ? UINT32_MAX :
+                             ((2 | (properties & 1)) << ((properties / 2) + 11));
+            if (dictionarySize > Info->DictionarySize)
+            {
+                Info->DictionarySize = dictionarySize;
+            }
+        }
+        else
+        {
+            *Supported = false;
+        }
+        cursor += propertiesSize;
+    }
+
+    //
+    // The rest of the header is padding, which must be zero
+    //
+    while (cursor < headerEnd)
+    {
+        if (*cursor++ != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+XzInfoReadStream (
+    const uint8_t* InputBuffer,
+    uint32_t* StreamEnd,
+    PSTREAM_INFO Info,
+    bool* Supported
+    )
+{
+    PXZ_STREAM_HEADER streamHeader;
+    PXZ_STREAM_FOOTER streamFooter;
+    const uint8_t* index;
+    const uint8_t* indexEnd;
+    const uint8_t* cursor;
+    uint64_t blockCount, unpaddedSize, uncompressedSize, blocksSize, i;
+    uint32_t indexSize;
+
+    //
+    // Start with the footer, which tells us the size of the index
+    //
+    if (*StreamEnd < (sizeof(*streamHeader) + sizeof(*streamFooter)))
+    {
+        return false;
+    }
+    streamFooter = (PXZ_STREAM_FOOTER)&InputBuffer[*StreamEnd - sizeof(*streamFooter)];
+    if ((streamFooter->Magic != k_XzStreamFooterMagic) ||
+        (streamFooter->u.s.ReservedFlags != 0) ||
+        (streamFooter->u.s.ReservedType != 0))
+    {
+        return false;
+    }
+    if (XzInfoCrc32((const uint8_t*)&streamFooter->BackwardSize,
+                    sizeof(streamFooter->BackwardSize) +
+                    sizeof(streamFooter->u.Flags)) != streamFooter->Crc32)
+    {
+        Info->ChecksumError = true;
+    }
+
+    //
+    // The index (with its CRC32) sits right before the footer
+    //
+    if (streamFooter->BackwardSize >
+        ((*StreamEnd - sizeof(*streamHeader) - sizeof(*streamFooter)) / 4 - 1))
+    {
+        return false;
+    }
+    indexSize = (streamFooter->BackwardSize + 1) * 4;
+    index = (const uint8_t*)streamFooter - indexSize;
+    indexEnd = (const uint8_t*)streamFooter - sizeof(uint32_t);
+    if (XzInfoCrc32(index, indexSize - (uint32_t)sizeof(uint32_t)) !=
+        *(const uint32_t*)indexEnd)
+    {
+        Info->ChecksumError = true;
+    }
+
+    //
+    // Add up the sizes of the blocks in the index, each of which is padded to
+    // a multiple of 4 bytes in the stream
+    //
+    cursor = index;
+    if ((*cursor++ != 0) || !XzInfoReadVli(&cursor, indexEnd, &blockCount))
+    {
+        return false;
+    }
+    blocksSize = 0;
+    for (i = 0; i < blockCount; i++)
+    {
+        if (!XzInfoReadVli(&cursor, indexEnd, &unpaddedSize) ||
+            !XzInfoReadVli(&cursor, indexEnd, &uncompressedSize) ||
+            (unpaddedSize < 5) ||
+            (unpaddedSize > UINT32_MAX))
+        {
+            return false;
+        }
+        blocksSize += (unpaddedSize + 3) & ~UINT64_C(3);
+        Info->UncompressedSize += uncompressedSize;
+    }
+    while (cursor < indexEnd)
+    {
+        if (*cursor++ != 0)
+        {
+            return false;
+        }
+    }
+
+    //
+    // Which leaves us right after the stream header
+    //
+    if (blocksSize > (uint64_t)(index - InputBuffer - sizeof(*streamHeader)))
+    {
+        return false;
+    }
+    streamHeader = (PXZ_STREAM_HEADER)(index - blocksSize - sizeof(*streamHeader));
+    if ((*(const uint32_t*)&streamHeader->Magic[1] != k_XzStreamHeaderMagic1) ||
+        (streamHeader->Magic[0] != k_XzStreamHeaderMagic0) ||
+        (streamHeader->Magic[5] != k_XzStreamHeaderMagic5) ||
+        (streamHeader->u.Flags != streamFooter->u.Flags))
+    {
+        return false;
+    }
+    if (XzInfoCrc32((const uint8_t*)&streamHeader->u.Flags,
+                    sizeof(streamHeader->u.Flags)) != streamHeader->Crc32)
+    {
+        Info->ChecksumError = true;
+    }
+    Info->CheckTypes |= 1 << streamHeader->u.s.CheckType;
+    Info->BlockCount += (uint32_t)blockCount;
+    *Supported = (blockCount <= 1);
+
+    //
+    // Only the header of the first block is read, for its dictionary size
+    //
+    if ((blockCount != 0) &&
+        !XzInfoReadBlockHeader((const uint8_t*)(streamHeader + 1), index, Info, Supported))
+    {
+        return false;
+    }
+    *StreamEnd = (uint32_t)((const uint8_t*)streamHeader - InputBuffer);
+    return true;
+}
+
+bool
+XzGetStreamInfo (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    PSTREAM_INFO Info
+    )
+{
+    uint32_t streamEnd;
+    bool supported;
+
+    //
+    // Walk the streams backwards from the end of the input, skipping over the
+    // stream padding (groups of 4 zero bytes) that can follow each of them.
+    // Only the footers, indexes and stream headers are read, along with the
+    // header of the first block of each stream, never the compressed data.
+    //
+    Info->UncompressedSize = 0;
+    Info->StreamCount = 0;
+    Info->BlockCount = 0;
+    Info->CheckTypes = 0;
+    Info->DictionarySize = 0;
+    Info->StreamPadding = 0;
+    Info->ChecksumError = false;
+    Info->Supported = true;
+    if ((InputSize % 4) != 0)
+    {
+        return false;
+    }
+    streamEnd = InputSize;
+    do
+    {
+        while ((streamEnd != 0) &&
+               (*(const uint32_t*)&InputBuffer[streamEnd - sizeof(uint32_t)] == 0))
+        {
+            streamEnd -= (uint32_t)sizeof(uint32_t);
+            Info->StreamPadding += (uint32_t)sizeof(uint32_t);
+        }
+        if (!XzInfoReadStream(InputBuffer, &streamEnd, Info, &supported))
+        {
+            return false;
+        }
+        Info->StreamCount++;
+        Info->Supported &= supported;
+    } while (streamEnd != 0);
+
+    //
+    // XzDecode only takes a single stream, with no padding after it
+    //
+    Info->Supported &= (Info->StreamCount == 1) &&
+                       (Info->StreamPadding == 0) &&
+                       (Info->UncompressedSize <= UINT32_MAX);
+    return true;
+}
+
+bool
+XzDecodeAlloc (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    const ALLOCATOR* Allocator,
+    uint8_t** OutputBuffer,
+    uint32_t* OutputSize
+    )
+{
+    STREAM_INFO info;
+    DECODE_BUDGET budget;
+    uint64_t bufferSize;
+    uint8_t* buffer;
+    uint32_t size;
+    bool result, checksumError;
+
+    //
+    // The index gives the exact size of the output, when the file has one that
+    // we can use and that isn't corrupted. Otherwise, start from a guess based
+    // on the input size. Either way, the dictionary grows the buffer as needed
+    // while decoding, so an implausible size is only trusted up to a point.
+    //
+    if (XzGetStreamInfo(InputBuffer, InputSize, &info) &&
+        info.Supported &&
+        !info.ChecksumError)
+    {
+        bufferSize = info.UncompressedSize;
+        if (bufferSize > ((uint64_t)InputSize * XZ_ALLOC_MAX_INITIAL_RATIO))
+        {
+            bufferSize = (uint64_t)InputSize * XZ_ALLOC_MAX_INITIAL_RATIO;
+        }
+    }
+    else
+    {
+        bufferSize = (uint64_t)InputSize * XZ_ALLOC_INITIAL_RATIO;
+    }
+    if (bufferSize > UINT32_MAX)
+    {
+        bufferSize = UINT32_MAX;
+    }
+    if (bufferSize == 0)
+    {
+        bufferSize = 1;
+    }
+    buffer = Allocator->Allocate(Allocator->Context, (uint32_t)bufferSize);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+
+    //
+    // This overwrites the state of any stream this thread was decoding in steps
+    //
+    LoadedStream = NULL;
+    MtBeginDecode();
+
+    //
+    // Decode the whole stream at once, letting the dictionary grow the buffer
+    //
+    budget.OutputLimit = XZ_STEP_UNLIMITED;
+    budget.Sequences = XZ_STEP_UNLIMITED;
+    budget.InputLimit = XZ_STEP_UNLIMITED;
+    budget.Exhausted = false;
+    result = XzBeginStream(InputBuffer, InputSize, buffer, (uint32_t)bufferSize);
+    if (result)
+    {
+        DtSetAllocator(Allocator);
+        result = XzContinueStream(&budget) && !budget.Exhausted;
+        DtSetAllocator(NULL);
+    }
+    buffer = DtGetBuffer(&size);
+    *OutputSize = result ? Stream.BlockSize : 0;
+
+    //
+    // Give back the unused part of the buffer, or all of it if the decode
+    // failed or produced nothing
+    //
+    if (*OutputSize == 0)
+    {
+        Allocator->Free(Allocator->Context, buffer, size);
+        buffer = NULL;
+    }
+    else if (*OutputSize != size)
+    {
+        *OutputBuffer = Allocator->Reallocate(Allocator->Context,
+                                              buffer,
+                                              size,
+                                              *OutputSize);
+        if (*OutputBuffer == NULL)
+        {
+            Allocator->Free(Allocator->Context, buffer, size);
+            *OutputSize = 0;
+            result = false;
+        }
+        buffer = *OutputBuffer;
+    }
+    *OutputBuffer = buffer;
+#ifdef MINLZ_INTEGRITY_CHECKS
+    checksumError = Container.ChecksumError;
+#else
+    checksumError = false;
+#endif
+    MtEndDecode(result, InputSize, *OutputSize, checksumError);
+    return result;
+}
+
+void
+XzResetContainer (
+    void
+    )
+{
+    //
+    // Another container format is about to use the decoder state of this
+    // thread, which overwrites any stream that was being decoded in steps
+    //
+    LoadedStream = NULL;
+#ifdef MINLZ_META_CHECKS
+    Container.ChecksumError = false;
+#endif
+}
+
+void
+XzSetChecksumError (
+    void
+    )
+{
+    //
+    // Let the other container formats report their checksum errors as well
+    //
+#ifdef MINLZ_META_CHECKS
+    Container.ChecksumError = true;
+#endif
+}
+
 bool
 XzChecksumError (
     void
@@ -50,6 +50,688 @@ XzChecksumError (
     void
     );
 
+/*!
+ * @brief          Describes a run of zero bytes in the decompressed output.
+ */
+typedef struct _XZ_ZERO_RUN
+{
+    uint32_t Offset;
+    uint32_t Length;
+} XZ_ZERO_RUN, *PXZ_ZERO_RUN;
+
+/*!
+ * @brief          Asks XzDecode to report the long runs of zero bytes that it
+ *                 writes to the output buffer.
+ *
+ * @detail         Runs are reported when the stream encodes them as repeats of
+ *                 a zero byte at distance 1, which is how encoders represent
+ *                 large zero-filled regions. Adjacent runs are merged. Callers
+ *                 can then avoid writing these regions (e.g.: by creating a
+ *                 sparse output file). Once the array is full, further runs
+ *                 are no longer reported. The array remains in use by the
+ *                 calling thread until this is called again with NULL.
+ *
+ * @param[in]      ZeroRuns - Array that receives the runs, or NULL to stop.
+ * @param[in]      MaxZeroRuns - The number of elements in the array.
+ */
+void
+XzSetZeroRunBuffer (
+    PXZ_ZERO_RUN ZeroRuns,
+    uint32_t MaxZeroRuns
+    );
+
+/*!
+ * @brief          Returns the number of zero runs reported by the last call to
+ *                 XzDecode on this thread.
+ */
+uint32_t
+XzGetZeroRunCount (
+    void
+    );
+
+/*!
+ * @brief          Types of the LZ77 sequences reported by XzDecode.
+ */
+typedef enum _XZ_LZ_TOKEN_TYPE
+{
+    XzLzTokenLiterals,
+    XzLzTokenMatch,
+    XzLzTokenRep0,
+    XzLzTokenRep1,
+    XzLzTokenRep2,
+    XzLzTokenRep3,
+    XzLzTokenShortRep
+} XZ_LZ_TOKEN_TYPE;
+
+/*!
+ * @brief          Describes one LZ77 sequence of the decompressed output.
+ *
+ * @detail         Literal runs have a Distance of 0, and their bytes are the
+ *                 next Length bytes of the output buffer. All other types copy
+ *                 Length bytes from Distance bytes back in the output buffer,
+ *                 with Type indicating how the encoder expressed the distance
+ *                 (an explicit distance, or one of the four recent distances).
+ */
+typedef struct _XZ_LZ_TOKEN
+{
+    uint32_t Type;
+    uint32_t Length;
+    uint32_t Distance;
+} XZ_LZ_TOKEN, *PXZ_LZ_TOKEN;
+
+/*!
+ * @brief          Asks XzDecode to report the LZ77 parse of the stream, which
+ *                 lets callers transcode it to other LZ77-based formats without
+ *                 having to search for matches again.
+ *
+ * @detail         Consecutive literals (including stored LZMA2 chunks) are
+ *                 merged into a single run, so an array with one entry per
+ *                 output byte is always large enough. If the array fills up,
+ *                 XzDecode fails. The array remains in use by the calling
+ *                 thread until this is called again with NULL.
+ *
+ * @param[in]      Tokens - Array that receives the sequences, or NULL to stop.
+ * @param[in]      MaxTokens - The number of elements in the array.
+ */
+void
+XzSetTokenBuffer (
+    PXZ_LZ_TOKEN Tokens,
+    uint32_t MaxTokens
+    );
+
+/*!
+ * @brief          Returns the number of sequences reported by the last call to
+ *                 XzDecode on this thread.
+ */
+uint32_t
+XzGetTokenCount (
+    void
+    );
+
+/*!
+ * @brief          Digests that XzDecode can compute over its output.
+ */
+typedef enum _XZ_DIGEST_TYPE
+{
+    XzDigestNone,
+    XzDigestXxh3,
+    XzDigestSha256,
+    XzDigestCallback
+} XZ_DIGEST_TYPE;
+
+/*!
+ * @brief          Caller-supplied digest routine, which receives the output of
+ *                 the stream in order, one LZMA2 chunk at a time.
+ */
+typedef void (*PXZ_DIGEST_ROUTINE)(void* Context, const uint8_t* Buffer, uint32_t Length);
+
+/*!
+ * @brief          Asks XzDecode to compute a digest of its output.
+ *
+ * @detail         Each LZMA2 chunk (up to 2MB) is hashed as soon as it has been
+ *                 decoded, while it is still in the processor's caches, which
+ *                 avoids a second pass over the output. XXH3 is the 64-bit
+ *                 variant with the default secret and a seed of 0. The setting
+ *                 applies to all further calls to XzDecode on the calling
+ *                 thread, until this is called again with XzDigestNone.
+ *
+ * @param[in]      Type - The digest to compute.
+ * @param[in]      Routine - For XzDigestCallback, the routine to call.
+ * @param[in]      Context - For XzDigestCallback, passed back to Routine.
+ */
+void
+XzSetDigest (
+    XZ_DIGEST_TYPE Type,
+    PXZ_DIGEST_ROUTINE Routine,
+    void* Context
+    );
+
+/*!
+ * @brief          Returns the digest of the output of the last call to XzDecode
+ *                 on this thread, in its canonical (big-endian) byte order.
+ *
+ * @param[out]     Digest - Buffer that receives the digest.
+ * @param[in]      DigestSize - The size of the buffer.
+ *
+ * @return         The size of the digest (8 for XXH3, 32 for SHA-256), or 0 if
+ *                 no built-in digest is selected or the buffer is too small.
+ */
+uint32_t
+XzGetDigest (
+    uint8_t* Digest,
+    uint32_t DigestSize
+    );
+
+#define XZ_METRICS_LATENCY_BUCKETS 32
+
+/*!
+ * @brief          Process-wide decoder metrics. All times are in nanoseconds,
+ *                 and are only collected while a clock is installed.
+ *
+ * @detail         Only calls to XzDecode with an output buffer are counted, not
+ *                 the ones querying the output size. LatencyBuckets[0] counts
+ *                 the decodes that took less than 1024ns, and each following
+ *                 bucket those that took less than twice the previous limit,
+ *                 with the last one counting all of the slower decodes.
+ */
+typedef struct _XZ_METRICS
+{
+    uint64_t DecodesStarted;
+    uint64_t DecodesFailed;
+    uint64_t CompressedBytes;
+    uint64_t DecompressedBytes;
+    uint64_t ChecksumErrors;
+    uint64_t LzmaTime;
+    uint64_t CrcTime;
+    uint64_t ContainerTime;
+    uint64_t LatencyBuckets[XZ_METRICS_LATENCY_BUCKETS];
+} XZ_METRICS, *PXZ_METRICS;
+
+/*!
+ * @brief          Caller-supplied clock, returning a monotonic time in ns.
+ */
+typedef uint64_t (*PXZ_CLOCK_ROUTINE)(void);
+
+/*!
+ * @brief          Installs the clock used to time the decodes for the metrics,
+ *                 for all threads. Pass NULL to stop timing them.
+ *
+ * @detail         The clock is read five times per decode, and never per chunk,
+ *                 but for streams of only a few hundred bytes its cost can still
+ *                 be comparable to the decode itself, so it should be cheap.
+ *
+ * @param[in]      Clock - The clock routine, or NULL.
+ */
+void
+XzSetMetricsClock (
+    PXZ_CLOCK_ROUTINE Clock
+    );
+
+/*!
+ * @brief          Takes a snapshot of the process-wide decoder metrics.
+ *
+ * @detail         The counters are updated with relaxed atomics once at the end
+ *                 of each decode, so decodes finishing while the snapshot is
+ *                 taken may only be partially reflected in it.
+ *
+ * @param[out]     Metrics - Receives the current value of every counter.
+ */
+void
+XzGetMetrics (
+    PXZ_METRICS Metrics
+    );
+
+/*!
+ * @brief          A stream being decoded in steps. This is an opaque buffer of
+ *                 XzGetStreamSize() bytes, allocated (8-byte aligned) by the
+ *                 caller.
+ */
+typedef struct _XZ_STREAM XZ_STREAM, *PXZ_STREAM;
+
+/*!
+ * @brief          Limits on the work done by a single call to XzDecodeStep. Any
+ *                 limit left at 0 does not apply.
+ *
+ * @detail         MaxOutput is the number of output bytes, MaxSequences is the
+ *                 number of LZMA sequences (literals, matches and reps), and
+ *                 MaxTime is in nanoseconds, measured with the clock installed
+ *                 by XzSetMetricsClock (it is ignored without one). A step can
+ *                 overshoot its output limit by up to one match (273 bytes), or
+ *                 one stored chunk (64KB), and its time limit by the time taken
+ *                 to decode 16KB of output. MaxInput is the number of bytes at
+ *                 the start of the input buffer that have been filled in, for
+ *                 input that is still being read: the step stops before any
+ *                 LZMA2 chunk that may not have fully arrived (any chunk that
+ *                 starts less than 64KB + 6 bytes before MaxInput, unless the
+ *                 input ends before that), and the value must never decrease.
+ */
+typedef struct _XZ_STEP_BUDGET
+{
+    uint32_t MaxOutput;
+    uint32_t MaxSequences;
+    uint64_t MaxTime;
+    uint32_t MaxInput;
+} XZ_STEP_BUDGET, *PXZ_STEP_BUDGET;
+
+/*!
+ * @brief          Status of a stream after a call to XzDecodeStep.
+ */
+typedef enum _XZ_STEP_STATUS
+{
+    XzStepFailed,
+    XzStepInProgress,
+    XzStepComplete,
+    XzStepOutputFull
+} XZ_STEP_STATUS;
+
+/*!
+ * @brief          Returns the size of the buffer holding a stream that is
+ *                 decoded in steps.
+ */
+uint32_t
+XzGetStreamSize (
+    void
+    );
+
+/*!
+ * @brief          Starts decoding an XZ stream in steps, so that an event loop
+ *                 can interleave it with other work (or with other streams).
+ *
+ * @detail         The stream header and block header are parsed right away,
+ *                 and the zero run, token and digest settings of the calling
+ *                 thread are captured for the whole stream. The input and
+ *                 output buffers must remain valid until the last step. When
+ *                 the input is still being read (see MaxInput), at least its
+ *                 first 1036 bytes (or all of it) must already be there.
+ *
+ * @param[out]     Stream - Caller-allocated buffer of XzGetStreamSize() bytes.
+ * @param[in]      InputBuffer - A fully formed buffer containing the XZ stream.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[in]      OutputBuffer - A buffer large enough for the whole output, as
+ *                 returned by XzDecode when called with no output buffer.
+ * @param[in]      OutputSize - The size of the output buffer.
+ *
+ * @return         true - The stream is ready to be stepped.
+ *                 false - The stream headers are invalid.
+ */
+bool
+XzDecodeStart (
+    PXZ_STREAM Stream,
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t OutputSize
+    );
+
+/*!
+ * @brief          Decodes the next part of a stream started by XzDecodeStart,
+ *                 stopping between two LZMA sequences (or two LZMA2 chunks)
+ *                 once the budget has run out.
+ *
+ * @detail         Any thread can take the next step of a stream, but only one
+ *                 thread at a time. Interleaving streams on a thread costs a
+ *                 copy of the decoder state (about 16KB) in each direction per
+ *                 switch, while stepping the same stream again does not.
+ *                 Calling XzDecode from the thread between two steps is fine.
+ *                 Once the stream is complete, XzChecksumError and XzGetDigest
+ *                 return its results, until the thread decodes something else.
+ *
+ * @param[in]      Stream - The stream to decode.
+ * @param[in]      Budget - The limits on the work done by this call.
+ * @param[out]     OutputSize - The number of bytes of output decoded so far, or
+ *                 the final size once the stream is complete.
+ *
+ * @return         XzStepInProgress - The budget ran out; call again later.
+ *                 XzStepComplete - The whole stream has been decoded.
+ *                 XzStepFailed - The stream is invalid.
+ *                 XzStepOutputFull - The output buffer is too small for the
+ *                 stream.
+ */
+XZ_STEP_STATUS
+XzDecodeStep (
+    PXZ_STREAM Stream,
+    const XZ_STEP_BUDGET* Budget,
+    uint32_t* OutputSize
+    );
+
+/*!
+ * @brief          Location of a member of an lzip (.lz) file, in the input and
+ *                 in the output, as returned by XzGetLzipMembers.
+ */
+typedef struct _XZ_LZIP_MEMBER
+{
+    uint32_t InputOffset;
+    uint32_t InputSize;
+    uint32_t OutputOffset;
+    uint32_t OutputSize;
+} XZ_LZIP_MEMBER, *PXZ_LZIP_MEMBER;
+
+/*!
+ * @brief          Decompresses an lzip file from InputBuffer into OutputBuffer.
+ *
+ * @detail         The file can contain any number of members, which are decoded
+ *                 one after the other. The trailing CRC32 of each member is only
+ *                 checked when integrity checks are enabled, and mismatches are
+ *                 reported by XzChecksumError, like for XZ streams.
+ *
+ * @param[in]      InputBuffer - A fully formed buffer containing the lzip file.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[in]      OutputBuffer - A fully allocated buffer to receive the output,
+ *                 or NULL to query the size of the decompressed buffer.
+ * @param[in,out]  OutputSize - On input, the size of the buffer. On output, the
+ *                 size of the decompressed result.
+ *
+ * @return         true - The input buffer was fully decompressed in OutputBuffer,
+ *                 or its decompressed size was returned in OutputSize.
+ *                 false - The file is invalid or the output buffer is too small.
+ */
+bool
+XzDecodeLzip (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    uint8_t* OutputBuffer,
+    uint32_t* OutputSize
+    );
+
+/*!
+ * @brief          Returns the members of an lzip file, in order, so that they
+ *                 can be decoded independently (e.g.: on multiple threads) with
+ *                 XzDecodeLzipMember.
+ *
+ * @param[in]      InputBuffer - A fully formed buffer containing the lzip file.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[out]     Members - Receives the members, or NULL to only count them.
+ * @param[in,out]  MemberCount - On input, the number of entries in Members. On
+ *                 output, the number of members in the file.
+ *
+ * @return         true - The members were counted, and returned if requested.
+ *                 false - The file is invalid, or Members is too small.
+ */
+bool
+XzGetLzipMembers (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    PXZ_LZIP_MEMBER Members,
+    uint32_t* MemberCount
+    );
+
+/*!
+ * @brief          Decompresses a single member of an lzip file.
+ *
+ * @detail         The member is written at its OutputOffset in OutputBuffer,
+ *                 which must be large enough for the whole file. Members do not
+ *                 share any state, so different threads can decode different
+ *                 members of the same file into the same buffer at once. The
+ *                 digest and XzChecksumError only cover this member.
+ *
+ * @param[in]      InputBuffer - A fully formed buffer containing the lzip file.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[in]      Member - A member returned by XzGetLzipMembers.
+ * @param[in]      OutputBuffer - The output buffer of the whole file.
+ *
+ * @return         true - The member was fully decompressed.
+ *                 false - The member is invalid.
+ */
+bool
+XzDecodeLzipMember (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    const XZ_LZIP_MEMBER* Member,
+    uint8_t* OutputBuffer
+    );
+
+/*!
+ * @brief          Summary of an XZ file, as returned by XzGetStreamInfo.
+ *
+ * @detail         CheckTypes has bit N set when a stream uses check type N (0
+ *                 for none, 1 for CRC32, 4 for CRC64, 10 for SHA-256), while
+ *                 DictionarySize is the largest one found in the first block of
+ *                 each stream. Supported is set when XzDecode can decode the
+ *                 file, which must then be a single stream, with at most one
+ *                 block, using LZMA2 and no other filters.
+ */
+typedef struct _XZ_STREAM_INFO
+{
+    uint64_t UncompressedSize;
+    uint32_t StreamCount;
+    uint32_t BlockCount;
+    uint32_t CheckTypes;
+    uint32_t DictionarySize;
+    uint32_t StreamPadding;
+    bool ChecksumError;
+    bool Supported;
+} XZ_STREAM_INFO, *PXZ_STREAM_INFO;
+
+/*!
+ * @brief          Describes an XZ file without decompressing it.
+ *
+ * @detail         Only the stream headers and footers, the indexes, and the
+ *                 header of the first block of each stream are read, so just a
+ *                 few pages of the input are touched, whatever its size. Their
+ *                 CRC32s are always checked, even without integrity checks, and
+ *                 mismatches are reported in ChecksumError.
+ *
+ * @param[in]      InputBuffer - A fully formed buffer containing the XZ file.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[out]     Info - Receives the summary of the file.
+ *
+ * @return         true - The file is structurally valid, and was described.
+ *                 false - The file is invalid.
+ */
+bool
+XzGetStreamInfo (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    PXZ_STREAM_INFO Info
+    );
+
+/*!
+ * @brief          Routines that XzDecodeAlloc uses to manage the output buffer.
+ *
+ * @detail         Reallocate must keep the first OldSize bytes of the buffer (or
+ *                 NewSize of them, when shrinking), and may move it, returning
+ *                 NULL if it could not be resized, in which case the original
+ *                 buffer must be left alone. Free is also given the size of the
+ *                 buffer, for allocators that need it (e.g.: munmap).
+ */
+typedef void* (*PXZ_ALLOCATE_ROUTINE)(void* Context, uint32_t Size);
+typedef void* (*PXZ_REALLOCATE_ROUTINE)(void* Context, void* Buffer, uint32_t OldSize, uint32_t NewSize);
+typedef void (*PXZ_FREE_ROUTINE)(void* Context, void* Buffer, uint32_t Size);
+typedef struct _XZ_ALLOCATOR
+{
+    PXZ_ALLOCATE_ROUTINE Allocate;
+    PXZ_REALLOCATE_ROUTINE Reallocate;
+    PXZ_FREE_ROUTINE Free;
+    void* Context;
+} XZ_ALLOCATOR, *PXZ_ALLOCATOR;
+
+/*!
+ * @brief          Decompresses an XZ stream from InputBuffer into a buffer that
+ *                 is allocated as needed, without a separate size query.
+ *
+ * @detail         The buffer is sized from the index when XzGetStreamInfo can
+ *                 read it and its checksums match, but never starts out larger
+ *                 than 256 times the size of the input, as the index could be
+ *                 forged. Otherwise, it starts out at a few times the size of
+ *                 the input. Either way, it is grown geometrically through
+ *                 Reallocate while decoding, so an allocator that can remap
+ *                 pages avoids copying the output. It is shrunk to the size of
+ *                 the output at the end.
+ *
+ * @param[in]      InputBuffer - A fully formed buffer containing the XZ stream.
+ * @param[in]      InputSize - The size of the input buffer.
+ * @param[in]      Allocator - The routines used to allocate the output buffer.
+ * @param[out]     OutputBuffer - Receives the decompressed output, which the
+ *                 caller frees with the allocator, or NULL if it is empty.
+ * @param[out]     OutputSize - Receives the size of the decompressed output.
+ *
+ * @return         true - The input buffer was fully decompressed.
+ *                 false - A failure occurred during the decompression process,
+ *                 and no buffer was returned.
+ */
+bool
+XzDecodeAlloc (
+    const uint8_t* InputBuffer,
+    uint32_t InputSize,
+    const XZ_ALLOCATOR* Allocator,
+    uint8_t** OutputBuffer,
+    uint32_t* OutputSize
+    );
+
+/*!
+ * @brief          Processor feature levels that the decoder can use for its hot
+ *                 kernels (match copies and checksums). Each level implies the
+ *                 previous ones.
+ */
+typedef enum _XZ_CPU_LEVEL
+{
+    XzCpuLevelGeneric,
+    XzCpuLevelSse42,
+    XzCpuLevelAvx2,
+    XzCpuLevelAvx512,
+    XzCpuLevelBest
+} XZ_CPU_LEVEL;
+
+/*!
+ * @brief          Selects the processor feature level used by XzDecode on the
+ *                 calling thread.
+ *
+ * @detail         By default, the best level supported by the processor is
+ *                 used. A lower level can be requested for benchmarking, and
+ *                 applies to the decodes run by the calling thread from then
+ *                 on.
+ *
+ * @param[in]      Level - The requested level, or XzCpuLevelBest.
+ *
+ * @return         true - The level will be used for the next decode.
+ *                 false - The processor does not support the requested level.
+ */
+bool
+XzSetCpuLevel (
+    XZ_CPU_LEVEL Level
+    );
+
+/*!
+ * @brief          Returns the processor feature level used by XzDecode.
+ *
+ * @return         The level in use by the calling thread.
+ */
+XZ_CPU_LEVEL
+XzGetCpuLevel (
+    void
+    );
+
+/*!
+ * @brief          Levels of checking performed on the input. Each level implies
+ *                 the previous ones, and XzIntegrityLevelBest is the highest one
+ *                 that minlzlib was built with (MINLZ_INTEGRITY_CHECKS for full
+ *                 checks, MINLZ_META_CHECKS for metadata checks).
+ *
+ * @detail         With no checks, the input is trusted: only the headers needed
+ *                 to find the LZMA2 data are read, and the index and footer are
+ *                 ignored. Metadata checks validate the stream and block headers,
+ *                 the index and the footer (along with their CRC32s, if built
+ *                 with MINLZ_INTEGRITY_CHECKS). Full checks also compute the
+ *                 check of the decompressed data, which is the only one whose
+ *                 cost grows with the size of the input.
+ */
+typedef enum _XZ_INTEGRITY_LEVEL
+{
+    XzIntegrityLevelNone,
+    XzIntegrityLevelMeta,
+    XzIntegrityLevelFull,
+    XzIntegrityLevelBest
+} XZ_INTEGRITY_LEVEL;
+
+/*!
+ * @brief          Selects the level of checking for the streams decoded by the
+ *                 calling thread.
+ *
+ * @detail         The level applies to the decodes started by the calling thread
+ *                 from then on, so that threads decoding trusted data and threads
+ *                 decoding untrusted data can share the same build. A stream that
+ *                 is decoded in steps keeps the level it was started with, even
+ *                 when its steps run on other threads.
+ *
+ * @param[in]      Level - The requested level, or XzIntegrityLevelBest.
+ *
+ * @return         true - The level will be used for the next decode.
+ *                 false - minlzlib was not built with the requested checks.
+ */
+bool
+XzSetIntegrityLevel (
+    XZ_INTEGRITY_LEVEL Level
+    );
+
+/*!
+ * @brief          Returns the level of checking for the next decode.
+ *
+ * @return         The level in use by the calling thread.
+ */
+XZ_INTEGRITY_LEVEL
+XzGetIntegrityLevel (
+    void
+    );
+
+/*!
+ * @brief          Selects whether the streams decoded by the calling thread are
+ *                 trusted, which decodes their LZMA data in a separate loop that
+ *                 does not check every input byte, distance and length.
+ *
+ * @detail         Trusted input is still checked once each LZMA2 chunk (or lzip
+ *                 member) is decoded, but malformed input can make the decoder
+ *                 read past the end of the input buffer, and write anywhere in
+ *                 the output buffer, or before and after it, before that. Only
+ *                 use it for input that was authenticated beforehand, such as
+ *                 signed images that were produced by the caller. Like the level
+ *                 of checking, a stream that is decoded in steps keeps the choice
+ *                 it was started with. Decodes that return their LZ sequences
+ *                 are never trusted.
+ *
+ * @param[in]      Trusted - Whether the next decodes are of trusted input.
+ */
+void
+XzSetTrustedInput (
+    bool Trusted
+    );
+
+/*!
+ * @brief          Returns whether the next decode is of trusted input.
+ *
+ * @return         The choice in use by the calling thread.
+ */
+bool
+XzGetTrustedInput (
+    void
+    );
+
+/*!
+ * @brief          Engines that decode the LZMA data of input that is not trusted.
+ *
+ * @detail         The call tree engine decodes each sequence through a function
+ *                 for each of its parts. The state machine engine is a single
+ *                 function, which keeps the range decoder and the dictionary in
+ *                 locals and jumps between the parts of a sequence (with computed
+ *                 goto where the compiler supports it). The assembly engine does
+ *                 the same in x86-64 assembly, and is only built on x86-64 Linux.
+ *                 All of them make the same checks and produce the same output.
+ */
+typedef enum _XZ_DECODE_ENGINE
+{
+    XzDecodeEngineCallTree,
+    XzDecodeEngineStateMachine,
+    XzDecodeEngineAssembly,
+    XzDecodeEngineMax
+} XZ_DECODE_ENGINE;
+
+/*!
+ * @brief          Selects the engine for the streams decoded by the calling
+ *                 thread, which defaults to the call tree engine.
+ *
+ * @detail         Like the level of checking, a stream that is decoded in steps
+ *                 keeps the engine it was started with. Trusted input and decodes
+ *                 that return their LZ sequences ignore the engine.
+ *
+ * @param[in]      Engine - The requested engine.
+ *
+ * @return         true - The engine will be used for the next decode.
+ *                 false - The engine does not exist, or was not built in.
+ */
+bool
+XzSetDecodeEngine (
+    XZ_DECODE_ENGINE Engine
+    );
+
+/*!
+ * @brief          Returns the engine for the next decode.
+ *
+ * @return         The engine in use by the calling thread.
+ */
+XZ_DECODE_ENGINE
+XzGetDecodeEngine (
+    void
+    );
+
 #if defined (__cplusplus)
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,644 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    minlzma.hpp
+
+Abstract:
+
+    This header file implements xz_istreambuf, a std::streambuf that decodes an
+    XZ stream as it is read, so that C++ code taking a std::istream can consume
+    .xz input directly, without decompressing it to a temporary file first. The
+    stream is decoded in steps (see XzDecodeStep) of at least one window of
+    output, each of which becomes the next get area. Since the decoder uses its
+    output as its dictionary, the get area is the decoded output itself, so
+    character reads are zero-copy, and xsgetn copies exactly once, from the
+    decoded output into the caller's buffer. Files are read by xz_reader, on a
+    dedicated thread that stays a few large buffers ahead of the decoder, so
+    that decoding starts before the whole file has been read, and overlaps with
+    the rest of the I/O (e.g.: on network filesystems).
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include "minlzma.h"
+
+namespace minlzma
+{
+
+//
+// Reads a file into memory on a dedicated thread. The end of the file (where
+// the index is) is read first, then the rest in order, one buffer at a time,
+// while the decoder is handed the buffers that are done through a single-
+// producer, single-consumer ring, without locks. The reader only ever stays a
+// given number of buffers ahead of the last one that was taken, so it follows
+// the decoder's position in the input rather than racing to the end of it.
+//
+class xz_reader
+{
+public:
+    static const uint32_t default_buffer_count = 4;
+    static const uint32_t default_buffer_size = 4 * 1024 * 1024;
+
+    //
+    // Buffers must hold the stream and block headers, and a whole LZMA2 chunk
+    //
+    static const uint32_t min_buffer_size = 128 * 1024;
+    static const uint32_t tail_size = 64 * 1024;
+
+    explicit
+    xz_reader (
+        const std::string& Path,
+        uint32_t BufferCount = default_buffer_count,
+        uint32_t BufferSize = default_buffer_size
+        ) :
+        m_File(Path.c_str(), std::ios::binary),
+        m_BufferCount((BufferCount != 0) ? BufferCount : 1),
+        m_BufferSize((BufferSize > min_buffer_size) ? BufferSize : min_buffer_size)
+    {
+        std::streamoff size;
+
+        //
+        // Until the first buffer has been taken, only let the reader read the
+        // end of the file and its first buffer, so that the index can be read
+        // while nothing else is being written
+        //
+        if (!m_File.seekg(0, std::ios::end))
+        {
+            return;
+        }
+        size = m_File.tellg();
+        if ((size < 0) || (size > UINT32_MAX))
+        {
+            return;
+        }
+        m_Size = static_cast<uint32_t>(size);
+        m_TailOffset = (m_Size > tail_size) ? (m_Size - tail_size) : 0;
+        m_Buffers = static_cast<uint32_t>((static_cast<uint64_t>(m_TailOffset) +
+                                           m_BufferSize - 1) / m_BufferSize);
+        m_Storage.reset(new uint8_t[(m_Size != 0) ? m_Size : 1]);
+        m_Limit.store(1, std::memory_order_relaxed);
+        m_Thread = std::thread(&xz_reader::read, this);
+    }
+
+    xz_reader (const xz_reader&) = delete;
+    xz_reader& operator= (const xz_reader&) = delete;
+
+    ~xz_reader (
+        void
+        )
+    {
+        if (m_Thread.joinable())
+        {
+            m_Stop.store(true, std::memory_order_relaxed);
+            m_Thread.join();
+        }
+    }
+
+    bool
+    is_open (
+        void
+        ) const
+    {
+        return m_Thread.joinable();
+    }
+
+    bool
+    failed (
+        void
+        ) const
+    {
+        return m_Failed.load(std::memory_order_acquire);
+    }
+
+    const uint8_t*
+    data (
+        void
+        ) const
+    {
+        return m_Storage.get();
+    }
+
+    uint32_t
+    size (
+        void
+        ) const
+    {
+        return m_Size;
+    }
+
+    /*!
+     * @brief          Hands the next buffer to the decoder, waiting for the
+     *                 reader to finish it if needed, and lets the reader move on
+     *                 to the one after the last one in flight.
+     *
+     * @return         The number of bytes at the start of the file that can be
+     *                 decoded, which is the whole file once the last buffer has
+     *                 been taken, or 0 if the file could not be read.
+     */
+    uint32_t
+    take (
+        void
+        )
+    {
+        uint32_t next;
+
+        //
+        // The end of the file is always read first, so wait for it along with
+        // the next buffer (or on its own, once there are none left)
+        //
+        next = (m_Taken < m_Buffers) ? (m_Taken + 1) : m_Buffers;
+        while (m_Completed.load(std::memory_order_acquire) < (next + 1))
+        {
+            if (failed())
+            {
+                return 0;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        m_Taken = next;
+        m_Limit.store(m_Taken + m_BufferCount, std::memory_order_release);
+        return (m_Taken == m_Buffers) ? m_Size : (m_Taken * m_BufferSize);
+    }
+
+    /*!
+     * @brief          Takes every buffer, waiting for the whole file to be read.
+     */
+    uint32_t
+    take_all (
+        void
+        )
+    {
+        uint32_t available;
+
+        do
+        {
+            available = take();
+        } while ((available != 0) && (available != m_Size));
+        return available;
+    }
+
+private:
+    void
+    read (
+        void
+        )
+    {
+        uint32_t step, offset, length;
+
+        //
+        // Step 0 reads the end of the file, and each step after that reads the
+        // next buffer, as long as it is no more than the allowed number of
+        // buffers ahead of the decoder
+        //
+        for (step = 0; step <= m_Buffers; step++)
+        {
+            if (step == 0)
+            {
+                offset = m_TailOffset;
+                length = m_Size - m_TailOffset;
+            }
+            else
+            {
+                while (step > m_Limit.load(std::memory_order_acquire))
+                {
+                    if (m_Stop.load(std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                offset = (step - 1) * m_BufferSize;
+                length = ((m_TailOffset - offset) > m_BufferSize) ?
+                         m_BufferSize : (m_TailOffset - offset);
+            }
+            if (m_Stop.load(std::memory_order_relaxed) ||
+                !m_File.seekg(offset) ||
+                !m_File.read(reinterpret_cast<char*>(&m_Storage[offset]), length))
+            {
+                m_Failed.store(true, std::memory_order_release);
+                return;
+            }
+            m_Completed.store(step + 1, std::memory_order_release);
+        }
+    }
+
+    std::ifstream m_File;
+    std::unique_ptr<uint8_t[]> m_Storage;
+    std::thread m_Thread;
+    uint32_t m_BufferCount;
+    uint32_t m_BufferSize;
+    uint32_t m_Size = 0;
+    uint32_t m_TailOffset = 0;
+    uint32_t m_Buffers = 0;
+    uint32_t m_Taken = 0;
+    std::atomic<uint32_t> m_Completed{0};
+    std::atomic<uint32_t> m_Limit{0};
+    std::atomic<bool> m_Failed{false};
+    std::atomic<bool> m_Stop{false};
+};
+
+class xz_istreambuf : public std::streambuf
+{
+public:
+    static const uint32_t default_window = 1024 * 1024;
+
+    /*!
+     * @brief          Decodes the .xz file at Path, which is read into memory by
+     *                 an xz_reader with ReadBuffers buffers of ReadBufferSize
+     *                 bytes in flight, while it is being decoded.
+     */
+    explicit
+    xz_istreambuf (
+        const std::string& Path,
+        uint32_t Window = default_window,
+        uint32_t ReadBuffers = xz_reader::default_buffer_count,
+        uint32_t ReadBufferSize = xz_reader::default_buffer_size
+        ) :
+        m_Reader(new xz_reader(Path, ReadBuffers, ReadBufferSize)),
+        m_Window(Window)
+    {
+        XZ_STREAM_INFO info;
+
+        //
+        // Size the output from the index, which the reader has read along with
+        // the first buffer, before letting it carry on. Without a usable index,
+        // wait for the whole file, and walk the stream to size it instead.
+        //
+        if (!m_Reader->is_open())
+        {
+            return;
+        }
+        m_Available = m_Reader->take();
+        if ((m_Available != 0) &&
+            XzGetStreamInfo(m_Reader->data(), m_Reader->size(), &info) &&
+            info.Supported)
+        {
+            m_OutputSize = static_cast<uint32_t>(info.UncompressedSize);
+            start(m_Reader->data(), m_Reader->size());
+        }
+        else if (m_Available != 0)
+        {
+            m_Available = m_Reader->take_all();
+            if (m_Available != 0)
+            {
+                open(m_Reader->data(), m_Reader->size());
+            }
+        }
+    }
+
+    /*!
+     * @brief          Decodes the XZ stream in InputBuffer, which must remain
+     *                 valid for the lifetime of the stream buffer.
+     */
+    xz_istreambuf (
+        const uint8_t* InputBuffer,
+        uint32_t InputSize,
+        uint32_t Window = default_window
+        ) :
+        m_Available(InputSize),
+        m_Window(Window)
+    {
+        open(InputBuffer, InputSize);
+    }
+
+    xz_istreambuf (const xz_istreambuf&) = delete;
+    xz_istreambuf& operator= (const xz_istreambuf&) = delete;
+
+    /*!
+     * @brief          Returns true if the stream headers were valid.
+     */
+    bool
+    is_open (
+        void
+        ) const
+    {
+        return m_Status != XzStepFailed;
+    }
+
+    /*!
+     * @brief          Returns true if the stream was decoded up to its end, with
+     *                 checksum errors reported by checksum_error.
+     */
+    bool
+    is_complete (
+        void
+        ) const
+    {
+        return m_Status == XzStepComplete;
+    }
+
+    bool
+    checksum_error (
+        void
+        ) const
+    {
+        return m_ChecksumError;
+    }
+
+    /*!
+     * @brief          Returns the decompressed size of the whole stream.
+     */
+    uint32_t
+    size (
+        void
+        ) const
+    {
+        return m_OutputSize;
+    }
+
+protected:
+    int_type
+    underflow (
+        void
+        ) override
+    {
+        uint32_t offset;
+
+        //
+        // Refill the get area with the next window of output
+        //
+        offset = static_cast<uint32_t>(gptr() - eback());
+        if ((offset == m_Decoded) && !decode(offset + 1))
+        {
+            return traits_type::eof();
+        }
+        setg(eback(), eback() + offset, eback() + m_Decoded);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize
+    xsgetn (
+        char_type* Buffer,
+        std::streamsize Count
+        ) override
+    {
+        std::streamsize copied, available;
+        uint32_t offset;
+
+        //
+        // Decode as much as was asked for (and at least a window) before
+        // copying it out, instead of going one window at a time
+        //
+        offset = static_cast<uint32_t>(gptr() - eback());
+        if ((Count > (m_Decoded - offset)) && (m_Status == XzStepInProgress))
+        {
+            decode((Count < (m_OutputSize - offset)) ?
+                   (offset + static_cast<uint32_t>(Count)) : m_OutputSize);
+        }
+        available = m_Decoded - offset;
+        copied = (Count < available) ? Count : available;
+        if (copied != 0)
+        {
+            std::memcpy(Buffer, gptr(), static_cast<size_t>(copied));
+        }
+        setg(eback(), gptr() + copied, eback() + m_Decoded);
+        return copied;
+    }
+
+    std::streamsize
+    showmanyc (
+        void
+        ) override
+    {
+        uint32_t offset;
+
+        offset = static_cast<uint32_t>(gptr() - eback());
+        return (m_Status == XzStepFailed) ? -1 :
+               static_cast<std::streamsize>(m_OutputSize - offset);
+    }
+
+    pos_type
+    seekoff (
+        off_type Offset,
+        std::ios_base::seekdir Direction,
+        std::ios_base::openmode Mode
+        ) override
+    {
+        off_type target;
+
+        if (!(Mode & std::ios_base::in) || (m_Status == XzStepFailed))
+        {
+            return pos_type(off_type(-1));
+        }
+        if (Direction == std::ios_base::cur)
+        {
+            target = (gptr() - eback()) + Offset;
+        }
+        else if (Direction == std::ios_base::end)
+        {
+            target = m_OutputSize + Offset;
+        }
+        else
+        {
+            target = Offset;
+        }
+
+        //
+        // Seeking backwards is free, since all of the output stays around as
+        // the dictionary, while seeking forward decodes up to the target
+        //
+        if ((target < 0) ||
+            (target > m_OutputSize) ||
+            ((target > m_Decoded) && !decode(static_cast<uint32_t>(target))))
+        {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + target, eback() + m_Decoded);
+        return pos_type(target);
+    }
+
+    pos_type
+    seekpos (
+        pos_type Position,
+        std::ios_base::openmode Mode
+        ) override
+    {
+        return seekoff(off_type(Position), std::ios_base::beg, Mode);
+    }
+
+private:
+    void
+    open (
+        const uint8_t* InputBuffer,
+        uint32_t InputSize
+        )
+    {
+        //
+        // Size the output, which has to hold the whole stream
+        //
+        m_OutputSize = 0;
+        if (XzDecode(InputBuffer, InputSize, nullptr, &m_OutputSize))
+        {
+            start(InputBuffer, InputSize);
+        }
+    }
+
+    void
+    start (
+        const uint8_t* InputBuffer,
+        uint32_t InputSize
+        )
+    {
+        char_type* output;
+
+        //
+        // Parse the headers right away so that invalid input is reported by
+        // is_open
+        //
+        m_InputSize = InputSize;
+        m_Output.reset(new uint8_t[(m_OutputSize != 0) ? m_OutputSize : 1]);
+        m_Stream.reset(new uint64_t[(XzGetStreamSize() + 7) / 8]);
+        if (XzDecodeStart(reinterpret_cast<PXZ_STREAM>(m_Stream.get()),
+                          InputBuffer,
+                          InputSize,
+                          m_Output.get(),
+                          m_OutputSize))
+        {
+            m_Status = XzStepInProgress;
+        }
+        output = reinterpret_cast<char_type*>(m_Output.get());
+        setg(output, output, output);
+    }
+
+    bool
+    decode (
+        uint32_t Target
+        )
+    {
+        XZ_STEP_BUDGET budget;
+        uint32_t needed;
+
+        //
+        // Decode at least a window of output at a time, even when less than
+        // that is needed, so that byte-sized reads still refill in bulk
+        //
+        while ((m_Decoded < Target) && (m_Status == XzStepInProgress))
+        {
+            needed = Target - m_Decoded;
+            budget.MaxOutput = (needed > m_Window) ? needed : m_Window;
+            budget.MaxSequences = 0;
+            budget.MaxTime = 0;
+            budget.MaxInput = (m_Available < m_InputSize) ? m_Available : 0;
+            m_Status = XzDecodeStep(reinterpret_cast<PXZ_STREAM>(m_Stream.get()),
+                                    &budget,
+                                    &m_Decoded);
+            if (m_Status == XzStepComplete)
+            {
+                m_ChecksumError = XzChecksumError();
+            }
+
+            //
+            // The buffer was sized from the index (or a size query), so a stream
+            // that does not fit in it is just as corrupt as any other
+            //
+            if (m_Status == XzStepOutputFull)
+            {
+                m_Status = XzStepFailed;
+            }
+
+            //
+            // A step that stops short of its output budget has run out of input,
+            // so hand the decoder the next buffer from the reader
+            //
+            if ((m_Status == XzStepInProgress) && (m_Decoded < Target))
+            {
+                m_Available = m_Reader->take();
+                if (m_Available == 0)
+                {
+                    throw std::ios_base::failure("failed to read xz file");
+                }
+            }
+        }
+
+        //
+        // A corrupt stream makes the istream go bad, rather than end early
+        //
+        if (m_Status == XzStepFailed)
+        {
+            throw std::ios_base::failure("invalid xz stream");
+        }
+        return m_Decoded >= Target;
+    }
+
+    std::unique_ptr<xz_reader> m_Reader;
+    std::unique_ptr<uint8_t[]> m_Output;
+    std::unique_ptr<uint64_t[]> m_Stream;
+    uint32_t m_InputSize = 0;
+    uint32_t m_Available = 0;
+    uint32_t m_OutputSize = 0;
+    uint32_t m_Decoded = 0;
+    uint32_t m_Window;
+    XZ_STEP_STATUS m_Status = XzStepFailed;
+    bool m_ChecksumError = false;
+};
+
+//
+// An istream reading from an xz_istreambuf, failing right away if the stream
+// could not be opened
+//
+class xz_istream : public std::istream
+{
+public:
+    explicit
+    xz_istream (
+        const std::string& Path,
+        uint32_t Window = xz_istreambuf::default_window,
+        uint32_t ReadBuffers = xz_reader::default_buffer_count,
+        uint32_t ReadBufferSize = xz_reader::default_buffer_size
+        ) :
+        std::istream(nullptr),
+        m_Buffer(Path, Window, ReadBuffers, ReadBufferSize)
+    {
+        init(&m_Buffer);
+        if (!m_Buffer.is_open())
+        {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    xz_istream (
+        const uint8_t* InputBuffer,
+        uint32_t InputSize,
+        uint32_t Window = xz_istreambuf::default_window
+        ) :
+        std::istream(nullptr),
+        m_Buffer(InputBuffer, InputSize, Window)
+    {
+        init(&m_Buffer);
+        if (!m_Buffer.is_open())
+        {
+            setstate(std::ios_base::failbit);
+        }
+    }
+
+    xz_istreambuf*
+    rdbuf (
+        void
+        )
+    {
+        return &m_Buffer;
+    }
+
+private:
+    xz_istreambuf m_Buffer;
+};
+
+}
@@ -0,0 +1,103 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    checksum.c
+
+Abstract:
+
+    This module implements the regression test for the block checks done by
+    integrity builds of minlzlib. A small stream with a CRC32 block check must
+    decode without being flagged as corrupt, a copy with a damaged check must
+    be flagged, and the flag must not carry over to the next decode.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <minlzma.h>
+
+//
+// "minlzma checks every block it decodes.\n", compressed with xz -T1 --check=crc32
+//
+const uint8_t k_TsStream[] =
+{
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x01, 0x69, 0x22, 0xde, 0x36,
+    0x02, 0x00, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3,
+    0x01, 0x00, 0x26, 0x6d, 0x69, 0x6e, 0x6c, 0x7a, 0x6d, 0x61, 0x20, 0x63,
+    0x68, 0x65, 0x63, 0x6b, 0x73, 0x20, 0x65, 0x76, 0x65, 0x72, 0x79, 0x20,
+    0x62, 0x6c, 0x6f, 0x63, 0x6b, 0x20, 0x69, 0x74, 0x20, 0x64, 0x65, 0x63,
+    0x6f, 0x64, 0x65, 0x73, 0x2e, 0x0a, 0x00, 0x00, 0x15, 0xba, 0x37, 0x5f,
+    0x00, 0x01, 0x3b, 0x27, 0x78, 0xef, 0x3e, 0xb9, 0x90, 0x42, 0x99, 0x0d,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x59, 0x5a
+};
+const char k_TsText[] = "minlzma checks every block it decodes.\n";
+#define TS_CHECK_OFFSET 68
+
+bool
+TsDecode (
+    const uint8_t* Stream,
+    uint32_t StreamSize,
+    bool ExpectError
+    )
+{
+    uint8_t output[sizeof(k_TsText)];
+    uint32_t outputSize;
+
+    //
+    // The stream must decode to the original text either way, since a block
+    // check failure is only reported, and never fails the decode
+    //
+    outputSize = sizeof(output);
+    if (!XzDecode(Stream, StreamSize, output, &outputSize) ||
+        (outputSize != (sizeof(k_TsText) - 1)) ||
+        (memcmp(output, k_TsText, outputSize) != 0))
+    {
+        printf("Stream failed to decode\n");
+        return false;
+    }
+    if (XzChecksumError() != ExpectError)
+    {
+        printf("Checksum error %s\n", ExpectError ? "missed" : "reported on intact stream");
+        return false;
+    }
+    return true;
+}
+
+int
+main (
+    void
+    )
+{
+    uint8_t corrupt[sizeof(k_TsStream)];
+
+    //
+    // An intact stream must not be flagged
+    //
+    if (!TsDecode(k_TsStream, sizeof(k_TsStream), false))
+    {
+        return 1;
+    }
+
+    //
+    // Flip a bit in the block check, which must then be flagged, and make
+    // sure that the intact stream decoded right after it is not
+    //
+    memcpy(corrupt, k_TsStream, sizeof(corrupt));
+    corrupt[TS_CHECK_OFFSET] ^= 1;
+    if (!TsDecode(corrupt, sizeof(corrupt), true) ||
+        !TsDecode(k_TsStream, sizeof(k_TsStream), false))
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
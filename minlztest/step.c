@@ -0,0 +1,670 @@
+/*++
+
+Copyright (c) Alex Ionescu.  All rights reserved.
+
+Module Name:
+
+    step.c
+
+Abstract:
+
+    This module implements the tests for decoding streams in steps, whose state
+    is saved after every step and brought back by whichever thread takes the
+    next one. Two streams are decoded in small steps interleaved on one thread,
+    and one of them is then handed back and forth between two threads, with a
+    full decode on one of them between steps, so that a thread holding an older
+    copy of the stream must notice that it is stale. Each time, the output and
+    its digest must match those of a one-shot decode, and the block checks must
+    pass. Finally, a stream whose output buffer is too small must stop with
+    XzStepOutputFull.
+
+Environment:
+
+    Windows & Linux, user mode.
+
+--*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <minlzma.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+//
+// Words that the test streams are made of, picked by a linear congruential
+// generator, so that the expected output doesn't have to be embedded as well
+//
+const char* k_TsWords[] =
+{
+    "minlzma ", "decodes ", "in steps\n", "lzma2 "
+};
+#define TS_SIZE_A   24576
+#define TS_SIZE_B   16384
+
+//
+// TsGenerate(1, 24576 bytes), compressed with xz -T1 --check=crc64
+//
+const uint8_t k_TsStreamA[] =
+{
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4, 0x46,
+    0x02, 0x00, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3,
+    0xe0, 0x5f, 0xff, 0x06, 0x13, 0x5d, 0x00, 0x34, 0x9b, 0x80, 0x06, 0x32,
+    0x2c, 0xf7, 0x36, 0xb1, 0x19, 0x6d, 0x1e, 0xa5, 0xe4, 0x4f, 0xb6, 0x62,
+    0xc2, 0x8a, 0x08, 0xc1, 0x40, 0x26, 0x47, 0x47, 0x08, 0xb8, 0xbd, 0xee,
+    0xe3, 0x68, 0xfa, 0xee, 0xae, 0x99, 0xd1, 0xe2, 0x98, 0x61, 0xa5, 0x8e,
+    0x05, 0x27, 0xdf, 0x8f, 0x1f, 0x7e, 0x48, 0xd8, 0xab, 0x12, 0x0c, 0xf2,
+    0xb5, 0xef, 0x90, 0xd5, 0x61, 0xd2, 0xe2, 0x6d, 0x51, 0x5f, 0x0a, 0x25,
+    0x86, 0xdd, 0x22, 0xcc, 0xe3, 0x95, 0xa7, 0x14, 0x92, 0x59, 0x63, 0xf6,
+    0x26, 0x5d, 0x47, 0x8d, 0x2f, 0x0b, 0x28, 0x7d, 0x59, 0x68, 0x81, 0x1e,
+    0xe7, 0x18, 0x81, 0x5a, 0x65, 0xd6, 0xd7, 0xa0, 0x11, 0x65, 0xd9, 0x85,
+    0xaf, 0x6e, 0xf2, 0x44, 0xc9, 0x50, 0xc4, 0x67, 0xcc, 0x76, 0x21, 0xea,
+    0x83, 0x8e, 0x0b, 0x05, 0x74, 0xd3, 0x21, 0x32, 0x67, 0x3f, 0x8f, 0x43,
+    0x99, 0xbb, 0x98, 0x78, 0xe1, 0x7f, 0x85, 0x40, 0x57, 0xff, 0xd5, 0xc2,
+    0xbf, 0x43, 0x49, 0x43, 0xb3, 0xf9, 0x37, 0x40, 0xf8, 0xb0, 0x4d, 0x55,
+    0x47, 0xdb, 0xf8, 0x42, 0xbf, 0x7d, 0x64, 0xaf, 0x60, 0xa9, 0x38, 0x90,
+    0xf4, 0xd8, 0xa7, 0xf2, 0x68, 0xfc, 0xd9, 0x51, 0x76, 0xa9, 0x0f, 0x8f,
+    0x31, 0xd6, 0x72, 0x90, 0x90, 0x41, 0x5b, 0xeb, 0xdc, 0x23, 0x95, 0xd5,
+    0xc0, 0xf6, 0x63, 0x5d, 0x60, 0x97, 0x4d, 0xe3, 0xb1, 0xc1, 0xe9, 0xaa,
+    0x58, 0xe7, 0x06, 0xa5, 0x8a, 0x9d, 0x18, 0x2b, 0x5c, 0x70, 0x9f, 0xd9,
+    0x02, 0xf3, 0x15, 0xa2, 0x84, 0xe5, 0x02, 0x9f, 0x29, 0xf4, 0x91, 0xd7,
+    0x47, 0x37, 0xb5, 0x76, 0x9f, 0x36, 0x06, 0x78, 0x2d, 0x38, 0x32, 0x21,
+    0x99, 0x92, 0xf4, 0x41, 0x4a, 0x07, 0xcf, 0xd4, 0xcb, 0x1b, 0xdd, 0x65,
+    0xcf, 0x63, 0x7f, 0x7e, 0x16, 0x0a, 0xdd, 0x65, 0xd8, 0x9b, 0x00, 0xe5,
+    0x83, 0xe8, 0xa3, 0xb6, 0xec, 0x5f, 0x5b, 0x3d, 0xcc, 0x3f, 0x29, 0x75,
+    0x41, 0x17, 0x4f, 0x23, 0x6a, 0x7c, 0x65, 0xf9, 0x45, 0x19, 0x22, 0x8f,
+    0x75, 0xa3, 0x42, 0x68, 0xdb, 0x18, 0xb8, 0x5a, 0x94, 0xc1, 0x25, 0xe9,
+    0x15, 0x5d, 0xe2, 0xcc, 0x88, 0xb2, 0x19, 0x68, 0x17, 0x16, 0xa0, 0x6d,
+    0x28, 0x9d, 0x3d, 0x67, 0x3b, 0x3c, 0xb3, 0x9b, 0x9b, 0x23, 0xd8, 0x05,
+    0x59, 0xed, 0x74, 0xc6, 0x1a, 0x31, 0xbe, 0x96, 0x2e, 0xe9, 0xab, 0xb1,
+    0xe1, 0x7f, 0x7e, 0x02, 0x6e, 0xe5, 0xbe, 0xae, 0x97, 0xe1, 0xa4, 0xb0,
+    0x6a, 0xbe, 0x3d, 0x9c, 0xb9, 0x3b, 0x32, 0xa6, 0x85, 0x20, 0x78, 0xcd,
+    0xa7, 0xdc, 0x09, 0xe0, 0xdd, 0x4e, 0x63, 0xa8, 0x48, 0xb3, 0xd9, 0x9a,
+    0xe6, 0x14, 0xdf, 0xfa, 0xc8, 0x12, 0xc7, 0x1a, 0xe6, 0xf0, 0xd3, 0xf2,
+    0xf4, 0x3d, 0x53, 0xee, 0x38, 0xa0, 0x12, 0x1e, 0xfa, 0x2d, 0x99, 0xd5,
+    0x6d, 0xd7, 0x8b, 0xcf, 0xaf, 0x90, 0xd5, 0x7d, 0xd0, 0x37, 0x3a, 0xbf,
+    0x7d, 0x17, 0x5a, 0x70, 0xf5, 0xc8, 0xae, 0x70, 0xbf, 0xa6, 0xe3, 0x58,
+    0xb7, 0x09, 0xd0, 0xda, 0x10, 0x21, 0xc7, 0x62, 0xab, 0x3b, 0xe9, 0x7d,
+    0x43, 0x32, 0x59, 0x4b, 0x3c, 0xe1, 0x8b, 0xdd, 0x1d, 0xee, 0x21, 0xcb,
+    0x5b, 0xa1, 0xd3, 0x18, 0x67, 0x97, 0x95, 0x42, 0x44, 0xd9, 0xfe, 0x0c,
+    0x30, 0x92, 0x8a, 0x89, 0x3e, 0x9c, 0xc7, 0x15, 0xf5, 0xc4, 0x85, 0xf6,
+    0x2f, 0x98, 0xb3, 0x1d, 0xa7, 0x73, 0xc7, 0x8f, 0xaf, 0x87, 0x39, 0x90,
+    0xfc, 0xe9, 0xbf, 0xc0, 0x9d, 0x8c, 0x41, 0xb7, 0x1b, 0x1c, 0x3f, 0xf0,
+    0x33, 0x96, 0x0e, 0x2c, 0xbd, 0xad, 0x4d, 0x88, 0x02, 0x09, 0xe5, 0xc5,
+    0xb3, 0x0a, 0xcb, 0x61, 0x21, 0xf1, 0x2e, 0x63, 0x74, 0x56, 0x04, 0x1b,
+    0xe0, 0x6a, 0x3c, 0x83, 0xb0, 0x56, 0xf0, 0x19, 0x6d, 0x8c, 0x8a, 0xa0,
+    0xda, 0x21, 0xce, 0x25, 0x13, 0xf5, 0x9f, 0x2a, 0x30, 0x7d, 0x08, 0x31,
+    0x6e, 0xb3, 0x13, 0x3b, 0x41, 0xdc, 0x97, 0x9b, 0x40, 0x8d, 0x57, 0x97,
+    0x24, 0xec, 0x69, 0xe4, 0x04, 0x92, 0xc7, 0x77, 0xd4, 0xea, 0xe5, 0x91,
+    0x4c, 0xd1, 0xa9, 0xb3, 0x39, 0x76, 0x69, 0xee, 0x93, 0x47, 0x35, 0x74,
+    0x90, 0xba, 0x04, 0x7a, 0xcf, 0x54, 0xff, 0xa1, 0xec, 0xc5, 0x93, 0xdf,
+    0x3d, 0x85, 0xb2, 0x30, 0x30, 0xdd, 0x91, 0x3b, 0xbc, 0x4b, 0x0e, 0x82,
+    0x92, 0x0e, 0x6d, 0xc0, 0xd0, 0x21, 0x0f, 0xaf, 0xe7, 0x2e, 0x0f, 0xa2,
+    0x74, 0xf3, 0x12, 0x0f, 0xc7, 0x8a, 0x8e, 0xf9, 0x23, 0xb9, 0x6d, 0xb8,
+    0x08, 0x82, 0xf5, 0xb7, 0x75, 0x5e, 0x42, 0xa3, 0x44, 0xe0, 0x8c, 0x81,
+    0x20, 0x41, 0xf7, 0xbe, 0x1f, 0x10, 0xbe, 0xd7, 0x39, 0xfb, 0xe3, 0xee,
+    0x8c, 0x4d, 0xef, 0xb7, 0xb0, 0x0d, 0x88, 0x2a, 0x2a, 0x89, 0x5f, 0x41,
+    0x93, 0xb6, 0x5f, 0x72, 0x69, 0xd2, 0x30, 0x00, 0x66, 0xa3, 0xe1, 0xdb,
+    0x11, 0x22, 0x0d, 0x46, 0xc8, 0xca, 0x7b, 0xd8, 0xda, 0xba, 0xf7, 0x39,
+    0x71, 0xd9, 0x27, 0x03, 0x6d, 0xaf, 0x9c, 0x2b, 0x75, 0x96, 0xf2, 0x45,
+    0xd5, 0x98, 0x18, 0x70, 0xfc, 0xf7, 0x67, 0xb5, 0x9b, 0xa0, 0x99, 0x7e,
+    0x6c, 0x40, 0x2b, 0x3a, 0x8b, 0x67, 0x89, 0x47, 0x81, 0xb7, 0x57, 0x68,
+    0x45, 0x34, 0x9c, 0xd7, 0xc4, 0xba, 0x3f, 0xac, 0xbb, 0x3a, 0xcc, 0x2f,
+    0xfb, 0xfe, 0x60, 0xd6, 0xe6, 0xcc, 0x28, 0x4b, 0x5c, 0xc8, 0x3a, 0x4f,
+    0xa4, 0x69, 0xf0, 0x4d, 0x0c, 0xbb, 0xc1, 0x33, 0x38, 0x1b, 0x20, 0x4a,
+    0xb0, 0x78, 0x4f, 0xd3, 0x73, 0x23, 0x83, 0xf4, 0x11, 0x87, 0x2b, 0x12,
+    0xa0, 0xc6, 0x35, 0x9a, 0x4d, 0x74, 0xbb, 0x21, 0x75, 0x40, 0x6a, 0x8b,
+    0x5a, 0x49, 0x01, 0x64, 0xfe, 0xf2, 0x84, 0x9d, 0x94, 0x64, 0x68, 0x26,
+    0x5e, 0x7c, 0x57, 0xa2, 0xc1, 0x74, 0x9a, 0xc8, 0xea, 0x4c, 0x0c, 0xe2,
+    0x55, 0x74, 0xe1, 0x2a, 0x66, 0x05, 0xe5, 0xfd, 0x9d, 0x26, 0x28, 0x64,
+    0x58, 0x44, 0xa1, 0x77, 0xda, 0x16, 0xfc, 0x35, 0x46, 0xb5, 0xbb, 0x91,
+    0x06, 0x69, 0x5b, 0x37, 0xf7, 0xf0, 0xff, 0x07, 0x1b, 0xde, 0x74, 0xdb,
+    0x5c, 0x7f, 0xe0, 0x57, 0xe6, 0xd7, 0xf0, 0x20, 0x7e, 0x6b, 0x1b, 0x26,
+    0xd0, 0x2d, 0x8b, 0xb4, 0x15, 0x64, 0xb2, 0x08, 0x4c, 0xb4, 0x67, 0x20,
+    0x2f, 0xdd, 0xb9, 0x39, 0xa6, 0x5d, 0x9d, 0x24, 0x8a, 0x46, 0x20, 0x6f,
+    0x31, 0xa6, 0x1a, 0x62, 0xd4, 0xa3, 0x01, 0x2b, 0x90, 0x88, 0xc8, 0x3c,
+    0xac, 0xe2, 0x44, 0x6f, 0x62, 0xcc, 0xfb, 0x8b, 0xe9, 0x00, 0xca, 0x8d,
+    0xc8, 0xf0, 0xeb, 0x50, 0x36, 0xdb, 0x54, 0x7a, 0xdd, 0xd6, 0x27, 0x39,
+    0x21, 0xe1, 0xbb, 0xb0, 0x07, 0x17, 0xb6, 0xd0, 0x91, 0xca, 0x83, 0x19,
+    0x1b, 0x88, 0x48, 0xf3, 0xd4, 0x9e, 0x0d, 0x12, 0xe1, 0x47, 0x54, 0x2a,
+    0x13, 0x3d, 0x85, 0x8e, 0xee, 0x11, 0xfe, 0x6a, 0x39, 0x12, 0xbd, 0x73,
+    0x76, 0x10, 0x05, 0xf5, 0xf2, 0x61, 0x39, 0x95, 0x6e, 0xd5, 0x55, 0x1f,
+    0x41, 0xbb, 0xdd, 0x07, 0xcd, 0x6b, 0xa5, 0xd6, 0xe5, 0xa0, 0x6e, 0x73,
+    0x61, 0x1b, 0x2a, 0x0f, 0x5e, 0x10, 0x78, 0xd0, 0x2a, 0x8d, 0x2c, 0xe8,
+    0x60, 0x30, 0x30, 0x79, 0x55, 0x0b, 0x51, 0x0b, 0x53, 0xff, 0xf1, 0xb9,
+    0x27, 0x7c, 0x20, 0xc7, 0xb5, 0xe0, 0xfe, 0xf5, 0x11, 0x76, 0x74, 0xd7,
+    0x06, 0xc5, 0x65, 0x33, 0x4b, 0x08, 0xbd, 0xa0, 0xdc, 0xa0, 0xd6, 0xd4,
+    0xe0, 0x45, 0x6d, 0x01, 0x83, 0x1c, 0x2d, 0x40, 0xd4, 0xea, 0x99, 0x91,
+    0x15, 0x1c, 0xeb, 0x7f, 0x53, 0xcb, 0xda, 0x03, 0x2d, 0x9d, 0x76, 0x21,
+    0x4b, 0x95, 0xa7, 0x60, 0xc4, 0x28, 0xf7, 0x21, 0x50, 0x1e, 0xff, 0x89,
+    0x25, 0x0e, 0x6e, 0xbc, 0xa4, 0x03, 0xc6, 0x8a, 0x5f, 0x9f, 0xfd, 0x46,
+    0xea, 0x70, 0x77, 0x47, 0xba, 0xeb, 0x44, 0x3a, 0x1d, 0x4f, 0x47, 0x00,
+    0x76, 0xbd, 0xbb, 0x38, 0xcd, 0xa7, 0x3d, 0xf3, 0x89, 0x55, 0x84, 0x28,
+    0xfc, 0x56, 0x11, 0x65, 0xff, 0x0e, 0xbd, 0xb5, 0x59, 0x26, 0xbf, 0x8a,
+    0xa7, 0x57, 0xeb, 0xc8, 0x07, 0xeb, 0x23, 0x83, 0x6f, 0x12, 0x8e, 0x7d,
+    0xa9, 0x3c, 0xdd, 0x8c, 0x18, 0xd6, 0xef, 0x8c, 0xc5, 0x7e, 0x3b, 0x8e,
+    0xc2, 0x69, 0x8c, 0x5c, 0x97, 0x1f, 0x83, 0x94, 0x4e, 0xbe, 0xfc, 0x44,
+    0x8f, 0x80, 0x55, 0x4e, 0x3e, 0x10, 0xb6, 0x43, 0x62, 0x69, 0xb9, 0x6e,
+    0x47, 0x60, 0xe8, 0x27, 0x44, 0x89, 0x13, 0x42, 0xd1, 0x6e, 0x95, 0x62,
+    0xb3, 0xf3, 0x3f, 0x0c, 0x98, 0x33, 0x63, 0x42, 0x29, 0xb5, 0x30, 0xa6,
+    0x08, 0xd5, 0x34, 0xa2, 0xce, 0xbb, 0x0a, 0x08, 0x58, 0xe5, 0x6d, 0xf8,
+    0x73, 0x1f, 0x41, 0x53, 0x2a, 0x36, 0xa5, 0x56, 0xee, 0xb6, 0x8b, 0x20,
+    0xd9, 0xc7, 0x4e, 0x5a, 0xf6, 0x08, 0xe7, 0x0a, 0x55, 0x17, 0xb8, 0x88,
+    0x00, 0x7d, 0xfe, 0xde, 0x88, 0xf4, 0xde, 0xca, 0xd6, 0xbf, 0x7f, 0xf0,
+    0xde, 0xa6, 0xab, 0xc4, 0xc0, 0xd0, 0x16, 0x19, 0xdc, 0x00, 0xe4, 0x41,
+    0xc0, 0xe3, 0xf8, 0x8d, 0x84, 0x6d, 0xfc, 0x52, 0x63, 0x6e, 0x50, 0x14,
+    0x28, 0xbf, 0x22, 0x61, 0xc3, 0x31, 0xc5, 0x46, 0x07, 0x58, 0xeb, 0xac,
+    0xf2, 0xcf, 0x99, 0xd7, 0x97, 0x63, 0x9b, 0xdd, 0x0f, 0x69, 0x44, 0xc6,
+    0x3e, 0xb6, 0xc8, 0xaf, 0x81, 0x8a, 0x92, 0xf8, 0xa2, 0xe2, 0xea, 0xd9,
+    0x47, 0xb4, 0xe8, 0x3f, 0xa1, 0xc1, 0xd8, 0x7a, 0x4d, 0x27, 0x9f, 0x49,
+    0x21, 0x26, 0xb7, 0x38, 0x20, 0x61, 0xa0, 0xd6, 0xc8, 0x65, 0x9b, 0xce,
+    0x34, 0x2d, 0x3c, 0x50, 0xd7, 0x0a, 0x0e, 0xf9, 0x7b, 0x12, 0x0f, 0xfe,
+    0x1a, 0x85, 0x91, 0xba, 0x55, 0xf4, 0x0a, 0x63, 0xfc, 0x27, 0xbd, 0x2a,
+    0xdc, 0xb9, 0xd5, 0xe6, 0x7b, 0x4d, 0x22, 0x61, 0x4a, 0xca, 0xc2, 0xd6,
+    0x2e, 0x16, 0x87, 0x28, 0x6d, 0x61, 0x64, 0x01, 0x58, 0x2a, 0x9c, 0x27,
+    0x62, 0x8b, 0x70, 0x1b, 0x76, 0xa4, 0xda, 0x0a, 0x3a, 0xef, 0x11, 0x81,
+    0x7a, 0xdc, 0xea, 0x79, 0xa1, 0xd9, 0x2a, 0x56, 0x9c, 0xbf, 0xd0, 0xec,
+    0xc8, 0x4b, 0x14, 0x46, 0x4d, 0x65, 0x2b, 0x9c, 0x6d, 0x5c, 0xdd, 0xdf,
+    0x5a, 0x8c, 0x36, 0x62, 0x8f, 0x2b, 0x5e, 0x84, 0xdd, 0x74, 0xe8, 0x22,
+    0x2b, 0xbb, 0x1c, 0xb8, 0x43, 0xc1, 0x3f, 0x10, 0x89, 0x57, 0x65, 0x30,
+    0xcd, 0x9b, 0x86, 0x49, 0xb3, 0xdc, 0x78, 0x3e, 0x23, 0xd9, 0x47, 0xa8,
+    0xe5, 0xf5, 0xa2, 0xfd, 0x49, 0x2d, 0x14, 0xe4, 0x56, 0x58, 0xf3, 0xfa,
+    0xf1, 0xbe, 0x38, 0x2a, 0x08, 0xe9, 0xcb, 0xbc, 0x0a, 0x77, 0xaa, 0xa5,
+    0xe0, 0xed, 0x89, 0x35, 0xd8, 0x45, 0x22, 0x4b, 0x8f, 0x37, 0xa3, 0x63,
+    0xbb, 0xef, 0x89, 0x7f, 0x35, 0xa6, 0x23, 0x0b, 0x78, 0x41, 0xb6, 0xf4,
+    0x30, 0x1e, 0x7d, 0xec, 0xfe, 0x01, 0x3f, 0x0b, 0x7e, 0x0e, 0x3e, 0x95,
+    0xe0, 0x40, 0x09, 0x31, 0x79, 0x44, 0xc3, 0xda, 0xef, 0xc8, 0x5d, 0x07,
+    0xdd, 0x9d, 0xef, 0xea, 0xeb, 0x26, 0x36, 0xfc, 0x22, 0xeb, 0xc8, 0x2b,
+    0x01, 0x13, 0xcc, 0x89, 0x8d, 0x7b, 0xfc, 0xee, 0x78, 0x36, 0x4a, 0xfa,
+    0xf1, 0x5e, 0x8c, 0xa1, 0xd3, 0x0e, 0x4f, 0x0f, 0x5e, 0x38, 0x3c, 0xde,
+    0xa3, 0x8e, 0xb3, 0x18, 0x14, 0xee, 0xc3, 0x8d, 0x22, 0x36, 0xa9, 0x98,
+    0x62, 0xb2, 0xb3, 0x26, 0x50, 0x89, 0x0f, 0x35, 0x17, 0xea, 0xf6, 0xf3,
+    0x09, 0x16, 0x00, 0x00, 0xa8, 0x2a, 0xc1, 0x1b, 0x3a, 0x06, 0x24, 0xdb,
+    0x00, 0x01, 0xaf, 0x0c, 0x80, 0xc0, 0x01, 0x00, 0xdd, 0x8b, 0x02, 0x8b,
+    0xb1, 0xc4, 0x67, 0xfb, 0x02, 0x00, 0x00, 0x00, 0x00, 0x04, 0x59, 0x5a
+};
+
+//
+// TsGenerate(2, 16384 bytes), compressed with xz -T1 --check=crc32
+//
+const uint8_t k_TsStreamB[] =
+{
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x01, 0x69, 0x22, 0xde, 0x36,
+    0x02, 0x00, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3,
+    0xe0, 0x3f, 0xff, 0x04, 0x4c, 0x5d, 0x00, 0x36, 0x9a, 0x4a, 0x1f, 0xaf,
+    0x92, 0x4c, 0xcb, 0xd9, 0x4c, 0x52, 0x22, 0xb0, 0x11, 0xad, 0x1c, 0xab,
+    0xdc, 0x85, 0xb7, 0xb5, 0xa9, 0x22, 0x02, 0x29, 0x72, 0x74, 0x00, 0x97,
+    0x42, 0xdf, 0xeb, 0x66, 0x13, 0x22, 0xbb, 0xe0, 0x59, 0x4b, 0x59, 0x1c,
+    0x35, 0x74, 0x66, 0x23, 0x82, 0x31, 0x9a, 0x1c, 0x48, 0x43, 0xd5, 0x67,
+    0x31, 0x41, 0xef, 0x55, 0x39, 0xcf, 0xeb, 0x83, 0x48, 0x07, 0xd5, 0x85,
+    0x04, 0x25, 0x9a, 0xc6, 0x47, 0xf7, 0x86, 0x92, 0x1b, 0x46, 0x49, 0xfb,
+    0x90, 0xb0, 0x25, 0x6e, 0xd2, 0x99, 0x3d, 0xe7, 0x7c, 0x65, 0x49, 0x0b,
+    0x19, 0xbf, 0x33, 0x98, 0x30, 0xe5, 0xab, 0x23, 0x7d, 0x14, 0x89, 0x75,
+    0x64, 0xf1, 0xf8, 0x87, 0xf5, 0xba, 0x7d, 0xa5, 0x9e, 0x71, 0x41, 0x3b,
+    0xb9, 0x1a, 0xcb, 0xf2, 0x66, 0xa2, 0xed, 0x08, 0x46, 0x0c, 0x57, 0x81,
+    0x16, 0x45, 0x79, 0x22, 0x3d, 0xdd, 0xde, 0x2d, 0xdd, 0x86, 0x89, 0xea,
+    0x02, 0xce, 0xf5, 0xee, 0x0f, 0xc7, 0x99, 0x87, 0xac, 0x5a, 0x38, 0xb7,
+    0x94, 0xf8, 0x14, 0x38, 0x98, 0x68, 0xaa, 0xd2, 0x82, 0xdb, 0xe2, 0x88,
+    0x3c, 0x3a, 0x73, 0x64, 0x02, 0x2a, 0x15, 0x5c, 0xe7, 0xf3, 0x2e, 0xff,
+    0x08, 0xae, 0xc6, 0x85, 0xcc, 0xc8, 0x07, 0xa6, 0x3a, 0xae, 0x6b, 0x32,
+    0x9d, 0xd7, 0xa4, 0xfd, 0x01, 0x8a, 0x1d, 0xb2, 0x52, 0xbc, 0x02, 0x5c,
+    0xe0, 0xd7, 0x0f, 0x4a, 0x2a, 0x1e, 0x98, 0x97, 0x5a, 0x3d, 0x3f, 0x58,
+    0x7d, 0x9e, 0xf0, 0x4f, 0xbc, 0x32, 0x71, 0xcd, 0xd6, 0x4e, 0x53, 0xe6,
+    0x40, 0x7f, 0x75, 0xbb, 0xc4, 0xba, 0xaf, 0x02, 0x69, 0xe2, 0x0e, 0x5d,
+    0xce, 0x7b, 0x78, 0x5b, 0xfb, 0xdf, 0x12, 0x54, 0x3b, 0x3f, 0xff, 0x33,
+    0xe8, 0x93, 0xb3, 0xb0, 0x08, 0x16, 0xcf, 0x1e, 0x28, 0x3d, 0x66, 0x01,
+    0xe0, 0xbe, 0x1f, 0x65, 0xde, 0x35, 0x55, 0x6d, 0xb1, 0x70, 0x33, 0x02,
+    0x78, 0x98, 0x03, 0xe7, 0xc2, 0xb6, 0x6c, 0x87, 0xd0, 0x86, 0x47, 0xd8,
+    0x61, 0x9e, 0xe4, 0x32, 0xb2, 0xb3, 0x12, 0x0e, 0x76, 0xb2, 0x6a, 0x8b,
+    0x3d, 0x27, 0xfc, 0xba, 0x1d, 0x5c, 0x61, 0x94, 0x0b, 0x53, 0x1d, 0x90,
+    0x3b, 0x7d, 0x25, 0x74, 0xd3, 0x7e, 0xf3, 0x38, 0xb7, 0xc7, 0x5d, 0xb1,
+    0xe0, 0x50, 0xaa, 0x15, 0x23, 0x51, 0x18, 0x7b, 0xf0, 0xa7, 0x7f, 0x33,
+    0x4d, 0x93, 0x7c, 0x7d, 0x29, 0x85, 0xe9, 0x68, 0xf7, 0xe2, 0x60, 0x2c,
+    0x0b, 0x33, 0xc1, 0x27, 0x77, 0x1e, 0x42, 0xcf, 0x53, 0xb6, 0x5d, 0x04,
+    0xfc, 0xb5, 0x21, 0xee, 0xc5, 0xef, 0x80, 0xef, 0xbf, 0xab, 0x97, 0x94,
+    0xf6, 0x6c, 0xbf, 0x9f, 0x09, 0x3d, 0xfc, 0xe6, 0x0f, 0xf9, 0xaf, 0x1e,
+    0x9e, 0xf1, 0x04, 0x09, 0x6c, 0x20, 0x70, 0xc7, 0x2b, 0xa7, 0x39, 0x3b,
+    0x72, 0x81, 0x49, 0x17, 0xab, 0x33, 0xf1, 0xbc, 0x81, 0x4f, 0x55, 0x7d,
+    0x83, 0xf9, 0x10, 0xa7, 0x01, 0x15, 0x43, 0x76, 0xa1, 0xb7, 0xad, 0x89,
+    0x68, 0x0a, 0xc7, 0x8c, 0xff, 0xcc, 0x47, 0x68, 0x1d, 0x16, 0x88, 0x48,
+    0x34, 0x04, 0x11, 0xbe, 0x54, 0xda, 0x73, 0x4a, 0xc8, 0xb6, 0x0f, 0x8d,
+    0x6d, 0x78, 0x1f, 0xed, 0xa9, 0xf1, 0x76, 0x58, 0x5a, 0xb0, 0x32, 0xfa,
+    0x4d, 0x50, 0xf0, 0x26, 0xd5, 0x35, 0x50, 0x08, 0x42, 0xb5, 0x37, 0x25,
+    0xc7, 0x86, 0x2f, 0x2b, 0x6f, 0x03, 0xa6, 0xe3, 0x74, 0x34, 0x88, 0x26,
+    0x5b, 0x57, 0x49, 0x9b, 0xaf, 0x49, 0x8b, 0x01, 0x53, 0x8d, 0x18, 0xdf,
+    0xe7, 0x61, 0xc4, 0x89, 0xd8, 0x10, 0xbb, 0x89, 0x16, 0xc5, 0x9e, 0xe8,
+    0xf6, 0xfc, 0xde, 0xe8, 0xa5, 0xb9, 0xee, 0xeb, 0x86, 0x8b, 0xd5, 0x5b,
+    0xac, 0xf2, 0xa0, 0x23, 0xed, 0x27, 0x86, 0x02, 0xb1, 0x08, 0x1a, 0x84,
+    0x71, 0x93, 0xc7, 0x9d, 0xd6, 0x15, 0x36, 0x85, 0x85, 0x31, 0xdc, 0x56,
+    0x80, 0x26, 0x4e, 0x8d, 0xfc, 0xb6, 0x02, 0x3b, 0x31, 0xc5, 0x95, 0xd4,
+    0x95, 0xd4, 0x6d, 0xe4, 0xf6, 0xf0, 0xf2, 0x8d, 0x23, 0x8b, 0x17, 0xf1,
+    0x2f, 0xe3, 0x41, 0x32, 0xb2, 0x9c, 0x92, 0xb6, 0x96, 0xad, 0xdb, 0x2c,
+    0x30, 0x41, 0xe3, 0x38, 0x46, 0xb0, 0xcd, 0x9e, 0x69, 0xc0, 0x8a, 0x59,
+    0xf7, 0x34, 0x3c, 0x15, 0xbc, 0xeb, 0xd6, 0x55, 0x74, 0x6d, 0x2f, 0x6c,
+    0xec, 0x15, 0xdb, 0xf1, 0xab, 0xab, 0x66, 0x6e, 0x35, 0x5e, 0x00, 0x08,
+    0x68, 0x30, 0x91, 0x0e, 0x74, 0xab, 0xd0, 0xa2, 0x0b, 0x98, 0x66, 0xab,
+    0x47, 0xbf, 0x34, 0x2b, 0x99, 0x0b, 0xe6, 0x42, 0x93, 0x84, 0x96, 0xc3,
+    0x8e, 0x30, 0x3e, 0xd1, 0x2a, 0x41, 0xcf, 0x92, 0x26, 0xad, 0xd0, 0xd0,
+    0xfb, 0x4b, 0x8f, 0x64, 0x38, 0x34, 0x00, 0xed, 0x69, 0x6c, 0x71, 0x73,
+    0xa2, 0x91, 0x9f, 0x30, 0x78, 0x02, 0x93, 0xf6, 0xd0, 0x56, 0xeb, 0xf1,
+    0x21, 0x74, 0x3e, 0x58, 0x56, 0xe6, 0x56, 0xf3, 0x59, 0x86, 0xd2, 0xb3,
+    0xb6, 0x94, 0x53, 0x13, 0x70, 0x29, 0xe9, 0x28, 0x53, 0x9c, 0x58, 0x03,
+    0x92, 0xcb, 0x11, 0x19, 0x13, 0x9b, 0x42, 0xb7, 0x8f, 0x3f, 0xb3, 0x2d,
+    0xd6, 0xf3, 0xdf, 0x36, 0x03, 0x09, 0x0b, 0x5a, 0xdf, 0x68, 0x90, 0x46,
+    0xa6, 0x8e, 0xb8, 0x13, 0xbb, 0x27, 0xd5, 0x23, 0x35, 0x51, 0x40, 0xaa,
+    0x17, 0x0e, 0x15, 0xdb, 0xda, 0x47, 0x06, 0x84, 0x24, 0x2e, 0xa2, 0xdf,
+    0xd9, 0x42, 0x52, 0xff, 0xab, 0xb7, 0x0b, 0x5f, 0x19, 0xcd, 0xb1, 0xda,
+    0x05, 0x65, 0x5e, 0x68, 0xd2, 0x0d, 0x91, 0x9f, 0x76, 0x24, 0x5c, 0xe1,
+    0x0b, 0xbf, 0xa1, 0x86, 0x1a, 0xa6, 0x6f, 0x7d, 0x50, 0x0f, 0x43, 0xfb,
+    0xf2, 0xec, 0xab, 0x7a, 0xb2, 0xf2, 0x2f, 0xe9, 0xfa, 0xd1, 0x18, 0x5c,
+    0xfc, 0xca, 0x4e, 0xbf, 0x58, 0x5b, 0x1f, 0xc3, 0x4f, 0x03, 0x52, 0x9d,
+    0x99, 0xfa, 0x6e, 0x51, 0x93, 0x0a, 0xd2, 0x40, 0xc6, 0xc2, 0x94, 0xe8,
+    0xdc, 0x31, 0x67, 0xda, 0x4f, 0x8b, 0xe0, 0xff, 0x24, 0xd4, 0xc1, 0xed,
+    0xb6, 0x23, 0xcb, 0xce, 0x25, 0x54, 0x3e, 0xbb, 0x41, 0xd5, 0xae, 0x4d,
+    0xb2, 0x52, 0x92, 0x16, 0x58, 0xa8, 0x47, 0x34, 0x5e, 0xbd, 0x8d, 0x62,
+    0x28, 0x84, 0x17, 0xb3, 0x05, 0x08, 0xae, 0x4e, 0xb1, 0x52, 0x33, 0x6c,
+    0x42, 0xc5, 0xb5, 0xa3, 0x3b, 0x87, 0x3f, 0x42, 0x06, 0x90, 0x40, 0x51,
+    0x14, 0xaf, 0xb1, 0x00, 0x1e, 0x94, 0x7f, 0xce, 0xbd, 0xc8, 0x2f, 0x9a,
+    0xb7, 0x7f, 0x75, 0xde, 0xe5, 0x80, 0xef, 0x23, 0xb3, 0xed, 0x7d, 0xd6,
+    0x2a, 0x14, 0x7a, 0xd5, 0xa6, 0xae, 0xd8, 0x92, 0xa2, 0xbf, 0xdf, 0x11,
+    0x00, 0xcc, 0xfb, 0x7c, 0xac, 0x81, 0x38, 0x2c, 0xfe, 0xd6, 0x57, 0x32,
+    0xe1, 0x22, 0xf0, 0x6c, 0x5d, 0xef, 0x6c, 0x64, 0x42, 0x29, 0xe2, 0x54,
+    0x2f, 0xc6, 0x94, 0xcc, 0xeb, 0x2d, 0xee, 0xb0, 0x89, 0x1a, 0xe2, 0x55,
+    0x18, 0xb9, 0x3e, 0x88, 0xda, 0x66, 0x13, 0x60, 0x9f, 0xaf, 0x56, 0x87,
+    0x51, 0xee, 0x4b, 0x97, 0xda, 0x5d, 0xec, 0xe3, 0xc1, 0x90, 0x57, 0x88,
+    0x93, 0x9c, 0x47, 0xc9, 0x61, 0xbc, 0xc5, 0xc5, 0x69, 0x8e, 0x6a, 0xa1,
+    0x1b, 0xab, 0x67, 0xa7, 0xa6, 0xfc, 0x8b, 0x9d, 0x16, 0x0a, 0x0f, 0x1c,
+    0xe3, 0xd6, 0x35, 0x48, 0x59, 0xc1, 0xde, 0x4e, 0x09, 0xfe, 0xfe, 0x40,
+    0x4b, 0xe7, 0x69, 0x7f, 0x03, 0x7c, 0xf8, 0xce, 0x1d, 0x53, 0xa6, 0x90,
+    0x1d, 0x52, 0xec, 0x57, 0x93, 0xf6, 0xa2, 0xba, 0xe1, 0x28, 0x75, 0xca,
+    0xe9, 0x57, 0x15, 0x0e, 0xd4, 0xa4, 0xcd, 0x60, 0x5d, 0x3d, 0x3d, 0x4e,
+    0x89, 0xb7, 0x56, 0x89, 0xa5, 0x9e, 0xef, 0x55, 0x6e, 0x9e, 0x88, 0x40,
+    0x9d, 0x93, 0x65, 0xa0, 0xea, 0x2a, 0xcb, 0x4c, 0x04, 0xa4, 0x82, 0x36,
+    0x2b, 0x82, 0x95, 0x1c, 0x89, 0xac, 0xc5, 0xb3, 0x58, 0x0f, 0x95, 0x56,
+    0xc4, 0x74, 0x8c, 0x5f, 0xeb, 0x59, 0xcb, 0x82, 0x89, 0x78, 0x4c, 0x0f,
+    0x23, 0x13, 0xcf, 0x4d, 0xbd, 0xf0, 0xa5, 0x85, 0x3c, 0x4f, 0x66, 0xde,
+    0x88, 0xa1, 0x26, 0x00, 0x8c, 0xc4, 0x1a, 0xdd, 0x00, 0x01, 0xe4, 0x08,
+    0x80, 0x80, 0x01, 0x00, 0x72, 0x5a, 0x87, 0x6b, 0x3e, 0x30, 0x0d, 0x8b,
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x59, 0x5a
+};
+//
+// A stream decoded in steps, along with its results once it is complete
+//
+typedef struct _TS_STEPPED
+{
+    const char* Name;
+    const uint8_t* Input;
+    uint32_t InputSize;
+    uint8_t* Output;
+    uint32_t OutputSize;
+    PXZ_STREAM Stream;
+    XZ_STEP_BUDGET Budget;
+    XZ_STEP_STATUS Status;
+    uint32_t Steps;
+    uint32_t Progress;
+    bool Stalled;
+    bool ChecksumError;
+    uint8_t Digest[8];
+} TS_STEPPED, *PTS_STEPPED;
+
+void
+TsGenerate (
+    uint32_t Seed,
+    uint8_t* Buffer,
+    uint32_t Size
+    )
+{
+    uint32_t offset, length;
+    const char* word;
+
+    for (offset = 0; offset < Size; offset += length)
+    {
+        Seed = (Seed * 1103515245) + 12345;
+        word = k_TsWords[(Seed >> 16) % (sizeof(k_TsWords) / sizeof(k_TsWords[0]))];
+        length = (uint32_t)strlen(word);
+        if (length > (Size - offset))
+        {
+            length = Size - offset;
+        }
+        memcpy(&Buffer[offset], word, length);
+    }
+}
+
+bool
+TsStart (
+    PTS_STEPPED Stepped,
+    const char* Name,
+    const uint8_t* Input,
+    uint32_t InputSize,
+    uint32_t OutputSize
+    )
+{
+    //
+    // The stream keeps the digest setting of the thread that starts it
+    //
+    memset(Stepped, 0, sizeof(*Stepped));
+    Stepped->Name = Name;
+    Stepped->Input = Input;
+    Stepped->InputSize = InputSize;
+    Stepped->OutputSize = OutputSize;
+    Stepped->Output = malloc(OutputSize);
+    Stepped->Stream = malloc(XzGetStreamSize());
+    Stepped->Status = XzStepInProgress;
+    if ((Stepped->Output == NULL) || (Stepped->Stream == NULL) ||
+        !XzDecodeStart(Stepped->Stream, Input, InputSize, Stepped->Output, OutputSize))
+    {
+        printf("%s: failed to start\n", Name);
+        return false;
+    }
+    return true;
+}
+
+bool
+TsStep (
+    PTS_STEPPED Stepped
+    )
+{
+    uint32_t outputSize;
+
+    //
+    // Take one step, which must get further than the last one did (a thread
+    // that resumed from a stale copy of the stream would redo its work), and
+    // pick up the results of the stream as soon as it is complete, before this
+    // thread decodes anything else. Return whether it needs more steps.
+    //
+    Stepped->Status = XzDecodeStep(Stepped->Stream, &Stepped->Budget, &outputSize);
+    Stepped->Steps++;
+    if (Stepped->Status == XzStepInProgress)
+    {
+        Stepped->Stalled |= (outputSize <= Stepped->Progress);
+        Stepped->Progress = outputSize;
+    }
+    else if (Stepped->Status == XzStepComplete)
+    {
+        Stepped->OutputSize = outputSize;
+        Stepped->ChecksumError = XzChecksumError();
+        XzGetDigest(Stepped->Digest, sizeof(Stepped->Digest));
+    }
+    return Stepped->Status == XzStepInProgress;
+}
+
+void
+TsFree (
+    PTS_STEPPED Stepped
+    )
+{
+    free(Stepped->Output);
+    free(Stepped->Stream);
+}
+
+bool
+TsCheck (
+    PTS_STEPPED Stepped,
+    uint32_t Seed,
+    uint32_t Size
+    )
+{
+    uint8_t* expected;
+    uint8_t* output;
+    uint8_t digest[8];
+    uint32_t outputSize;
+    bool result;
+
+    //
+    // The stream must have taken several steps, and end up with the same
+    // output, digest and check result as when it is decoded in one go
+    //
+    result = false;
+    expected = malloc(Size);
+    output = malloc(Size);
+    if ((expected == NULL) || (output == NULL))
+    {
+        goto Cleanup;
+    }
+    TsGenerate(Seed, expected, Size);
+    outputSize = Size;
+    if (!XzDecode(Stepped->Input, Stepped->InputSize, output, &outputSize) ||
+        (outputSize != Size) ||
+        (memcmp(output, expected, Size) != 0) ||
+        (XzGetDigest(digest, sizeof(digest)) != sizeof(digest)))
+    {
+        printf("%s: one-shot decode failed\n", Stepped->Name);
+        goto Cleanup;
+    }
+    if (Stepped->Status != XzStepComplete)
+    {
+        printf("%s: ended with status %d\n", Stepped->Name, Stepped->Status);
+        goto Cleanup;
+    }
+    if (Stepped->Steps < 4)
+    {
+        printf("%s: only took %d steps\n", Stepped->Name, Stepped->Steps);
+        goto Cleanup;
+    }
+    if (Stepped->Stalled)
+    {
+        printf("%s: a step made no progress\n", Stepped->Name);
+        goto Cleanup;
+    }
+    if ((Stepped->OutputSize != Size) || (memcmp(Stepped->Output, expected, Size) != 0))
+    {
+        printf("%s: output does not match\n", Stepped->Name);
+        goto Cleanup;
+    }
+    if (memcmp(Stepped->Digest, digest, sizeof(digest)) != 0)
+    {
+        printf("%s: digest does not match\n", Stepped->Name);
+        goto Cleanup;
+    }
+    if (Stepped->ChecksumError)
+    {
+        printf("%s: checksum error\n", Stepped->Name);
+        goto Cleanup;
+    }
+    result = true;
+
+Cleanup:
+    free(expected);
+    free(output);
+    return result;
+}
+
+bool
+TsTestInterleaved (
+    void
+    )
+{
+    TS_STEPPED streamA, streamB;
+    bool pendingA, pendingB, result;
+
+    //
+    // Step both streams in turn on this thread, one with an output budget and
+    // the other with a sequence budget
+    //
+    result = false;
+    memset(&streamB, 0, sizeof(streamB));
+    if (!TsStart(&streamA, "interleaved A", k_TsStreamA, sizeof(k_TsStreamA), TS_SIZE_A) ||
+        !TsStart(&streamB, "interleaved B", k_TsStreamB, sizeof(k_TsStreamB), TS_SIZE_B))
+    {
+        goto Cleanup;
+    }
+    streamA.Budget.MaxOutput = 1000;
+    streamB.Budget.MaxSequences = 50;
+    pendingA = pendingB = true;
+    while (pendingA || pendingB)
+    {
+        if (pendingA)
+        {
+            pendingA = TsStep(&streamA);
+        }
+        if (pendingB)
+        {
+            pendingB = TsStep(&streamB);
+        }
+    }
+    result = TsCheck(&streamA, 1, TS_SIZE_A) && TsCheck(&streamB, 2, TS_SIZE_B);
+
+Cleanup:
+    TsFree(&streamA);
+    TsFree(&streamB);
+    return result;
+}
+
+#ifndef _WIN32
+//
+// A stream that two threads take turns stepping
+//
+typedef struct _TS_HANDOFF
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t Event;
+    uint32_t Turn;
+    bool Pending;
+    TS_STEPPED Stepped;
+} TS_HANDOFF, *PTS_HANDOFF;
+
+void
+TsTakeTurns (
+    PTS_HANDOFF Handoff,
+    uint32_t Turn
+    )
+{
+    uint8_t output[TS_SIZE_B];
+    uint32_t outputSize;
+    bool pending;
+
+    //
+    // Wait for our turn, take one step, and hand the stream over to the other
+    // thread, until it is done. The second thread also decodes another stream
+    // in one go after each of its steps.
+    //
+    pthread_mutex_lock(&Handoff->Lock);
+    for (;;)
+    {
+        while (Handoff->Pending && (Handoff->Turn != Turn))
+        {
+            pthread_cond_wait(&Handoff->Event, &Handoff->Lock);
+        }
+        if (!Handoff->Pending)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&Handoff->Lock);
+        pending = TsStep(&Handoff->Stepped);
+        if (Turn == 1)
+        {
+            outputSize = sizeof(output);
+            (void)XzDecode(k_TsStreamB, sizeof(k_TsStreamB), output, &outputSize);
+        }
+        pthread_mutex_lock(&Handoff->Lock);
+        Handoff->Pending = pending;
+        Handoff->Turn = Turn ^ 1;
+        pthread_cond_signal(&Handoff->Event);
+    }
+    pthread_mutex_unlock(&Handoff->Lock);
+}
+
+void*
+TsHandoffThread (
+    void* Context
+    )
+{
+    TsTakeTurns((PTS_HANDOFF)Context, 1);
+    return NULL;
+}
+
+bool
+TsTestThreads (
+    void
+    )
+{
+    TS_HANDOFF handoff;
+    pthread_t thread;
+    bool result;
+
+    //
+    // Each thread still holds the copy of the stream it saved after its last
+    // step when its next turn comes, but the other thread moved it on since
+    //
+    pthread_mutex_init(&handoff.Lock, NULL);
+    pthread_cond_init(&handoff.Event, NULL);
+    handoff.Turn = 0;
+    handoff.Pending = true;
+    result = false;
+    if (!TsStart(&handoff.Stepped, "threads", k_TsStreamA, sizeof(k_TsStreamA), TS_SIZE_A))
+    {
+        goto Cleanup;
+    }
+    handoff.Stepped.Budget.MaxOutput = 700;
+    if (pthread_create(&thread, NULL, TsHandoffThread, &handoff) != 0)
+    {
+        printf("threads: failed to create thread\n");
+        goto Cleanup;
+    }
+    TsTakeTurns(&handoff, 0);
+    pthread_join(thread, NULL);
+    result = TsCheck(&handoff.Stepped, 1, TS_SIZE_A);
+
+Cleanup:
+    TsFree(&handoff.Stepped);
+    pthread_cond_destroy(&handoff.Event);
+    pthread_mutex_destroy(&handoff.Lock);
+    return result;
+}
+#endif
+
+bool
+TsTestOutputFull (
+    void
+    )
+{
+    TS_STEPPED stepped;
+    bool pending, result;
+
+    //
+    // A buffer that is too small must be reported as such (and stay that way),
+    // rather than as a corrupt stream
+    //
+    result = false;
+    if (TsStart(&stepped, "output full", k_TsStreamA, sizeof(k_TsStreamA), TS_SIZE_A - 1000))
+    {
+        stepped.Budget.MaxOutput = 4096;
+        do
+        {
+            pending = TsStep(&stepped);
+        } while (pending);
+        result = (stepped.Status == XzStepOutputFull) &&
+                 !TsStep(&stepped) &&
+                 (stepped.Status == XzStepOutputFull);
+        if (!result)
+        {
+            printf("output full: ended with status %d\n", stepped.Status);
+        }
+    }
+    TsFree(&stepped);
+    return result;
+}
+
+int
+main (
+    void
+    )
+{
+    //
+    // Digest every stream that this thread starts, and every one-shot decode
+    //
+    XzSetDigest(XzDigestXxh3, NULL, NULL);
+    if (!TsTestInterleaved() ||
+#ifndef _WIN32
+        !TsTestThreads() ||
+#endif
+        !TsTestOutputFull())
+    {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}